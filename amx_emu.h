@@ -0,0 +1,601 @@
+/*
+    Software emulation of Intel AMX tiles, so that the examples run on hosts without AMX.
+
+    The emulated tiles follow the semantics of the instructions:
+    - _tile_loadconfig: palette 1 has 8 tiles with at most 16 rows and 64 bytes per row.
+      Loading a config zeros all tiles and an invalid config is a fatal error (#GP on hardware).
+    - _tile_loadd/_tile_stored: move rows x colsb bytes between memory and a tile.
+      Rows & bytes beyond the config are zeroed by loads.
+    - _tile_dpbssd: C[m][n] += sum of A[m][4k+i] * B[k][4n+i], i = 0..3, int8 * int8 -> int32.
+      _tile_dpbsud, _tile_dpbusd & _tile_dpbuud are the same with unsigned B, A or both (s = signed, u = unsigned).
+    - _tile_dpbf16ps: C[m][n] += A[m][2k] * B[k][2n], then C[m][n] += A[m][2k+1] * B[k][2n+1],
+      bf16 * bf16 -> float in this order, with denormal inputs and outputs flushed to zero.
+    - _tile_dpfp16ps (AMX-FP16): the same as _tile_dpbf16ps with fp16 inputs.
+    Dot products are computed with AVX-512 or AVX2 if available, otherwise in scalar code.
+
+    Code should use amx_tile_* below instead of _tile_*, which dispatch to either
+    the real instructions or the emulation depending on amx_emulated.
+*/
+
+#pragma once
+
+#include <immintrin.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#define AMX_EMU_TILES 8
+#define AMX_EMU_MAX_ROWS 16
+#define AMX_EMU_MAX_COLSB 64
+
+// Whether amx_tile_* run in software. Set by init_amx().
+inline bool amx_emulated = false;
+
+struct amx_emu_tile {
+    alignas(64) uint8_t data[AMX_EMU_MAX_ROWS][AMX_EMU_MAX_COLSB];
+    int rows;
+    int colsb;
+};
+
+// Tile registers of the current thread
+struct amx_emu_state {
+    bool configured = false;
+    amx_emu_tile tiles[AMX_EMU_TILES];
+};
+inline thread_local amx_emu_state amx_emu;
+
+[[noreturn]] inline void amx_emu_fault(const char* msg) {
+    std::cerr << "AMX emulation fault: " << msg << "\n";
+    std::abort();
+}
+
+// Dot-product kernels on whole tiles, whose rows are AMX_EMU_MAX_COLSB bytes apart.
+// M = rows of C & A, N = columns (dwords) of C & B, K = dwords of a row of A = rows of B.
+// int8 kernels are templates on the signedness of A & B and take their bytes as int8_t.
+typedef void (*amx_emu_dpbd_fn)(int32_t* C, const int8_t* A, const int8_t* B, int M, int N, int K);
+// 16-bit float kernels take their elements as uint16_t
+typedef void (*amx_emu_dpbf16ps_fn)(float* C, const uint16_t* A, const uint16_t* B, int M, int N, int K);
+
+struct amx_emu_kernels {
+    const char* name;
+    amx_emu_dpbd_fn dpbssd;
+    amx_emu_dpbd_fn dpbsud;
+    amx_emu_dpbd_fn dpbusd;
+    amx_emu_dpbd_fn dpbuud;
+    amx_emu_dpbf16ps_fn dpbf16ps;
+    amx_emu_dpbf16ps_fn dpfp16ps;
+};
+
+// ---------------------------------------------------------------------------
+// Scalar kernels
+
+inline float amx_emu_bf16_to_float(uint16_t x) {
+    uint32_t tmp = (uint32_t)x << 16;
+    float f;
+    std::memcpy(&f, &tmp, sizeof(f));
+    return f;
+}
+
+inline float amx_emu_fp16_to_float(uint16_t x) {
+    uint32_t sign = (uint32_t)(x & 0x8000) << 16;
+    uint32_t exp = (x >> 10) & 0x1F;
+    uint32_t mant = x & 0x3FF;
+    uint32_t bits;
+    if (exp == 0) {
+        float f = mant * (1.0f / (1 << 24));
+        std::memcpy(&bits, &f, sizeof(bits));
+        bits |= sign;
+    } else if (exp == 31) {
+        bits = sign | 0x7F800000 | (mant << 13);
+    } else {
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+template <bool a_signed, bool b_signed>
+inline int32_t amx_emu_int8_product(int8_t a, int8_t b) {
+    int32_t x = a_signed ? (int32_t)a : (int32_t)(uint8_t)a;
+    int32_t y = b_signed ? (int32_t)b : (int32_t)(uint8_t)b;
+    return x * y;
+}
+
+template <bool a_signed, bool b_signed>
+inline void amx_emu_dpbd_scalar(int32_t* C, const int8_t* A, const int8_t* B, int M, int N, int K) {
+    for (int m = 0; m < M; ++m) {
+        for (int n = 0; n < N; ++n) {
+            // int32 accumulation wraps around, as on hardware
+            uint32_t acc = C[m * 16 + n];
+            for (int k = 0; k < K; ++k) {
+                for (int i = 0; i < 4; ++i) {
+                    acc += (uint32_t)amx_emu_int8_product<a_signed, b_signed>(A[m * 64 + k * 4 + i],
+                                                                              B[k * 64 + n * 4 + i]);
+                }
+            }
+            C[m * 16 + n] = (int32_t)acc;
+        }
+    }
+}
+
+// DAZ & FTZ of MXCSR give the denormal handling of AMX.
+inline void amx_emu_dpbf16ps_scalar(float* C, const uint16_t* A, const uint16_t* B, int M, int N, int K) {
+    unsigned int csr = _mm_getcsr();
+    _mm_setcsr(csr | 0x8040);
+    for (int m = 0; m < M; ++m) {
+        for (int n = 0; n < N; ++n) {
+            float acc = C[m * 16 + n];
+            for (int k = 0; k < K; ++k) {
+                // The product of two bf16 values is exact in float, so only the additions round.
+                acc += amx_emu_bf16_to_float(A[m * 32 + k * 2]) * amx_emu_bf16_to_float(B[k * 32 + n * 2]);
+                acc += amx_emu_bf16_to_float(A[m * 32 + k * 2 + 1]) * amx_emu_bf16_to_float(B[k * 32 + n * 2 + 1]);
+            }
+            C[m * 16 + n] = acc;
+        }
+    }
+    _mm_setcsr(csr);
+}
+
+// fp16 values are normal floats and their products are exact in float as well
+inline void amx_emu_dpfp16ps_scalar(float* C, const uint16_t* A, const uint16_t* B, int M, int N, int K) {
+    unsigned int csr = _mm_getcsr();
+    _mm_setcsr(csr | 0x8040);
+    for (int m = 0; m < M; ++m) {
+        for (int n = 0; n < N; ++n) {
+            float acc = C[m * 16 + n];
+            for (int k = 0; k < K; ++k) {
+                acc += amx_emu_fp16_to_float(A[m * 32 + k * 2]) * amx_emu_fp16_to_float(B[k * 32 + n * 2]);
+                acc += amx_emu_fp16_to_float(A[m * 32 + k * 2 + 1]) * amx_emu_fp16_to_float(B[k * 32 + n * 2 + 1]);
+            }
+            C[m * 16 + n] = acc;
+        }
+    }
+    _mm_setcsr(csr);
+}
+
+// ---------------------------------------------------------------------------
+// AVX2 kernels
+// Lanes beyond N hold zeros in all tiles, so kernels always compute full rows of 16 dwords.
+
+// int8 * int8 -> int32: sign (or zero) extend to int16 and multiply-add adjacent pairs,
+// which leaves 2 partial sums per column. They are added after the loop over K.
+// u8 * u8 fits as well: 2 * 255 * 255 < 2^31.
+template <bool a_signed, bool b_signed>
+__attribute__((target("avx2")))
+inline void amx_emu_dpbd_avx2(int32_t* C, const int8_t* A, const int8_t* B, int M, int N, int K) {
+    (void)N;
+    // B rows sign-extended to int16, 4 registers of 4 columns per row
+    __m256i b16[16][4];
+    for (int k = 0; k < K; ++k) {
+        for (int j = 0; j < 4; ++j) {
+            __m128i b = _mm_load_si128((const __m128i*)(B + k * 64 + j * 16));
+            b16[k][j] = b_signed ? _mm256_cvtepi8_epi16(b) : _mm256_cvtepu8_epi16(b);
+        }
+    }
+    for (int m = 0; m < M; ++m) {
+        __m256i acc[4] = {_mm256_setzero_si256(), _mm256_setzero_si256(),
+                          _mm256_setzero_si256(), _mm256_setzero_si256()};
+        for (int k = 0; k < K; ++k) {
+            int32_t a4;
+            std::memcpy(&a4, A + m * 64 + k * 4, sizeof(a4));
+            __m256i a16 = a_signed ? _mm256_cvtepi8_epi16(_mm_set1_epi32(a4)) : _mm256_cvtepu8_epi16(_mm_set1_epi32(a4));
+            for (int j = 0; j < 4; ++j) {
+                acc[j] = _mm256_add_epi32(acc[j], _mm256_madd_epi16(a16, b16[k][j]));
+            }
+        }
+        // acc[j] holds 2 partial sums for each of columns 4j..4j+3
+        for (int j = 0; j < 4; j += 2) {
+            __m256i sum = _mm256_hadd_epi32(acc[j], acc[j + 1]);
+            sum = _mm256_permute4x64_epi64(sum, 0xd8);
+            __m256i c = _mm256_loadu_si256((const __m256i*)(C + m * 16 + j * 4));
+            _mm256_storeu_si256((__m256i*)(C + m * 16 + j * 4), _mm256_add_epi32(c, sum));
+        }
+    }
+}
+
+// bf16 * bf16 -> float: even & odd elements of a VNNI pair are shifted to the high half of a float.
+__attribute__((target("avx2")))
+inline void amx_emu_dpbf16ps_avx2(float* C, const uint16_t* A, const uint16_t* B, int M, int N, int K) {
+    (void)N;
+    unsigned int csr = _mm_getcsr();
+    _mm_setcsr(csr | 0x8040);
+    const __m256i odd_mask = _mm256_set1_epi32((int)0xffff0000);
+    for (int m = 0; m < M; ++m) {
+        __m256 acc0 = _mm256_loadu_ps(C + m * 16);
+        __m256 acc1 = _mm256_loadu_ps(C + m * 16 + 8);
+        for (int k = 0; k < K; ++k) {
+            int32_t a2;
+            std::memcpy(&a2, A + m * 32 + k * 2, sizeof(a2));
+            __m256i a = _mm256_set1_epi32(a2);
+            __m256 a_even = _mm256_castsi256_ps(_mm256_slli_epi32(a, 16));
+            __m256 a_odd = _mm256_castsi256_ps(_mm256_and_si256(a, odd_mask));
+            __m256i b0 = _mm256_load_si256((const __m256i*)(B + k * 32));
+            __m256i b1 = _mm256_load_si256((const __m256i*)(B + k * 32 + 16));
+            acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(a_even, _mm256_castsi256_ps(_mm256_slli_epi32(b0, 16))));
+            acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(a_even, _mm256_castsi256_ps(_mm256_slli_epi32(b1, 16))));
+            acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(a_odd, _mm256_castsi256_ps(_mm256_and_si256(b0, odd_mask))));
+            acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(a_odd, _mm256_castsi256_ps(_mm256_and_si256(b1, odd_mask))));
+        }
+        _mm256_storeu_ps(C + m * 16, acc0);
+        _mm256_storeu_ps(C + m * 16 + 8, acc1);
+    }
+    _mm_setcsr(csr);
+}
+
+// ---------------------------------------------------------------------------
+// AVX-512 kernels, same as AVX2 ones with a full row of the tile in one or two registers
+
+template <bool a_signed, bool b_signed>
+__attribute__((target("avx512f,avx512bw")))
+inline void amx_emu_dpbd_avx512(int32_t* C, const int8_t* A, const int8_t* B, int M, int N, int K) {
+    (void)N;
+    __m512i b16[16][2];
+    for (int k = 0; k < K; ++k) {
+        for (int j = 0; j < 2; ++j) {
+            __m256i b = _mm256_load_si256((const __m256i*)(B + k * 64 + j * 32));
+            b16[k][j] = b_signed ? _mm512_cvtepi8_epi16(b) : _mm512_cvtepu8_epi16(b);
+        }
+    }
+    // picks the even dwords of two registers
+    const __m512i even = _mm512_set_epi32(30, 28, 26, 24, 22, 20, 18, 16, 14, 12, 10, 8, 6, 4, 2, 0);
+    for (int m = 0; m < M; ++m) {
+        __m512i acc0 = _mm512_setzero_si512();
+        __m512i acc1 = _mm512_setzero_si512();
+        for (int k = 0; k < K; ++k) {
+            int32_t a4;
+            std::memcpy(&a4, A + m * 64 + k * 4, sizeof(a4));
+            __m512i a16 = a_signed ? _mm512_cvtepi8_epi16(_mm256_set1_epi32(a4))
+                                   : _mm512_cvtepu8_epi16(_mm256_set1_epi32(a4));
+            acc0 = _mm512_add_epi32(acc0, _mm512_madd_epi16(a16, b16[k][0]));
+            acc1 = _mm512_add_epi32(acc1, _mm512_madd_epi16(a16, b16[k][1]));
+        }
+        acc0 = _mm512_add_epi32(acc0, _mm512_srli_epi64(acc0, 32));
+        acc1 = _mm512_add_epi32(acc1, _mm512_srli_epi64(acc1, 32));
+        __m512i sum = _mm512_permutex2var_epi32(acc0, even, acc1);
+        __m512i c = _mm512_loadu_si512(C + m * 16);
+        _mm512_storeu_si512(C + m * 16, _mm512_add_epi32(c, sum));
+    }
+}
+
+__attribute__((target("avx512f,avx512bw")))
+inline void amx_emu_dpbf16ps_avx512(float* C, const uint16_t* A, const uint16_t* B, int M, int N, int K) {
+    (void)N;
+    unsigned int csr = _mm_getcsr();
+    _mm_setcsr(csr | 0x8040);
+    const __m512i odd_mask = _mm512_set1_epi32((int)0xffff0000);
+    for (int m = 0; m < M; ++m) {
+        __m512 acc = _mm512_loadu_ps(C + m * 16);
+        for (int k = 0; k < K; ++k) {
+            int32_t a2;
+            std::memcpy(&a2, A + m * 32 + k * 2, sizeof(a2));
+            __m512i a = _mm512_set1_epi32(a2);
+            __m512i b = _mm512_load_si512(B + k * 32);
+            __m512 a_even = _mm512_castsi512_ps(_mm512_slli_epi32(a, 16));
+            __m512 a_odd = _mm512_castsi512_ps(_mm512_and_si512(a, odd_mask));
+            acc = _mm512_add_ps(acc, _mm512_mul_ps(a_even, _mm512_castsi512_ps(_mm512_slli_epi32(b, 16))));
+            acc = _mm512_add_ps(acc, _mm512_mul_ps(a_odd, _mm512_castsi512_ps(_mm512_and_si512(b, odd_mask))));
+        }
+        _mm512_storeu_ps(C + m * 16, acc);
+    }
+    _mm_setcsr(csr);
+}
+
+// fp16 * fp16 -> float: even & odd elements of a VNNI pair are narrowed to 16 bits and converted
+__attribute__((target("avx512f,avx512bw")))
+inline void amx_emu_dpfp16ps_avx512(float* C, const uint16_t* A, const uint16_t* B, int M, int N, int K) {
+    (void)N;
+    unsigned int csr = _mm_getcsr();
+    _mm_setcsr(csr | 0x8040);
+    __m512 b_even[16], b_odd[16];
+    for (int k = 0; k < K; ++k) {
+        __m512i b = _mm512_load_si512(B + k * 32);
+        b_even[k] = _mm512_cvtph_ps(_mm512_cvtepi32_epi16(b));
+        b_odd[k] = _mm512_cvtph_ps(_mm512_cvtepi32_epi16(_mm512_srli_epi32(b, 16)));
+    }
+    for (int m = 0; m < M; ++m) {
+        __m512 acc = _mm512_loadu_ps(C + m * 16);
+        for (int k = 0; k < K; ++k) {
+            __m512 a_even = _mm512_set1_ps(amx_emu_fp16_to_float(A[m * 32 + k * 2]));
+            __m512 a_odd = _mm512_set1_ps(amx_emu_fp16_to_float(A[m * 32 + k * 2 + 1]));
+            acc = _mm512_add_ps(acc, _mm512_mul_ps(a_even, b_even[k]));
+            acc = _mm512_add_ps(acc, _mm512_mul_ps(a_odd, b_odd[k]));
+        }
+        _mm512_storeu_ps(C + m * 16, acc);
+    }
+    _mm_setcsr(csr);
+}
+
+// ---------------------------------------------------------------------------
+// Kernel selection
+// There is no AVX2 kernel for fp16, which would need F16C, so the AVX2 kernels use the scalar one.
+
+inline amx_emu_kernels amx_emu_kernels_scalar() {
+    return {"scalar", amx_emu_dpbd_scalar<true, true>, amx_emu_dpbd_scalar<true, false>, amx_emu_dpbd_scalar<false, true>,
+            amx_emu_dpbd_scalar<false, false>, amx_emu_dpbf16ps_scalar, amx_emu_dpfp16ps_scalar};
+}
+
+inline amx_emu_kernels amx_emu_kernels_avx2() {
+    return {"avx2", amx_emu_dpbd_avx2<true, true>, amx_emu_dpbd_avx2<true, false>, amx_emu_dpbd_avx2<false, true>,
+            amx_emu_dpbd_avx2<false, false>, amx_emu_dpbf16ps_avx2, amx_emu_dpfp16ps_scalar};
+}
+
+inline amx_emu_kernels amx_emu_kernels_avx512() {
+    return {"avx512", amx_emu_dpbd_avx512<true, true>, amx_emu_dpbd_avx512<true, false>, amx_emu_dpbd_avx512<false, true>,
+            amx_emu_dpbd_avx512<false, false>, amx_emu_dpbf16ps_avx512, amx_emu_dpfp16ps_avx512};
+}
+
+inline amx_emu_kernels amx_emu_kernels_best() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) return amx_emu_kernels_avx512();
+    if (__builtin_cpu_supports("avx2")) return amx_emu_kernels_avx2();
+    return amx_emu_kernels_scalar();
+}
+
+inline amx_emu_kernels amx_emu_active = amx_emu_kernels_scalar();
+
+// Turn on emulation with the given kernels ("scalar", "avx2", "avx512"), or the best ones if null.
+// Returns false if the kernels are unknown or not supported by the CPU.
+inline bool amx_emu_enable(const char* kernels = nullptr) {
+    __builtin_cpu_init();
+    if (!kernels || !*kernels || !std::strcmp(kernels, "1")) {
+        amx_emu_active = amx_emu_kernels_best();
+    } else if (!std::strcmp(kernels, "scalar")) {
+        amx_emu_active = amx_emu_kernels_scalar();
+    } else if (!std::strcmp(kernels, "avx2") && __builtin_cpu_supports("avx2")) {
+        amx_emu_active = amx_emu_kernels_avx2();
+    } else if (!std::strcmp(kernels, "avx512") && __builtin_cpu_supports("avx512bw")) {
+        amx_emu_active = amx_emu_kernels_avx512();
+    } else {
+        return false;
+    }
+    amx_emulated = true;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Emulated instructions
+
+inline amx_emu_tile& amx_emu_configured_tile(int t) {
+    if (!amx_emu.configured) amx_emu_fault("tiles are not configured");
+    amx_emu_tile& tile = amx_emu.tiles[t];
+    if (tile.rows == 0 || tile.colsb == 0) amx_emu_fault("tile is not configured");
+    return tile;
+}
+
+inline void amx_emu_tile_release() {
+    amx_emu.configured = false;
+    for (auto& tile : amx_emu.tiles) {
+        tile.rows = 0;
+        tile.colsb = 0;
+    }
+}
+
+// The config is 64 bytes: palette_id at 0, start_row at 1, 16 x uint16 colsb at 16 and 16 x uint8 rows at 48.
+inline void amx_emu_tile_loadconfig(const void* config) {
+    const uint8_t* cfg = (const uint8_t*)config;
+    if (cfg[0] == 0) {
+        amx_emu_tile_release();
+        return;
+    }
+    if (cfg[0] != 1) amx_emu_fault("unsupported palette");
+    for (int i = 2; i < 16; ++i) {
+        if (cfg[i]) amx_emu_fault("reserved bytes of config must be zero");
+    }
+    for (int t = 0; t < 16; ++t) {
+        uint16_t colsb;
+        std::memcpy(&colsb, cfg + 16 + t * 2, sizeof(colsb));
+        uint8_t rows = cfg[48 + t];
+        if (t >= AMX_EMU_TILES) {
+            if (colsb || rows) amx_emu_fault("palette 1 has only 8 tiles");
+            continue;
+        }
+        if (rows > AMX_EMU_MAX_ROWS || colsb > AMX_EMU_MAX_COLSB) amx_emu_fault("tile is too large");
+        if ((rows == 0) != (colsb == 0)) amx_emu_fault("rows and colsb must be both zero or both non-zero");
+        amx_emu_tile& tile = amx_emu.tiles[t];
+        tile.rows = rows;
+        tile.colsb = colsb;
+        std::memset(tile.data, 0, sizeof(tile.data));
+    }
+    amx_emu.configured = true;
+}
+
+inline void amx_emu_tile_loadd(int t, const void* base, long stride) {
+    amx_emu_tile& tile = amx_emu_configured_tile(t);
+    std::memset(tile.data, 0, sizeof(tile.data));
+    for (int r = 0; r < tile.rows; ++r) {
+        std::memcpy(tile.data[r], (const uint8_t*)base + r * stride, tile.colsb);
+    }
+}
+
+inline void amx_emu_tile_stored(int t, void* base, long stride) {
+    amx_emu_tile& tile = amx_emu_configured_tile(t);
+    for (int r = 0; r < tile.rows; ++r) {
+        std::memcpy((uint8_t*)base + r * stride, tile.data[r], tile.colsb);
+    }
+}
+
+inline void amx_emu_tile_zero(int t) {
+    amx_emu_tile& tile = amx_emu_configured_tile(t);
+    std::memset(tile.data, 0, sizeof(tile.data));
+}
+
+// Shapes must match as the instructions require (#UD on hardware otherwise)
+inline void amx_emu_check_dp(const amx_emu_tile& c, const amx_emu_tile& a, const amx_emu_tile& b) {
+    if (c.rows != a.rows || c.colsb != b.colsb || a.colsb != b.rows * 4) {
+        amx_emu_fault("tile shapes do not match for dot product");
+    }
+}
+
+inline void amx_emu_tile_dpbd(amx_emu_dpbd_fn fn, int dst, int src1, int src2) {
+    amx_emu_tile& c = amx_emu_configured_tile(dst);
+    amx_emu_tile& a = amx_emu_configured_tile(src1);
+    amx_emu_tile& b = amx_emu_configured_tile(src2);
+    amx_emu_check_dp(c, a, b);
+    fn((int32_t*)c.data, (const int8_t*)a.data, (const int8_t*)b.data, c.rows, c.colsb / 4, a.colsb / 4);
+}
+
+inline void amx_emu_tile_dpbssd(int dst, int src1, int src2) { amx_emu_tile_dpbd(amx_emu_active.dpbssd, dst, src1, src2); }
+inline void amx_emu_tile_dpbsud(int dst, int src1, int src2) { amx_emu_tile_dpbd(amx_emu_active.dpbsud, dst, src1, src2); }
+inline void amx_emu_tile_dpbusd(int dst, int src1, int src2) { amx_emu_tile_dpbd(amx_emu_active.dpbusd, dst, src1, src2); }
+inline void amx_emu_tile_dpbuud(int dst, int src1, int src2) { amx_emu_tile_dpbd(amx_emu_active.dpbuud, dst, src1, src2); }
+
+inline void amx_emu_tile_dp16ps(amx_emu_dpbf16ps_fn fn, int dst, int src1, int src2) {
+    amx_emu_tile& c = amx_emu_configured_tile(dst);
+    amx_emu_tile& a = amx_emu_configured_tile(src1);
+    amx_emu_tile& b = amx_emu_configured_tile(src2);
+    amx_emu_check_dp(c, a, b);
+    fn((float*)c.data, (const uint16_t*)a.data, (const uint16_t*)b.data, c.rows, c.colsb / 4, a.colsb / 4);
+}
+
+inline void amx_emu_tile_dpbf16ps(int dst, int src1, int src2) { amx_emu_tile_dp16ps(amx_emu_active.dpbf16ps, dst, src1, src2); }
+inline void amx_emu_tile_dpfp16ps(int dst, int src1, int src2) { amx_emu_tile_dp16ps(amx_emu_active.dpfp16ps, dst, src1, src2); }
+
+// ---------------------------------------------------------------------------
+// Counts of tile instructions of the current thread, with GEMM_PROFILE defined (see gemm_profile.h).
+// They are counted in the dispatch below, so hardware and emulation count the same.
+
+struct amx_tile_counters {
+    uint64_t configs = 0;
+    uint64_t loads = 0;
+    uint64_t stores = 0;
+    uint64_t zeros = 0;
+    uint64_t dps = 0;
+};
+
+#ifdef GEMM_PROFILE
+inline thread_local amx_tile_counters amx_tile_counts;
+#define AMX_TILE_COUNT(field, n) (amx_tile_counts.field += (n))
+#else
+#define AMX_TILE_COUNT(field, n) ((void)0)
+#endif
+
+// ---------------------------------------------------------------------------
+// Dispatch between hardware and emulation. Tile numbers must be literals.
+
+inline void amx_tile_loadconfig(const void* config) {
+    AMX_TILE_COUNT(configs, 1);
+    if (amx_emulated) amx_emu_tile_loadconfig(config);
+    else _tile_loadconfig(config);
+}
+
+inline void amx_tile_release() {
+    if (amx_emulated) amx_emu_tile_release();
+    else _tile_release();
+}
+
+#define amx_tile_loadd(dst, base, stride)                                       \
+    do {                                                                        \
+        AMX_TILE_COUNT(loads, 1);                                               \
+        if (amx_emulated) amx_emu_tile_loadd(dst, base, stride);                \
+        else _tile_loadd(dst, base, stride);                                    \
+    } while (0)
+
+#define amx_tile_stored(dst, base, stride)                                      \
+    do {                                                                        \
+        AMX_TILE_COUNT(stores, 1);                                              \
+        if (amx_emulated) amx_emu_tile_stored(dst, base, stride);               \
+        else _tile_stored(dst, base, stride);                                   \
+    } while (0)
+
+#define amx_tile_zero(dst)                                                      \
+    do {                                                                        \
+        AMX_TILE_COUNT(zeros, 1);                                               \
+        if (amx_emulated) amx_emu_tile_zero(dst);                               \
+        else _tile_zero(dst);                                                   \
+    } while (0)
+
+#define amx_tile_dpbssd(dst, src1, src2)                                        \
+    do {                                                                        \
+        AMX_TILE_COUNT(dps, 1);                                                 \
+        if (amx_emulated) amx_emu_tile_dpbssd(dst, src1, src2);                 \
+        else _tile_dpbssd(dst, src1, src2);                                     \
+    } while (0)
+
+#define amx_tile_dpbsud(dst, src1, src2)                                        \
+    do {                                                                        \
+        AMX_TILE_COUNT(dps, 1);                                                 \
+        if (amx_emulated) amx_emu_tile_dpbsud(dst, src1, src2);                 \
+        else _tile_dpbsud(dst, src1, src2);                                     \
+    } while (0)
+
+#define amx_tile_dpbusd(dst, src1, src2)                                        \
+    do {                                                                        \
+        AMX_TILE_COUNT(dps, 1);                                                 \
+        if (amx_emulated) amx_emu_tile_dpbusd(dst, src1, src2);                 \
+        else _tile_dpbusd(dst, src1, src2);                                     \
+    } while (0)
+
+#define amx_tile_dpbuud(dst, src1, src2)                                        \
+    do {                                                                        \
+        AMX_TILE_COUNT(dps, 1);                                                 \
+        if (amx_emulated) amx_emu_tile_dpbuud(dst, src1, src2);                 \
+        else _tile_dpbuud(dst, src1, src2);                                     \
+    } while (0)
+
+#define amx_tile_dpbf16ps(dst, src1, src2)                                      \
+    do {                                                                        \
+        AMX_TILE_COUNT(dps, 1);                                                 \
+        if (amx_emulated) amx_emu_tile_dpbf16ps(dst, src1, src2);               \
+        else _tile_dpbf16ps(dst, src1, src2);                                   \
+    } while (0)
+
+// TDPFP16PS (AMX-FP16) by its encoding, VEX.128.F2.0F38.W0 5C /r, as the compiler may not know it:
+// ModRM.reg = dst, ModRM.rm = src1 and VEX.vvvv = src2 (inverted).
+#define amx_tile_dpfp16ps(dst, src1, src2)                                      \
+    do {                                                                        \
+        AMX_TILE_COUNT(dps, 1);                                                 \
+        if (amx_emulated) amx_emu_tile_dpfp16ps(dst, src1, src2);               \
+        else __asm__ volatile(".byte 0xc4, 0xe2, %c0, 0x5c, %c1"                \
+                              :: "i"(((~(src2) & 0xF) << 3) | 3),               \
+                                 "i"(0xC0 | ((dst) << 3) | (src1)));            \
+    } while (0)
+
+// ---------------------------------------------------------------------------
+// The same with tile numbers as template parameters, for code that computes them at compile time
+// (e.g., gemm_traits.h): the _tile_* macros paste their arguments into register names, so they
+// only take literals, while these print constants into the register names.
+
+// The "memory" clobber keeps stores to the tile rows (e.g., packing right before) ahead of the load,
+// since the asm reads memory the compiler does not see as an operand
+template <int dst>
+inline void amx_tile_loadd_t(const void* base, long stride) {
+    AMX_TILE_COUNT(loads, 1);
+    if (amx_emulated) amx_emu_tile_loadd(dst, base, stride);
+    else __asm__ volatile("{tileloadd\t(%0,%1,1), %%tmm%c2|tileloadd\t%%tmm%c2, [%0+%1*1]}"
+                          :: "r"(base), "r"(stride), "i"(dst) : "memory");
+}
+
+template <int src>
+inline void amx_tile_stored_t(void* base, long stride) {
+    AMX_TILE_COUNT(stores, 1);
+    if (amx_emulated) amx_emu_tile_stored(src, base, stride);
+    else __asm__ volatile("{tilestored\t%%tmm%c2, (%0,%1,1)|tilestored\t[%0+%1*1], %%tmm%c2}"
+                          :: "r"(base), "r"(stride), "i"(src) : "memory");
+}
+
+template <int dst>
+inline void amx_tile_zero_t() {
+    AMX_TILE_COUNT(zeros, 1);
+    if (amx_emulated) amx_emu_tile_zero(dst);
+    else __asm__ volatile("tilezero\t%%tmm%c0" :: "i"(dst));
+}
+
+#define AMX_TILE_DP_T(name)                                                                                    \
+    template <int dst, int src1, int src2>                                                                     \
+    inline void amx_tile_##name##_t() {                                                                        \
+        AMX_TILE_COUNT(dps, 1);                                                                                \
+        if (amx_emulated) amx_emu_tile_##name(dst, src1, src2);                                                \
+        else __asm__ volatile("{t" #name "\t%%tmm%c2, %%tmm%c1, %%tmm%c0|t" #name "\t%%tmm%c0, %%tmm%c1, %%tmm%c2}" \
+                              :: "i"(dst), "i"(src1), "i"(src2));                                              \
+    }
+AMX_TILE_DP_T(dpbssd)
+AMX_TILE_DP_T(dpbsud)
+AMX_TILE_DP_T(dpbusd)
+AMX_TILE_DP_T(dpbuud)
+AMX_TILE_DP_T(dpbf16ps)
+#undef AMX_TILE_DP_T
+
+template <int dst, int src1, int src2>
+inline void amx_tile_dpfp16ps_t() { amx_tile_dpfp16ps(dst, src1, src2); }
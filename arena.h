@@ -0,0 +1,251 @@
+/*
+    Arena allocator for the buffers of the GEMM: packed weights, and scratch buffers reused across calls.
+
+    Memory comes from mmap in chunks, aligned to 64 bytes (a tile row) or more, and can be backed by huge pages:
+    - small: 4 KB pages
+    - thp: chunks of 2 MB or more are 2 MB aligned and advised with MADV_HUGEPAGE, so that transparent
+      huge pages back them when THP is enabled (always or madvise in /sys/kernel/mm/transparent_hugepage)
+    - hugetlb: MAP_HUGETLB from the pages reserved in /proc/sys/vm/nr_hugepages, or thp if none are left
+    The default is thp, or ARENA_PAGES=small|thp|hugetlb. With 2 MB pages, streaming a large packed B
+    takes 512x fewer TLB entries than with 4 KB pages.
+
+    An arena hands out memory by bumping an offset; arena_scope rewinds it when the scope ends, so that
+    nested scopes allocate and free in LIFO order. Each thread has a scratch arena (arena_thread_scratch)
+    for packed A panels, K tails and packed B of one call: chunks stay mapped, so once the first call
+    has grown the arena, later calls of the same or smaller shapes map nothing and do no heap allocation.
+    When the whole arena is rewound and it has grown to several chunks, they are merged into one.
+    arena_counts() counts the mappings, e.g., to check that steady state does not allocate.
+*/
+
+#pragma once
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define ARENA_ALIGNMENT 64
+#define ARENA_HUGE_PAGE_SIZE ((size_t)2 << 20)
+#define ARENA_CHUNK_SIZE ((size_t)1 << 20)
+
+enum arena_pages {
+    ARENA_PAGES_SMALL,
+    ARENA_PAGES_THP,
+    ARENA_PAGES_HUGETLB,
+};
+
+inline const char* arena_pages_name(arena_pages pages) {
+    return pages == ARENA_PAGES_SMALL ? "small" : pages == ARENA_PAGES_HUGETLB ? "hugetlb" : "thp";
+}
+
+// Pages of ARENA_PAGES, thp if not set
+inline arena_pages arena_default_pages() {
+    static const arena_pages pages = [] {
+        const char* env = std::getenv("ARENA_PAGES");
+        std::string name = env ? env : "";
+        if (name == "small") return ARENA_PAGES_SMALL;
+        if (name == "hugetlb") return ARENA_PAGES_HUGETLB;
+        if (!name.empty() && name != "thp") std::cout << "Unknown ARENA_PAGES " << name << ", using thp\n";
+        return ARENA_PAGES_THP;
+    }();
+    return pages;
+}
+
+// Counts of mappings of all arenas and arena_map calls
+struct arena_stats {
+    uint64_t maps;
+    uint64_t unmaps;
+    uint64_t bytes;              // bytes mapped now
+    uint64_t hugetlb_fallbacks;  // MAP_HUGETLB failed and thp was used instead
+};
+
+struct arena_counters {
+    std::atomic<uint64_t> maps{0};
+    std::atomic<uint64_t> unmaps{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> hugetlb_fallbacks{0};
+};
+
+inline arena_counters arena_global_counters;
+
+inline arena_stats arena_counts() {
+    return {arena_global_counters.maps.load(), arena_global_counters.unmaps.load(), arena_global_counters.bytes.load(),
+            arena_global_counters.hugetlb_fallbacks.load()};
+}
+
+inline size_t arena_round_up(size_t x, size_t y) { return (x + y - 1) / y * y; }
+
+// Map at least bytes of memory with the given pages. Returns null on failure.
+// *mapped is the size to pass to arena_unmap.
+inline void* arena_map(size_t bytes, arena_pages pages, size_t* mapped) {
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+    bytes = std::max<size_t>(bytes, 1);
+    void* p = MAP_FAILED;
+    size_t size = 0;
+    if (pages == ARENA_PAGES_HUGETLB) {
+        size = arena_round_up(bytes, ARENA_HUGE_PAGE_SIZE);
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED) {
+            ++arena_global_counters.hugetlb_fallbacks;
+            pages = ARENA_PAGES_THP;
+        }
+    }
+    if (p == MAP_FAILED && pages == ARENA_PAGES_THP && bytes >= ARENA_HUGE_PAGE_SIZE) {
+        // map one huge page more and trim to a 2 MB aligned range
+        size = arena_round_up(bytes, ARENA_HUGE_PAGE_SIZE);
+        char* raw = (char*)mmap(nullptr, size + ARENA_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw != MAP_FAILED) {
+            char* aligned = (char*)arena_round_up((uintptr_t)raw, ARENA_HUGE_PAGE_SIZE);
+            if (aligned > raw) munmap(raw, aligned - raw);
+            if (raw + ARENA_HUGE_PAGE_SIZE > aligned) munmap(aligned + size, raw + ARENA_HUGE_PAGE_SIZE - aligned);
+            madvise(aligned, size, MADV_HUGEPAGE);
+            p = aligned;
+        }
+    }
+    if (p == MAP_FAILED) {
+        size = arena_round_up(bytes, page_size);
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (p == MAP_FAILED) {
+        std::cout << "Failed to map " << bytes << " bytes\n";
+        return nullptr;
+    }
+    ++arena_global_counters.maps;
+    arena_global_counters.bytes += size;
+    *mapped = size;
+    return p;
+}
+
+inline void arena_unmap(void* p, size_t mapped) {
+    if (!p) return;
+    munmap(p, mapped);
+    ++arena_global_counters.unmaps;
+    arena_global_counters.bytes -= mapped;
+}
+
+// Position in an arena to rewind to
+struct arena_mark {
+    size_t chunk;
+    size_t offset;
+};
+
+class arena {
+public:
+    // Chunks are at least chunk_bytes
+    explicit arena(size_t chunk_bytes = ARENA_CHUNK_SIZE, arena_pages pages = arena_default_pages())
+        : chunk_bytes_(chunk_bytes), pages_(pages) {}
+    ~arena() { release(); }
+
+    arena(arena&& other) noexcept { *this = std::move(other); }
+    arena& operator=(arena&& other) noexcept {
+        std::swap(chunks_, other.chunks_);
+        std::swap(current_, other.current_);
+        std::swap(offset_, other.offset_);
+        std::swap(chunk_bytes_, other.chunk_bytes_);
+        std::swap(pages_, other.pages_);
+        return *this;
+    }
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    // bytes of uninitialized memory aligned to alignment (a power of 2 up to the page size).
+    // Returns null if no memory can be mapped.
+    void* allocate(size_t bytes, size_t alignment = ARENA_ALIGNMENT) {
+        // the rest of the current chunk, or the next free chunk that fits, or a new chunk
+        for (; current_ < chunks_.size(); ++current_, offset_ = 0) {
+            size_t begin = arena_round_up(offset_, alignment);
+            if (begin + bytes <= chunks_[current_].size) {
+                offset_ = begin + bytes;
+                return chunks_[current_].data + begin;
+            }
+        }
+        chunk c;
+        c.data = (char*)arena_map(std::max(bytes, chunk_bytes_), pages_, &c.size);
+        if (!c.data) return nullptr;
+        chunks_.push_back(c);
+        current_ = chunks_.size() - 1;
+        offset_ = bytes;
+        return c.data;
+    }
+
+    // count elements of T, uninitialized
+    template <typename T>
+    T* allocate(size_t count) {
+        return (T*)allocate(count * sizeof(T), std::max<size_t>(ARENA_ALIGNMENT, alignof(T)));
+    }
+
+    arena_mark mark() const { return {current_, offset_}; }
+
+    // Free everything allocated after mark. Rewinding all of an arena of several chunks merges them into one,
+    // big enough for what was allocated, so that the next round of the same allocations maps nothing.
+    void rewind(arena_mark m) {
+        current_ = m.chunk;
+        offset_ = m.offset;
+        if (current_ == 0 && offset_ == 0 && chunks_.size() > 1) {
+            size_t total = 0;
+            for (const chunk& c : chunks_) total += c.size;
+            release();
+            chunk c;
+            c.data = (char*)arena_map(total, pages_, &c.size);
+            if (c.data) chunks_.push_back(c);
+        }
+    }
+
+    void reset() { rewind({0, 0}); }
+
+    // Unmap all chunks
+    void release() {
+        for (const chunk& c : chunks_) arena_unmap(c.data, c.size);
+        chunks_.clear();
+        current_ = 0;
+        offset_ = 0;
+    }
+
+    size_t capacity() const {
+        size_t total = 0;
+        for (const chunk& c : chunks_) total += c.size;
+        return total;
+    }
+    size_t chunks() const { return chunks_.size(); }
+    arena_pages pages() const { return pages_; }
+
+private:
+    struct chunk {
+        char* data = nullptr;
+        size_t size = 0;
+    };
+    std::vector<chunk> chunks_;
+    size_t current_ = 0;
+    size_t offset_ = 0;
+    size_t chunk_bytes_ = ARENA_CHUNK_SIZE;
+    arena_pages pages_ = ARENA_PAGES_THP;
+};
+
+// Rewind an arena to where it was at the beginning of the scope
+class arena_scope {
+public:
+    explicit arena_scope(arena& a) : arena_(a), mark_(a.mark()) {}
+    ~arena_scope() { arena_.rewind(mark_); }
+    arena_scope(const arena_scope&) = delete;
+    arena_scope& operator=(const arena_scope&) = delete;
+
+    template <typename T>
+    T* allocate(size_t count) { return arena_.allocate<T>(count); }
+
+private:
+    arena& arena_;
+    arena_mark mark_;
+};
+
+// Scratch arena of this thread, for the buffers of a GEMM call
+inline arena& arena_thread_scratch() {
+    static thread_local arena scratch;
+    return scratch;
+}
@@ -0,0 +1,245 @@
+/*
+    This benchmark shows the effect of the arena allocator (arena.h) on the GEMM library:
+    1. Allocations in steady state: heap allocations (operator new) and arena mappings per call
+       of each entry point, after a warm-up call has grown the scratch arenas. None should do any.
+    2. Pages of packed B: a GEMM with small M streams all of packed B for little compute, so it is sensitive
+       to TLB misses. For small pages, THP and hugetlb, it reports the time, the bandwidth of B,
+       how much of packed B is backed by huge pages and the dTLB load misses per call (n/a if perf_event_open
+       is not available, e.g., in a VM). hugetlb needs pages reserved in /proc/sys/vm/nr_hugepages.
+
+    Usage: bench-arena [M N K]   (default 16 4096 4096)
+*/
+
+#include "gemm_batched.h"
+#include "packed_matrix.h"
+#include "bench.h"
+#include <linux/perf_event.h>
+#include <new>
+
+#define WARMUP 2
+#define ITERS 10
+
+// Count heap allocations of the whole program: all replaceable forms of operator new
+// (plain, array, nothrow and aligned) count and allocate with malloc, and all forms of operator delete free.
+// heap_free is not inlined, so that GCC does not see free() of a pointer from operator new (-Wmismatched-new-delete).
+std::atomic<uint64_t> heap_allocations{0};
+
+void* heap_allocate(size_t size, size_t alignment = 0) noexcept {
+    ++heap_allocations;
+    if (!size) size = 1;
+    if (alignment <= alignof(std::max_align_t)) return std::malloc(size);
+    void* p = nullptr;
+    return posix_memalign(&p, alignment, size) ? nullptr : p;
+}
+
+__attribute__((noinline)) void heap_free(void* p) noexcept { std::free(p); }
+
+void* operator new(size_t size) {
+    if (void* p = heap_allocate(size)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return heap_allocate(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return heap_allocate(size); }
+void* operator new(size_t size, std::align_val_t al) {
+    if (void* p = heap_allocate(size, (size_t)al)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size, std::align_val_t al) { return operator new(size, al); }
+void* operator new(size_t size, std::align_val_t al, const std::nothrow_t&) noexcept {
+    return heap_allocate(size, (size_t)al);
+}
+void* operator new[](size_t size, std::align_val_t al, const std::nothrow_t&) noexcept {
+    return heap_allocate(size, (size_t)al);
+}
+void operator delete(void* p) noexcept { heap_free(p); }
+void operator delete[](void* p) noexcept { heap_free(p); }
+void operator delete(void* p, size_t) noexcept { heap_free(p); }
+void operator delete[](void* p, size_t) noexcept { heap_free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { heap_free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { heap_free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { heap_free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { heap_free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { heap_free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { heap_free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { heap_free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { heap_free(p); }
+
+// Heap allocations and arena mappings per call of fn, after WARMUP calls
+template <typename F>
+void count_allocations(const char* name, F&& fn) {
+    for (int i = 0; i < WARMUP; ++i) fn();
+    uint64_t heap = heap_allocations;
+    uint64_t maps = arena_counts().maps;
+    for (int i = 0; i < ITERS; ++i) fn();
+    std::cout << name << ", " << (double)(heap_allocations - heap) / ITERS << ", "
+              << (double)(arena_counts().maps - maps) / ITERS << "\n";
+}
+
+template <typename T, typename Acc>
+void bench_allocations(const char* name, amx_thread_pool& pool) {
+    const int M = 200, N = 300, K = 1000;
+    std::vector<T> A((size_t)M * K);
+    std::vector<T> B((size_t)K * N);
+    std::vector<T> B_packed(packed_B_size<T>(K, N));
+    std::vector<Acc> C((size_t)M * N);
+    std::vector<bfloat16> out((size_t)M * N);
+    init_buffer(A.data(), A.size());
+    init_buffer(B.data(), B.size());
+    pack_B(B.data(), K, N, N, B_packed.data());
+
+    std::cout << name << ": [" << M << ", " << K << "] x [" << K << ", " << N << "]\n";
+    std::cout << "call, heap allocations per call, arena maps per call\n";
+    count_allocations("gemm_amx, packed B", [&] {
+        gemm_amx(M, N, K, A.data(), K, B_packed.data(), C.data(), N);
+    });
+    gemm_blocking in_place = gemm_default_blocking<T>();
+    in_place.pack_A = false;
+    count_allocations("gemm_amx, packed B, A in place", [&] {
+        gemm_amx(M, N, K, A.data(), K, B_packed.data(), C.data(), N, in_place);
+    });
+    count_allocations("gemm_amx, plain B", [&] {
+        gemm_amx(M, N, K, A.data(), K, B.data(), N, C.data(), N);
+    });
+    gemm_epilogue ep;
+    ep.activation = GEMM_ACTIVATION_GELU;
+    ep.out_type = GEMM_OUTPUT_BF16;
+    ep.out = out.data();
+    ep.ld_out = N;
+    count_allocations("gemm_amx, epilogue", [&] {
+        gemm_amx(M, N, K, A.data(), K, B_packed.data(), ep);
+    });
+    count_allocations("gemm_amx_parallel", [&] {
+        gemm_amx_parallel(pool, M, N, K, A.data(), K, B_packed.data(), C.data(), N);
+    });
+    // one block of C and long K: K is split over the threads and partial sums are reduced
+    std::vector<T> B_block(packed_B_size<T>(K, GEMM_BLOCK_N));
+    pack_B(B.data(), K, GEMM_BLOCK_N, N, B_block.data());
+    count_allocations("gemm_amx_parallel, K split", [&] {
+        gemm_amx_parallel(pool, GEMM_BLOCK_M, GEMM_BLOCK_N, K, A.data(), K, B_block.data(), C.data(), N);
+    });
+    count_allocations("gemm_amx_batched", [&] {
+        gemm_amx_batched(4, M / 4, N, K, A.data(), K, (size_t)M / 4 * K, B_packed.data(), 0, C.data(), N,
+                         (size_t)M / 4 * N, &pool);
+    });
+}
+
+// Bytes of the mapping at addr backed by huge pages, from /proc/self/smaps
+size_t huge_page_bytes(const void* addr) {
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    bool in_mapping = false;
+    size_t anon_huge_kb = 0, page_kb = 0, rss_kb = 0;
+    while (std::getline(smaps, line)) {
+        unsigned long start, end;
+        char dash;
+        std::istringstream s(line);
+        if (s >> std::hex >> start >> dash >> end && dash == '-') {
+            if (in_mapping) break;
+            in_mapping = (uintptr_t)addr >= start && (uintptr_t)addr < end;
+            continue;
+        }
+        if (!in_mapping) continue;
+        std::string key;
+        size_t kb;
+        std::istringstream fields(line);
+        fields >> key >> std::dec >> kb;
+        if (key == "AnonHugePages:") anon_huge_kb = kb;
+        else if (key == "KernelPageSize:") page_kb = kb;
+        else if (key == "Rss:") rss_kb = kb;
+    }
+    // hugetlb pages are not in AnonHugePages but in the page size of the mapping
+    return (page_kb >= 2048 ? rss_kb : anon_huge_kb) * 1024;
+}
+
+// dTLB load misses of this thread, from perf_event_open; fd < 0 if not available
+struct dtlb_counter {
+    int fd = -1;
+    dtlb_counter() {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    ~dtlb_counter() {
+        if (fd >= 0) close(fd);
+    }
+    uint64_t read_value() const {
+        uint64_t value = 0;
+        if (fd >= 0 && read(fd, &value, sizeof(value)) != sizeof(value)) value = 0;
+        return value;
+    }
+};
+
+template <typename T, typename Acc>
+bool bench_pages(const char* name, int M, int N, int K) {
+    std::vector<T> A((size_t)M * K);
+    std::vector<T> B((size_t)K * N);
+    std::vector<Acc> C((size_t)M * N);
+    std::vector<Acc> C_ref((size_t)M * N);
+    init_buffer(A.data(), A.size());
+    init_buffer(B.data(), B.size());
+    size_t b_bytes = packed_B_size<T>(K, N) * sizeof(T);
+
+    std::cout << name << ": [" << M << ", " << K << "] x [" << K << ", " << N << "], packed B "
+              << b_bytes / 1048576.0 << " MB\n";
+    std::cout << "pages, ms, GB/s of B, huge pages of B (MB), dTLB load misses per call\n";
+    dtlb_counter dtlb;
+    bool ok = true;
+    for (arena_pages pages : {ARENA_PAGES_SMALL, ARENA_PAGES_THP, ARENA_PAGES_HUGETLB}) {
+        uint64_t fallbacks = arena_counts().hugetlb_fallbacks;
+        packed_matrix packed = packed_matrix::pack(B.data(), K, N, N, pages);
+        if (packed.empty()) return false;
+        auto run = [&] { gemm_amx(M, K, A.data(), K, packed, C.data(), N); };
+        run();
+        uint64_t misses = dtlb.read_value();
+        double t = bench_median_seconds(run, WARMUP, ITERS);
+        misses = dtlb.read_value() - misses;
+        std::cout << arena_pages_name(pages);
+        if (arena_counts().hugetlb_fallbacks != fallbacks) std::cout << " (no hugetlb pages, thp)";
+        std::cout << ", " << t * 1e3 << ", " << b_bytes / t * 1e-9 << ", "
+                  << huge_page_bytes(packed.data<T>()) / 1048576.0 << ", ";
+        if (dtlb.fd >= 0) std::cout << (double)misses / (ITERS + WARMUP) << "\n";
+        else std::cout << "n/a\n";
+        // the same kernel on the same data whatever the pages
+        if (pages == ARENA_PAGES_SMALL) C_ref = C;
+        else ok &= check_results(C.data(), C_ref.data(), M, N, (Acc)0);
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    int M = 16, N = 4096, K = 4096;
+    if (argc >= 4) {
+        M = std::atoi(argv[1]);
+        N = std::atoi(argv[2]);
+        K = std::atoi(argv[3]);
+    }
+
+    std::cout << "=========================================\n";
+    std::cout << "  Arena allocation for AMX GEMM\n";
+    std::cout << "=========================================\n";
+
+    if (M <= 0 || N <= 0 || K <= 0) {
+        std::cout << "M, N and K must be positive\n";
+        return 1;
+    }
+    if (!init_amx()) return 1;
+
+    amx_thread_pool pool(2);
+    bench_allocations<int8_t, int32_t>("int8 * int8 -> int32", pool);
+    bench_allocations<bfloat16, float>("bf16 * bf16 -> float", pool);
+
+    bool ok = bench_pages<int8_t, int32_t>("int8 * int8 -> int32", M, N, K);
+    ok &= bench_pages<bfloat16, float>("bf16 * bf16 -> float", M, N, K);
+
+    amx_tile_release();
+    if (!ok) return 1;
+    std::cout << "Done\n";
+    return 0;
+}
@@ -0,0 +1,114 @@
+/*
+    This benchmark compares the fp32 <-> bf16 conversions of bf16_convert.h and the mixed-precision GEMM
+    with fp32 A in gemm.h:
+    1. Conversions: GB/s of each kernel the CPU has (avx512bf16, avx512, avx2, scalar) in both directions,
+       counting bytes read and written, with the bits checked against bfloat16(float) element by element.
+       Inputs are random normal floats, so the hardware conversion gives the same bits as the others.
+    2. GEMM with fp32 A and packed bf16 B: A converted panel by panel while packing, vs. converting all of A
+       to a bf16 copy first (bulk and element by element) and calling the bf16 GEMM. The results must be the same.
+
+    Usage: bench-bf16-convert [M N K]   (default 1024 1024 1024)
+*/
+
+#include "gemm.h"
+#include "bench.h"
+
+#define WARMUP 2
+#define ITERS 10
+
+bool bench_convert(size_t n) {
+    std::vector<float> in(n), back(n);
+    std::vector<bfloat16> ref(n), out(n);
+    std::mt19937 gen(n);
+    std::normal_distribution<float> distr(0.0f, 10.0f);
+    for (float& x : in) x = distr(gen);
+    for (size_t i = 0; i < n; ++i) ref[i] = bfloat16(in[i]);
+    double bytes = (double)n * (sizeof(float) + sizeof(bfloat16));
+    bool ok = true;
+
+    double t = bench_median_seconds([&] {
+        for (size_t i = 0; i < n; ++i) out[i] = bfloat16(in[i]);
+    }, WARMUP, ITERS);
+    std::cout << n << ", bfloat16(float), " << t * 1e3 << ", " << bytes / t * 1e-9 << ", \n";
+    for (const char* name : {"avx512bf16", "avx512", "avx2", "scalar"}) {
+        const bf16_convert_kernels* k = bf16_convert_find(name);
+        if (!k) {
+            std::cout << n << ", " << name << ", not supported\n";
+            continue;
+        }
+        std::fill(out.begin(), out.end(), bfloat16());
+        double t_from = bench_median_seconds([&] { k->from_fp32(in.data(), out.data(), n); }, WARMUP, ITERS);
+        double t_to = bench_median_seconds([&] { k->to_fp32(out.data(), back.data(), n); }, WARMUP, ITERS);
+        bool same = !std::memcmp(out.data(), ref.data(), n * sizeof(bfloat16));
+        for (size_t i = 0; i < n && same; ++i) same = back[i] == (float)ref[i];
+        ok &= same;
+        std::cout << n << ", " << name << ", " << t_from * 1e3 << ", " << bytes / t_from * 1e-9 << ", "
+                  << t_to * 1e3 << ", " << bytes / t_to * 1e-9 << (same ? "" : ", MISMATCH") << "\n";
+    }
+    return ok;
+}
+
+bool bench_gemm(int M, int N, int K) {
+    std::vector<float> A((size_t)M * K);
+    std::vector<bfloat16> A_bf16((size_t)M * K);
+    std::vector<bfloat16> B((size_t)K * N);
+    std::vector<bfloat16> B_packed(packed_B_size<bfloat16>(K, N));
+    std::vector<float> C_ref((size_t)M * N), C((size_t)M * N);
+    std::mt19937 gen(M + N + K);
+    std::uniform_real_distribution<float> distr(-1.0f, 1.0f);
+    for (float& x : A) x = distr(gen);
+    init_bf16_buffer(B.data(), B.size());
+    pack_B(B.data(), K, N, N, B_packed.data());
+    bf16_from_fp32(A.data(), A_bf16.data(), A.size());
+    gemm_amx(M, N, K, A_bf16.data(), K, B_packed.data(), C_ref.data(), N);
+
+    std::cout << "fp32 * bf16 -> float: [" << M << ", " << K << "] x [" << K << ", " << N << "]\n";
+    std::cout << "method, ms, TFLOPS\n";
+    bool ok = true;
+    auto report = [&](const char* method, double t) {
+        std::cout << method << ", " << t * 1e3 << ", " << gemm_ops(M, N, K) / t * 1e-12 << "\n";
+        ok &= check_results(C.data(), C_ref.data(), M, N, 0.0f);
+    };
+    report("fp32 A converted while packing", bench_median_seconds([&] {
+        gemm_amx(M, N, K, A.data(), K, B_packed.data(), C.data(), N);
+    }, WARMUP, ITERS));
+    report("bulk convert A + bf16 GEMM", bench_median_seconds([&] {
+        bf16_from_fp32(A.data(), A_bf16.data(), A.size());
+        gemm_amx(M, N, K, A_bf16.data(), K, B_packed.data(), C.data(), N);
+    }, WARMUP, ITERS));
+    report("bfloat16(float) A + bf16 GEMM", bench_median_seconds([&] {
+        for (size_t i = 0; i < A.size(); ++i) A_bf16[i] = bfloat16(A[i]);
+        gemm_amx(M, N, K, A_bf16.data(), K, B_packed.data(), C.data(), N);
+    }, WARMUP, ITERS));
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    int M = 1024, N = 1024, K = 1024;
+    if (argc >= 4) {
+        M = std::atoi(argv[1]);
+        N = std::atoi(argv[2]);
+        K = std::atoi(argv[3]);
+    }
+
+    std::cout << "=========================================\n";
+    std::cout << "  fp32 <-> bf16 conversion\n";
+    std::cout << "=========================================\n";
+
+    if (M <= 0 || N <= 0 || K <= 0) {
+        std::cout << "M, N and K must be positive\n";
+        return 1;
+    }
+    std::cout << "active kernel: " << bf16_convert_active().name << "\n";
+    std::cout << "elements, kernel, fp32 -> bf16 ms, GB/s, bf16 -> fp32 ms, GB/s\n";
+    bool ok = true;
+    for (size_t n : {4096 + 13, 1 << 20, 16 << 20}) ok &= bench_convert(n);
+
+    if (!init_amx()) return 1;
+    ok &= bench_gemm(M, N, K);
+
+    amx_tile_release();
+    if (!ok) return 1;
+    std::cout << "Done\n";
+    return 0;
+}
@@ -0,0 +1,173 @@
+/*
+    This benchmark compares the fused attention of gemm_attention.h with the unfused three passes
+    for one head at sequence lengths from 512 up to 16K (or a given maximum):
+        1. S = Q x K^T with gemm_amx_parallel (K packed by pack_B_trans), S [seq, seq] in float
+        2. softmax of each row of scale * S (with the causal mask) to P [seq, seq] in bf16, with AVX-512
+        3. O = P x V with gemm_amx_parallel (V packed by pack_B)
+    For each length, with and without the causal mask, it reports the time of both, the speedup of fused,
+    the memory of the score matrices the unfused passes write and read, and the largest difference of
+    the outputs relative to the largest output (both round P to bf16, after different maxima).
+    Fused attention is first checked against a double precision reference on odd shapes,
+    including seq_q != seq_k, d not a multiple of 32 and queries that see no key.
+
+    Usage: bench-gemm-attention [d [max_seq [threads]]]   (default 128 16384, all CPUs)
+*/
+
+#include "gemm_attention.h"
+#include "bench.h"
+
+#define WARMUP 1
+#define ITERS 3
+
+// Double precision attention with the same mask as gemm_attention; rows with no key are zeros
+void attention_ref(int seq_q, int seq_k, int d, const bfloat16* Q, const bfloat16* K, const bfloat16* V, float* O,
+                   float scale, bool causal) {
+    std::vector<double> s(seq_k);
+    for (int i = 0; i < seq_q; ++i) {
+        int n = causal ? std::min(seq_k, std::max(0, i + seq_k - seq_q + 1)) : seq_k;
+        double row_max = -1e300, sum = 0;
+        for (int j = 0; j < n; ++j) {
+            double dot = 0;
+            for (int c = 0; c < d; ++c) dot += (double)(float)Q[(size_t)i * d + c] * (float)K[(size_t)j * d + c];
+            s[j] = dot * scale;
+            row_max = std::max(row_max, s[j]);
+        }
+        for (int j = 0; j < n; ++j) sum += s[j] = std::exp(s[j] - row_max);
+        for (int c = 0; c < d; ++c) {
+            double o = 0;
+            for (int j = 0; j < n; ++j) o += s[j] * (float)V[(size_t)j * d + c];
+            O[(size_t)i * d + c] = n ? (float)(o / sum) : 0.0f;
+        }
+    }
+}
+
+// Largest |a - b| relative to the largest |b|
+double max_rel_diff(const std::vector<float>& a, const std::vector<float>& b) {
+    double max_ref = 0, max_diff = 0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        max_ref = std::max(max_ref, (double)std::fabs(b[i]));
+        max_diff = std::max(max_diff, (double)std::fabs(a[i] - b[i]));
+    }
+    return max_ref > 0 ? max_diff / max_ref : max_diff;
+}
+
+bool check_shapes(amx_thread_pool& pool) {
+    bool ok = true;
+    struct shape { int seq_q, seq_k, d; };
+    for (shape sh : {shape{1, 1, 32}, shape{77, 133, 80}, shape{100, 100, 64}, shape{40, 20, 16},
+                     shape{130, 257, 128}}) {
+        for (bool causal : {false, true}) {
+            std::vector<bfloat16> Q((size_t)sh.seq_q * sh.d), K((size_t)sh.seq_k * sh.d), V((size_t)sh.seq_k * sh.d);
+            init_bf16_buffer(Q.data(), Q.size());
+            init_bf16_buffer(K.data(), K.size());
+            init_bf16_buffer(V.data(), V.size());
+            std::vector<float> O((size_t)sh.seq_q * sh.d), O_ref(O.size());
+            float scale = 1.0f / std::sqrt((float)sh.d);
+            gemm_attention(pool, sh.seq_q, sh.seq_k, sh.d, Q.data(), sh.d, K.data(), sh.d, V.data(), sh.d, O.data(),
+                           sh.d, scale, causal);
+            attention_ref(sh.seq_q, sh.seq_k, sh.d, Q.data(), K.data(), V.data(), O_ref.data(), scale, causal);
+            double diff = max_rel_diff(O, O_ref);
+            bool same = diff < 1e-2;
+            ok &= same;
+            std::cout << "check [" << sh.seq_q << ", " << sh.seq_k << ", " << sh.d << "]" << (causal ? " causal" : "")
+                      << ": max rel. diff " << diff << (same ? ", OK" : ", FAILED") << "\n";
+        }
+    }
+    return ok;
+}
+
+// Step 2 of the unfused attention: P = softmax(scale * S) row by row, with AVX-512
+__attribute__((target("avx512f,avx512bw")))
+void softmax_rows(amx_thread_pool& pool, const float* S, int seq_q, int seq_k, float scale, bool causal,
+                  bfloat16* P) {
+    int num_threads = pool.size();
+    pool.run([&](int tid) {
+        for (int i = gemm_split_begin(seq_q, num_threads, tid); i < gemm_split_begin(seq_q, num_threads, tid + 1); ++i) {
+            const float* s = S + (size_t)i * seq_k;
+            bfloat16* p = P + (size_t)i * seq_k;
+            int n = causal ? std::min(seq_k, std::max(0, i + seq_k - seq_q + 1)) : seq_k;
+            __m512 vscale = _mm512_set1_ps(scale);
+            __m512 vmax = _mm512_set1_ps(-std::numeric_limits<float>::infinity());
+            for (int j = 0; j < n; j += 16) {
+                __mmask16 k = (__mmask16)((1u << std::min(16, n - j)) - 1);
+                vmax = _mm512_mask_max_ps(vmax, k, vmax, _mm512_mul_ps(_mm512_maskz_loadu_ps(k, s + j), vscale));
+            }
+            __m512 vm = _mm512_set1_ps(_mm512_reduce_max_ps(vmax));
+            __m512 vsum = _mm512_setzero_ps();
+            for (int j = 0; j < n; j += 16) {
+                __mmask16 k = (__mmask16)((1u << std::min(16, n - j)) - 1);
+                __m512 e = gemm_exp_avx512(_mm512_sub_ps(_mm512_mul_ps(_mm512_maskz_loadu_ps(k, s + j), vscale), vm));
+                vsum = _mm512_add_ps(vsum, _mm512_maskz_mov_ps(k, e));
+            }
+            __m512 inv = _mm512_set1_ps(n ? 1.0f / _mm512_reduce_add_ps(vsum) : 0.0f);
+            for (int j = 0; j < seq_k; j += 16) {
+                int cols = std::min(16, seq_k - j);
+                __mmask16 k = (__mmask16)((1u << cols) - 1);
+                __mmask16 kv = (__mmask16)((1u << std::max(0, std::min(16, n - j))) - 1);
+                __m512 e = gemm_exp_avx512(_mm512_sub_ps(_mm512_mul_ps(_mm512_maskz_loadu_ps(kv, s + j), vscale), vm));
+                _mm256_mask_storeu_epi16(p + j, k, bf16_round_avx512(_mm512_maskz_mul_ps(kv, e, inv)));
+            }
+        }
+    });
+}
+
+bool bench_seq(amx_thread_pool& pool, int seq, int d, bool causal) {
+    std::vector<bfloat16> Q((size_t)seq * d), K((size_t)seq * d), V((size_t)seq * d);
+    init_bf16_buffer(Q.data(), Q.size());
+    init_bf16_buffer(K.data(), K.size());
+    init_bf16_buffer(V.data(), V.size());
+    std::vector<float> O((size_t)seq * d), O_unfused((size_t)seq * d);
+    std::vector<float> S((size_t)seq * seq);
+    std::vector<bfloat16> P((size_t)seq * seq);
+    std::vector<bfloat16> K_packed(packed_B_size<bfloat16>(d, seq)), V_packed(packed_B_size<bfloat16>(seq, d));
+    float scale = 1.0f / std::sqrt((float)d);
+
+    double t_fused = bench_median_seconds([&] {
+        gemm_attention(pool, seq, seq, d, Q.data(), d, K.data(), d, V.data(), d, O.data(), d, scale, causal);
+    }, WARMUP, ITERS);
+    double t_unfused = bench_median_seconds([&] {
+        pack_B_trans(K.data(), d, seq, d, K_packed.data());
+        gemm_amx_parallel(pool, seq, seq, d, Q.data(), d, K_packed.data(), S.data(), seq);
+        softmax_rows(pool, S.data(), seq, seq, scale, causal, P.data());
+        pack_B(V.data(), seq, d, d, V_packed.data());
+        gemm_amx_parallel(pool, seq, d, seq, P.data(), seq, V_packed.data(), O_unfused.data(), d);
+    }, WARMUP, ITERS);
+    double diff = max_rel_diff(O, O_unfused);
+    bool ok = diff < 1e-2;
+    double score_mb = (double)seq * seq * (sizeof(float) + sizeof(bfloat16)) / 1048576.0;
+    std::cout << seq << ", " << (causal ? "causal" : "full") << ", " << t_fused * 1e3 << ", " << t_unfused * 1e3
+              << ", " << t_unfused / t_fused << ", " << score_mb << ", " << diff << (ok ? "" : ", MISMATCH") << "\n";
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    int d = 128, max_seq = 16384;
+    int num_threads = std::thread::hardware_concurrency();
+    if (argc >= 2) d = std::atoi(argv[1]);
+    if (argc >= 3) max_seq = std::atoi(argv[2]);
+    if (argc >= 4) num_threads = std::atoi(argv[3]);
+    num_threads = std::max(num_threads, 1);
+
+    std::cout << "=========================================\n";
+    std::cout << "  Fused attention with Intel AMX\n";
+    std::cout << "=========================================\n";
+
+    if (d <= 0 || max_seq <= 0) {
+        std::cout << "d and max_seq must be positive\n";
+        return 1;
+    }
+    if (!init_amx()) return 1;
+    amx_thread_pool pool(num_threads);
+
+    bool ok = check_shapes(pool);
+    std::cout << "head dim " << d << ", threads " << num_threads << "\n";
+    std::cout << "seq, mask, fused ms, unfused ms, speedup, unfused S + P MB, max rel. diff\n";
+    for (int seq = 512; seq <= max_seq; seq *= 2) {
+        for (bool causal : {false, true}) ok &= bench_seq(pool, seq, d, causal);
+    }
+
+    amx_tile_release();
+    if (!ok) return 1;
+    std::cout << "Done\n";
+    return 0;
+}
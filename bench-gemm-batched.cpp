@@ -0,0 +1,115 @@
+/*
+    This benchmark compares many small GEMMs computed by a loop of gemm_amx calls
+    with the batched and grouped GEMM in gemm_batched.h, in GEMM calls per second:
+    - batched: uniform shapes, e.g., the 12x24x12 of the small examples, attention heads, and shapes with tails
+    - grouped: MoE experts with a random number of tokens each
+    Batched & grouped GEMM run on 1 thread and on all threads. Results must match the loop exactly.
+
+    Usage: bench-gemm-batched [max_threads]
+*/
+
+#include "gemm_batched.h"
+#include "bench.h"
+
+#define WARMUP 2
+#define ITERS 10
+
+template <typename Acc>
+void report(const char* name, const char* variant, int calls, double t, const std::vector<Acc>& C,
+            const std::vector<Acc>& C_loop) {
+    std::cout << name << ", " << variant << ", " << t * 1e3 << ", " << calls / t << "\n";
+    if (&C != &C_loop && std::memcmp(C.data(), C_loop.data(), C.size() * sizeof(Acc))) {
+        std::cout << "Failed: result differs from the loop of gemm_amx!\n";
+    }
+}
+
+// batch problems of [M, K] x [K, N], each with its own B
+template <typename T, typename Acc>
+void bench_batched(const char* name, int batch, int M, int N, int K, amx_thread_pool& pool) {
+    size_t stride_a = (size_t)M * K, stride_b = packed_B_size<T>(K, N), stride_c = (size_t)M * N;
+    std::vector<T> A(batch * stride_a);
+    std::vector<T> B((size_t)K * N);
+    std::vector<T> B_packed(batch * stride_b);
+    std::vector<Acc> C(batch * stride_c), C_loop(batch * stride_c);
+    init_buffer(A.data(), A.size());
+    for (int i = 0; i < batch; ++i) {
+        init_buffer(B.data(), B.size());
+        pack_B(B.data(), K, N, N, B_packed.data() + i * stride_b);
+    }
+    double t = bench_median_seconds([&] {
+        for (int i = 0; i < batch; ++i) {
+            gemm_amx(M, N, K, A.data() + i * stride_a, K, B_packed.data() + i * stride_b, C_loop.data() + i * stride_c, N);
+        }
+    }, WARMUP, ITERS);
+    report(name, "loop", batch, t, C_loop, C_loop);
+    t = bench_median_seconds([&] {
+        gemm_amx_batched(batch, M, N, K, A.data(), K, stride_a, B_packed.data(), stride_b, C.data(), N, stride_c);
+    }, WARMUP, ITERS);
+    report(name, "batched, 1 thread", batch, t, C, C_loop);
+    t = bench_median_seconds([&] {
+        gemm_amx_batched(batch, M, N, K, A.data(), K, stride_a, B_packed.data(), stride_b, C.data(), N, stride_c, &pool);
+    }, WARMUP, ITERS);
+    report(name, "batched, all threads", batch, t, C, C_loop);
+}
+
+// count experts of [M_i, K] x [K, N], with M_i from 1 to max_m
+template <typename T, typename Acc>
+void bench_grouped(const char* name, int count, int max_m, int N, int K, amx_thread_pool& pool) {
+    std::mt19937 gen(count);
+    std::uniform_int_distribution<> tokens(1, max_m);
+    std::vector<int> M(count);
+    std::vector<size_t> offset_a(count + 1, 0), offset_c(count + 1, 0);
+    for (int i = 0; i < count; ++i) {
+        M[i] = tokens(gen);
+        offset_a[i + 1] = offset_a[i] + (size_t)M[i] * K;
+        offset_c[i + 1] = offset_c[i] + (size_t)M[i] * N;
+    }
+    size_t stride_b = packed_B_size<T>(K, N);
+    std::vector<T> A(offset_a[count]);
+    std::vector<T> B((size_t)K * N);
+    std::vector<T> B_packed(count * stride_b);
+    std::vector<Acc> C(offset_c[count]), C_loop(offset_c[count]);
+    init_buffer(A.data(), A.size());
+    for (int i = 0; i < count; ++i) {
+        init_buffer(B.data(), B.size());
+        pack_B(B.data(), K, N, N, B_packed.data() + i * stride_b);
+    }
+    std::vector<gemm_problem<T, T, Acc>> problems(count);
+    for (int i = 0; i < count; ++i) {
+        problems[i] = {M[i], N, K, A.data() + offset_a[i], K, B_packed.data() + i * stride_b, C.data() + offset_c[i], N};
+    }
+    double t = bench_median_seconds([&] {
+        for (auto& p : problems) {
+            gemm_amx(p.M, p.N, p.K, p.A, p.lda, p.B_packed, C_loop.data() + (p.C - C.data()), p.ldc);
+        }
+    }, WARMUP, ITERS);
+    report(name, "loop", count, t, C_loop, C_loop);
+    t = bench_median_seconds([&] { gemm_amx_grouped(problems.data(), count); }, WARMUP, ITERS);
+    report(name, "grouped, 1 thread", count, t, C, C_loop);
+    t = bench_median_seconds([&] { gemm_amx_grouped(problems.data(), count, &pool); }, WARMUP, ITERS);
+    report(name, "grouped, all threads", count, t, C, C_loop);
+}
+
+int main(int argc, char** argv) {
+    int max_threads = argc >= 2 ? std::atoi(argv[1]) : std::thread::hardware_concurrency();
+
+    std::cout << "=========================================\n";
+    std::cout << "  Batched & grouped GEMM with Intel AMX\n";
+    std::cout << "=========================================\n";
+
+    if (!init_amx()) return 1;
+    amx_thread_pool pool(max_threads);
+    std::cout << "Threads: " << pool.size() << "\n";
+
+    std::cout << "problem, variant, ms, GEMMs/s\n";
+    bench_batched<int8_t, int32_t>("int8 4096 x 12x24x12", 4096, 12, 24, 12, pool);
+    bench_batched<bfloat16, float>("bf16 4096 x 12x24x12", 4096, 12, 24, 12, pool);
+    bench_batched<bfloat16, float>("bf16 1024 x 64x64x64 (attention heads)", 1024, 64, 64, 64, pool);
+    bench_batched<int8_t, int32_t>("int8 1024 x 48x40x100 (tails)", 1024, 48, 40, 100, pool);
+    bench_grouped<int8_t, int32_t>("int8 256 experts x 1..64x128x256", 256, 64, 128, 256, pool);
+    bench_grouped<bfloat16, float>("bf16 256 experts x 1..64x128x256", 256, 64, 128, 256, pool);
+
+    amx_tile_release();
+    std::cout << "Done\n";
+    return 0;
+}
@@ -0,0 +1,71 @@
+/*
+    This benchmark compares the outer blocking of the GEMM in gemm.h on square shapes from 256 up to max_size:
+    - unblocked: the mc -> nc -> kc loop of the large examples, with A read in place
+    - blocked: panels of A & B sized from the cache hierarchy, with A read in place
+    - blocked + packed A: same, with each A panel packed in tile order first
+    With cache-aware blocking, throughput should stay flat as matrices outgrow the caches.
+    The default sweep goes up to 8192^3, where the operands (about 1 GB for bf16) are far beyond L3.
+
+    Usage: bench-gemm-blocking [max_size]   (default 8192)
+*/
+
+#include "gemm.h"
+#include "bench.h"
+
+template <typename T, typename Acc>
+void bench_dtype(const char* name, int size) {
+    int M = size, N = size, K = size;
+    bench_gemm_operands<T> op(M, N, K);
+    std::vector<Acc> C((size_t)M * N);
+    std::vector<Acc> C_unblocked((size_t)M * N);
+    // fewer runs for large shapes
+    int iters = std::max(1, (int)(2e10 / gemm_ops(M, N, K)));
+    iters = std::min(iters, 20);
+
+    gemm_blocking blocked = gemm_default_blocking<T>();
+    blocked.pack_A = false;
+    const std::pair<const char*, gemm_blocking> variants[] = {
+        {"unblocked", gemm_unblocked()},
+        {"blocked", blocked},
+        {"blocked + packed A", gemm_default_blocking<T>()},
+    };
+    for (auto& variant : variants) {
+        Acc* c = variant.second.mc == gemm_unblocked().mc ? C_unblocked.data() : C.data();
+        double t = bench_median_seconds([&] {
+            gemm_amx(M, N, K, op.A.data(), K, op.B_packed.data(), c, N, variant.second);
+        }, 1, iters);
+        std::cout << name << ", " << size << ", " << variant.first << ", " << t * 1e3 << ", "
+                  << gemm_ops(M, N, K) / t * 1e-12 << "\n";
+        if (c == C.data() && std::memcmp(C.data(), C_unblocked.data(), C.size() * sizeof(Acc))) {
+            // Blocking does not change the order of accumulation along K
+            std::cout << "Failed: result differs from unblocked GEMM!\n";
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    int max_size = argc >= 2 ? std::atoi(argv[1]) : 8192;
+
+    std::cout << "=========================================\n";
+    std::cout << "  Cache-aware blocking of GEMM with Intel AMX\n";
+    std::cout << "=========================================\n";
+
+    if (!init_amx()) return 1;
+
+    gemm_cache_sizes cache = gemm_detect_cache_sizes();
+    std::cout << "Caches: L1 " << (cache.l1 >> 10) << " KB, L2 " << (cache.l2 >> 10) << " KB, L3 "
+              << (cache.l3 >> 10) << " KB\n";
+    gemm_blocking b8 = gemm_default_blocking<int8_t>();
+    gemm_blocking b16 = gemm_default_blocking<bfloat16>();
+    std::cout << "Panels (mc, nc, kc): int8 (" << b8.mc << ", " << b8.nc << ", " << b8.kc << "), bf16 ("
+              << b16.mc << ", " << b16.nc << ", " << b16.kc << ")\n";
+    std::cout << "dtype, size, variant, ms, T(FL)OPS\n";
+    for (int size = 256; size <= max_size; size *= 2) {
+        bench_dtype<int8_t, int32_t>("int8", size);
+        bench_dtype<bfloat16, float>("bf16", size);
+    }
+
+    amx_tile_release();
+    std::cout << "Done\n";
+    return 0;
+}
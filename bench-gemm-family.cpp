@@ -0,0 +1,86 @@
+/*
+    This benchmark instantiates members of the kernel family in gemm_traits.h
+    for each data type and several block shapes, and checks each one against gemm_ref:
+    - 32 x 32 blocks with 2x2 C tiles, as the large examples
+    - 16 x 64 blocks with 1x4 C tiles and 32 x 16 blocks with 2x1 C tiles
+    - half-depth K steps (32 bytes of A per tile row)
+    fp16 runs only with AMX-FP16 or under emulation (AMX_EMULATE=1).
+
+    Usage: bench-gemm-family [size]   (M = N = K = size, a multiple of 64; default 512)
+*/
+
+#include "gemm_traits.h"
+#include "bench.h"
+
+template <typename Kernel, typename In, typename TB, typename Acc>
+bool run_kernel(int size, const In* A, const TB* B, Acc* C_ref, Acc tolerance) {
+    int M = size, N = size, K = size;
+    std::vector<TB> B_packed((size_t)K * N);
+    std::vector<Acc> C((size_t)M * N);
+    Kernel::pack_B(B, K, N, N, B_packed.data());
+    int iters = std::min(50, std::max(1, (int)(1e10 / gemm_ops(M, N, K))));
+    bool ok = true;
+    double t = bench_median_seconds([&] {
+        ok = Kernel::compute(M, N, K, A, K, B_packed.data(), C.data(), N);
+    }, 1, iters);
+    std::cout << Kernel::traits::name << ", " << Kernel::tiles_m * 16 << ", " << Kernel::tiles_n * 16 << ", "
+              << Kernel::tilecfg.colsb[Kernel::a_tile(0)] / (int)sizeof(In) << ", " << t * 1e3 << ", "
+              << gemm_ops(M, N, K) / t * 1e-12 << ": ";
+    return ok && check_results(C.data(), C_ref, M, N, tolerance);
+}
+
+// Run the members of the family for In with BK_full = 64 bytes of In
+template <typename In, int BK_full>
+int run_dtype(int size, typename amx_traits<In>::acc_type tolerance) {
+    typedef typename amx_traits<In>::b_type TB;
+    typedef typename amx_traits<In>::acc_type Acc;
+    std::vector<In> A((size_t)size * size);
+    std::vector<TB> B((size_t)size * size);
+    std::vector<Acc> C_ref((size_t)size * size);
+    init_buffer(A.data(), A.size());
+    init_buffer(B.data(), B.size());
+    gemm_ref(A.data(), size, B.data(), size, C_ref.data(), size, size, size, size);
+
+    int failures = 0;
+    failures += !run_kernel<amx_gemm_kernel<In, Acc, 32, 32, BK_full>>(size, A.data(), B.data(), C_ref.data(), tolerance);
+    failures += !run_kernel<amx_gemm_kernel<In, Acc, 16, 64, BK_full>>(size, A.data(), B.data(), C_ref.data(), tolerance);
+    failures += !run_kernel<amx_gemm_kernel<In, Acc, 32, 16, BK_full>>(size, A.data(), B.data(), C_ref.data(), tolerance);
+    failures += !run_kernel<amx_gemm_kernel<In, Acc, 16, 16, BK_full>>(size, A.data(), B.data(), C_ref.data(), tolerance);
+    failures += !run_kernel<amx_gemm_kernel<In, Acc, 32, 32, BK_full / 2>>(size, A.data(), B.data(), C_ref.data(), tolerance);
+    return failures;
+}
+
+int main(int argc, char** argv) {
+    int size = argc >= 2 ? std::atoi(argv[1]) : 512;
+
+    std::cout << "=========================================\n";
+    std::cout << "  AMX GEMM kernel family\n";
+    std::cout << "=========================================\n";
+    std::cout << "Shape: [" << size << ", " << size << "] x [" << size << ", " << size << "]\n";
+
+    if (size <= 0 || size % 64) {
+        std::cout << "Size must be a positive multiple of 64\n";
+        return 1;
+    }
+    if (!init_amx()) return 1;
+
+    int failures = 0;
+    std::cout << "dtype, BM, BN, BK, ms, T(FL)OPS\n";
+    failures += run_dtype<int8_t, 64>(size, 0);
+    failures += run_dtype<uint8_t, 64>(size, 0);
+    failures += run_dtype<bfloat16, 32>(size, 1e-3f);
+    if (amx_fp16_supported()) {
+        failures += run_dtype<float16, 32>(size, 1e-3f);
+    } else {
+        std::cout << "fp16: AMX-FP16 is not supported on your hardware, skipped (run with AMX_EMULATE=1)\n";
+    }
+
+    std::cout << "Release tiles...\n";
+    amx_tile_release();
+    if (failures) {
+        std::cout << "Failed: " << failures << " kernels mismatch!\n";
+        return 1;
+    }
+    std::cout << "Done\n";
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+    This benchmark compares the weight-only int4 GEMM of gemm_int4.h with the bf16 GEMM on memory-bound shapes:
+    small M with large N & K, where both stream all of the weights for little compute.
+    The caches are flushed before each call, so that the weights come from memory.
+    For each M it reports, on 1 thread and on a pool of threads, the time of both (gemm_amx and gemm_amx_int4
+    on 1 thread; gemm_small_m, or gemm_amx_parallel above its M, and gemm_amx_int4 on the pool),
+    the speedup of int4, the GB/s of the weights int4 reads on the pool (counting its scales and zero points)
+    and the speedup of int4 on the pool over int4 on 1 thread.
+    For M > GEMM_INT4_SCALE_AFTER_MAX_M, the int4 result is checked to be exactly that of the bf16 GEMM on the
+    dequantized weights. Below, the scales are applied to exact sums of A x (q - zero_point), while bf16 rounds
+    each dequantized weight by up to 2^-9 of it, so it is checked to within 2^-8 sum |a| |w| of the bf16 GEMM
+    (a bf16 GEMM on |A| and |B|). The pool must match 1 thread exactly. The max relative error from the bf16 GEMM
+    on the original weights (the quantization error) is reported.
+
+    Usage: bench-gemm-int4 [N K [group_size [threads]]]   (default 4096 4096 128, all CPUs)
+*/
+
+#include "gemm_int4.h"
+#include "gemm_small_m.h"
+#include "bench.h"
+
+#include <thread>
+
+#define WARMUP 3
+#define ITERS 20
+
+bool bench_shape(amx_thread_pool& pool, std::vector<char>& flush, int M, int N, int K,
+                 const gemm_int4_weights& B_int4, const std::vector<bfloat16>& B_packed,
+                 const std::vector<bfloat16>& B_deq_packed, const std::vector<bfloat16>& B_abs_packed) {
+    std::vector<bfloat16> A((size_t)M * K), A_abs((size_t)M * K);
+    std::vector<float> C((size_t)M * N), C_pool((size_t)M * N), C_deq((size_t)M * N), C_bf16((size_t)M * N);
+    std::vector<float> C_abs((size_t)M * N);
+    init_bf16_buffer(A.data(), A.size());
+    for (size_t i = 0; i < A.size(); ++i) A_abs[i].value = A[i].value & 0x7FFF;
+    gemm_amx(M, N, K, A.data(), K, B_deq_packed.data(), C_deq.data(), N);
+    gemm_amx(M, N, K, A_abs.data(), K, B_abs_packed.data(), C_abs.data(), N);
+
+    // write the flush buffer on all threads, untimed
+    auto cold = [&](auto&& fn) {
+        return bench_cold_median_seconds(fn, [&] {
+            pool.run([&](int tid) {
+                size_t begin = flush.size() * tid / pool.size(), end = flush.size() * (tid + 1) / pool.size();
+                std::fill(flush.data() + begin, flush.data() + end, (char)tid);
+            });
+        }, WARMUP, ITERS);
+    };
+    double t_bf16 = cold([&] { gemm_amx(M, N, K, A.data(), K, B_packed.data(), C_bf16.data(), N); });
+    double t_int4 = cold([&] { gemm_amx_int4(M, A.data(), K, B_int4, C.data(), N); });
+    // the first call of gemm_small_m chooses its kernel by timing, outside of the timed runs
+    gemm_small_m(pool, M, N, K, A.data(), K, B_packed.data(), C_bf16.data(), N);
+    double t_bf16_pool = cold([&] { gemm_small_m(pool, M, N, K, A.data(), K, B_packed.data(), C_bf16.data(), N); });
+    double t_int4_pool = cold([&] { gemm_amx_int4(pool, M, A.data(), K, B_int4, C_pool.data(), N); });
+
+    bool exact = M > GEMM_INT4_SCALE_AFTER_MAX_M;
+    bool ok = true;
+    for (size_t i = 0; i < C.size() && ok; ++i) {
+        ok = exact ? C[i] == C_deq[i] : std::fabs(C[i] - C_deq[i]) <= std::ldexp(C_abs[i], -8);
+    }
+    double max_rel = 0, max_ref = 0;
+    for (size_t i = 0; i < C.size(); ++i) max_ref = std::max(max_ref, (double)std::fabs(C_bf16[i]));
+    for (size_t i = 0; i < C.size(); ++i) max_rel = std::max(max_rel, std::fabs(C[i] - C_bf16[i]) / max_ref);
+    bool same = !std::memcmp(C.data(), C_pool.data(), C.size() * sizeof(float));
+
+    double bytes_int4 = (double)B_int4.total_bytes();
+    std::cout << M << ", " << t_bf16 * 1e3 << ", " << t_int4 * 1e3 << ", " << t_bf16 / t_int4 << ", "
+              << t_bf16_pool * 1e3 << ", " << t_int4_pool * 1e3 << ", " << t_bf16_pool / t_int4_pool << ", "
+              << bytes_int4 / t_int4_pool * 1e-9 << ", " << t_int4 / t_int4_pool << ", " << max_rel
+              << (ok ? "" : exact ? ", MISMATCH with dequantized bf16" : ", too far from dequantized bf16")
+              << (same ? "" : ", MISMATCH of threads with 1 thread") << "\n";
+    return ok && same;
+}
+
+int main(int argc, char** argv) {
+    int N = 4096, K = 4096, group_size = 128;
+    int num_threads = (int)std::thread::hardware_concurrency();
+    if (argc >= 3) {
+        N = std::atoi(argv[1]);
+        K = std::atoi(argv[2]);
+    }
+    if (argc >= 4) group_size = std::atoi(argv[3]);
+    if (argc >= 5) num_threads = std::atoi(argv[4]);
+
+    std::cout << "=========================================\n";
+    std::cout << "  Weight-only int4 AMX GEMM\n";
+    std::cout << "=========================================\n";
+
+    if (N <= 0 || K <= 0 || num_threads <= 0) {
+        std::cout << "N, K and threads must be positive\n";
+        return 1;
+    }
+    if (!init_amx()) return 1;
+    amx_thread_pool pool(num_threads);
+    std::vector<char> flush(bench_flush_bytes(gemm_detect_cache_sizes().l3));
+
+    std::vector<bfloat16> B((size_t)K * N);
+    init_bf16_buffer(B.data(), B.size());
+    gemm_int4_weights B_int4;
+    if (!pack_B_int4(B.data(), K, N, N, group_size, B_int4)) return 1;
+    std::vector<bfloat16> B_packed(packed_B_size<bfloat16>(K, N));
+    pack_B(B.data(), K, N, N, B_packed.data());
+    std::vector<bfloat16> B_deq((size_t)K * N), B_deq_packed(B_packed.size());
+    gemm_int4_dequantize(B_int4, B_deq.data(), N);
+    pack_B(B_deq.data(), K, N, N, B_deq_packed.data());
+    std::vector<bfloat16> B_abs_packed(B_packed.size());
+    for (bfloat16& x : B_deq) x.value &= 0x7FFF;
+    pack_B(B_deq.data(), K, N, N, B_abs_packed.data());
+
+    std::cout << "B: [" << K << ", " << N << "], group size " << group_size << ", bf16 "
+              << B_packed.size() * sizeof(bfloat16) / 1048576.0 << " MB, int4 " << B_int4.total_bytes() / 1048576.0
+              << " MB, threads: " << num_threads << "\n";
+    std::cout << "M, bf16 ms, int4 ms, speedup, bf16 ms (threads), int4 ms (threads), speedup (threads), "
+                 "int4 GB/s (threads), int4 threads / 1 thread, max rel. error\n";
+    bool ok = true;
+    for (int M : {1, 4, 16, 32, 64, 128}) {
+        ok &= bench_shape(pool, flush, M, N, K, B_int4, B_packed, B_deq_packed, B_abs_packed);
+    }
+
+    amx_tile_release();
+    if (!ok) return 1;
+    std::cout << "Done\n";
+    return 0;
+}
@@ -0,0 +1,106 @@
+/*
+    This benchmark compares the kernels generated by gemm_jit.h with the intrinsic 2x2 kernel (gemm_block)
+    on a few shapes, with the default blocking (packed A) and without blocking (A read in place, lda = K),
+    and measures the cost of looking up a generated kernel:
+    - hit in the per-thread cache (the same key as the last lookup)
+    - hit in the global map (alternating between two keys)
+    - miss, i.e., generating a kernel
+    The generated kernels accumulate in the same order as gemm_block, so the results must match exactly.
+
+    Usage: bench-gemm-jit
+*/
+
+#include "gemm.h"
+#include "bench.h"
+
+template <typename T, typename Acc>
+bool bench_shape(const char* name, int M, int N, int K) {
+    bench_gemm_operands<T> op(M, N, K);
+    std::vector<Acc> C((size_t)M * N);
+    std::vector<Acc> C_jit((size_t)M * N);
+    int iters = std::min(50, std::max(1, (int)(1e10 / gemm_ops(M, N, K))));
+
+    bool ok = true;
+    const std::pair<const char*, gemm_blocking> blockings[] = {
+        {"blocked", gemm_default_blocking<T>()},
+        {"unblocked", gemm_unblocked()},
+    };
+    for (auto& blocking : blockings) {
+        double t[2];
+        for (int jit = 0; jit < 2; ++jit) {
+            gemm_blocking b = blocking.second;
+            b.kernel = jit ? GEMM_KERNEL_JIT : GEMM_KERNEL_2X2;
+            Acc* c = jit ? C_jit.data() : C.data();
+            t[jit] = bench_median_seconds([&] {
+                gemm_amx(M, N, K, op.A.data(), K, op.B_packed.data(), c, N, b);
+            }, 1, iters);
+        }
+        std::cout << name << ", " << M << ", " << N << ", " << K << ", " << blocking.first << ", "
+                  << t[0] * 1e3 << ", " << t[1] * 1e3 << ", " << t[0] / t[1] << "\n";
+        if (std::memcmp(C.data(), C_jit.data(), C.size() * sizeof(Acc))) {
+            std::cout << "Failed: result of JIT kernel differs from 2x2 kernel!\n";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+void bench_lookup() {
+    const int iters = 1000000;
+    gemm_jit_key key = {GEMM_JIT_DPBSSD, 32, 32, false, false, 64, 2048, 4096, 4096};
+    gemm_jit_key other = key;
+    other.accumulate = true;
+    volatile gemm_jit_kernel sink;
+
+    // miss: a new C stride for each kernel
+    const int misses = 100;
+    double t0 = bench_now_seconds();
+    for (int i = 0; i < misses; ++i) {
+        gemm_jit_key k = key;
+        k.c_stride = 8192 + 64 * i;
+        sink = gemm_jit_get(k);
+    }
+    double miss = (bench_now_seconds() - t0) / misses;
+
+    sink = gemm_jit_get(key);
+    t0 = bench_now_seconds();
+    for (int i = 0; i < iters; ++i) sink = gemm_jit_get(key);
+    double hit_thread = (bench_now_seconds() - t0) / iters;
+
+    t0 = bench_now_seconds();
+    for (int i = 0; i < iters; ++i) sink = gemm_jit_get(i % 2 ? key : other);
+    double hit_global = (bench_now_seconds() - t0) / iters;
+    (void)sink;
+
+    std::cout << "Lookup, per-thread hit: " << hit_thread * 1e9 << " ns, global hit: " << hit_global * 1e9
+              << " ns, miss (generate): " << miss * 1e6 << " us\n";
+    std::cout << "Kernels: " << gemm_jit_kernels.kernels.size() << ", code: " << gemm_jit_kernels.code_bytes
+              << " bytes of " << GEMM_JIT_CODE_CAPACITY << "\n";
+}
+
+int main() {
+
+    std::cout << "=========================================\n";
+    std::cout << "  JIT GEMM kernels with Intel AMX\n";
+    std::cout << "=========================================\n";
+
+    if (!init_amx()) return 1;
+    if (!gemm_jit_enabled()) {
+        std::cout << "JIT is disabled (GEMM_JIT=0 or AMX emulation), generated kernels fall back to gemm_block\n";
+    }
+
+    bool ok = true;
+    std::cout << "dtype, M, N, K, blocking, 2x2 ms, JIT ms, speedup\n";
+    ok &= bench_shape<int8_t, int32_t>("int8", 1024, 1024, 1024);
+    ok &= bench_shape<bfloat16, float>("bf16", 1024, 1024, 1024);
+    ok &= bench_shape<int8_t, int32_t>("int8", 100, 300, 1000);
+    ok &= bench_shape<bfloat16, float>("bf16", 100, 300, 1000);
+    ok &= bench_shape<int8_t, int32_t>("int8", 64, 4096, 256);
+    ok &= bench_shape<bfloat16, float>("bf16", 64, 4096, 256);
+    bench_lookup();
+
+    amx_tile_release();
+    if (!ok) return 1;
+    std::cout << "Done\n";
+    return 0;
+}
@@ -0,0 +1,63 @@
+/*
+    This benchmark compares the block kernels of the GEMM in gemm.h at increasing K depths:
+    - 2x2: 2x2 C tiles per 32x32 block, loads followed by dot products, as the large examples
+    - 2x2 pipelined: same tiles, loads interleaved with dot products and prefetch of the next K blocks
+    - 1x4: 1x4 C tiles per 16x64 block, A double-buffered in two tiles
+    on a square shape (M = N = 1024) and a skinny one (M = 16, N = 4096), where 2x2 blocks are half empty.
+    The kernels accumulate along K in the same order, so their results must match exactly.
+
+    Usage: bench-gemm-kernels [max_K]
+*/
+
+#include "gemm.h"
+#include "bench.h"
+
+template <typename T, typename Acc>
+void bench_shape(const char* name, int M, int N, int K) {
+    bench_gemm_operands<T> op(M, N, K);
+    std::vector<Acc> C((size_t)M * N);
+    std::vector<Acc> C_base((size_t)M * N);
+    int iters = std::max(1, (int)(1e10 / gemm_ops(M, N, K)));
+    iters = std::min(iters, 50);
+
+    const std::pair<const char*, gemm_kernel_type> kernels[] = {
+        {"2x2", GEMM_KERNEL_2X2},
+        {"2x2 pipelined", GEMM_KERNEL_2X2_PIPELINED},
+        {"1x4", GEMM_KERNEL_1X4},
+    };
+    for (auto& kernel : kernels) {
+        gemm_blocking blocking = gemm_default_blocking<T>();
+        blocking.kernel = kernel.second;
+        Acc* c = kernel.second == GEMM_KERNEL_2X2 ? C_base.data() : C.data();
+        double t = bench_median_seconds([&] {
+            gemm_amx(M, N, K, op.A.data(), K, op.B_packed.data(), c, N, blocking);
+        }, 1, iters);
+        std::cout << name << ", " << M << ", " << N << ", " << K << ", " << kernel.first << ", " << t * 1e3 << ", "
+                  << gemm_ops(M, N, K) / t * 1e-12 << "\n";
+        if (c == C.data() && std::memcmp(C.data(), C_base.data(), C.size() * sizeof(Acc))) {
+            std::cout << "Failed: result differs from 2x2 kernel!\n";
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    int max_K = argc >= 2 ? std::atoi(argv[1]) : 16384;
+
+    std::cout << "=========================================\n";
+    std::cout << "  GEMM block kernels with Intel AMX\n";
+    std::cout << "=========================================\n";
+
+    if (!init_amx()) return 1;
+
+    std::cout << "dtype, M, N, K, kernel, ms, T(FL)OPS\n";
+    for (int K = 256; K <= max_K; K *= 4) {
+        bench_shape<int8_t, int32_t>("int8", 1024, 1024, K);
+        bench_shape<bfloat16, float>("bf16", 1024, 1024, K);
+        bench_shape<int8_t, int32_t>("int8", 16, 4096, K);
+        bench_shape<bfloat16, float>("bf16", 16, 4096, K);
+    }
+
+    amx_tile_release();
+    std::cout << "Done\n";
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*
+    This benchmark compares the NUMA policies of gemm_numa.h for the multithreaded AMX GEMM:
+    none, pin, first-touch, replicate and interleave. For each policy, packed B is placed with
+    gemm_numa_weights and C is a fresh mapping, zeroed by gemm_numa_first_touch for the policies that place memory
+    (otherwise by the calling thread), and it reports the time of the GEMM, the speedup over none,
+    and on which nodes the pages of packed B and C are. Results are checked against single-threaded gemm_amx.
+    On a single-node machine, run with GEMM_NUMA_FAKE_NODES=2 to go through the multi-node paths
+    (times are then the same for all policies).
+
+    Usage: bench-gemm-numa [M N K [threads]]
+*/
+
+#include "gemm_numa.h"
+#include "bench.h"
+#include <map>
+
+#define WARMUP 3
+#define ITERS 10
+
+// Pages of [data, data + bytes) per node, as "node0 n0, node1 n1"
+std::string page_nodes(const void* data, size_t bytes) {
+    std::map<int, size_t> pages;
+    size_t page = sysconf(_SC_PAGESIZE);
+    for (size_t offset = 0; offset < bytes; offset += page) ++pages[gemm_numa_page_node((const char*)data + offset)];
+    std::ostringstream s;
+    for (auto& [node, count] : pages) {
+        if (s.tellp() > 0) s << ", ";
+        if (node < 0) s << "unknown " << count;
+        else s << "node" << node << " " << count;
+    }
+    return s.str();
+}
+
+template <typename T, typename Acc>
+bool bench_dtype(const char* name, int M, int N, int K, int num_threads) {
+    bench_gemm_operands<T> op(M, N, K);
+    std::vector<Acc> C_ref((size_t)M * N);
+    gemm_amx(M, N, K, op.A.data(), K, op.B_packed.data(), C_ref.data(), N);
+
+    std::cout << name << ": [" << M << ", " << K << "] x [" << K << ", " << N << "], " << num_threads << " threads\n";
+    std::cout << "policy, ms, T(FL)OPS, speedup, copies of B, pages of B, pages of C\n";
+    bool ok = true;
+    double base = 0;
+    for (gemm_numa_policy policy : {GEMM_NUMA_NONE, GEMM_NUMA_PIN, GEMM_NUMA_FIRST_TOUCH, GEMM_NUMA_REPLICATE,
+                                    GEMM_NUMA_INTERLEAVE}) {
+        gemm_numa_pool pool(num_threads, policy);
+        gemm_numa_weights<T> weights(pool, op.B.data(), K, N, N, M);
+        gemm_numa_buffer<Acc> C((size_t)M * N);
+        if (policy == GEMM_NUMA_NONE || policy == GEMM_NUMA_PIN) std::fill(C.data(), C.data() + C.size(), Acc());
+        else gemm_numa_first_touch<T, T>(pool, M, N, K, C.data(), N);
+
+        double t = bench_median_seconds([&] {
+            gemm_amx_parallel(pool, M, K, op.A.data(), K, weights, C.data(), N);
+        }, WARMUP, ITERS);
+        if (policy == GEMM_NUMA_NONE) base = t;
+        std::cout << gemm_numa_policy_name(policy) << ", " << t * 1e3 << ", " << gemm_ops(M, N, K) / t * 1e-12 << ", "
+                  << base / t << ", " << weights.copies() << ", " << page_nodes(weights.data(), weights.size() * sizeof(T))
+                  << ", " << page_nodes(C.data(), C.bytes()) << "\n";
+        // Same result as single-threaded gemm_amx (K split may change float rounding)
+        ok &= check_results(C.data(), C_ref.data(), M, N, (Acc)(std::is_same<T, int8_t>::value ? 0 : 1e-3));
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    int M = 2048, N = 2048, K = 2048;
+    int num_threads = std::thread::hardware_concurrency();
+    if (argc >= 4) {
+        M = std::atoi(argv[1]);
+        N = std::atoi(argv[2]);
+        K = std::atoi(argv[3]);
+    }
+    if (argc >= 5) num_threads = std::atoi(argv[4]);
+    num_threads = std::max(num_threads, 1);
+
+    std::cout << "=========================================\n";
+    std::cout << "  NUMA placement of AMX GEMM\n";
+    std::cout << "=========================================\n";
+
+    if (!init_amx()) return 1;
+
+    gemm_numa_topology topology = gemm_numa_detect();
+    std::cout << topology.nodes.size() << (topology.fake ? " fake" : "") << " NUMA nodes:";
+    for (const gemm_numa_node& node : topology.nodes) {
+        std::cout << " [memory node" << node.memory << ", " << node.cpus.size() << " CPUs]";
+    }
+    std::cout << "\n";
+
+    bool ok = bench_dtype<int8_t, int32_t>("int8 * int8 -> int32", M, N, K, num_threads);
+    ok &= bench_dtype<bfloat16, float>("bf16 * bf16 -> float", M, N, K, num_threads);
+
+    amx_tile_release();
+    if (!ok) return 1;
+    std::cout << "Done\n";
+    return 0;
+}
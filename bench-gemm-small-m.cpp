@@ -0,0 +1,228 @@
+/*
+    This benchmark measures the small-M GEMM of gemm_small_m.h on decode shapes (M = 1 to 16, large N & K),
+    where the GEMM streams all of packed B for little compute, against the memory bandwidth:
+    1. STREAM-like roofline with all threads: read (sum of an array) and triad (a = b + s * c),
+       on arrays larger than the L3 cache.
+    2. For each M, the GB/s of packed B read by gemm_amx (1 thread, 1x4 kernel), gemm_amx_parallel,
+       and gemm_small_m with the AMX kernel, the AVX-512 kernel and the kernel it chooses,
+       and the latter as a fraction of the STREAM read bandwidth.
+       The caches are flushed before each call, so that B comes from memory.
+    Results are checked against gemm_amx, exactly for int8 and AMX bf16; the AVX-512 bf16 kernel rounds
+    differently (vdpbf16ps), so it is checked to 1e-3 of the largest value.
+    All combinations of signed & unsigned int8 are checked first on odd shapes.
+
+    Usage: bench-gemm-small-m [N K [threads]]   (default 8192 8192, all CPUs)
+*/
+
+#include "gemm_small_m.h"
+#include "bench.h"
+
+#define WARMUP 2
+#define ITERS 7
+
+// Memory for the STREAM arrays and for flushing the caches
+size_t stream_bytes() {
+    return bench_flush_bytes(gemm_detect_cache_sizes().l3);
+}
+
+// Sum of floats with AVX-512, so that the loads are not limited by one add chain
+__attribute__((target("avx512f")))
+float stream_read(const float* a, size_t n) {
+    __m512 s[4] = {_mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps()};
+    for (size_t i = 0; i + 64 <= n; i += 64) {
+        for (int j = 0; j < 4; ++j) s[j] = _mm512_add_ps(s[j], _mm512_loadu_ps(a + i + 16 * j));
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(s[0], s[1]), _mm512_add_ps(s[2], s[3])));
+}
+
+struct stream_result {
+    double read;
+    double triad;
+};
+
+stream_result bench_stream(amx_thread_pool& pool, std::vector<float>& buf) {
+    int num_threads = pool.size();
+    size_t n = buf.size() / 3;
+    float* a = buf.data();
+    float* b = a + n;
+    float* c = b + n;
+    std::vector<float> sums(num_threads);
+    // each thread works on its part, first touched by the thread itself
+    auto part = [&](int tid, size_t& i0, size_t& i1) {
+        i0 = n * tid / num_threads / 64 * 64;
+        i1 = tid + 1 == num_threads ? n : n * (tid + 1) / num_threads / 64 * 64;
+    };
+    pool.run([&](int tid) {
+        size_t i0, i1;
+        part(tid, i0, i1);
+        for (size_t i = i0; i < i1; ++i) {
+            a[i] = 0;
+            b[i] = 1;
+            c[i] = 2;
+        }
+    });
+    stream_result r;
+    double t_read = bench_median_seconds([&] {
+        pool.run([&](int tid) {
+            size_t i0, i1;
+            part(tid, i0, i1);
+            sums[tid] = stream_read(b + i0, i1 - i0);
+        });
+    }, WARMUP, ITERS);
+    r.read = n * sizeof(float) / t_read * 1e-9;
+    double t_triad = bench_median_seconds([&] {
+        pool.run([&](int tid) {
+            size_t i0, i1;
+            part(tid, i0, i1);
+            for (size_t i = i0; i < i1; ++i) a[i] = b[i] + 3.0f * c[i];
+        });
+    }, WARMUP, ITERS);
+    r.triad = 3 * n * sizeof(float) / t_triad * 1e-9;
+    return r;
+}
+
+// Median time of fn with the caches flushed before each run by reading buf
+template <typename F>
+double bench_cold_seconds(F&& fn, amx_thread_pool& pool, const std::vector<float>& buf) {
+    volatile float sink = 0;
+    double t = bench_cold_median_seconds(fn, [&] {
+        pool.run([&](int tid) {
+            size_t n = buf.size() / pool.size() / 64 * 64;
+            float s = stream_read(buf.data() + n * tid, n);
+            if (tid == 0) sink = s;
+        });
+    }, WARMUP, ITERS);
+    (void)sink;
+    return t;
+}
+
+// Both kernels against gemm_amx on shapes with M, N & K tails
+template <typename T, typename TB, typename Acc>
+bool check_dtype(amx_thread_pool& pool, const char* name) {
+    bool ok = true;
+    for (int M : {1, 3, 7, 16}) {
+        for (auto nk : {std::make_pair(100, 100), std::make_pair(257, 333), std::make_pair(31, 64)}) {
+            int N = nk.first, K = nk.second;
+            std::vector<T> A((size_t)M * K);
+            std::vector<TB> B((size_t)K * N), B_packed(packed_B_size<TB>(K, N));
+            std::vector<Acc> C_ref((size_t)M * N), C((size_t)M * N);
+            init_buffer(A.data(), A.size());
+            init_buffer(B.data(), B.size());
+            pack_B(B.data(), K, N, N, B_packed.data());
+            gemm_amx(M, N, K, A.data(), K, B_packed.data(), C_ref.data(), N);
+            for (gemm_small_m_kernel kernel : {GEMM_SMALL_M_AMX, GEMM_SMALL_M_AVX512}) {
+                if (kernel == GEMM_SMALL_M_AVX512 && !gemm_small_m_has_avx512<T>()) continue;
+                gemm_small_m(pool, M, N, K, A.data(), K, B_packed.data(), C.data(), N, kernel);
+                Acc tolerance = 0;
+                if (kernel == GEMM_SMALL_M_AVX512 && std::is_same<T, bfloat16>::value) {
+                    for (Acc c : C_ref) tolerance = std::max(tolerance, (Acc)std::fabs(c));
+                    tolerance *= (Acc)1e-3;
+                }
+                std::cout << name << " [" << M << ", " << K << "] x [" << K << ", " << N << "] "
+                          << gemm_small_m_kernel_name(kernel) << ": ";
+                ok &= check_results(C.data(), C_ref.data(), M, N, tolerance);
+            }
+        }
+    }
+    return ok;
+}
+
+template <typename T, typename Acc>
+bool bench_dtype(amx_thread_pool& pool, const char* name, int N, int K, const std::vector<float>& flush,
+                 double stream_read_gbs) {
+    std::vector<T> B((size_t)K * N), B_packed(packed_B_size<T>(K, N));
+    init_buffer(B.data(), B.size());
+    pack_B(B.data(), K, N, N, B_packed.data());
+    double bytes = (double)B_packed.size() * sizeof(T);
+    bool ok = true;
+
+    std::cout << name << ": B [" << K << ", " << N << "], " << bytes / 1048576.0 << " MB packed\n";
+    std::cout << "M, gemm_amx GB/s, gemm_amx_parallel GB/s, small-M amx GB/s, small-M avx512 GB/s, "
+                 "small-M auto GB/s (kernel), auto / STREAM read\n";
+    for (int M : {1, 2, 4, 8, 12, 16}) {
+        std::vector<T> A((size_t)M * K);
+        std::vector<Acc> C_ref((size_t)M * N), C((size_t)M * N);
+        init_buffer(A.data(), A.size());
+        gemm_amx(M, N, K, A.data(), K, B_packed.data(), C_ref.data(), N);
+        Acc tolerance = 0;
+        for (Acc c : C_ref) tolerance = std::max(tolerance, (Acc)std::fabs(c));
+        tolerance *= (Acc)1e-3;
+
+        auto gbs = [&](double t) { return bytes / t * 1e-9; };
+        double t_single = bench_cold_seconds([&] {
+            gemm_amx(M, N, K, A.data(), K, B_packed.data(), C.data(), N);
+        }, pool, flush);
+        double t_parallel = bench_cold_seconds([&] {
+            gemm_amx_parallel(pool, M, N, K, A.data(), K, B_packed.data(), C.data(), N);
+        }, pool, flush);
+        double t_kernel[2] = {0, 0};
+        bool same = true;
+        for (int i = 0; i < 2; ++i) {
+            gemm_small_m_kernel kernel = i ? GEMM_SMALL_M_AVX512 : GEMM_SMALL_M_AMX;
+            if (kernel == GEMM_SMALL_M_AVX512 && !gemm_small_m_has_avx512<T>()) continue;
+            t_kernel[i] = bench_cold_seconds([&] {
+                gemm_small_m(pool, M, N, K, A.data(), K, B_packed.data(), C.data(), N, kernel);
+            }, pool, flush);
+            Acc tol = std::is_same<T, bfloat16>::value && i ? tolerance : 0;
+            for (size_t j = 0; j < C.size() && same; ++j) same = std::fabs(C[j] - C_ref[j]) <= tol;
+        }
+        // the first call chooses the kernel by timing, outside of the timed runs
+        gemm_small_m(pool, M, N, K, A.data(), K, B_packed.data(), C.data(), N);
+        double t_auto = bench_cold_seconds([&] {
+            gemm_small_m(pool, M, N, K, A.data(), K, B_packed.data(), C.data(), N);
+        }, pool, flush);
+        gemm_small_m_kernel chosen = gemm_small_m_forced();
+        if (!gemm_small_m_has_avx512<T>()) chosen = GEMM_SMALL_M_AMX;
+        else if (chosen == GEMM_SMALL_M_AUTO) gemm_small_m_lookup<T, T>(M, N, K, pool.size(), chosen);
+        for (size_t j = 0; j < C.size() && same; ++j) {
+            same = std::fabs(C[j] - C_ref[j]) <= (chosen == GEMM_SMALL_M_AVX512 ? tolerance : 0);
+        }
+        ok &= same;
+        std::cout << M << ", " << gbs(t_single) << ", " << gbs(t_parallel) << ", " << gbs(t_kernel[0]) << ", "
+                  << (t_kernel[1] > 0 ? gbs(t_kernel[1]) : 0) << ", " << gbs(t_auto) << " ("
+                  << gemm_small_m_kernel_name(chosen) << "), " << gbs(t_auto) / stream_read_gbs
+                  << (same ? "" : ", MISMATCH") << "\n";
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    int N = 8192, K = 8192;
+    int num_threads = std::thread::hardware_concurrency();
+    if (argc >= 3) {
+        N = std::atoi(argv[1]);
+        K = std::atoi(argv[2]);
+    }
+    if (argc >= 4) num_threads = std::atoi(argv[3]);
+    num_threads = std::max(num_threads, 1);
+
+    std::cout << "=========================================\n";
+    std::cout << "  Small-M GEMM vs. memory bandwidth\n";
+    std::cout << "=========================================\n";
+
+    if (N <= 0 || K <= 0) {
+        std::cout << "N and K must be positive\n";
+        return 1;
+    }
+    if (!init_amx()) return 1;
+    amx_thread_pool pool(num_threads);
+
+    bool ok = check_dtype<int8_t, int8_t, int32_t>(pool, "s8 * s8");
+    ok &= check_dtype<int8_t, uint8_t, int32_t>(pool, "s8 * u8");
+    ok &= check_dtype<uint8_t, int8_t, int32_t>(pool, "u8 * s8");
+    ok &= check_dtype<uint8_t, uint8_t, int32_t>(pool, "u8 * u8");
+    ok &= check_dtype<bfloat16, bfloat16, float>(pool, "bf16 * bf16");
+
+    std::vector<float> buf(stream_bytes() / sizeof(float));
+    stream_result s = bench_stream(pool, buf);
+    std::cout << "threads: " << num_threads << ", STREAM read: " << s.read << " GB/s, triad: " << s.triad
+              << " GB/s (" << buf.size() * sizeof(float) / 1048576 << " MB)\n";
+
+    ok &= bench_dtype<int8_t, int32_t>(pool, "int8 * int8 -> int32", N, K, buf, s.read);
+    ok &= bench_dtype<bfloat16, float>(pool, "bf16 * bf16 -> float", N, K, buf, s.read);
+
+    amx_tile_release();
+    if (!ok) return 1;
+    std::cout << "Done\n";
+    return 0;
+}
@@ -0,0 +1,134 @@
+/*
+    This benchmark compares gemm_amx_sparse (gemm_sparse.h) with the dense gemm_amx on block-sparse B
+    at densities from 100% down to 5%: B is random, then a random part of its blocks (64 x 32 for int8,
+    32 x 32 for bf16, the blocks of packed B) is set to zero.
+    For each density, it reports the time of both, the speedup of sparse, the time of pack_B and
+    pack_B_sparse, and the memory of packed B and of its non-zero blocks.
+    Results must be exactly those of gemm_amx (zero blocks add nothing), and are checked against
+    gemm_ref_fast, exactly for int8 and to 1e-4 relative (+ 1e-3 absolute) for bf16.
+    Odd shapes (M, N & K tails, empty column panels, all-zero B) are checked first.
+
+    Usage: bench-gemm-sparse [M N K]   (default 512 4096 4096)
+*/
+
+#include "gemm_sparse.h"
+#include "gemm_ref.h"
+#include "bench.h"
+
+#define WARMUP 1
+#define ITERS 5
+
+// Set each block of B [K, N] to zero with probability 1 - density
+template <typename T>
+void sparsify(T* B, int K, int N, double density, std::mt19937& rng) {
+    constexpr int block_k = gemm_block_k<T>();
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    for (int k0 = 0; k0 < K; k0 += block_k) {
+        for (int n0 = 0; n0 < N; n0 += GEMM_BLOCK_N) {
+            if (dist(rng) < density) continue;
+            for (int k = k0; k < std::min(K, k0 + block_k); ++k) {
+                std::fill(B + (size_t)k * N + n0, B + (size_t)k * N + std::min(N, n0 + GEMM_BLOCK_N), T());
+            }
+        }
+    }
+}
+
+// Sparse against dense gemm_amx (exact) and gemm_ref_fast
+template <typename T, typename Acc>
+bool check_result(const Acc* C, const Acc* C_dense, const T* A, const T* B, int M, int N, int K) {
+    std::vector<Acc> C_ref((size_t)M * N);
+    gemm_ref_fast(A, K, B, N, C_ref.data(), N, M, N, K);
+    bool bf16 = std::is_same<T, bfloat16>::value;
+    std::cout << "  vs. gemm_amx: ";
+    bool ok = gemm_check(C, N, C_dense, N, M, N).ok();
+    std::cout << "  vs. gemm_ref: ";
+    ok &= gemm_check(C, N, C_ref.data(), N, M, N, bf16 ? 1e-3 : 0, bf16 ? 1e-4 : 0).ok();
+    return ok;
+}
+
+template <typename T, typename Acc>
+bool check_dtype(const char* name) {
+    bool ok = true;
+    std::mt19937 rng(1);
+    struct shape { int M, N, K; double density; };
+    for (shape sh : {shape{1, 1, 1, 1.0}, shape{77, 100, 333, 0.5}, shape{33, 257, 130, 0.3},
+                     shape{64, 96, 1000, 0.05}, shape{40, 70, 90, 0.0}}) {
+        std::vector<T> A((size_t)sh.M * sh.K), B((size_t)sh.K * sh.N), B_packed(packed_B_size<T>(sh.K, sh.N));
+        init_buffer(A.data(), A.size());
+        init_buffer(B.data(), B.size());
+        sparsify(B.data(), sh.K, sh.N, sh.density, rng);
+        pack_B(B.data(), sh.K, sh.N, sh.N, B_packed.data());
+        gemm_sparse_B<T> B_sparse;
+        if (!pack_B_sparse(B.data(), sh.K, sh.N, sh.N, B_sparse)) return false;
+        std::vector<Acc> C((size_t)sh.M * sh.N, (Acc)-1), C_dense((size_t)sh.M * sh.N);
+        gemm_amx(sh.M, sh.N, sh.K, A.data(), sh.K, B_packed.data(), C_dense.data(), sh.N);
+        gemm_amx_sparse(sh.M, A.data(), sh.K, B_sparse, C.data(), sh.N);
+        std::cout << name << " [" << sh.M << ", " << sh.K << "] x [" << sh.K << ", " << sh.N << "], density "
+                  << B_sparse.density() << "\n";
+        ok &= check_result(C.data(), C_dense.data(), A.data(), B.data(), sh.M, sh.N, sh.K);
+    }
+    return ok;
+}
+
+template <typename T, typename Acc>
+bool bench_dtype(const char* name, int M, int N, int K) {
+    std::vector<T> A((size_t)M * K), B_full((size_t)K * N), B((size_t)K * N), B_packed(packed_B_size<T>(K, N));
+    std::vector<Acc> C((size_t)M * N), C_dense((size_t)M * N);
+    init_buffer(A.data(), A.size());
+    init_buffer(B_full.data(), B_full.size());
+    bool ok = true;
+
+    std::cout << name << ": [" << M << ", " << K << "] x [" << K << ", " << N << "]\n";
+    std::cout << "density, dense ms, sparse ms, speedup, pack_B ms, pack_B_sparse ms, packed MB, sparse MB\n";
+    for (double density : {1.0, 0.75, 0.5, 0.35, 0.2, 0.1, 0.05}) {
+        std::mt19937 rng(7);
+        B = B_full;
+        sparsify(B.data(), K, N, density, rng);
+        gemm_sparse_B<T> B_sparse;
+        double t_pack = bench_median_seconds([&] { pack_B(B.data(), K, N, N, B_packed.data()); }, WARMUP, ITERS);
+        double t_pack_sparse = bench_median_seconds([&] {
+            if (!pack_B_sparse(B.data(), K, N, N, B_sparse)) ok = false;
+        }, WARMUP, ITERS);
+        if (!ok) return false;
+        double t_dense = bench_median_seconds([&] {
+            gemm_amx(M, N, K, A.data(), K, B_packed.data(), C_dense.data(), N);
+        }, WARMUP, ITERS);
+        double t_sparse = bench_median_seconds([&] {
+            gemm_amx_sparse(M, A.data(), K, B_sparse, C.data(), N);
+        }, WARMUP, ITERS);
+        std::cout << B_sparse.density() << ", " << t_dense * 1e3 << ", " << t_sparse * 1e3 << ", "
+                  << t_dense / t_sparse << ", " << t_pack * 1e3 << ", " << t_pack_sparse * 1e3 << ", "
+                  << B_packed.size() * sizeof(T) / 1048576.0 << ", " << B_sparse.bytes() / 1048576.0 << "\n";
+        ok &= check_result(C.data(), C_dense.data(), A.data(), B.data(), M, N, K);
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    int M = 512, N = 4096, K = 4096;
+    if (argc >= 4) {
+        M = std::atoi(argv[1]);
+        N = std::atoi(argv[2]);
+        K = std::atoi(argv[3]);
+    }
+
+    std::cout << "=========================================\n";
+    std::cout << "  Block-sparse B GEMM with Intel AMX\n";
+    std::cout << "=========================================\n";
+
+    if (M <= 0 || N <= 0 || K <= 0) {
+        std::cout << "M, N and K must be positive\n";
+        return 1;
+    }
+    if (!init_amx()) return 1;
+
+    bool ok = check_dtype<int8_t, int32_t>("int8");
+    ok &= check_dtype<bfloat16, float>("bf16");
+    ok &= bench_dtype<int8_t, int32_t>("int8 * int8 -> int32", M, N, K);
+    ok &= bench_dtype<bfloat16, float>("bf16 * bf16 -> float", M, N, K);
+
+    amx_tile_release();
+    if (!ok) return 1;
+    std::cout << "Done\n";
+    return 0;
+}
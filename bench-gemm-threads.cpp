@@ -0,0 +1,68 @@
+/*
+    This benchmark measures the scaling of the multithreaded AMX GEMM in gemm_parallel.h.
+    For 1, 2, 4, ... threads up to the number of CPUs, it reports TOPS of int8 GEMM and
+    TFLOPS of bf16 GEMM, and the speedup over 1 thread.
+
+    Usage: bench-gemm-threads [M N K [max_threads]]
+*/
+
+#include "gemm_parallel.h"
+#include "bench.h"
+
+#define WARMUP 3
+#define ITERS 10
+
+template <typename T, typename Acc>
+void bench_dtype(const char* name, int M, int N, int K, int max_threads) {
+    bench_gemm_operands<T> op(M, N, K);
+    std::vector<Acc> C((size_t)M * N);
+    std::vector<Acc> C_ref((size_t)M * N);
+    gemm_amx(M, N, K, op.A.data(), K, op.B_packed.data(), C_ref.data(), N);
+
+    std::cout << name << ": [" << M << ", " << K << "] x [" << K << ", " << N << "]\n";
+    std::cout << "threads, partition (m x n x k), ms, T(FL)OPS, speedup\n";
+    double base = 0;
+    // 1, 2, 4, ... threads and max_threads
+    std::vector<int> thread_counts;
+    for (int t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+    for (int num_threads : thread_counts) {
+        amx_thread_pool pool(num_threads);
+        double t = bench_median_seconds([&] {
+            gemm_amx_parallel(pool, M, N, K, op.A.data(), K, op.B_packed.data(), C.data(), N);
+        }, WARMUP, ITERS);
+        if (num_threads == 1) base = t;
+        gemm_partition p = gemm_partition_grid((M + GEMM_BLOCK_M - 1) / GEMM_BLOCK_M,
+                                               (N + GEMM_BLOCK_N - 1) / GEMM_BLOCK_N,
+                                               (K + gemm_block_k<T>() - 1) / gemm_block_k<T>(), num_threads);
+        std::cout << num_threads << ", " << p.tm << " x " << p.tn << " x " << p.tk << ", "
+                  << t * 1e3 << ", " << gemm_ops(M, N, K) / t * 1e-12 << ", " << base / t << "\n";
+        // Same result as single-threaded gemm_amx (K split may change float rounding)
+        check_results(C.data(), C_ref.data(), M, N, (Acc)(std::is_same<T, int8_t>::value ? 0 : 1e-3));
+    }
+}
+
+int main(int argc, char** argv) {
+    int M = 2048, N = 2048, K = 2048;
+    int max_threads = std::thread::hardware_concurrency();
+    if (argc >= 4) {
+        M = std::atoi(argv[1]);
+        N = std::atoi(argv[2]);
+        K = std::atoi(argv[3]);
+    }
+    if (argc >= 5) max_threads = std::atoi(argv[4]);
+    max_threads = std::max(max_threads, 1);
+
+    std::cout << "=========================================\n";
+    std::cout << "  Multithreaded GEMM with Intel AMX\n";
+    std::cout << "=========================================\n";
+
+    if (!init_amx()) return 1;
+
+    bench_dtype<int8_t, int32_t>("int8 * int8 -> int32", M, N, K, max_threads);
+    bench_dtype<bfloat16, float>("bf16 * bf16 -> float", M, N, K, max_threads);
+
+    amx_tile_release();
+    std::cout << "Done\n";
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+    This benchmark compares the four layouts of C = op(A) x op(B) in gemm.h: NN, NT, TN and TT,
+    where T means the operand is given transposed (A as [K, M], B as [N, K]) and is packed block by block
+    with AVX-512 transposes (pack_A_panel_trans, pack_B_trans). For each layout it reports the time of
+    gemm_amx(trans_a, trans_b, ...), which packs B on every call, and its ratio to NN, next to an explicit
+    transpose of the whole operands followed by NN. Results are checked to be the same as NN.
+    It also times packing B from [K, N] (pack_B) and from [N, K] (pack_B_trans).
+
+    Usage: bench-gemm-trans [M N K]   (default 1024 1024 1024)
+*/
+
+#include "gemm.h"
+#include "bench.h"
+
+#define WARMUP 2
+#define ITERS 10
+
+// out [cols, rows] = in [rows, cols]^T
+template <typename T>
+void transpose(const T* in, int rows, int cols, T* out) {
+    for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < cols; ++j) out[(size_t)j * rows + i] = in[(size_t)i * cols + j];
+    }
+}
+
+template <typename T, typename Acc>
+bool bench_dtype(const char* name, int M, int N, int K) {
+    bench_gemm_operands<T> op(M, N, K, false);
+    const std::vector<T>& A = op.A;
+    const std::vector<T>& B = op.B;
+    std::vector<T> At((size_t)K * M), Bt((size_t)N * K);
+    std::vector<T> A_tmp(A.size()), B_tmp(B.size());
+    std::vector<Acc> C_ref((size_t)M * N), C((size_t)M * N);
+    transpose(A.data(), M, K, At.data());
+    transpose(B.data(), K, N, Bt.data());
+    gemm_amx(M, N, K, A.data(), K, B.data(), N, C_ref.data(), N);
+
+    std::cout << name << ": [" << M << ", " << K << "] x [" << K << ", " << N << "]\n";
+    std::cout << "layout, ms, T(FL)OPS, vs. NN, explicit transpose + NN (ms)\n";
+    bool ok = true;
+    double base = 0;
+    for (int layout = 0; layout < 4; ++layout) {
+        bool trans_a = layout & 2, trans_b = layout & 1;
+        const T* a = trans_a ? At.data() : A.data();
+        const T* b = trans_b ? Bt.data() : B.data();
+        int lda = trans_a ? M : K, ldb = trans_b ? K : N;
+        double t = bench_median_seconds([&] {
+            gemm_amx(trans_a, trans_b, M, N, K, a, lda, b, ldb, C.data(), N);
+        }, WARMUP, ITERS);
+        // Packing works on the same values in the same order: the result is exactly that of NN
+        ok &= check_results(C.data(), C_ref.data(), M, N, (Acc)0);
+        double t_explicit = bench_median_seconds([&] {
+            if (trans_a) transpose(At.data(), K, M, A_tmp.data());
+            if (trans_b) transpose(Bt.data(), N, K, B_tmp.data());
+            gemm_amx(M, N, K, trans_a ? A_tmp.data() : a, K, trans_b ? B_tmp.data() : b, N, C.data(), N);
+        }, WARMUP, ITERS);
+        if (layout == 0) base = t;
+        std::cout << (trans_a ? "T" : "N") << (trans_b ? "T" : "N") << ", " << t * 1e3 << ", "
+                  << gemm_ops(M, N, K) / t * 1e-12 << ", " << base / t << ", " << t_explicit * 1e3 << "\n";
+    }
+
+    std::vector<T> B_packed(packed_B_size<T>(K, N)), B_packed_trans(packed_B_size<T>(K, N));
+    double t_pack = bench_median_seconds([&] { pack_B(B.data(), K, N, N, B_packed.data()); }, WARMUP, ITERS);
+    double t_pack_trans = bench_median_seconds([&] {
+        pack_B_trans(Bt.data(), K, N, K, B_packed_trans.data());
+    }, WARMUP, ITERS);
+    bool same = !std::memcmp(B_packed.data(), B_packed_trans.data(), B_packed.size() * sizeof(T));
+    ok &= same;
+    std::cout << "pack_B: " << t_pack * 1e3 << " ms, pack_B_trans: " << t_pack_trans * 1e3 << " ms"
+              << (same ? "" : ", MISMATCH") << "\n";
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    int M = 1024, N = 1024, K = 1024;
+    if (argc >= 4) {
+        M = std::atoi(argv[1]);
+        N = std::atoi(argv[2]);
+        K = std::atoi(argv[3]);
+    }
+
+    std::cout << "=========================================\n";
+    std::cout << "  Transposed A & B in AMX GEMM\n";
+    std::cout << "=========================================\n";
+
+    if (M <= 0 || N <= 0 || K <= 0) {
+        std::cout << "M, N and K must be positive\n";
+        return 1;
+    }
+    if (!init_amx()) return 1;
+
+    bool ok = bench_dtype<int8_t, int32_t>("int8 * int8 -> int32", M, N, K);
+    ok &= bench_dtype<bfloat16, float>("bf16 * bf16 -> float", M, N, K);
+
+    amx_tile_release();
+    if (!ok) return 1;
+    std::cout << "Done\n";
+    return 0;
+}
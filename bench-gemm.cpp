@@ -0,0 +1,250 @@
+/*
+    Benchmark of the AMX GEMM (gemm.h & gemm_parallel.h) for regression tracking.
+
+    For each data type and shape, it runs warmup GEMMs, then times repeated runs and reports
+    min / median / p99 / mean latency and T(FL)OPS of the median, against the peak AMX throughput
+    of the threads at the CPU's maximum frequency (1024 int8 or 512 bf16 multiply-adds per cycle per core).
+    Results are checked against gemm_ref_fast (exact for 8-bit, tolerance 1e-3 for bf16),
+    which takes a few seconds per core for 4096^3.
+    The default shapes cover the single-tile path of the small examples (16 x 16 x 64),
+    small M with 1x4 blocks and the blocked path of the large examples.
+    Without AMX, the GEMMs run on the tile emulator (see amx_emu.h); the peak is still that of AMX.
+
+    Usage: bench-gemm [options]
+      --dtype int8|uint8|bf16|all   data type, uint8 is u8 x s8 (default all, may repeat)
+      --shape MxNxK                 shape (may repeat; default 16x16x64, 16x4096x4096, 1024x1024x1024)
+      --threads N                   threads (default 1)
+      --kernel NAME                 auto, 2x2, 2x2-pipelined, 1x4, jit, unblocked or tuned (default auto)
+                                    tuned uses the blocking of the shape in GEMM_TUNING_CACHE (see gemm-tune)
+      --warmup N                    untimed runs (default 3)
+      --iters N                     timed runs (default 20)
+      --format text|csv|json        output format (default text)
+      --ghz F                       CPU frequency for the peak (default from the system)
+      --no-check                    skip the check against gemm_ref_fast
+*/
+
+#include "gemm_parallel.h"
+#include "bench.h"
+#include "gemm_ref.h"
+#include <cstdio>
+#include <memory>
+
+struct bench_shape {
+    int M;
+    int N;
+    int K;
+};
+
+struct bench_options {
+    std::vector<std::string> dtypes;
+    std::vector<bench_shape> shapes;
+    int threads = 1;
+    std::string kernel = "auto";
+    int warmup = 3;
+    int iters = 20;
+    std::string format = "text";
+    double ghz = 0;
+    bool check = true;
+};
+
+struct bench_result {
+    std::string dtype;
+    bench_shape shape;
+    int threads;
+    std::string kernel;
+    bench_stats stats;
+    double tops;       // of the median
+    double peak_tops;  // 0 if the frequency is unknown
+    std::string check; // OK, FAILED or skipped
+    gemm_check_result errors;
+};
+
+void print_usage() {
+    std::cout << "Usage: bench-gemm [--dtype int8|uint8|bf16|all] [--shape MxNxK] [--threads N]\n"
+              << "                  [--kernel auto|2x2|2x2-pipelined|1x4|jit|unblocked|tuned] [--warmup N] [--iters N]\n"
+              << "                  [--format text|csv|json] [--ghz F] [--no-check]\n";
+}
+
+// Parse the command line into options. Returns false on errors.
+bool parse_options(int argc, char** argv, bench_options& o) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--no-check") {
+            o.check = false;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cout << "Missing value of " << arg << "\n";
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--dtype") {
+            if (value == "all") {
+                o.dtypes.insert(o.dtypes.end(), {"int8", "uint8", "bf16"});
+            } else if (value == "int8" || value == "uint8" || value == "bf16") {
+                o.dtypes.push_back(value);
+            } else {
+                std::cout << "Unknown dtype " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--shape") {
+            bench_shape s;
+            char x1, x2;
+            if (std::sscanf(value.c_str(), "%d%c%d%c%d", &s.M, &x1, &s.N, &x2, &s.K) != 5 || x1 != 'x' || x2 != 'x' ||
+                s.M <= 0 || s.N <= 0 || s.K <= 0) {
+                std::cout << "Invalid shape " << value << ", expected MxNxK\n";
+                return false;
+            }
+            o.shapes.push_back(s);
+        } else if (arg == "--threads") {
+            o.threads = std::atoi(value.c_str());
+        } else if (arg == "--kernel") {
+            o.kernel = value;
+        } else if (arg == "--warmup") {
+            o.warmup = std::atoi(value.c_str());
+        } else if (arg == "--iters") {
+            o.iters = std::atoi(value.c_str());
+        } else if (arg == "--format") {
+            o.format = value;
+        } else if (arg == "--ghz") {
+            o.ghz = std::atof(value.c_str());
+        } else {
+            std::cout << "Unknown option " << arg << "\n";
+            return false;
+        }
+    }
+    if (o.dtypes.empty()) o.dtypes = {"int8", "uint8", "bf16"};
+    if (o.shapes.empty()) o.shapes = {{16, 16, 64}, {16, 4096, 4096}, {1024, 1024, 1024}};
+    if (o.threads < 1 || o.iters < 1 || o.warmup < 0) {
+        std::cout << "threads and iters must be positive and warmup non-negative\n";
+        return false;
+    }
+    if (o.format != "text" && o.format != "csv" && o.format != "json") {
+        std::cout << "Unknown format " << o.format << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Blocking for a kernel name. Returns false if the name is unknown.
+template <typename T>
+bool blocking_of(const std::string& kernel, gemm_blocking& blocking) {
+    blocking = gemm_default_blocking<T>();
+    if (kernel == "auto") blocking.kernel = GEMM_KERNEL_AUTO;
+    else if (kernel == "2x2") blocking.kernel = GEMM_KERNEL_2X2;
+    else if (kernel == "2x2-pipelined") blocking.kernel = GEMM_KERNEL_2X2_PIPELINED;
+    else if (kernel == "1x4") blocking.kernel = GEMM_KERNEL_1X4;
+    else if (kernel == "jit") blocking.kernel = GEMM_KERNEL_JIT;
+    else if (kernel == "unblocked") blocking = gemm_unblocked();
+    else if (kernel == "tuned") blocking = gemm_tuned_blocking<T>();
+    else return false;
+    return true;
+}
+
+template <typename T, typename TB, typename Acc>
+bench_result run_case(const bench_options& o, const char* dtype, bench_shape s, const gemm_blocking& blocking,
+                      amx_thread_pool* pool) {
+    int M = s.M, N = s.N, K = s.K;
+    std::vector<T> A((size_t)M * K);
+    std::vector<TB> B((size_t)K * N);
+    std::vector<TB> B_packed(packed_B_size<TB>(K, N));
+    std::vector<Acc> C((size_t)M * N);
+    init_buffer(A.data(), A.size());
+    init_buffer(B.data(), B.size());
+    pack_B(B.data(), K, N, N, B_packed.data());
+
+    bench_result r;
+    r.dtype = dtype;
+    r.shape = s;
+    r.threads = o.threads;
+    r.kernel = o.kernel;
+    r.stats = bench_run([&] {
+        if (pool) gemm_amx_parallel(*pool, M, N, K, A.data(), K, B_packed.data(), C.data(), N, true, blocking);
+        else gemm_amx(M, N, K, A.data(), K, B_packed.data(), C.data(), N, blocking);
+    }, o.warmup, o.iters);
+    r.tops = gemm_ops(M, N, K) / r.stats.median * 1e-12;
+    r.peak_tops = o.threads * amx_peak_ops_per_cycle(sizeof(T)) * o.ghz * 1e-3;
+
+    r.check = "skipped";
+    if (o.check) {
+        std::vector<Acc> C_ref((size_t)M * N);
+        gemm_ref_fast(A.data(), K, B.data(), N, C_ref.data(), N, M, N, K);
+        double tolerance = std::is_same<Acc, float>::value ? 1e-3 : 0;
+        // mismatches are printed only with text output
+        r.errors = gemm_check(C.data(), N, C_ref.data(), N, M, N, tolerance, 0, o.format == "text" ? 10 : 0, false);
+        r.check = r.errors.ok() ? "OK" : "FAILED";
+    }
+    return r;
+}
+
+void print_result(const bench_options& o, const bench_result& r, bool first) {
+    double efficiency = r.peak_tops > 0 ? r.tops / r.peak_tops : 0;
+    const bench_stats& t = r.stats;
+    if (o.format == "csv") {
+        if (first) {
+            std::cout << "dtype,M,N,K,threads,kernel,iters,min_ms,median_ms,p99_ms,mean_ms,tops,peak_tops,efficiency,"
+                         "emulated,check,max_abs_err\n";
+        }
+        std::cout << r.dtype << "," << r.shape.M << "," << r.shape.N << "," << r.shape.K << "," << r.threads << ","
+                  << r.kernel << "," << t.iters << "," << t.min * 1e3 << "," << t.median * 1e3 << "," << t.p99 * 1e3
+                  << "," << t.mean * 1e3 << "," << r.tops << "," << r.peak_tops << "," << efficiency << ","
+                  << (amx_emulated ? 1 : 0) << "," << r.check << "," << r.errors.max_abs << "\n";
+    } else if (o.format == "json") {
+        std::cout << (first ? "[\n" : ",\n") << "  {\"dtype\": \"" << r.dtype << "\", \"M\": " << r.shape.M
+                  << ", \"N\": " << r.shape.N << ", \"K\": " << r.shape.K << ", \"threads\": " << r.threads
+                  << ", \"kernel\": \"" << r.kernel << "\", \"iters\": " << t.iters << ", \"min_ms\": " << t.min * 1e3
+                  << ", \"median_ms\": " << t.median * 1e3 << ", \"p99_ms\": " << t.p99 * 1e3
+                  << ", \"mean_ms\": " << t.mean * 1e3 << ", \"tops\": " << r.tops << ", \"peak_tops\": " << r.peak_tops
+                  << ", \"efficiency\": " << efficiency << ", \"emulated\": " << (amx_emulated ? "true" : "false")
+                  << ", \"check\": \"" << r.check << "\", \"max_abs_err\": " << r.errors.max_abs << "}";
+    } else {
+        std::cout << r.dtype << " [" << r.shape.M << ", " << r.shape.K << "] x [" << r.shape.K << ", " << r.shape.N
+                  << "], " << r.threads << (r.threads == 1 ? " thread, " : " threads, ") << r.kernel << ": min " << t.min * 1e3 << " ms, median "
+                  << t.median * 1e3 << " ms, p99 " << t.p99 * 1e3 << " ms, " << r.tops << " T(FL)OPS";
+        if (r.peak_tops > 0) std::cout << " (" << efficiency * 100 << "% of " << r.peak_tops << ")";
+        std::cout << ", check " << r.check;
+        if (r.check != "skipped") std::cout << " (max abs err " << r.errors.max_abs << ")";
+        std::cout << "\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    bench_options o;
+    if (!parse_options(argc, argv, o)) {
+        print_usage();
+        return 1;
+    }
+    if (o.ghz <= 0) o.ghz = bench_cpu_ghz();
+
+    // Messages go to stderr with CSV & JSON, so that stdout is only the results
+    std::streambuf* out = std::cout.rdbuf();
+    if (o.format != "text") std::cout.rdbuf(std::cerr.rdbuf());
+    if (!init_amx()) return 1;
+    std::cout.rdbuf(out);
+
+    gemm_blocking blocking_int8, blocking_bf16;
+    if (!blocking_of<int8_t>(o.kernel, blocking_int8) || !blocking_of<bfloat16>(o.kernel, blocking_bf16)) {
+        std::cout << "Unknown kernel " << o.kernel << "\n";
+        print_usage();
+        return 1;
+    }
+    std::unique_ptr<amx_thread_pool> pool;
+    if (o.threads > 1) pool.reset(new amx_thread_pool(o.threads));
+
+    bool first = true;
+    int failures = 0;
+    for (const std::string& dtype : o.dtypes) {
+        for (const bench_shape& s : o.shapes) {
+            bench_result r;
+            if (dtype == "int8") r = run_case<int8_t, int8_t, int32_t>(o, "int8", s, blocking_int8, pool.get());
+            else if (dtype == "uint8") r = run_case<uint8_t, int8_t, int32_t>(o, "uint8", s, blocking_int8, pool.get());
+            else r = run_case<bfloat16, bfloat16, float>(o, "bf16", s, blocking_bf16, pool.get());
+            print_result(o, r, first);
+            first = false;
+            failures += r.check == "FAILED";
+        }
+    }
+    if (o.format == "json") std::cout << "\n]\n";
+    amx_tile_release();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,60 @@
+/*
+    This benchmark compares packing B to blocked & VNNI layout in gemm.h:
+    - two-step: copy each block to a buffer, then pack it to VNNI layout (as the large examples)
+    - fused scalar: one pass in scalar code
+    - fused avx512: one pass with AVX-512 permutes
+    It reports GB/s counting bytes read from B and written to packed B, and checks that all outputs are the same.
+
+    Usage: bench-pack [K N]
+*/
+
+#include "gemm.h"
+#include "bench.h"
+
+#define WARMUP 2
+#define ITERS 10
+
+template <typename T>
+bool bench_dtype(const char* name, int K, int N) {
+    std::vector<T> B((size_t)K * N);
+    size_t packed_size = packed_B_size<T>(K, N);
+    std::vector<T> B_ref(packed_size);
+    std::vector<T> B_packed(packed_size);
+    if constexpr (std::is_same<T, int8_t>::value) init_int8_buffer(B.data(), B.size());
+    else init_bf16_buffer(B.data(), B.size());
+    double bytes = ((double)K * N + packed_size) * sizeof(T);
+    bool ok = true;
+
+    auto run = [&](const char* method, void (*pack)(const T*, int, int, int, T*)) {
+        std::fill(B_packed.begin(), B_packed.end(), T(1));
+        double t = bench_median_seconds([&] { pack(B.data(), K, N, N, B_packed.data()); }, WARMUP, ITERS);
+        bool same = !std::memcmp(B_packed.data(), B_ref.data(), packed_size * sizeof(T));
+        ok = ok && same;
+        std::cout << name << ", " << K << ", " << N << ", " << method << ", " << t * 1e3 << ", "
+                  << bytes / t * 1e-9 << (same ? "" : ", MISMATCH") << "\n";
+    };
+    pack_B_two_step(B.data(), K, N, N, B_ref.data());
+    run("two-step", pack_B_two_step<T>);
+    run("fused scalar", pack_B_fused_scalar<T>);
+    if (pack_B_has_avx512<T>()) {
+        run("fused avx512", [](const T* in, int K, int N, int ldb, T* out) { pack_B_fused_avx512(in, K, N, ldb, out); });
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::pair<int, int>> shapes = {{1024, 1024}, {4096, 4096}, {4096, 11008}, {1000, 1000}};
+    if (argc >= 3) shapes = {{std::atoi(argv[1]), std::atoi(argv[2])}};
+
+    std::cout << "=========================================\n";
+    std::cout << "  Packing B to blocked & VNNI layout\n";
+    std::cout << "=========================================\n";
+    std::cout << "dtype, K, N, method, ms, GB/s\n";
+    bool ok = true;
+    for (auto& shape : shapes) {
+        ok = bench_dtype<int8_t>("int8", shape.first, shape.second) && ok;
+        ok = bench_dtype<bfloat16>("bf16", shape.first, shape.second) && ok;
+    }
+    std::cout << (ok ? "OK\n" : "Failed: packed B mismatch!\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+/*
+    Helpers to time GEMMs in the benchmarks.
+*/
+
+#pragma once
+
+#include "gemm.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <vector>
+
+inline double bench_now_seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Statistics of the times of repeated runs, in seconds
+struct bench_stats {
+    double min;
+    double median;
+    double p99;
+    double mean;
+    int iters;
+};
+
+// Run fn warmup times, then iters times and return the statistics of the timed runs
+template <typename F>
+bench_stats bench_run(F&& fn, int warmup, int iters) {
+    iters = std::max(iters, 1);
+    for (int i = 0; i < warmup; ++i) fn();
+    std::vector<double> times(iters);
+    for (int i = 0; i < iters; ++i) {
+        double start = bench_now_seconds();
+        fn();
+        times[i] = bench_now_seconds() - start;
+    }
+    std::sort(times.begin(), times.end());
+    bench_stats s;
+    s.min = times[0];
+    s.median = times[iters / 2];
+    // nearest rank: the smallest time that at least 99% of the runs do not exceed
+    s.p99 = times[std::max(0, (int)std::ceil(0.99 * iters) - 1)];
+    s.mean = 0;
+    for (double t : times) s.mean += t;
+    s.mean /= iters;
+    s.iters = iters;
+    return s;
+}
+
+// Run fn warmup times, then iters times and return the median time of one run in seconds
+template <typename F>
+double bench_median_seconds(F&& fn, int warmup, int iters) {
+    return bench_run(fn, warmup, iters).median;
+}
+
+// Run fn warmup times, then iters times with flush() before each run, untimed (e.g., to evict the operands
+// from the caches), and return the median time of one run in seconds
+template <typename F, typename Flush>
+double bench_cold_median_seconds(F&& fn, Flush&& flush, int warmup, int iters) {
+    std::vector<double> times;
+    for (int i = 0; i < warmup + std::max(iters, 1); ++i) {
+        flush();
+        double start = bench_now_seconds();
+        fn();
+        if (i >= warmup) times.push_back(bench_now_seconds() - start);
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+// Bytes to touch to flush the caches, given the size of L3: 2 x L3, at least 256 MB and at most 1 GB
+inline size_t bench_flush_bytes(size_t l3) {
+    return std::min<size_t>(std::max<size_t>(2 * l3, 256 << 20), 1 << 30);
+}
+
+// Maximum CPU frequency in GHz, from cpufreq or else /proc/cpuinfo. Returns 0 if unknown.
+inline double bench_cpu_ghz() {
+    std::ifstream max_freq("/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq");
+    double khz = 0;
+    if (max_freq >> khz && khz > 0) return khz * 1e-6;
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.compare(0, 7, "cpu MHz") == 0) {
+            size_t colon = line.find(':');
+            if (colon != std::string::npos) return std::atof(line.c_str() + colon + 1) * 1e-3;
+        }
+    }
+    return 0;
+}
+
+// Peak AMX operations per cycle of a core: a 16 x 16 x 64 (int8) or 16 x 16 x 32 (bf16) tile dot product
+// every 16 cycles, i.e., 1024 int8 or 512 bf16 multiply-adds per cycle
+inline double amx_peak_ops_per_cycle(int elem_size) {
+    return elem_size == 1 ? 2048 : 1024;
+}
+
+// Operations of a GEMM, counting a multiply-add as 2
+inline double gemm_ops(int M, int N, int K) {
+    return 2.0 * M * N * K;
+}
+
+// Operands of a GEMM benchmark: A [M, K] and B [K, N] with random values, and B packed by pack_B
+// (B_packed is left empty if pack is false)
+template <typename T>
+struct bench_gemm_operands {
+    std::vector<T> A;
+    std::vector<T> B;
+    std::vector<T> B_packed;
+
+    bench_gemm_operands(int M, int N, int K, bool pack = true)
+        : A((size_t)M * K), B((size_t)K * N), B_packed(pack ? packed_B_size<T>(K, N) : 0) {
+        init_buffer(A.data(), A.size());
+        init_buffer(B.data(), B.size());
+        if (pack) pack_B(B.data(), K, N, N, B_packed.data());
+    }
+};
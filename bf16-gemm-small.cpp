@@ -36,20 +36,20 @@ void init_tile_config() {
     cfg_data.colsb[2] = N * 2 * sizeof(bfloat16);
     cfg_data.rows[2] = K / 2;
 
-    _tile_loadconfig(&cfg_data);
+    amx_tile_loadconfig(&cfg_data);
 }
 
 void gemm_amx(bfloat16* A, bfloat16* B, float* C) {
     // load A to tile 1
-    _tile_loadd(1, A, /* stride */ K * sizeof(bfloat16));
+    amx_tile_loadd(1, A, /* stride */ K * sizeof(bfloat16));
     // load B to tile 2
-    _tile_loadd(2, B, /* stride */ N * 2 * sizeof(bfloat16));
+    amx_tile_loadd(2, B, /* stride */ N * 2 * sizeof(bfloat16));
     // clear tile 0 to hold results
-    _tile_zero(0);
+    amx_tile_zero(0);
     // compute GEMM (dot product)
-    _tile_dpbf16ps(0, 1, 2);
+    amx_tile_dpbf16ps(0, 1, 2);
     // store results to C buffer
-    _tile_stored(0, C, /* stride */ N * sizeof(float));
+    amx_tile_stored(0, C, /* stride */ N * sizeof(float));
 }
 
 int main() {
@@ -85,7 +85,7 @@ int main() {
     std::cout << "Check results...\n";
     check_results(C, C_ref, M, N, 1e-5f);
     std::cout << "Release tiles...\n";
-    _tile_release();
+    amx_tile_release();
     std::cout << "Done\n";
     return 0;
 }
\ No newline at end of file
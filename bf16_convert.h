@@ -0,0 +1,170 @@
+/*
+    Bulk conversions between fp32 and bf16, for activations that come as fp32.
+
+    bfloat16(float) in common.h converts one element at a time. The kernels here convert arrays
+    with SIMD, the best one for the CPU chosen once:
+    - avx512bf16: _mm512_cvtne2ps_pbh, 32 floats per instruction
+    - avx512: the rounding of bfloat16(float) in integer AVX-512, 16 floats at a time
+    - avx2: the same in AVX2, 8 floats at a time
+    - scalar: bfloat16(float)
+    All round to nearest even. The emulated kernels give the same bits as bfloat16(float) for all inputs;
+    _mm512_cvtne2ps_pbh differs from them only for denormal inputs, which it flushes to zero,
+    and NaNs, which it keeps NaN (bfloat16(float) may round a NaN to infinity).
+    bf16 to fp32 is exact: the 16 bits are put in the upper half of the float.
+    BF16_CONVERT=avx512bf16|avx512|avx2|scalar forces a kernel (if the CPU has it).
+*/
+
+#pragma once
+
+#include "common.h"
+#include <algorithm>
+#include <string>
+
+typedef void (*bf16_from_fp32_fn)(const float* in, bfloat16* out, size_t n);
+typedef void (*bf16_to_fp32_fn)(const bfloat16* in, float* out, size_t n);
+
+inline void bf16_from_fp32_scalar(const float* in, bfloat16* out, size_t n) {
+    for (size_t i = 0; i < n; ++i) out[i] = bfloat16(in[i]);
+}
+
+inline void bf16_to_fp32_scalar(const bfloat16* in, float* out, size_t n) {
+    for (size_t i = 0; i < n; ++i) out[i] = (float)in[i];
+}
+
+// 32 floats to 32 bf16 with one instruction; tails are loaded with masks
+__attribute__((target("avx512f,avx512bw,avx512bf16")))
+inline void bf16_from_fp32_avx512bf16(const float* in, bfloat16* out, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512bh v = _mm512_cvtne2ps_pbh(_mm512_loadu_ps(in + i + 16), _mm512_loadu_ps(in + i));
+        _mm512_storeu_si512(out + i, (__m512i)v);
+    }
+    if (i < n) {
+        int rest = (int)(n - i);
+        __mmask16 lo = (__mmask16)((1u << std::min(rest, 16)) - 1);
+        __mmask16 hi = (__mmask16)(rest > 16 ? (1u << (rest - 16)) - 1 : 0);
+        __m512bh v = _mm512_cvtne2ps_pbh(_mm512_maskz_loadu_ps(hi, in + i + 16), _mm512_maskz_loadu_ps(lo, in + i));
+        _mm512_mask_storeu_epi16(out + i, (__mmask32)(rest == 32 ? ~0u : (1u << rest) - 1), (__m512i)v);
+    }
+}
+
+// Rounding of bfloat16(float) on 16 floats: add 0x7FFF + the lowest bit kept.
+// The bf16 values are the upper 16 bits of the dwords.
+__attribute__((target("avx512f")))
+inline __m512i bf16_round_bits_avx512(__m512 x) {
+    __m512i bits = _mm512_castps_si512(x);
+    __m512i odd = _mm512_and_si512(_mm512_srli_epi32(bits, 16), _mm512_set1_epi32(1));
+    return _mm512_add_epi32(bits, _mm512_add_epi32(odd, _mm512_set1_epi32(0x7FFF)));
+}
+
+// 16 floats rounded to 16 bf16
+__attribute__((target("avx512f")))
+inline __m256i bf16_round_avx512(__m512 x) {
+    return _mm512_cvtepi32_epi16(_mm512_srli_epi32(bf16_round_bits_avx512(x), 16));
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+inline void bf16_from_fp32_avx512(const float* in, bfloat16* out, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm256_storeu_si256((__m256i*)(out + i), bf16_round_avx512(_mm512_loadu_ps(in + i)));
+    }
+    if (i < n) {
+        __mmask16 k = (__mmask16)((1u << (n - i)) - 1);
+        _mm256_mask_storeu_epi16(out + i, k, bf16_round_avx512(_mm512_maskz_loadu_ps(k, in + i)));
+    }
+}
+
+// The same rounding on 8 floats, to the low 16 bits of each dword
+__attribute__((target("avx2")))
+inline __m256i bf16_round_avx2(__m256 x) {
+    __m256i bits = _mm256_castps_si256(x);
+    __m256i odd = _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+    bits = _mm256_add_epi32(bits, _mm256_add_epi32(odd, _mm256_set1_epi32(0x7FFF)));
+    return _mm256_srli_epi32(bits, 16);
+}
+
+__attribute__((target("avx2")))
+inline void bf16_from_fp32_avx2(const float* in, bfloat16* out, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        // dwords are < 65536, so packus keeps them; it packs within 128-bit lanes, hence the permute
+        __m256i lo = bf16_round_avx2(_mm256_loadu_ps(in + i));
+        __m256i hi = bf16_round_avx2(_mm256_loadu_ps(in + i + 8));
+        __m256i v = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8);
+        _mm256_storeu_si256((__m256i*)(out + i), v);
+    }
+    bf16_from_fp32_scalar(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+inline void bf16_to_fp32_avx512(const bfloat16* in, float* out, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i v = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(in + i)));
+        _mm512_storeu_si512(out + i, _mm512_slli_epi32(v, 16));
+    }
+    if (i < n) {
+        __mmask16 k = (__mmask16)((1u << (n - i)) - 1);
+        __m512i v = _mm512_cvtepu16_epi32(_mm256_maskz_loadu_epi16(k, in + i));
+        _mm512_mask_storeu_epi32(out + i, k, _mm512_slli_epi32(v, 16));
+    }
+}
+
+__attribute__((target("avx2")))
+inline void bf16_to_fp32_avx2(const bfloat16* in, float* out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(in + i)));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_slli_epi32(v, 16));
+    }
+    bf16_to_fp32_scalar(in + i, out + i, n - i);
+}
+
+// A kernel of each direction. Conversions to fp32 are the same for avx512bf16 and avx512.
+struct bf16_convert_kernels {
+    const char* name;
+    bf16_from_fp32_fn from_fp32;
+    bf16_to_fp32_fn to_fp32;
+};
+
+// Kernels by name, or null if the CPU does not have them
+inline const bf16_convert_kernels* bf16_convert_find(const std::string& name) {
+    static const bf16_convert_kernels kernels[] = {
+        {"avx512bf16", bf16_from_fp32_avx512bf16, bf16_to_fp32_avx512},
+        {"avx512", bf16_from_fp32_avx512, bf16_to_fp32_avx512},
+        {"avx2", bf16_from_fp32_avx2, bf16_to_fp32_avx2},
+        {"scalar", bf16_from_fp32_scalar, bf16_to_fp32_scalar},
+    };
+    __builtin_cpu_init();
+    bool avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+                  __builtin_cpu_supports("avx512vl");
+    bool supported[] = {avx512 && __builtin_cpu_supports("avx512bf16"), avx512, (bool)__builtin_cpu_supports("avx2"),
+                        true};
+    for (int i = 0; i < 4; ++i) {
+        if (name == kernels[i].name) return supported[i] ? &kernels[i] : nullptr;
+    }
+    return nullptr;
+}
+
+// The kernels of BF16_CONVERT, otherwise the best the CPU has
+inline const bf16_convert_kernels& bf16_convert_active() {
+    static const bf16_convert_kernels* active = [] {
+        const char* env = std::getenv("BF16_CONVERT");
+        if (env && *env) {
+            if (const bf16_convert_kernels* k = bf16_convert_find(env)) return k;
+            std::cout << "Unknown or unsupported BF16_CONVERT=" << env << ", using the best available\n";
+        }
+        for (const char* name : {"avx512bf16", "avx512", "avx2"}) {
+            if (const bf16_convert_kernels* k = bf16_convert_find(name)) return k;
+        }
+        return bf16_convert_find("scalar");
+    }();
+    return *active;
+}
+
+// out[i] = bfloat16(in[i]) for n elements
+inline void bf16_from_fp32(const float* in, bfloat16* out, size_t n) { bf16_convert_active().from_fp32(in, out, n); }
+
+// out[i] = (float)in[i] for n elements
+inline void bf16_to_fp32(const bfloat16* in, float* out, size_t n) { bf16_convert_active().to_fp32(in, out, n); }
@@ -1,11 +1,16 @@
+#pragma once
+
 #include <iostream>
 #include <immintrin.h>
+#include <cpuid.h>
 #include <unistd.h>
 #include <sys/syscall.h>
 #include <cstdint>
 #include <limits>
 #include <random>
 #include <cstring>
+#include <cstdlib>
+#include "amx_emu.h"
 
 #define XFEATURE_XTILECFG 17
 #define XFEATURE_XTILEDATA 18
@@ -15,25 +20,51 @@
 #define ARCH_GET_XCOMP_PERM 0x1022
 #define ARCH_REQ_XCOMP_PERM 0x1023
 
+// Enable AMX instructions, or fall back to software emulation (see amx_emu.h) if they are not available.
+// Emulation can be forced by setting environment variable AMX_EMULATE to 1, scalar, avx2 or avx512.
 bool init_amx() {
+  const char* emulate = std::getenv("AMX_EMULATE");
+  if (emulate && *emulate && std::strcmp(emulate, "0")) {
+      if (!amx_emu_enable(emulate)) {
+          std::cout << "Unknown or unsupported AMX_EMULATE=" << emulate << "\n";
+          return false;
+      }
+      std::cout << "AMX is emulated in software (" << amx_emu_active.name << ") as requested by AMX_EMULATE\n";
+      return true;
+  }
   unsigned long bitmask = 0;
   // Request permission to use AMX instructions
   long rc = syscall(SYS_arch_prctl, ARCH_REQ_XCOMP_PERM, XFEATURE_XTILEDATA);
   if (rc) {
       std::cout << "Failed to enable AMX\n";
-      return false;
-  }
-  // Check if the system supports AMX instructions
-  rc = syscall(SYS_arch_prctl, ARCH_GET_XCOMP_PERM, &bitmask);
-  if (rc) {
-      std::cout << "AMX is not supported on your hardware\n";
-      return false;
-  }
-  if (bitmask & XFEATURE_MASK_XTILE) {
-      std::cout << "AMX is supported on your hardware and it's enabled\n";
-      return true;
+  } else {
+      // Check if the system supports AMX instructions
+      rc = syscall(SYS_arch_prctl, ARCH_GET_XCOMP_PERM, &bitmask);
+      if (rc) {
+          std::cout << "AMX is not supported on your hardware\n";
+      } else if (bitmask & XFEATURE_MASK_XTILE) {
+          std::cout << "AMX is supported on your hardware and it's enabled\n";
+          return true;
+      }
   }
-  return false;
+  amx_emu_enable();
+  std::cout << "Falling back to AMX emulation in software (" << amx_emu_active.name << ")\n";
+  return true;
+}
+
+// Request AMX permission without printing, e.g., from worker threads after init_amx() succeeded.
+// The permission is per process, so this is cheap to call more than once.
+bool request_amx_permission() {
+  if (amx_emulated) return true;
+  return syscall(SYS_arch_prctl, ARCH_REQ_XCOMP_PERM, XFEATURE_XTILEDATA) == 0;
+}
+
+// Whether _tile_dpfp16ps can be used: AMX-FP16 is CPUID.(EAX=7, ECX=1):EAX[21], and the emulation has it.
+bool amx_fp16_supported() {
+  if (amx_emulated) return true;
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid_count(7, 1, &eax, &ebx, &ecx, &edx)) return false;
+  return eax & (1u << 21);
 }
 
 // Define tile config data structure
@@ -55,6 +86,15 @@ void init_int8_buffer(int8_t* buffer, int length) {
     }
 }
 
+void init_uint8_buffer(uint8_t* buffer, int length) {
+    std::random_device rd; // obtain a random number from hardware
+    std::mt19937 gen(rd()); // seed the generator
+    std::uniform_int_distribution<> distr(0, 255); // define the range
+    for (int i = 0; i < length; ++i) {
+        buffer[i] = distr(gen);
+    }
+}
+
 struct bfloat16 {
     uint16_t value;
 
@@ -89,6 +129,79 @@ void init_bf16_buffer(bfloat16* buffer, int length) {
     }
 }
 
+// IEEE half precision, for AMX-FP16 (_tile_dpfp16ps)
+struct float16 {
+    uint16_t value;
+
+    float16() : value(0) {}
+
+    // Construct from float, rounding to nearest even
+    float16(float f) {
+        uint32_t x;
+        std::memcpy(&x, &f, sizeof(x));
+        uint32_t sign = (x >> 16) & 0x8000;
+        uint32_t abs = x & 0x7FFFFFFF;
+        if (abs >= 0x7F800000) {
+            // inf or NaN
+            value = sign | (abs > 0x7F800000 ? 0x7E00 : 0x7C00);
+        } else if (abs >= 0x477FF000) {
+            // >= 65520 rounds to inf
+            value = sign | 0x7C00;
+        } else if (abs < 0x38800000) {
+            // below 2^-14: subnormal or zero. Adding 0.5 aligns the mantissa to units of 2^-24
+            // and rounds it to nearest even in the FPU.
+            float a;
+            std::memcpy(&a, &abs, sizeof(a));
+            a += 0.5f;
+            uint32_t r;
+            std::memcpy(&r, &a, sizeof(r));
+            value = sign | (r - 0x3F000000);
+        } else {
+            // rebias the exponent from 127 to 15 and round the lower 13 bits of the mantissa
+            abs += 0xC8000FFF + ((abs >> 13) & 1);
+            value = sign | (abs >> 13);
+        }
+    }
+
+    // Convert back to float (exact)
+    operator float() const {
+        uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+        uint32_t exp = (value >> 10) & 0x1F;
+        uint32_t mant = value & 0x3FF;
+        uint32_t bits;
+        if (exp == 0) {
+            float f = mant * (1.0f / (1 << 24));
+            std::memcpy(&bits, &f, sizeof(bits));
+            bits |= sign;
+        } else if (exp == 31) {
+            bits = sign | 0x7F800000 | (mant << 13);
+        } else {
+            bits = sign | ((exp + 112) << 23) | (mant << 13);
+        }
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+};
+
+void init_fp16_buffer(float16* buffer, int length) {
+    std::random_device rd; // obtain a random number from hardware
+    std::mt19937 gen(rd()); // seed the generator
+    std::uniform_int_distribution<> distr(-128, 127); // define the range
+    for (int i = 0; i < length; ++i) {
+        buffer[i] = float16(distr(gen) / 120.0f);
+    }
+}
+
+// Fill a buffer of int8, uint8, bf16 or fp16 with random values by the functions above
+template <typename T>
+void init_buffer(T* buffer, size_t length) {
+    if constexpr (std::is_same<T, int8_t>::value) init_int8_buffer(buffer, length);
+    else if constexpr (std::is_same<T, uint8_t>::value) init_uint8_buffer(buffer, length);
+    else if constexpr (std::is_same<T, bfloat16>::value) init_bf16_buffer(buffer, length);
+    else init_fp16_buffer(buffer, length);
+}
+
 // assume B's shape = [K, N]
 // Reorder from [K, N] to [K/vnni_size, N, vnni_size]
 template <typename T>
@@ -101,31 +214,58 @@ void pack_B_to_vnni(T* in, int N, int K, T* out) {
     }
 }
 
+// A, B and C are row-major with leading dimensions lda, ldb and ldc
+template <typename in_dtype, typename b_dtype, typename acc_dtype>
+void gemm_ref(const in_dtype* A, int lda, const b_dtype* B, int ldb, acc_dtype* C, int ldc, int M, int N, int K) {
+    for (int m = 0; m < M; ++m) {
+        for (int n = 0; n < N; ++n) {
+            acc_dtype acc = 0;
+            for (int k = 0; k < K; ++k) {
+                acc += (acc_dtype)A[m * lda + k] * (acc_dtype)B[k * ldb + n];
+            }
+            C[m * ldc + n] = acc;
+        }
+    }
+}
+
 template <typename in_dtype, typename acc_dtype>
 void gemm_ref(in_dtype* A, in_dtype* B, acc_dtype* C, int M, int N, int K) {
+    gemm_ref(A, K, B, N, C, N, M, N, K);
+}
+
+// Quantized GEMM with real values A_real = a_scale * (A - a_zero_point), B_real = b_scale * (B - b_zero_point):
+// C = a_scale * b_scale * sum_k (A[m, k] - a_zero_point) * (B[k, n] - b_zero_point), summed in int32
+template <typename a_dtype, typename b_dtype>
+void gemm_ref_quantized(const a_dtype* A, int lda, const b_dtype* B, int ldb, float* C, int ldc, int M, int N, int K,
+                        float a_scale, int a_zero_point, float b_scale, int b_zero_point) {
     for (int m = 0; m < M; ++m) {
         for (int n = 0; n < N; ++n) {
-            acc_dtype acc = 0;
+            int32_t acc = 0;
             for (int k = 0; k < K; ++k) {
-                acc += (acc_dtype)A[m * K + k] * (acc_dtype)B[k * N + n];
+                acc += ((int32_t)A[m * lda + k] - a_zero_point) * ((int32_t)B[k * ldb + n] - b_zero_point);
             }
-            C[m * N + n] = acc;
+            C[m * ldc + n] = a_scale * b_scale * acc;
         }
     }
 }
 
+// Compare C with C_ref and print the first mismatches (at most 10) and their number
 template <typename T>
-void check_results(T* C, T* C_ref, int M, int N, T tolerance = 0) {
+bool check_results(T* C, T* C_ref, int M, int N, T tolerance = 0) {
+    const int max_print = 10;
     int error_count = 0;
     for (int m = 0; m < M; ++m) {
         for (int n = 0; n < N; ++n) {
             if (std::fabs(C[m * N + n] - C_ref[m * N + n]) > tolerance) {
-              std::cout << "error: ref=" << C[m * N + n] << " vs actual=" << C_ref[m * N + n]
-                  << ", diff = " << std::fabs(C[m * N + n] - C_ref[m * N + n]) << std::endl;
+              if (error_count < max_print) {
+                  std::cout << "error at [" << m << ", " << n << "]: ref=" << C_ref[m * N + n] << " vs actual=" << C[m * N + n]
+                      << ", diff = " << std::fabs(C[m * N + n] - C_ref[m * N + n]) << std::endl;
+              }
               ++ error_count;
             }
         }
     }
     if (error_count == 0) std::cout << "OK\n";
     else std::cout << "\nFailed: " << error_count << "/" << (M * N) << " elements mismatch!\n";
+    return error_count == 0;
 }
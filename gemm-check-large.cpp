@@ -0,0 +1,111 @@
+/*
+    This example checks the AMX GEMM (gemm.h & gemm_parallel.h) on large and odd shapes
+    against the fast reference gemm_ref_fast (gemm_ref.h), for int8, u8 x s8 and bf16.
+
+    It first compares gemm_ref_fast with the naive gemm_ref on a medium shape (the results must be identical)
+    and reports the speedup, then runs the sweep on all threads and prints max abs/rel error and ULP stats.
+    bf16 is checked to a tolerance that grows with K (4 K 2^-24 absolute + K 2^-24 relative).
+
+    Usage: gemm-check-large [M N K]   (default: a sweep up to 4096 x 4096 x 4096)
+*/
+
+#include "gemm_parallel.h"
+#include "gemm_ref.h"
+#include "bench.h"
+#include <thread>
+
+// Rounding error of a float addition
+#define GEMM_CHECK_FLOAT_EPS 0x1p-24
+
+// gemm_ref_fast vs gemm_ref on [M, K] x [K, N]
+template <typename T, typename TB, typename Acc>
+bool compare_ref(const char* name, int M, int N, int K) {
+    std::vector<T> A((size_t)M * K);
+    std::vector<TB> B((size_t)K * N);
+    std::vector<Acc> C_ref((size_t)M * N), C_fast((size_t)M * N);
+    init_buffer(A.data(), A.size());
+    init_buffer(B.data(), B.size());
+    double t0 = bench_now_seconds();
+    gemm_ref(A.data(), K, B.data(), N, C_ref.data(), N, M, N, K);
+    double t_ref = bench_now_seconds() - t0;
+    t0 = bench_now_seconds();
+    gemm_ref_fast(A.data(), K, B.data(), N, C_fast.data(), N, M, N, K);
+    double t_fast = bench_now_seconds() - t0;
+    std::cout << name << " [" << M << ", " << K << "] x [" << K << ", " << N << "], gemm_ref " << t_ref * 1e3
+              << " ms, gemm_ref_fast " << t_fast * 1e3 << " ms (" << t_ref / t_fast << "x): ";
+    return gemm_check(C_fast.data(), N, C_ref.data(), N, M, N).ok();
+}
+
+// AMX GEMM vs gemm_ref_fast on [M, K] x [K, N]
+template <typename T, typename TB, typename Acc>
+bool check_shape(amx_thread_pool& pool, const char* name, int M, int N, int K) {
+    std::vector<T> A((size_t)M * K);
+    std::vector<TB> B((size_t)K * N);
+    std::vector<TB> B_packed(packed_B_size<TB>(K, N));
+    std::vector<Acc> C((size_t)M * N), C_ref((size_t)M * N);
+    init_buffer(A.data(), A.size());
+    init_buffer(B.data(), B.size());
+    pack_B(B.data(), K, N, N, B_packed.data());
+
+    double t0 = bench_now_seconds();
+    gemm_amx_parallel(pool, M, N, K, A.data(), K, B_packed.data(), C.data(), N);
+    double t_amx = bench_now_seconds() - t0;
+    t0 = bench_now_seconds();
+    gemm_ref_fast(A.data(), K, B.data(), N, C_ref.data(), N, M, N, K);
+    double t_ref = bench_now_seconds() - t0;
+
+    std::cout << name << " [" << M << ", " << K << "] x [" << K << ", " << N << "], AMX " << t_amx * 1e3
+              << " ms, reference " << t_ref * 1e3 << " ms: ";
+    // Products of bf16 are exact in float, so only the K float additions round, in another order than the
+    // reference: up to about K * 2^-24 of the magnitude of the partial sums (abs) or of the result (rel)
+    double tolerance = std::is_same<Acc, float>::value ? K * GEMM_CHECK_FLOAT_EPS : 0;
+    return gemm_check(C.data(), N, C_ref.data(), N, M, N, 4 * tolerance, tolerance).ok();
+}
+
+template <typename T, typename TB, typename Acc>
+int check_shapes(amx_thread_pool& pool, const char* name, const std::vector<std::array<int, 3>>& shapes) {
+    int failures = 0;
+    for (auto& s : shapes) failures += !check_shape<T, TB, Acc>(pool, name, s[0], s[1], s[2]);
+    return failures;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::array<int, 3>> shapes = {
+        {4096, 4096, 4096}, {1000, 3000, 2000}, {1, 4096, 4096}, {4095, 33, 1027}, {17, 4099, 515},
+    };
+    if (argc >= 4) {
+        shapes = {{std::atoi(argv[1]), std::atoi(argv[2]), std::atoi(argv[3])}};
+        if (shapes[0][0] <= 0 || shapes[0][1] <= 0 || shapes[0][2] <= 0) {
+            std::cout << "M, N and K must be positive\n";
+            return 1;
+        }
+    }
+
+    std::cout << "=========================================\n";
+    std::cout << "  AMX GEMM check on large shapes\n";
+    std::cout << "=========================================\n";
+
+    if (!init_amx()) return 1;
+
+    int failures = 0;
+    std::cout << "Reference:\n";
+    failures += !compare_ref<int8_t, int8_t, int32_t>("int8", 256, 512, 1024);
+    failures += !compare_ref<uint8_t, int8_t, int32_t>("uint8", 256, 512, 1024);
+    failures += !compare_ref<bfloat16, bfloat16, float>("bf16", 256, 512, 1024);
+
+    int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    amx_thread_pool pool(num_threads);
+    std::cout << "AMX GEMM on " << num_threads << (num_threads == 1 ? " thread:\n" : " threads:\n");
+    failures += check_shapes<int8_t, int8_t, int32_t>(pool, "int8", shapes);
+    failures += check_shapes<uint8_t, int8_t, int32_t>(pool, "uint8", shapes);
+    failures += check_shapes<bfloat16, bfloat16, float>(pool, "bf16", shapes);
+
+    std::cout << "Release tiles...\n";
+    amx_tile_release();
+    if (failures) {
+        std::cout << "Failed: " << failures << " shapes mismatch!\n";
+        return 1;
+    }
+    std::cout << "Done\n";
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+    This example applies post-ops to the GEMM in gemm.h in two ways:
+    - fused: the epilogue is applied to each block of C right after its tiles are stored (gemm_epilogue.h)
+    - separate: C is written as int32/float first, and the epilogue takes a second pass over C
+    The fused output is checked against gemm_ref followed by the scalar epilogue,
+    and both ways are timed on the largest shape.
+*/
+
+#include "gemm.h"
+#include "bench.h"
+
+// Output of the epilogue as float, to compare with the reference
+float output_at(const gemm_epilogue& ep, size_t i) {
+    if (ep.out_type == GEMM_OUTPUT_FP32) return ((const float*)ep.out)[i];
+    if (ep.out_type == GEMM_OUTPUT_BF16) return ((const bfloat16*)ep.out)[i];
+    return ((const int8_t*)ep.out)[i];
+}
+
+size_t output_size(gemm_output_type type) {
+    return type == GEMM_OUTPUT_FP32 ? 4 : type == GEMM_OUTPUT_BF16 ? 2 : 1;
+}
+
+template <typename T>
+bool run_case(const char* name, int M, int N, int K, gemm_activation activation, gemm_output_type out_type,
+              bool use_residual, bool timed) {
+    using Acc = gemm_acc_type<T>;
+    std::cout << name << ", [" << M << ", " << K << "] x [" << K << ", " << N << "]: ";
+    std::vector<T> A((size_t)M * K);
+    std::vector<T> B((size_t)K * N);
+    std::vector<T> B_packed(packed_B_size<T>(K, N));
+    std::vector<Acc> C((size_t)M * N);
+    std::vector<float> scales(N), bias(N), residual((size_t)M * N);
+    std::vector<char> out((size_t)M * N * output_size(out_type)), out_ref(out.size());
+    std::mt19937 gen(M + N + K);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    if constexpr (std::is_same<T, int8_t>::value) {
+        init_int8_buffer(A.data(), A.size());
+        init_int8_buffer(B.data(), B.size());
+    } else {
+        init_bf16_buffer(A.data(), A.size());
+        init_bf16_buffer(B.data(), B.size());
+    }
+    for (int n = 0; n < N; ++n) {
+        scales[n] = 1.0f + 0.5f * uniform(gen);
+        bias[n] = uniform(gen);
+    }
+    for (auto& r : residual) r = uniform(gen);
+    pack_B(B.data(), K, N, N, B_packed.data());
+
+    gemm_epilogue ep;
+    // int8 sums are ~K * 128 * 128 / 3, scale them to ~1
+    bool int8 = std::is_same<T, int8_t>::value;
+    ep.scale = int8 ? 1.0f / (64 * K) : 1.0f / 8;
+    ep.scales = int8 ? scales.data() : nullptr;
+    ep.bias = bias.data();
+    ep.residual = use_residual ? residual.data() : nullptr;
+    ep.ld_residual = N;
+    ep.activation = activation;
+    ep.out_type = out_type;
+    ep.ld_out = N;
+    ep.out_scale = 1.0f / 64;
+    ep.out_zero_point = -8;
+
+    // reference: GEMM, then the scalar epilogue
+    gemm_ref(A.data(), K, B.data(), N, C.data(), N, M, N, K);
+    ep.out = out_ref.data();
+    gemm_epilogue_apply_scalar(ep, C.data(), N, 0, 0, M, N);
+    ep.out = out.data();
+    gemm_amx(M, N, K, A.data(), K, B_packed.data(), ep);
+
+    // bf16 GEMM sums differ from the sequential reference by rounding (see gemm-shapes),
+    // and requantized int8 may round the other way on a tie
+    float tolerance = out_type == GEMM_OUTPUT_INT8 ? 1.0f : out_type == GEMM_OUTPUT_BF16 ? 1e-2f : 1e-3f;
+    int errors = 0;
+    for (size_t i = 0; i < (size_t)M * N; ++i) {
+        float x = output_at(ep, i);
+        ep.out = out_ref.data();
+        float x_ref = output_at(ep, i);
+        ep.out = out.data();
+        if (std::fabs(x - x_ref) > tolerance * std::max(1.0f, std::fabs(x_ref))) {
+            if (errors++ < 10) std::cout << "error at " << i << ": ref=" << x_ref << " vs actual=" << x << "\n";
+        }
+    }
+    if (errors) {
+        std::cout << "Failed: " << errors << "/" << ((size_t)M * N) << " elements mismatch!\n";
+        return false;
+    }
+    std::cout << "OK\n";
+
+    if (timed) {
+        int iters = std::max(1, std::min(20, (int)(1e10 / gemm_ops(M, N, K))));
+        double t_fused = bench_median_seconds([&] {
+            gemm_amx(M, N, K, A.data(), K, B_packed.data(), ep);
+        }, 1, iters);
+        double t_separate = bench_median_seconds([&] {
+            gemm_amx(M, N, K, A.data(), K, B_packed.data(), C.data(), N);
+            gemm_epilogue_apply(ep, C.data(), N, 0, 0, M, N);
+        }, 1, iters);
+        std::cout << "  fused " << t_fused * 1e3 << " ms, separate pass " << t_separate * 1e3 << " ms\n";
+    }
+    return true;
+}
+
+int main() {
+
+    std::cout << "=========================================\n";
+    std::cout << "  Matrix multiplication with Intel AMX\n";
+    std::cout << "=========================================\n";
+    std::cout << "Fused epilogues\n";
+
+    if (!init_amx()) return 1;
+
+    const int shapes[][3] = {{10, 300, 250}, {200, 300, 250}, {70, 200, 3000}, {1024, 1024, 1024}};
+    int failures = 0;
+    for (int i = 0; i < 4; ++i) {
+        int M = shapes[i][0], N = shapes[i][1], K = shapes[i][2];
+        bool timed = i == 3;
+        failures += !run_case<int8_t>("int8, scales + bias + relu -> int8", M, N, K,
+                                      GEMM_ACTIVATION_RELU, GEMM_OUTPUT_INT8, false, timed);
+        failures += !run_case<int8_t>("int8, scales + bias + gelu -> bf16", M, N, K,
+                                      GEMM_ACTIVATION_GELU, GEMM_OUTPUT_BF16, false, timed);
+        failures += !run_case<bfloat16>("bf16, bias + residual + silu -> fp32", M, N, K,
+                                        GEMM_ACTIVATION_SILU, GEMM_OUTPUT_FP32, true, timed);
+        failures += !run_case<bfloat16>("bf16, bias + gelu -> bf16", M, N, K,
+                                        GEMM_ACTIVATION_GELU, GEMM_OUTPUT_BF16, false, timed);
+    }
+
+    std::cout << "Release tiles...\n";
+    amx_tile_release();
+    if (failures) {
+        std::cout << "Failed: " << failures << " cases mismatch!\n";
+        return 1;
+    }
+    std::cout << "Done\n";
+    return 0;
+}
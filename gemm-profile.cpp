@@ -0,0 +1,117 @@
+/*
+    This example builds the GEMM library with instrumentation (GEMM_PROFILE, see gemm_profile.h)
+    and prints the profile of a few calls:
+    - packing B, and int8 & bf16 GEMM with packed B
+    - GEMM with plain B, which packs B in the same call
+    - small M (1x4 kernel), the JIT kernel and a fused epilogue (bf16 output with GELU)
+    - the multithreaded GEMM
+    The counts of tile dot products are checked against the number of tile blocks of the shape.
+    Run with GEMM_PROFILE_PERF=1 to read hardware counters, or AMX_EMULATE=1 to profile the emulation.
+
+    Usage: gemm-profile [M N K]   (default 1024 1024 1024)
+*/
+
+#define GEMM_PROFILE
+#include "gemm_parallel.h"
+
+// Dot products of the 2x2 kernel: one per 16 x 16 tile of C and block of K
+template <typename T>
+uint64_t expected_dps(int M, int N, int K) {
+    int KC = (K + gemm_block_k<T>() - 1) / gemm_block_k<T>();
+    return (uint64_t)((M + 15) / 16) * ((N + 15) / 16) * KC;
+}
+
+bool check_dps(uint64_t expected) {
+    uint64_t dps = gemm_profile_last.tiles.dps;
+    if (dps == expected) return true;
+    std::cout << "Failed: " << dps << " tile dot products, expected " << expected << "\n";
+    return false;
+}
+
+template <typename T, typename Acc>
+bool profile_dtype(int M, int N, int K) {
+    std::vector<T> A((size_t)M * K);
+    std::vector<T> B((size_t)K * N);
+    std::vector<T> B_packed(packed_B_size<T>(K, N));
+    std::vector<Acc> C((size_t)M * N);
+    init_buffer(A.data(), A.size());
+    init_buffer(B.data(), B.size());
+    bool ok = true;
+
+    pack_B(B.data(), K, N, N, B_packed.data());
+    // the first call also creates the A panel buffers, profile the second one
+    gemm_profile_dump = false;
+    gemm_amx(M, N, K, A.data(), K, B_packed.data(), C.data(), N);
+    gemm_profile_dump = true;
+    gemm_amx(M, N, K, A.data(), K, B_packed.data(), C.data(), N);
+    ok &= check_dps(expected_dps<T>(M, N, K));
+
+    gemm_amx(M, N, K, A.data(), K, B.data(), N, C.data(), N);
+    ok &= check_dps(expected_dps<T>(M, N, K));
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    int M = 1024, N = 1024, K = 1024;
+    if (argc >= 4) {
+        M = std::atoi(argv[1]);
+        N = std::atoi(argv[2]);
+        K = std::atoi(argv[3]);
+    }
+
+    std::cout << "=========================================\n";
+    std::cout << "  Profile of AMX GEMM\n";
+    std::cout << "=========================================\n";
+
+    if (M <= 0 || N <= 0 || K <= 0) {
+        std::cout << "M, N and K must be positive\n";
+        return 1;
+    }
+    if (!init_amx()) return 1;
+
+    bool ok = true;
+    std::cout << "\nint8:\n";
+    ok &= profile_dtype<int8_t, int32_t>(M, N, K);
+    std::cout << "\nbf16:\n";
+    ok &= profile_dtype<bfloat16, float>(M, N, K);
+
+    std::vector<bfloat16> A((size_t)M * K);
+    std::vector<bfloat16> B((size_t)K * N);
+    std::vector<bfloat16> B_packed(packed_B_size<bfloat16>(K, N));
+    std::vector<float> C((size_t)M * N);
+    init_bf16_buffer(A.data(), A.size());
+    init_bf16_buffer(B.data(), B.size());
+    gemm_profile_dump = false;
+    pack_B(B.data(), K, N, N, B_packed.data());
+    gemm_profile_dump = true;
+
+    std::cout << "\nbf16, small M (1x4 kernel):\n";
+    int small_m = std::min(M, 8);
+    gemm_amx(small_m, N, K, A.data(), K, B_packed.data(), C.data(), N);
+
+    std::cout << "\nbf16, JIT kernel:\n";
+    gemm_blocking jit = gemm_default_blocking<bfloat16>();
+    jit.kernel = GEMM_KERNEL_JIT;
+    gemm_amx(M, N, K, A.data(), K, B_packed.data(), C.data(), N, jit);
+    ok &= check_dps(expected_dps<bfloat16>(M, N, K));
+
+    std::cout << "\nbf16, epilogue (GELU, bf16 output):\n";
+    std::vector<bfloat16> out((size_t)M * N);
+    gemm_epilogue ep;
+    ep.activation = GEMM_ACTIVATION_GELU;
+    ep.out_type = GEMM_OUTPUT_BF16;
+    ep.out = out.data();
+    ep.ld_out = N;
+    gemm_amx(M, N, K, A.data(), K, B_packed.data(), ep);
+
+    std::cout << "\nbf16, 2 threads:\n";
+    amx_thread_pool pool(2);
+    gemm_amx_parallel(pool, M, N, K, A.data(), K, B_packed.data(), C.data(), N);
+    ok &= check_dps(expected_dps<bfloat16>(M, N, K));
+
+    std::cout << "\nRelease tiles...\n";
+    amx_tile_release();
+    if (!ok) return 1;
+    std::cout << "Done\n";
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*
+    This example checks the runtime-shaped AMX GEMM in gemm.h against gemm_ref
+    over a sweep of random shapes, including M, N & K that are not multiples of the block sizes
+    and leading dimensions larger than the matrix widths, and K = 0, where C must be zeros.
+    8-bit GEMMs with unsigned A and/or B are checked with zero points, against gemm_ref_quantized.
+*/
+
+#include "gemm.h"
+
+#define NUM_SHAPES 50
+#define NUM_SHAPES_K0 5
+#define MAX_DIM 300
+
+template <typename T, typename Acc>
+bool run_shape(std::mt19937& gen, int M, int N, int K, Acc tolerance) {
+    std::uniform_int_distribution<> pad(0, 7);
+    int lda = K + pad(gen);
+    int ldb = N + pad(gen);
+    int ldc = N + pad(gen);
+    std::cout << "Shape: [" << M << ", " << K << "] x [" << K << ", " << N << "]"
+              << ", lda = " << lda << ", ldb = " << ldb << ", ldc = " << ldc << ": ";
+
+    std::vector<T> A((size_t)M * lda);
+    std::vector<T> B((size_t)K * ldb);
+    std::vector<T> B_packed(packed_B_size<T>(K, N));
+    // filled with a sentinel, so that elements the GEMM does not write are caught
+    std::vector<Acc> C((size_t)M * ldc, Acc(12345));
+    std::vector<Acc> C_dense((size_t)M * N);
+    std::vector<Acc> C_ref((size_t)M * N);
+    init_buffer(A.data(), A.size());
+    init_buffer(B.data(), B.size());
+
+    pack_B(B.data(), K, N, ldb, B_packed.data());
+    gemm_ref(A.data(), lda, B.data(), ldb, C_ref.data(), N, M, N, K);
+    gemm_amx(M, N, K, A.data(), lda, B_packed.data(), C.data(), ldc);
+    for (int m = 0; m < M; ++m) {
+        std::copy(&C[(size_t)m * ldc], &C[(size_t)m * ldc + N], &C_dense[(size_t)m * N]);
+    }
+    return check_results(C_dense.data(), C_ref.data(), M, N, tolerance);
+}
+
+// Quantized GEMM of 8-bit A & B with zero points, compensated by the epilogue
+template <typename TA, typename TB>
+bool run_shape_quantized(std::mt19937& gen, int M, int N, int K) {
+    std::uniform_int_distribution<> pad(0, 7);
+    int lda = K + pad(gen);
+    int ldb = N + pad(gen);
+    int ldc = N + pad(gen);
+    // zero points in the range of each type
+    int a_zero_point = std::is_same<TA, int8_t>::value ? pad(gen) - 4 : 120 + pad(gen);
+    int b_zero_point = std::is_same<TB, int8_t>::value ? pad(gen) - 4 : 120 + pad(gen);
+    std::cout << "Shape: [" << M << ", " << K << "] x [" << K << ", " << N << "]"
+              << ", lda = " << lda << ", ldb = " << ldb << ", ldc = " << ldc
+              << ", zero points = " << a_zero_point << ", " << b_zero_point << ": ";
+
+    std::vector<TA> A((size_t)M * lda);
+    std::vector<TB> B((size_t)K * ldb);
+    std::vector<TB> B_packed(packed_B_size<TB>(K, N));
+    std::vector<int32_t> b_col_sums(N);
+    std::vector<float> C((size_t)M * ldc, 12345.0f);
+    std::vector<float> C_dense((size_t)M * N);
+    std::vector<float> C_ref((size_t)M * N);
+    init_buffer(A.data(), A.size());
+    init_buffer(B.data(), B.size());
+
+    pack_B(B.data(), K, N, ldb, B_packed.data());
+    pack_B_col_sums(B.data(), K, N, ldb, b_col_sums.data());
+    float a_scale = 0.02f, b_scale = 0.01f;
+    gemm_ref_quantized(A.data(), lda, B.data(), ldb, C_ref.data(), N, M, N, K, a_scale, a_zero_point, b_scale,
+                       b_zero_point);
+    gemm_epilogue ep;
+    ep.a_zero_point = a_zero_point;
+    ep.b_zero_point = b_zero_point;
+    ep.b_col_sums = b_col_sums.data();
+    ep.scale = a_scale * b_scale;
+    ep.out = C.data();
+    ep.ld_out = ldc;
+    gemm_amx(M, N, K, A.data(), lda, B_packed.data(), ep);
+    for (int m = 0; m < M; ++m) {
+        std::copy(&C[(size_t)m * ldc], &C[(size_t)m * ldc + N], &C_dense[(size_t)m * N]);
+    }
+    // int32 sums are exact and scaled the same way
+    return check_results(C_dense.data(), C_ref.data(), M, N, 0.0f);
+}
+
+int main() {
+
+    std::cout << "=========================================\n";
+    std::cout << "  Matrix multiplication with Intel AMX\n";
+    std::cout << "=========================================\n";
+    std::cout << "Runtime shapes, " << NUM_SHAPES << " random shapes per data type\n";
+
+    if (!init_amx()) return 1;
+
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_int_distribution<> dim(1, MAX_DIM);
+    int failures = 0;
+
+    std::cout << "Data type: int8 * int8 -> int32\n";
+    for (int i = 0; i < NUM_SHAPES; ++i) {
+        if (!run_shape<int8_t, int32_t>(gen, dim(gen), dim(gen), dim(gen), 0)) ++failures;
+    }
+    std::cout << "Data type: bf16 * bf16 -> float\n";
+    for (int i = 0; i < NUM_SHAPES; ++i) {
+        if (!run_shape<bfloat16, float>(gen, dim(gen), dim(gen), dim(gen), 1e-3f)) ++failures;
+    }
+    std::cout << "Data type: u8 * s8 -> int32 -> float, with zero points\n";
+    for (int i = 0; i < NUM_SHAPES; ++i) {
+        if (!run_shape_quantized<uint8_t, int8_t>(gen, dim(gen), dim(gen), dim(gen))) ++failures;
+    }
+    std::cout << "Data type: s8 * u8 and u8 * u8 -> int32 -> float, with zero points\n";
+    for (int i = 0; i < NUM_SHAPES / 2; ++i) {
+        if (!run_shape_quantized<int8_t, uint8_t>(gen, dim(gen), dim(gen), dim(gen))) ++failures;
+        if (!run_shape_quantized<uint8_t, uint8_t>(gen, dim(gen), dim(gen), dim(gen))) ++failures;
+    }
+    std::cout << "K = 0, all data types: C must be zeros\n";
+    for (int i = 0; i < NUM_SHAPES_K0; ++i) {
+        if (!run_shape<int8_t, int32_t>(gen, dim(gen), dim(gen), 0, 0)) ++failures;
+        if (!run_shape<bfloat16, float>(gen, dim(gen), dim(gen), 0, 0.0f)) ++failures;
+        if (!run_shape_quantized<uint8_t, int8_t>(gen, dim(gen), dim(gen), 0)) ++failures;
+    }
+
+    std::cout << "Release tiles...\n";
+    amx_tile_release();
+    if (failures) {
+        std::cout << "Failed: " << failures << "/" << (4 * NUM_SHAPES + 3 * NUM_SHAPES_K0) << " shapes mismatch!\n";
+        return 1;
+    }
+    std::cout << "Done\n";
+    return 0;
+}
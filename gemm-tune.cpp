@@ -0,0 +1,195 @@
+/*
+    Offline autotuning of GEMM shapes (see gemm_autotune.h) into a tuning cache file.
+
+    For each data type and shape, it times the default blocking, tunes the shape, checks that the tuned GEMM
+    computes the same as the default one and prints both times. The results are added to the cache file,
+    keeping the entries of other shapes. Run the GEMM with GEMM_TUNING_CACHE=FILE to use them.
+    Shapes are tuned on the given number of threads, as gemm_amx (1 thread) or gemm_amx_parallel.
+
+    Usage: gemm-tune [options]
+      --dtype int8|uint8|bf16|all   data type, uint8 is u8 x s8 (default all, may repeat)
+      --shape MxNxK                 shape (may repeat)
+      --shapes FILE                 shapes, one MxNxK per line
+      --threads N                   threads (default 1)
+      --cache FILE                  cache file to update (default $GEMM_TUNING_CACHE or gemm_tuning.txt)
+      --min-time S                  seconds to time each candidate (default 0.05)
+      --verbose                     print each candidate
+*/
+
+#include "gemm_autotune.h"
+#include "gemm_ref.h"
+#include <cstdio>
+#include <memory>
+
+struct tune_shape {
+    int M;
+    int N;
+    int K;
+};
+
+struct tune_options {
+    std::vector<std::string> dtypes;
+    std::vector<tune_shape> shapes;
+    int threads = 1;
+    std::string cache;
+    gemm_autotune_options autotune;
+};
+
+void print_usage() {
+    std::cout << "Usage: gemm-tune [--dtype int8|uint8|bf16|all] [--shape MxNxK] [--shapes FILE] [--threads N]\n"
+              << "                 [--cache FILE] [--min-time S] [--verbose]\n";
+}
+
+bool parse_shape(const std::string& value, tune_shape& s) {
+    char x1, x2;
+    if (std::sscanf(value.c_str(), "%d%c%d%c%d", &s.M, &x1, &s.N, &x2, &s.K) != 5 || x1 != 'x' || x2 != 'x' ||
+        s.M <= 0 || s.N <= 0 || s.K <= 0) {
+        std::cout << "Invalid shape " << value << ", expected MxNxK\n";
+        return false;
+    }
+    return true;
+}
+
+// Parse the command line into options. Returns false on errors.
+bool parse_options(int argc, char** argv, tune_options& o) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--verbose") {
+            o.autotune.verbose = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cout << "Missing value of " << arg << "\n";
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--dtype") {
+            if (value == "all") {
+                o.dtypes.insert(o.dtypes.end(), {"int8", "uint8", "bf16"});
+            } else if (value == "int8" || value == "uint8" || value == "bf16") {
+                o.dtypes.push_back(value);
+            } else {
+                std::cout << "Unknown dtype " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--shape") {
+            tune_shape s;
+            if (!parse_shape(value, s)) return false;
+            o.shapes.push_back(s);
+        } else if (arg == "--shapes") {
+            std::ifstream file(value);
+            if (!file) {
+                std::cout << "Cannot open " << value << "\n";
+                return false;
+            }
+            std::string line;
+            while (std::getline(file, line)) {
+                size_t first = line.find_first_not_of(" \t\r");
+                if (first == std::string::npos || line[first] == '#') continue;
+                tune_shape s;
+                if (!parse_shape(line.substr(first), s)) return false;
+                o.shapes.push_back(s);
+            }
+        } else if (arg == "--threads") {
+            o.threads = std::atoi(value.c_str());
+        } else if (arg == "--cache") {
+            o.cache = value;
+        } else if (arg == "--min-time") {
+            o.autotune.min_seconds = std::atof(value.c_str());
+        } else {
+            std::cout << "Unknown option " << arg << "\n";
+            return false;
+        }
+    }
+    if (o.dtypes.empty()) o.dtypes = {"int8", "uint8", "bf16"};
+    if (o.shapes.empty()) {
+        std::cout << "No shapes to tune\n";
+        return false;
+    }
+    if (o.threads < 1) {
+        std::cout << "threads must be positive\n";
+        return false;
+    }
+    if (o.cache.empty()) {
+        const char* env = std::getenv("GEMM_TUNING_CACHE");
+        o.cache = env && *env ? env : "gemm_tuning.txt";
+    }
+    return true;
+}
+
+template <typename T, typename TB, typename Acc>
+bool tune(const tune_options& o, const char* dtype, tune_shape s, amx_thread_pool* pool) {
+    int M = s.M, N = s.N, K = s.K;
+    std::vector<T> A((size_t)M * K);
+    std::vector<TB> B((size_t)K * N);
+    std::vector<TB> B_packed(packed_B_size<TB>(K, N));
+    std::vector<Acc> C((size_t)M * N), C_default((size_t)M * N);
+    init_buffer(A.data(), A.size());
+    init_buffer(B.data(), B.size());
+    pack_B(B.data(), K, N, N, B_packed.data());
+
+    // the default blocking, as the GEMM without a tuning cache
+    const gemm_blocking blocking = gemm_default_blocking<T>();
+    auto run_default = [&] {
+        if (pool) gemm_amx_parallel(*pool, M, N, K, A.data(), K, B_packed.data(), C_default.data(), N, true, blocking);
+        else gemm_amx(M, N, K, A.data(), K, B_packed.data(), C_default.data(), N, blocking);
+    };
+    run_default();
+    int iters = std::max(3, std::min(50, (int)(o.autotune.min_seconds / 0.001)));
+    double t_default = bench_run(run_default, 1, iters).median;
+
+    std::cout << dtype << " [" << M << ", " << K << "] x [" << K << ", " << N << "], " << o.threads
+              << (o.threads == 1 ? " thread:\n" : " threads:\n");
+    gemm_tuning_entry entry = gemm_autotune(pool, M, N, K, A.data(), K, B_packed.data(), C.data(), N, o.autotune);
+
+    // the entry points now find the shape in the cache
+    std::fill(C.begin(), C.end(), Acc());
+    if (pool) gemm_amx_parallel(*pool, M, N, K, A.data(), K, B_packed.data(), C.data(), N);
+    else gemm_amx(M, N, K, A.data(), K, B_packed.data(), C.data(), N);
+    double tolerance = std::is_same<Acc, float>::value ? 1e-3 : 0;
+    gemm_check_result check = gemm_check(C.data(), N, C_default.data(), N, M, N, tolerance, 0, 10, false);
+
+    gemm_autotune_candidate best = {entry.blocking, {entry.tm, entry.tn, entry.tk}};
+    std::cout << "  default " << t_default * 1e3 << " ms, tuned " << entry.seconds * 1e3 << " ms ("
+              << t_default / entry.seconds << "x): " << gemm_autotune_describe(best) << ", check "
+              << (check.ok() ? "OK" : "FAILED") << "\n";
+    return check.ok();
+}
+
+int main(int argc, char** argv) {
+    tune_options o;
+    if (!parse_options(argc, argv, o)) {
+        print_usage();
+        return 1;
+    }
+
+    std::cout << "=========================================\n";
+    std::cout << "  Autotuning of AMX GEMM\n";
+    std::cout << "=========================================\n";
+
+    if (!init_amx()) return 1;
+    if (std::ifstream(o.cache) && !gemm_tuning_load(o.cache)) return 1;
+    std::unique_ptr<amx_thread_pool> pool;
+    if (o.threads > 1) pool.reset(new amx_thread_pool(o.threads));
+
+    int failures = 0;
+    for (const std::string& dtype : o.dtypes) {
+        for (const tune_shape& s : o.shapes) {
+            bool ok;
+            if (dtype == "int8") ok = tune<int8_t, int8_t, int32_t>(o, "int8", s, pool.get());
+            else if (dtype == "uint8") ok = tune<uint8_t, int8_t, int32_t>(o, "uint8", s, pool.get());
+            else ok = tune<bfloat16, bfloat16, float>(o, "bf16", s, pool.get());
+            failures += !ok;
+        }
+    }
+    if (!gemm_tuning_save(o.cache)) return 1;
+    std::cout << "Saved " << gemm_tuned_shapes.entries.size() << " shapes to " << o.cache << "\n";
+
+    amx_tile_release();
+    if (failures) {
+        std::cout << "Failed: " << failures << " tuned shapes mismatch!\n";
+        return 1;
+    }
+    std::cout << "Done\n";
+    return 0;
+}
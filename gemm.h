@@ -0,0 +1,1479 @@
+/*
+    GEMM with Intel AMX instructions for shapes known only at runtime.
+    The problem is C = A x B, where A's shape = [M, K], B's shape = [K, N], C's shape = [M, N],
+    and A, B and C are row-major with leading dimensions lda, ldb and ldc.
+    Supported data types are int8 * int8 -> int32 and bf16 * bf16 -> float,
+    where either int8 side may be unsigned (u8 * s8, s8 * u8 or u8 * u8 with _tile_dpbusd, dpbsud or dpbuud).
+    Asymmetric quantization (zero points of A & B) is compensated in the epilogue, see gemm_epilogue.h.
+
+    It follows the large examples (int8-gemm-large.cpp & bf16-gemm-large.cpp):
+    C is computed block by block with block_m & block_n = 32 and block_k = 64 bytes of A,
+    with 4 tiles for C, 2 tiles for A and 2 tiles for B.
+    Differently, M, N and K need not be multiples of the block sizes:
+    - M & N tails are computed with tiles configured to fewer rows/colsb.
+    - K tail is padded with zeros in packed B, and the last block of A is copied to a zero-padded buffer.
+    For M <= 16, where half of a 32 x 32 block would be empty, blocks of 16 x 64 with 1x4 C tiles are used instead.
+    With an epilogue (gemm_epilogue.h), post-ops are applied to each block of C right after its tiles are stored.
+    With GEMM_KERNEL_JIT, the 2x2 block kernel is generated at runtime for each block shape & strides (gemm_jit.h).
+    With GEMM_PROFILE defined, the phases of each call are timed and summarized (gemm_profile.h).
+    Blockings found by the autotuner (gemm_autotune.h) are kept per shape in a tuning cache,
+    which the GEMM consults by default (see gemm_tuning_find).
+    Scratch buffers (packed A panels, K tails of A, packed B of plain B) come from the scratch arena
+    of each thread (arena.h), so that calls allocate nothing once the arena has grown.
+    Transposed A ([K, M]) and B ([N, K]) are packed block by block to the same layouts as A and B,
+    with AVX-512 transposes of 16 x 16 dwords (pack_A_panel_trans, pack_B_trans).
+    fp32 A with bf16 B is converted to bf16 panel by panel while packing (pack_A_panel_fp32, bf16_convert.h),
+    so that no bf16 copy of all of A is made.
+*/
+
+#pragma once
+
+#include "arena.h"
+#include "bf16_convert.h"
+#include "common.h"
+#include "gemm_epilogue.h"
+#include "gemm_jit.h"
+#include "gemm_profile.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#define GEMM_BLOCK_M 32
+#define GEMM_BLOCK_N 32
+
+// VNNI packing factor: 4 for int8 and 2 for bf16, so that a VNNI group is 4 bytes
+template <typename T>
+constexpr int gemm_vnni_size() { return 4 / sizeof(T); }
+
+// Accumulator type: int32 for int8/uint8 and float for bf16
+template <typename T>
+using gemm_acc_type = typename std::conditional<sizeof(T) == 1, int32_t, float>::type;
+
+// block_k is chosen so that a row of A tile is 64 bytes: 64 for int8 and 32 for bf16
+template <typename T>
+constexpr int gemm_block_k() { return 64 / sizeof(T); }
+
+inline int gemm_round_up(int x, int y) { return (x + y - 1) / y * y; }
+
+// Number of elements of packed B for a [K, N] matrix.
+// Packed B holds whole blocks, so K and N are rounded up to block_k and block_n.
+template <typename T>
+size_t packed_B_size(int K, int N) {
+    return (size_t)gemm_round_up(K, gemm_block_k<T>()) * gemm_round_up(N, GEMM_BLOCK_N);
+}
+
+// Address of block (kc, nc) in packed B. Np = N rounded up to block_n.
+template <typename T>
+const T* packed_B_block(const T* B_packed, int kc, int nc, int Np) {
+    constexpr int block_k = gemm_block_k<T>();
+    return B_packed + (size_t)kc * block_k * Np + (size_t)nc * block_k * GEMM_BLOCK_N;
+}
+
+// Pack B to blocked layout in memory and in each block, data are in VNNI layout
+// [K, N] -> [Kp/block_k, Np/block_n, block_k/vnni, block_n, vnni]
+// where Kp & Np are K & N rounded up to the block sizes and the padding is filled with zeros.
+// This is the two-step way of the large examples: copy a block to a buffer, then pack it to VNNI layout.
+// pack_B below does the same in one pass.
+template <typename T>
+void pack_B_two_step(const T* in, int K, int N, int ldb, T* out) {
+    constexpr int block_k = gemm_block_k<T>();
+    int Np = gemm_round_up(N, GEMM_BLOCK_N);
+    int KC = (K + block_k - 1) / block_k;
+    int NC = Np / GEMM_BLOCK_N;
+    for (int kc = 0; kc < KC; ++kc) {
+        for (int nc = 0; nc < NC; ++nc) {
+            T block_B_buffer[block_k * GEMM_BLOCK_N];
+            for (int kb = 0; kb < block_k; ++kb) {
+                int k = kc * block_k + kb;
+                for (int nb = 0; nb < GEMM_BLOCK_N; ++nb) {
+                    int n = nc * GEMM_BLOCK_N + nb;
+                    block_B_buffer[kb * GEMM_BLOCK_N + nb] = (k < K && n < N) ? in[(size_t)k * ldb + n] : T();
+                }
+            }
+            pack_B_to_vnni(block_B_buffer, GEMM_BLOCK_N, block_k,
+                           const_cast<T*>(packed_B_block(out, kc, nc, Np)));
+        }
+    }
+}
+
+// Pack block (kc, nc) of B to out (block_k x block_n elements) in scalar code,
+// reading the vnni rows of B interleaved. Rows beyond K are read from a row of zeros.
+template <typename T>
+void pack_B_block_scalar(const T* in, int K, int N, int ldb, int kc, int nc, T* out) {
+    constexpr int block_k = gemm_block_k<T>();
+    constexpr int vnni = gemm_vnni_size<T>();
+    const T zeros[GEMM_BLOCK_N] = {};
+    int n0 = nc * GEMM_BLOCK_N;
+    int cols = std::min(GEMM_BLOCK_N, N - n0);
+    T* dst = out;
+    for (int k0 = kc * block_k; k0 < (kc + 1) * block_k; k0 += vnni) {
+        const T* rows[vnni];
+        for (int i = 0; i < vnni; ++i) {
+            rows[i] = k0 + i < K ? in + (size_t)(k0 + i) * ldb + n0 : zeros;
+        }
+        for (int nb = 0; nb < cols; ++nb) {
+            for (int i = 0; i < vnni; ++i) dst[nb * vnni + i] = rows[i][nb];
+        }
+        std::fill(dst + cols * vnni, dst + GEMM_BLOCK_N * vnni, T());
+        dst += GEMM_BLOCK_N * vnni;
+    }
+}
+
+// Fused blocking & VNNI packing in scalar code: write each block of packed B in order
+template <typename T>
+void pack_B_fused_scalar(const T* in, int K, int N, int ldb, T* out) {
+    constexpr int block_k = gemm_block_k<T>();
+    int KC = (K + block_k - 1) / block_k;
+    int NC = gemm_round_up(N, GEMM_BLOCK_N) / GEMM_BLOCK_N;
+    T* dst = out;
+    for (int kc = 0; kc < KC; ++kc) {
+        for (int nc = 0; nc < NC; ++nc, dst += block_k * GEMM_BLOCK_N) pack_B_block_scalar(in, K, N, ldb, kc, nc, dst);
+    }
+}
+
+// Fused packing with AVX-512, int8.
+// A row of a packed block, [block_n, 4] = 128 bytes, interleaves 4 rows of 32 bytes of B.
+// Rows 0 & 1 and rows 2 & 3 are put in two registers and vpermt2b picks the bytes
+// in VNNI order, 64 bytes at a time. Tails of N and K are loaded as zeros with masks.
+// The indices of vpermt2b for the two halves of a packed row, 16 columns each:
+// out byte j of a packed row is row j % 4, column j / 4 of B.
+// Index bit 6 selects the second register (rows 2 & 3) and bit 5 the odd row within a register.
+// The indices are computed once, so that they are cheap to load for each block.
+__attribute__((target("avx512f")))
+inline __m512i pack_vnni_index_int8(int h) {
+    static const std::array<uint8_t, 128> idx = [] {
+        std::array<uint8_t, 128> t;
+        for (int j = 0; j < 128; ++j) {
+            int n = j / 64 * 16 + j % 64 / 4;
+            int i = j % 4;
+            t[j] = (uint8_t)((i / 2) * 64 + (i % 2) * 32 + n);
+        }
+        return t;
+    }();
+    return _mm512_loadu_si512(idx.data() + h * 64);
+}
+
+// One row of the VNNI layout: columns [n0, n0 + 32) of rows [k0, k0 + 4) of in [K, ld], as 32 dwords
+// of 4 bytes, 16 columns in lo and 16 in hi. Columns not in mask and rows beyond K are zeros.
+__attribute__((target("avx512f,avx512bw,avx512vl,avx512vbmi")))
+inline void pack_vnni_row_avx512(const int8_t* in, int ld, int K, int k0, int n0, __mmask32 mask, __m512i idx0,
+                                 __m512i idx1, __m512i& lo, __m512i& hi) {
+    __m256i rows[4];
+    for (int i = 0; i < 4; ++i) {
+        rows[i] = k0 + i < K ? _mm256_maskz_loadu_epi8(mask, in + (size_t)(k0 + i) * ld + n0) : _mm256_setzero_si256();
+    }
+    __m512i r01 = _mm512_inserti64x4(_mm512_castsi256_si512(rows[0]), rows[1], 1);
+    __m512i r23 = _mm512_inserti64x4(_mm512_castsi256_si512(rows[2]), rows[3], 1);
+    lo = _mm512_permutex2var_epi8(r01, idx0, r23);
+    hi = _mm512_permutex2var_epi8(r01, idx1, r23);
+}
+
+// Pack block (kc, nc) of int8 B to out with AVX-512
+__attribute__((target("avx512f,avx512bw,avx512vl,avx512vbmi")))
+inline void pack_B_block_avx512(const int8_t* in, int K, int N, int ldb, int kc, int nc, int8_t* out) {
+    constexpr int block_k = gemm_block_k<int8_t>();
+    const __m512i idx0 = pack_vnni_index_int8(0);
+    const __m512i idx1 = pack_vnni_index_int8(1);
+    int n0 = nc * GEMM_BLOCK_N;
+    int cols = std::min(GEMM_BLOCK_N, N - n0);
+    __mmask32 mask = cols == 32 ? (__mmask32)~0u : (__mmask32)((1u << cols) - 1);
+    int8_t* dst = out;
+    for (int k0 = kc * block_k; k0 < (kc + 1) * block_k; k0 += 4) {
+        __m512i lo, hi;
+        pack_vnni_row_avx512(in, ldb, K, k0, n0, mask, idx0, idx1, lo, hi);
+        _mm512_storeu_si512(dst, lo);
+        _mm512_storeu_si512(dst + 64, hi);
+        dst += 128;
+    }
+}
+
+// Fused packing with AVX-512, bf16.
+// A row of a packed block, [block_n, 2] = 64 words, interleaves 2 rows of 32 words of B,
+// which vpermt2w does for 32 words at a time.
+// out word j of a packed row is row j % 2, column j / 2 of B. Index bit 5 selects the second row.
+__attribute__((target("avx512f")))
+inline __m512i pack_vnni_index_bf16(int h) {
+    static const std::array<uint16_t, 64> idx = [] {
+        std::array<uint16_t, 64> t;
+        for (int j = 0; j < 64; ++j) t[j] = (uint16_t)((j % 2) * 32 + j / 32 * 16 + j % 32 / 2);
+        return t;
+    }();
+    return _mm512_loadu_si512(idx.data() + h * 32);
+}
+
+// One row of the VNNI layout: columns [n0, n0 + 32) of rows [k0, k0 + 2) of in [K, ld], as 32 dwords
+// of 2 words, 16 columns in lo and 16 in hi. Columns not in mask and rows beyond K are zeros.
+__attribute__((target("avx512f,avx512bw")))
+inline void pack_vnni_row_avx512(const bfloat16* in, int ld, int K, int k0, int n0, __mmask32 mask, __m512i idx0,
+                                 __m512i idx1, __m512i& lo, __m512i& hi) {
+    __m512i rows[2];
+    for (int i = 0; i < 2; ++i) {
+        rows[i] = k0 + i < K ? _mm512_maskz_loadu_epi16(mask, in + (size_t)(k0 + i) * ld + n0) : _mm512_setzero_si512();
+    }
+    lo = _mm512_permutex2var_epi16(rows[0], idx0, rows[1]);
+    hi = _mm512_permutex2var_epi16(rows[0], idx1, rows[1]);
+}
+
+// Pack block (kc, nc) of bf16 B to out with AVX-512
+__attribute__((target("avx512f,avx512bw")))
+inline void pack_B_block_avx512(const bfloat16* in, int K, int N, int ldb, int kc, int nc, bfloat16* out) {
+    constexpr int block_k = gemm_block_k<bfloat16>();
+    const __m512i idx0 = pack_vnni_index_bf16(0);
+    const __m512i idx1 = pack_vnni_index_bf16(1);
+    int n0 = nc * GEMM_BLOCK_N;
+    int cols = std::min(GEMM_BLOCK_N, N - n0);
+    __mmask32 mask = cols == 32 ? (__mmask32)~0u : (__mmask32)((1u << cols) - 1);
+    uint16_t* dst = (uint16_t*)out;
+    for (int k0 = kc * block_k; k0 < (kc + 1) * block_k; k0 += 2) {
+        __m512i lo, hi;
+        pack_vnni_row_avx512(in, ldb, K, k0, n0, mask, idx0, idx1, lo, hi);
+        _mm512_storeu_si512(dst, lo);
+        _mm512_storeu_si512(dst + 32, hi);
+        dst += 64;
+    }
+}
+
+// Fused packing with AVX-512: write each block of packed B in order
+template <typename T>
+__attribute__((target("avx512f,avx512bw,avx512vl,avx512vbmi")))
+void pack_B_fused_avx512(const T* in, int K, int N, int ldb, T* out) {
+    constexpr int block_k = gemm_block_k<T>();
+    int KC = (K + block_k - 1) / block_k;
+    int NC = gemm_round_up(N, GEMM_BLOCK_N) / GEMM_BLOCK_N;
+    T* dst = out;
+    for (int kc = 0; kc < KC; ++kc) {
+        for (int nc = 0; nc < NC; ++nc, dst += block_k * GEMM_BLOCK_N) pack_B_block_avx512(in, K, N, ldb, kc, nc, dst);
+    }
+}
+
+// Whether the CPU can run pack_B_fused_avx512 for T
+template <typename T>
+bool pack_B_has_avx512() {
+    __builtin_cpu_init();
+    if constexpr (std::is_same<T, int8_t>::value) {
+        return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl") &&
+               __builtin_cpu_supports("avx512vbmi");
+    } else {
+        return __builtin_cpu_supports("avx512bw");
+    }
+}
+
+// Pack B to blocked & VNNI layout, see pack_B_two_step for the layout.
+// Uses AVX-512 if available, otherwise fused scalar code.
+// out should hold packed_B_size<T>(K, N) elements.
+// uint8 B is packed as bytes, the same as int8.
+template <typename T>
+void pack_B(const T* in, int K, int N, int ldb, T* out) {
+    if constexpr (std::is_same<T, uint8_t>::value) {
+        pack_B((const int8_t*)in, K, N, ldb, (int8_t*)out);
+    } else {
+        GEMM_PROFILE_CALL("pack_B", 0, N, K);
+        GEMM_PROFILE_SCOPE(GEMM_PHASE_PACK_B);
+        static const bool has_avx512 = pack_B_has_avx512<T>();
+        if (has_avx512) pack_B_fused_avx512(in, K, N, ldb, out);
+        else pack_B_fused_scalar(in, K, N, ldb, out);
+    }
+}
+
+// Pack block (kc, nc) of B [K, N] alone to out (block_k x block_n elements), as pack_B packs it,
+// e.g., to pack only some blocks of B (gemm_sparse.h)
+template <typename T>
+void pack_B_block(const T* in, int K, int N, int ldb, int kc, int nc, T* out) {
+    if constexpr (std::is_same<T, uint8_t>::value) {
+        pack_B_block((const int8_t*)in, K, N, ldb, kc, nc, (int8_t*)out);
+    } else {
+        static const bool has_avx512 = pack_B_has_avx512<T>();
+        if (has_avx512) pack_B_block_avx512(in, K, N, ldb, kc, nc, out);
+        else pack_B_block_scalar(in, K, N, ldb, kc, nc, out);
+    }
+}
+
+// Transposed inputs: B stored as [N, K] (B^T row-major, e.g., weights of a linear layer) and
+// A stored as [K, M] (column-major A). Both are packed to the same layouts as pack_B and pack_A_panel,
+// block by block, without a transpose of the whole matrix.
+// In both layouts, vnni consecutive elements along K make a dword: a row of 64 bytes of B^T is
+// 16 dwords of one column of B, which are a column of 16 dwords in a packed block of B [16, 32 dwords];
+// and a packed row of A^T as B (pack_vnni_row_avx512) is a column of dwords of a block of A [32, 16 dwords].
+// So both come down to transposes of 16 x 16 dwords.
+
+// Transpose 16 x 16 dwords in r: r[i] holds row i, and then column i
+__attribute__((target("avx512f")))
+inline void gemm_transpose_16x16_epi32(__m512i r[16]) {
+    __m512i t[16];
+    // 2 x 2 blocks of dwords, then of qwords, within each lane of 128 bits
+    for (int i = 0; i < 16; i += 2) {
+        t[i] = _mm512_unpacklo_epi32(r[i], r[i + 1]);
+        t[i + 1] = _mm512_unpackhi_epi32(r[i], r[i + 1]);
+    }
+    for (int i = 0; i < 16; i += 4) {
+        r[i] = _mm512_unpacklo_epi64(t[i], t[i + 2]);
+        r[i + 1] = _mm512_unpackhi_epi64(t[i], t[i + 2]);
+        r[i + 2] = _mm512_unpacklo_epi64(t[i + 1], t[i + 3]);
+        r[i + 3] = _mm512_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+    // 4 x 4 lanes
+    for (int i = 0; i < 4; ++i) {
+        t[i] = _mm512_shuffle_i32x4(r[i], r[i + 4], 0x88);
+        t[i + 4] = _mm512_shuffle_i32x4(r[i], r[i + 4], 0xdd);
+        t[i + 8] = _mm512_shuffle_i32x4(r[i + 8], r[i + 12], 0x88);
+        t[i + 12] = _mm512_shuffle_i32x4(r[i + 8], r[i + 12], 0xdd);
+    }
+    for (int i = 0; i < 4; ++i) {
+        r[i] = _mm512_shuffle_i32x4(t[i], t[i + 8], 0x88);
+        r[i + 8] = _mm512_shuffle_i32x4(t[i], t[i + 8], 0xdd);
+        r[i + 4] = _mm512_shuffle_i32x4(t[i + 4], t[i + 12], 0x88);
+        r[i + 12] = _mm512_shuffle_i32x4(t[i + 4], t[i + 12], 0xdd);
+    }
+}
+
+// Pack B given as B^T [N, K] with leading dimension ldb >= K, in scalar code
+template <typename T>
+void pack_B_trans_scalar(const T* in, int K, int N, int ldb, T* out) {
+    constexpr int block_k = gemm_block_k<T>();
+    constexpr int vnni = gemm_vnni_size<T>();
+    int Np = gemm_round_up(N, GEMM_BLOCK_N);
+    int KC = (K + block_k - 1) / block_k;
+    int NC = Np / GEMM_BLOCK_N;
+    T* dst = out;
+    for (int kc = 0; kc < KC; ++kc) {
+        for (int nc = 0; nc < NC; ++nc) {
+            for (int k0 = kc * block_k; k0 < (kc + 1) * block_k; k0 += vnni) {
+                for (int nb = 0; nb < GEMM_BLOCK_N; ++nb) {
+                    int n = nc * GEMM_BLOCK_N + nb;
+                    for (int i = 0; i < vnni; ++i) {
+                        *dst++ = n < N && k0 + i < K ? in[(size_t)n * ldb + k0 + i] : T();
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Pack B given as B^T [N, K] with AVX-512: load 32 rows of B^T of 64 bytes (K tails masked),
+// transpose them as two 16 x 16 blocks of dwords and store 16 rows of 32 dwords of the packed block.
+template <typename T>
+__attribute__((target("avx512f,avx512bw")))
+void pack_B_trans_avx512(const T* in, int K, int N, int ldb, T* out) {
+    constexpr int block_k = gemm_block_k<T>();
+    int Np = gemm_round_up(N, GEMM_BLOCK_N);
+    int KC = (K + block_k - 1) / block_k;
+    int NC = Np / GEMM_BLOCK_N;
+    char* dst = (char*)out;
+    for (int kc = 0; kc < KC; ++kc) {
+        int k0 = kc * block_k;
+        int bytes = std::min(block_k, K - k0) * (int)sizeof(T);
+        __mmask64 mask = bytes == 64 ? ~(__mmask64)0 : (((__mmask64)1 << bytes) - 1);
+        for (int nc = 0; nc < NC; ++nc) {
+            __m512i r[2][16];
+            for (int nb = 0; nb < GEMM_BLOCK_N; ++nb) {
+                int n = nc * GEMM_BLOCK_N + nb;
+                r[nb / 16][nb % 16] = n < N ? _mm512_maskz_loadu_epi8(mask, in + (size_t)n * ldb + k0)
+                                            : _mm512_setzero_si512();
+            }
+            gemm_transpose_16x16_epi32(r[0]);
+            gemm_transpose_16x16_epi32(r[1]);
+            for (int j = 0; j < 16; ++j, dst += 128) {
+                _mm512_storeu_si512(dst, r[0][j]);
+                _mm512_storeu_si512(dst + 64, r[1][j]);
+            }
+        }
+    }
+}
+
+// Pack B given as B^T [N, K] with leading dimension ldb >= K, to the layout of pack_B (of B [K, N]).
+// out should hold packed_B_size<T>(K, N) elements.
+template <typename T>
+void pack_B_trans(const T* in, int K, int N, int ldb, T* out) {
+    if constexpr (std::is_same<T, uint8_t>::value) {
+        pack_B_trans((const int8_t*)in, K, N, ldb, (int8_t*)out);
+    } else {
+        GEMM_PROFILE_CALL("pack_B", 0, N, K);
+        GEMM_PROFILE_SCOPE(GEMM_PHASE_PACK_B);
+        static const bool has_avx512 = __builtin_cpu_supports("avx512bw");
+        if (has_avx512) pack_B_trans_avx512(in, K, N, ldb, out);
+        else pack_B_trans_scalar(in, K, N, ldb, out);
+    }
+}
+
+// Column sums of int8/uint8 B [K, N], for the compensation of the zero point of A (see gemm_epilogue.h).
+// Computed once when B (weights) is packed.
+template <typename T>
+void pack_B_col_sums(const T* in, int K, int N, int ldb, int32_t* col_sums) {
+    static_assert(sizeof(T) == 1, "column sums are for int8/uint8 B");
+    std::fill(col_sums, col_sums + N, 0);
+    for (int k = 0; k < K; ++k) {
+        const T* row = in + (size_t)k * ldb;
+        for (int n = 0; n < N; ++n) col_sums[n] += row[n];
+    }
+}
+
+// Column sums of int8/uint8 B given as B^T [N, K], i.e., row sums of B^T
+template <typename T>
+void pack_B_trans_col_sums(const T* in, int K, int N, int ldb, int32_t* col_sums) {
+    static_assert(sizeof(T) == 1, "column sums are for int8/uint8 B");
+    for (int n = 0; n < N; ++n) {
+        const T* row = in + (size_t)n * ldb;
+        int32_t sum = 0;
+        for (int k = 0; k < K; ++k) sum += row[k];
+        col_sums[n] = sum;
+    }
+}
+
+// Row sums of int8/uint8 A for rows [m0, m1), for the compensation of the zero point of B
+template <typename T>
+void gemm_A_row_sums(const T* A, int lda, int m0, int m1, int K, int32_t* row_sums) {
+    for (int m = m0; m < m1; ++m) {
+        const T* row = A + (size_t)m * lda;
+        int32_t sum = 0;
+        for (int k = 0; k < K; ++k) sum += row[k];
+        row_sums[m - m0] = sum;
+    }
+}
+
+// Row sums of int8/uint8 A given as A^T [K, M], for rows [m0, m1) of A
+template <typename T>
+void gemm_A_row_sums_trans(const T* A, int lda, int m0, int m1, int K, int32_t* row_sums) {
+    std::fill(row_sums, row_sums + (m1 - m0), 0);
+    for (int k = 0; k < K; ++k) {
+        const T* row = A + (size_t)k * lda;
+        for (int m = m0; m < m1; ++m) row_sums[m - m0] += row[m];
+    }
+}
+
+// Tile config of a block of C with mb rows and nb columns (mb, nb <= 32)
+//         N
+//   +-----+-----+
+//   |  0  |  1  |
+// M +-----+-----+
+//   |  2  |  3  |
+//   +-----+-----+
+// Tiles 0-3 hold C, tiles 4 & 5 hold A (different M) and tiles 6 & 7 hold B (different N).
+// Tiles 0 & 1 have min(mb, 16) rows and tiles 2 & 3 have the rest; similarly for columns.
+// Tiles not needed by the block are left unconfigured (rows = colsb = 0).
+template <typename T>
+void gemm_block_tile_config(amx_tilecfg& cfg_data, int mb, int nb) {
+    constexpr int vnni = gemm_vnni_size<T>();
+    int rows[2] = {std::min(mb, 16), std::max(mb - 16, 0)};
+    int cols[2] = {std::min(nb, 16), std::max(nb - 16, 0)};
+    cfg_data.palette_id = 1;
+    cfg_data.start_row = 0;
+    for (int i = 0; i < 2; ++i) {
+        for (int j = 0; j < 2; ++j) {
+            bool used = rows[i] > 0 && cols[j] > 0;
+            // config for C
+            cfg_data.rows[i * 2 + j] = used ? rows[i] : 0;
+            cfg_data.colsb[i * 2 + j] = used ? cols[j] * 4 : 0;
+        }
+        // config for A
+        cfg_data.rows[4 + i] = rows[i];
+        cfg_data.colsb[4 + i] = rows[i] > 0 ? 64 : 0;
+        // config for B
+        cfg_data.rows[6 + i] = cols[i] > 0 ? 64 / sizeof(T) / vnni : 0;
+        cfg_data.colsb[6 + i] = cols[i] * vnni * sizeof(T);
+    }
+}
+
+// The config currently loaded by this thread, so that we only call _tile_loadconfig
+// when the config changes (i.e., at M & N tails).
+// Call gemm_tile_config_invalidate() after loading another config or releasing tiles.
+struct gemm_tile_config_state {
+    bool valid = false;
+    amx_tilecfg cfg_data;
+};
+inline thread_local gemm_tile_config_state gemm_tile_config_current;
+
+inline void gemm_tile_config_invalidate() {
+    gemm_tile_config_current.valid = false;
+}
+
+template <typename T>
+void gemm_configure_block(int mb, int nb) {
+    auto& cur = gemm_tile_config_current;
+    amx_tilecfg cfg_data;
+    gemm_block_tile_config<T>(cfg_data, mb, nb);
+    if (cur.valid && !std::memcmp(&cur.cfg_data, &cfg_data, sizeof(cfg_data))) return;
+    amx_tile_loadconfig(&cfg_data);
+    cur.cfg_data = cfg_data;
+    cur.valid = true;
+}
+
+// dot product of tiles, (u)int8 * (u)int8 -> int32 or bf16 * bf16 -> float,
+// with T & TB the types of A & B. Tile numbers must be literals.
+#define GEMM_TILE_DP(T, TB, dst, src1, src2)                                        \
+    do {                                                                            \
+        if constexpr (std::is_same<T, bfloat16>::value)                             \
+            amx_tile_dpbf16ps(dst, src1, src2);                                     \
+        else if constexpr (std::is_same<T, int8_t>::value && std::is_same<TB, int8_t>::value) \
+            amx_tile_dpbssd(dst, src1, src2);                                       \
+        else if constexpr (std::is_same<T, int8_t>::value)                          \
+            amx_tile_dpbsud(dst, src1, src2);                                       \
+        else if constexpr (std::is_same<TB, int8_t>::value)                         \
+            amx_tile_dpbusd(dst, src1, src2);                                       \
+        else                                                                        \
+            amx_tile_dpbuud(dst, src1, src2);                                       \
+    } while (0)
+
+// Compute one block of C = A x B with mb rows and nb columns, accumulating over KC blocks of K.
+// A is the top-left of the block row in A, rows are a_stride bytes apart and K blocks are a_step elements apart.
+// If A_tail is not null, it replaces the last K block of A (a [32, block_k] buffer with K tail padded with zeros).
+// B is the first K block of the block column in packed B and the K blocks are b_step elements apart.
+// If accumulate is set, results are added to C, otherwise C is overwritten.
+// If k_index is not null, step kc multiplies K block k_index[kc] of A with block kc of B,
+// e.g., to skip the zero blocks of a block-sparse B (gemm_sparse.h).
+template <typename T, typename TB, typename Acc>
+void gemm_block(const T* A, long a_stride, size_t a_step, const T* A_tail, const TB* B, size_t b_step,
+                Acc* C, int ldc, int mb, int nb, int KC, bool accumulate = false, const int* k_index = nullptr) {
+    constexpr int block_k = gemm_block_k<T>();
+    constexpr int vnni = gemm_vnni_size<T>();
+    bool m1 = mb > 16;
+    bool n1 = nb > 16;
+    long c_stride = (long)ldc * sizeof(Acc);
+    GEMM_PROFILE_SCOPE(GEMM_PHASE_KERNEL);
+    // 1. clear C tiles, or load them to accumulate on the partial results
+    if (accumulate) {
+        amx_tile_loadd(0, C, c_stride);
+        if (n1) amx_tile_loadd(1, C + 16, c_stride);
+        if (m1) amx_tile_loadd(2, C + 16 * ldc, c_stride);
+        if (m1 && n1) amx_tile_loadd(3, C + 16 * ldc + 16, c_stride);
+    } else {
+        amx_tile_zero(0);
+        if (n1) amx_tile_zero(1);
+        if (m1) amx_tile_zero(2);
+        if (m1 && n1) amx_tile_zero(3);
+    }
+    // 2. loop over K
+    for (int kc = 0; kc < KC; ++kc) {
+        const T* a = A + (k_index ? k_index[kc] : kc) * a_step;
+        long a_ld = a_stride;
+        if (A_tail && kc == KC - 1) {
+            a = A_tail;
+            a_ld = block_k * sizeof(T);
+        }
+        const TB* b = B + kc * b_step;
+        // 2.1 load a block of A to tile 4 & 5 (different M)
+        amx_tile_loadd(4, a, a_ld);
+        if (m1) amx_tile_loadd(5, (const char*)a + 16 * a_ld, a_ld);
+        // 2.2 load a block of B [block_k/vnni, block_n, vnni] to tile 6 & 7 (different N)
+        amx_tile_loadd(6, b, /* stride */ GEMM_BLOCK_N * vnni * sizeof(T));
+        if (n1) amx_tile_loadd(7, b + 16 * vnni, /* stride */ GEMM_BLOCK_N * vnni * sizeof(T));
+        // 2.3 compute GEMM of one block (dot product)
+        GEMM_TILE_DP(T, TB, 0, 4, 6);
+        if (n1) GEMM_TILE_DP(T, TB, 1, 4, 7);
+        if (m1) GEMM_TILE_DP(T, TB, 2, 5, 6);
+        if (m1 && n1) GEMM_TILE_DP(T, TB, 3, 5, 7);
+    }
+    // 3. store results to C buffer
+    GEMM_PROFILE_NEXT(GEMM_PHASE_STORE);
+    amx_tile_stored(0, C, c_stride);
+    if (n1) amx_tile_stored(1, C + 16, c_stride);
+    if (m1) amx_tile_stored(2, C + 16 * ldc, c_stride);
+    if (m1 && n1) amx_tile_stored(3, C + 16 * ldc + 16, c_stride);
+}
+
+// Same as gemm_block with a kernel generated by gemm_jit.h for the block (see gemm_jit_key).
+// Falls back to gemm_block if the JIT is disabled or fails.
+template <typename T, typename TB, typename Acc>
+void gemm_block_jit(const T* A, long a_stride, size_t a_step, const T* A_tail, const TB* B, size_t b_step,
+                    Acc* C, int ldc, int mb, int nb, int KC, bool accumulate = false) {
+    gemm_jit_kernel kernel = nullptr;
+    if (gemm_jit_enabled()) {
+        gemm_jit_key key = {gemm_jit_dp_of<T, TB>(), mb > 16 ? 32 : 16, nb > 16 ? 32 : 16, A_tail != nullptr,
+                            accumulate, a_stride, (long)(a_step * sizeof(T)), (long)(b_step * sizeof(TB)),
+                            (long)ldc * (long)sizeof(Acc)};
+        kernel = gemm_jit_get(key);
+    }
+    if (kernel) {
+        GEMM_PROFILE_SCOPE(GEMM_PHASE_KERNEL);
+        kernel(A, B, C, A_tail, KC - (A_tail ? 1 : 0));
+#ifdef GEMM_PROFILE
+        // the generated code does not go through amx_tile_*, count its tile instructions here
+        int a_tiles = mb > 16 ? 2 : 1;
+        int b_tiles = nb > 16 ? 2 : 1;
+        AMX_TILE_COUNT(loads, (accumulate ? a_tiles * b_tiles : 0) + KC * (a_tiles + b_tiles));
+        AMX_TILE_COUNT(zeros, accumulate ? 0 : a_tiles * b_tiles);
+        AMX_TILE_COUNT(dps, KC * a_tiles * b_tiles);
+        AMX_TILE_COUNT(stores, a_tiles * b_tiles);
+#endif
+    } else {
+        gemm_block(A, a_stride, a_step, A_tail, B, b_step, C, ldc, mb, nb, KC, accumulate);
+    }
+}
+
+// Prefetch rows of a tile-sized block to L1
+inline void gemm_prefetch_rows(const void* p, long stride, int rows) {
+    for (int r = 0; r < rows; ++r) _mm_prefetch((const char*)p + r * stride, _MM_HINT_T0);
+}
+
+// Same as gemm_block, software-pipelined:
+// - loads and dot products are interleaved, so that each dot product only waits for its own operands
+//   and the loads of tile 7 & 5 overlap with the dot products before them
+// - A & B of K block kc + prefetch are prefetched to L1 while computing K block kc (0 = no prefetch)
+template <typename T, typename TB, typename Acc>
+void gemm_block_pipelined(const T* A, long a_stride, size_t a_step, const T* A_tail, const TB* B, size_t b_step,
+                          Acc* C, int ldc, int mb, int nb, int KC, bool accumulate = false, int prefetch = 1) {
+    constexpr int block_k = gemm_block_k<T>();
+    constexpr int vnni = gemm_vnni_size<T>();
+    constexpr long b_stride = GEMM_BLOCK_N * vnni * sizeof(T);
+    bool m1 = mb > 16;
+    bool n1 = nb > 16;
+    long c_stride = (long)ldc * sizeof(Acc);
+    GEMM_PROFILE_SCOPE(GEMM_PHASE_KERNEL);
+    if (accumulate) {
+        amx_tile_loadd(0, C, c_stride);
+        if (n1) amx_tile_loadd(1, C + 16, c_stride);
+        if (m1) amx_tile_loadd(2, C + 16 * ldc, c_stride);
+        if (m1 && n1) amx_tile_loadd(3, C + 16 * ldc + 16, c_stride);
+    } else {
+        amx_tile_zero(0);
+        if (n1) amx_tile_zero(1);
+        if (m1) amx_tile_zero(2);
+        if (m1 && n1) amx_tile_zero(3);
+    }
+    for (int kc = 0; kc < KC; ++kc) {
+        const T* a = A + kc * a_step;
+        long a_ld = a_stride;
+        if (A_tail && kc == KC - 1) {
+            a = A_tail;
+            a_ld = block_k * sizeof(T);
+        }
+        const TB* b = B + kc * b_step;
+        if (prefetch && kc + prefetch < KC && !(A_tail && kc + prefetch == KC - 1)) {
+            gemm_prefetch_rows(A + (kc + prefetch) * a_step, a_stride, mb);
+            gemm_prefetch_rows(B + (kc + prefetch) * b_step, 64, 64 * sizeof(T) / vnni * (n1 ? 2 : 1) / 4);
+        }
+        amx_tile_loadd(4, a, a_ld);
+        amx_tile_loadd(6, b, b_stride);
+        GEMM_TILE_DP(T, TB, 0, 4, 6);
+        if (n1) {
+            amx_tile_loadd(7, b + 16 * vnni, b_stride);
+            GEMM_TILE_DP(T, TB, 1, 4, 7);
+        }
+        if (m1) {
+            amx_tile_loadd(5, (const char*)a + 16 * a_ld, a_ld);
+            GEMM_TILE_DP(T, TB, 2, 5, 6);
+            if (n1) GEMM_TILE_DP(T, TB, 3, 5, 7);
+        }
+    }
+    GEMM_PROFILE_NEXT(GEMM_PHASE_STORE);
+    amx_tile_stored(0, C, c_stride);
+    if (n1) amx_tile_stored(1, C + 16, c_stride);
+    if (m1) amx_tile_stored(2, C + 16 * ldc, c_stride);
+    if (m1 && n1) amx_tile_stored(3, C + 16 * ldc + 16, c_stride);
+}
+
+// Tile config of the 1x4 kernel for a block of C with mb <= 16 rows and up to 64 columns
+//          N
+//   +----+----+----+----+
+// M |  0 |  1 |  2 |  3 |
+//   +----+----+----+----+
+// Tiles 0-3 hold C, tiles 4 & 7 hold A of even & odd K blocks and tiles 5 & 6 take turns to hold B.
+// All tiles are 64 bytes wide, N tails are stored through a buffer.
+template <typename T>
+void gemm_block_1x4_tile_config(amx_tilecfg& cfg_data, int mb) {
+    cfg_data.palette_id = 1;
+    cfg_data.start_row = 0;
+    for (int i = 0; i < 8; ++i) {
+        bool b_tile = i == 5 || i == 6;
+        cfg_data.rows[i] = b_tile ? 64 / sizeof(T) / gemm_vnni_size<T>() : mb;
+        cfg_data.colsb[i] = 64;
+    }
+}
+
+template <typename T>
+void gemm_configure_block_1x4(int mb) {
+    auto& cur = gemm_tile_config_current;
+    amx_tilecfg cfg_data;
+    gemm_block_1x4_tile_config<T>(cfg_data, mb);
+    if (cur.valid && !std::memcmp(&cur.cfg_data, &cfg_data, sizeof(cfg_data))) return;
+    amx_tile_loadconfig(&cfg_data);
+    cur.cfg_data = cfg_data;
+    cur.valid = true;
+}
+
+// One K block of the 1x4 kernel with A in tile a_cur. The next K block of A is loaded to tile a_next
+// before the last dot product, so that it overlaps with the computation.
+#define GEMM_1X4_STEP(T, TB, a_cur, a_next)                                               \
+    do {                                                                                  \
+        const TB* b0 = B0 + kc * b_step;                                                  \
+        const TB* b1 = B1 + kc * b_step;                                                  \
+        if (prefetch && kc + prefetch < KC) {                                             \
+            gemm_prefetch_rows(a_at(kc + prefetch), a_stride, mb);                        \
+            gemm_prefetch_rows(B0 + (kc + prefetch) * b_step, 64, 32);                    \
+            if (n2) gemm_prefetch_rows(B1 + (kc + prefetch) * b_step, 64, 32);            \
+        }                                                                                 \
+        amx_tile_loadd(5, b0, b_stride);                                                  \
+        GEMM_TILE_DP(T, TB, 0, a_cur, 5);                                                     \
+        if (n1) {                                                                         \
+            amx_tile_loadd(6, b0 + 16 * vnni, b_stride);                                  \
+            GEMM_TILE_DP(T, TB, 1, a_cur, 6);                                                 \
+        }                                                                                 \
+        if (n2) {                                                                         \
+            amx_tile_loadd(5, b1, b_stride);                                              \
+            GEMM_TILE_DP(T, TB, 2, a_cur, 5);                                                 \
+        }                                                                                 \
+        if (kc + 1 < KC) amx_tile_loadd(a_next, a_at(kc + 1), a_ld(kc + 1));              \
+        if (n3) {                                                                         \
+            amx_tile_loadd(6, b1 + 16 * vnni, b_stride);                                  \
+            GEMM_TILE_DP(T, TB, 3, a_cur, 6);                                                 \
+        }                                                                                 \
+    } while (0)
+
+// Compute one block of C = A x B with mb <= 16 rows and nb <= 64 columns: one A tile and 4 C tiles,
+// which fits small M better than the 2x2 kernel. Arguments are the same as gemm_block,
+// with B0 & B1 the first K blocks of two adjacent block columns in packed B (B1 is unused if nb <= 32).
+// The config must be loaded by gemm_configure_block_1x4.
+template <typename T, typename TB, typename Acc>
+void gemm_block_1x4(const T* A, long a_stride, size_t a_step, const T* A_tail, const TB* B0, const TB* B1,
+                    size_t b_step, Acc* C, int ldc, int mb, int nb, int KC, bool accumulate = false,
+                    int prefetch = 1) {
+    constexpr int block_k = gemm_block_k<T>();
+    constexpr int vnni = gemm_vnni_size<T>();
+    constexpr long b_stride = GEMM_BLOCK_N * vnni * sizeof(T);
+    bool n1 = nb > 16;
+    bool n2 = nb > 32;
+    bool n3 = nb > 48;
+    long c_stride = (long)ldc * sizeof(Acc);
+    auto a_at = [&](int kc) { return A_tail && kc == KC - 1 ? A_tail : A + kc * a_step; };
+    auto a_ld = [&](int kc) { return A_tail && kc == KC - 1 ? (long)(block_k * sizeof(T)) : a_stride; };
+    // The tile with columns beyond nb is stored through this buffer
+    alignas(64) Acc c_tail[16 * 16];
+    int tail_tile = nb % 16 ? nb / 16 : -1;
+    Acc* c_tail_dst = C + (nb / 16) * 16;
+    int tail_cols = nb % 16;
+    GEMM_PROFILE_SCOPE(GEMM_PHASE_KERNEL);
+    if (accumulate) {
+        if (tail_tile >= 0) {
+            for (int m = 0; m < mb; ++m) {
+                for (int n = 0; n < 16; ++n) c_tail[m * 16 + n] = n < tail_cols ? c_tail_dst[(size_t)m * ldc + n] : 0;
+            }
+        }
+        auto c_at = [&](int j) { return j == tail_tile ? c_tail : C + j * 16; };
+        long c_ld[4];
+        for (int j = 0; j < 4; ++j) c_ld[j] = j == tail_tile ? 16 * sizeof(Acc) : c_stride;
+        amx_tile_loadd(0, c_at(0), c_ld[0]);
+        if (n1) amx_tile_loadd(1, c_at(1), c_ld[1]);
+        if (n2) amx_tile_loadd(2, c_at(2), c_ld[2]);
+        if (n3) amx_tile_loadd(3, c_at(3), c_ld[3]);
+    } else {
+        amx_tile_zero(0);
+        if (n1) amx_tile_zero(1);
+        if (n2) amx_tile_zero(2);
+        if (n3) amx_tile_zero(3);
+    }
+    if (KC > 0) amx_tile_loadd(4, a_at(0), a_ld(0));
+    // unrolled by 2 so that A alternates between tiles 4 & 7
+    int kc = 0;
+    for (; kc + 1 < KC; ++kc) {
+        GEMM_1X4_STEP(T, TB, 4, 7);
+        ++kc;
+        GEMM_1X4_STEP(T, TB, 7, 4);
+    }
+    if (kc < KC) GEMM_1X4_STEP(T, TB, 4, 7);
+    GEMM_PROFILE_NEXT(GEMM_PHASE_STORE);
+    auto store = [&](int j) { return j == tail_tile ? c_tail : C + j * 16; };
+    long s_ld[4];
+    for (int j = 0; j < 4; ++j) s_ld[j] = j == tail_tile ? 16 * sizeof(Acc) : c_stride;
+    amx_tile_stored(0, store(0), s_ld[0]);
+    if (n1) amx_tile_stored(1, store(1), s_ld[1]);
+    if (n2) amx_tile_stored(2, store(2), s_ld[2]);
+    if (n3) amx_tile_stored(3, store(3), s_ld[3]);
+    if (tail_tile >= 0) {
+        for (int m = 0; m < mb; ++m) {
+            std::memcpy(c_tail_dst + (size_t)m * ldc, c_tail + m * 16, tail_cols * sizeof(Acc));
+        }
+    }
+}
+
+// Cache sizes in bytes, from sysconf or sysfs, with defaults of Sapphire Rapids if unknown.
+struct gemm_cache_sizes {
+    size_t l1 = 48 << 10;
+    size_t l2 = 2 << 20;
+    size_t l3 = 32 << 20;
+};
+
+inline size_t gemm_read_sysfs_cache_size(int level) {
+    for (int index = 0; index < 8; ++index) {
+        std::string dir = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/";
+        FILE* f = std::fopen((dir + "level").c_str(), "r");
+        if (!f) break;
+        int l = 0;
+        bool match = std::fscanf(f, "%d", &l) == 1 && l == level;
+        std::fclose(f);
+        if (!match) continue;
+        f = std::fopen((dir + "type").c_str(), "r");
+        char type[32] = {0};
+        if (f) {
+            if (std::fscanf(f, "%31s", type) != 1) type[0] = 0;
+            std::fclose(f);
+        }
+        if (!std::strcmp(type, "Instruction")) continue;
+        f = std::fopen((dir + "size").c_str(), "r");
+        size_t size = 0;
+        char unit = 0;
+        if (f) {
+            if (std::fscanf(f, "%zu%c", &size, &unit) < 1) size = 0;
+            std::fclose(f);
+        }
+        if (unit == 'K') size <<= 10;
+        else if (unit == 'M') size <<= 20;
+        return size;
+    }
+    return 0;
+}
+
+inline gemm_cache_sizes gemm_detect_cache_sizes() {
+    static const gemm_cache_sizes sizes = [] {
+        gemm_cache_sizes c;
+        const int names[3] = {_SC_LEVEL1_DCACHE_SIZE, _SC_LEVEL2_CACHE_SIZE, _SC_LEVEL3_CACHE_SIZE};
+        size_t* fields[3] = {&c.l1, &c.l2, &c.l3};
+        for (int level = 1; level <= 3; ++level) {
+            long size = sysconf(names[level - 1]);
+            if (size <= 0) size = (long)gemm_read_sysfs_cache_size(level);
+            if (size > 0) *fields[level - 1] = size;
+        }
+        return c;
+    }();
+    return sizes;
+}
+
+// Panel sizes of the outer (GOTO/BLIS-style) blocking around the 32x32 block kernel.
+// mc, nc & kc are in elements and multiples of block_m, block_n & block_k.
+// For each [kc, nc] panel of B and each [mc, kc] panel of A, the blocks of C in the panel are computed
+// column by column: the B panel stays in L2 while the A panel is read from L1/L2 for every column.
+// C is loaded to tiles and stored once per kc panel.
+// If pack_A is set, the A panel is copied to a contiguous buffer in tile order first.
+// kernel selects the block kernel and prefetch its prefetch distance in K blocks (0 = no prefetch).
+// loop_order may compute the blocks of a panel row by row instead.
+// If tuned is set, the GEMM first looks up the shape in the tuning cache (see gemm_tuning_find below)
+// and uses these values only if the shape was not tuned.
+enum gemm_kernel_type {
+    GEMM_KERNEL_AUTO,           // gemm_select_kernel by shape
+    GEMM_KERNEL_2X2,            // gemm_block, as the large examples
+    GEMM_KERNEL_2X2_PIPELINED,  // gemm_block_pipelined
+    GEMM_KERNEL_1X4,            // gemm_block_1x4, for small M
+    GEMM_KERNEL_JIT,            // gemm_block_jit, generated for the block shape & strides
+};
+
+// Order of the blocks of C within a panel
+enum gemm_loop_order {
+    GEMM_LOOP_COLUMNS,  // column by column: a block of B is reused for the blocks of the A panel
+    GEMM_LOOP_ROWS,     // row by row: a block row of A is reused for the blocks of the B panel
+};
+
+struct gemm_blocking {
+    int mc;
+    int nc;
+    int kc;
+    bool pack_A;
+    gemm_kernel_type kernel = GEMM_KERNEL_AUTO;
+    int prefetch = 1;
+    gemm_loop_order loop_order = GEMM_LOOP_COLUMNS;
+    bool tuned = false;
+};
+
+inline const char* gemm_kernel_name(gemm_kernel_type kernel) {
+    static const char* names[] = {"auto", "2x2", "2x2-pipelined", "1x4", "jit"};
+    return names[kernel];
+}
+
+// Kernel by its name. Returns false if the name is unknown.
+inline bool gemm_kernel_from_name(const std::string& name, gemm_kernel_type& kernel) {
+    for (int k = GEMM_KERNEL_AUTO; k <= GEMM_KERNEL_JIT; ++k) {
+        if (name == gemm_kernel_name((gemm_kernel_type)k)) {
+            kernel = (gemm_kernel_type)k;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Kernel for GEMM with M rows: one row of 16 x 64 C tiles if M fits in a tile, otherwise 32 x 32 blocks.
+// On the machines measured so far (bench-gemm-kernels), the pipelined 2x2 kernel does not beat
+// the plain one on large M, so it is only used when asked for.
+inline gemm_kernel_type gemm_select_kernel(int M) {
+    return M <= 16 ? GEMM_KERNEL_1X4 : GEMM_KERNEL_2X2;
+}
+
+// Blocking from the cache sizes:
+// - a [32, kc] block row of A fills L1
+// - a [mc, kc] panel of A fills 2 x L1, so it stays in L2 next to B
+// - a [kc, nc] panel of B takes 3/4 of L2
+// These give kc = 1536 bytes, mc = 64 and nc = 1024 on Sapphire Rapids (48 KB L1, 2 MB L2).
+template <typename T>
+gemm_blocking gemm_default_blocking() {
+    static const gemm_blocking blocking = [] {
+        constexpr int block_k = gemm_block_k<T>();
+        gemm_cache_sizes c = gemm_detect_cache_sizes();
+        gemm_blocking b;
+        size_t kc_bytes = std::max<size_t>(c.l1 / GEMM_BLOCK_M / 64 * 64, 64);
+        b.kc = (int)(kc_bytes / sizeof(T)) / block_k * block_k;
+        b.mc = std::max<int>(GEMM_BLOCK_M, (int)(2 * c.l1 / kc_bytes) / GEMM_BLOCK_M * GEMM_BLOCK_M);
+        b.nc = std::max<int>(GEMM_BLOCK_N, (int)(c.l2 * 3 / 4 / kc_bytes) / GEMM_BLOCK_N * GEMM_BLOCK_N);
+        b.pack_A = true;
+        return b;
+    }();
+    return blocking;
+}
+
+// Blocking without outer panels: the whole range in one panel and A read in place.
+// This is the loop of the large examples: mc -> nc -> kc.
+inline gemm_blocking gemm_unblocked() {
+    return {1 << 30, 1 << 30, 1 << 30, false, GEMM_KERNEL_2X2, 0};
+}
+
+// The default blocking, used for shapes not in the tuning cache: the default of the GEMM entry points
+template <typename T>
+gemm_blocking gemm_tuned_blocking() {
+    gemm_blocking b = gemm_default_blocking<T>();
+    b.tuned = true;
+    return b;
+}
+
+// Name of the data types of A & B in the tuning cache
+template <typename T, typename TB>
+const char* gemm_dtype_name() {
+    if constexpr (std::is_same<T, bfloat16>::value) return "bf16";
+    else if constexpr (std::is_same<T, int8_t>::value) return std::is_same<TB, int8_t>::value ? "int8" : "s8u8";
+    else return std::is_same<TB, int8_t>::value ? "uint8" : "u8u8";
+}
+
+// Tuning cache: the fastest blocking and split over threads of each tuned shape (see gemm_autotune.h).
+// It is loaded from the file named by GEMM_TUNING_CACHE on first use; the GEMM entry points look up
+// the exact dtype, shape & number of threads when called with a tuned blocking.
+// The file has one shape per line, and '#' starts a comment:
+//   dtype M N K threads mc nc kc pack_A kernel prefetch loop_order tm tn tk seconds
+// e.g., "bf16 1024 1024 1024 1 64 1024 768 1 2x2 1 columns 1 1 1 0.0072".
+// tm, tn & tk split the blocks over threads in gemm_amx_parallel (0 = chosen by gemm_partition_grid)
+// and seconds is the median time measured when tuning.
+struct gemm_tuning_key {
+    std::string dtype;
+    int M;
+    int N;
+    int K;
+    int threads;
+
+    bool operator<(const gemm_tuning_key& o) const {
+        return std::tie(dtype, M, N, K, threads) < std::tie(o.dtype, o.M, o.N, o.K, o.threads);
+    }
+};
+
+struct gemm_tuning_entry {
+    gemm_blocking blocking = gemm_default_blocking<int8_t>();
+    int tm = 0;
+    int tn = 0;
+    int tk = 0;
+    double seconds = 0;
+};
+
+struct gemm_tuning_cache {
+    std::mutex mutex;
+    std::map<gemm_tuning_key, gemm_tuning_entry> entries;
+    std::atomic<bool> empty{true};
+};
+inline gemm_tuning_cache gemm_tuned_shapes;
+
+inline std::string gemm_tuning_format(const gemm_tuning_key& key, const gemm_tuning_entry& e) {
+    const gemm_blocking& b = e.blocking;
+    std::ostringstream line;
+    line << key.dtype << " " << key.M << " " << key.N << " " << key.K << " " << key.threads << " " << b.mc << " "
+         << b.nc << " " << b.kc << " " << (b.pack_A ? 1 : 0) << " " << gemm_kernel_name(b.kernel) << " " << b.prefetch
+         << " " << (b.loop_order == GEMM_LOOP_ROWS ? "rows" : "columns") << " " << e.tm << " " << e.tn << " " << e.tk
+         << " " << e.seconds;
+    return line.str();
+}
+
+// Parse a line of the file. Returns false if it is not a valid entry.
+inline bool gemm_tuning_parse(const std::string& line, gemm_tuning_key& key, gemm_tuning_entry& e) {
+    std::istringstream in(line);
+    std::string kernel, loop_order;
+    int pack_A;
+    gemm_blocking& b = e.blocking;
+    if (!(in >> key.dtype >> key.M >> key.N >> key.K >> key.threads >> b.mc >> b.nc >> b.kc >> pack_A >> kernel >>
+          b.prefetch >> loop_order >> e.tm >> e.tn >> e.tk >> e.seconds)) {
+        return false;
+    }
+    b.pack_A = pack_A != 0;
+    b.tuned = false;
+    if (loop_order != "rows" && loop_order != "columns") return false;
+    b.loop_order = loop_order == "rows" ? GEMM_LOOP_ROWS : GEMM_LOOP_COLUMNS;
+    return gemm_kernel_from_name(kernel, b.kernel) && b.mc > 0 && b.nc > 0 && b.kc > 0 && b.prefetch >= 0;
+}
+
+// Add or replace the entry of a shape
+inline void gemm_tuning_insert(const gemm_tuning_key& key, const gemm_tuning_entry& entry) {
+    std::lock_guard<std::mutex> lock(gemm_tuned_shapes.mutex);
+    gemm_tuned_shapes.entries[key] = entry;
+    gemm_tuned_shapes.empty = false;
+}
+
+// Add the entries of a file to the cache. Returns false if the file cannot be read or has invalid lines.
+inline bool gemm_tuning_load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "Cannot open tuning cache " << path << "\n";
+        return false;
+    }
+    std::string line;
+    int line_number = 0;
+    bool ok = true;
+    while (std::getline(file, line)) {
+        ++line_number;
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') continue;
+        gemm_tuning_key key;
+        gemm_tuning_entry entry;
+        if (!gemm_tuning_parse(line, key, entry)) {
+            std::cout << "Invalid entry at " << path << ":" << line_number << "\n";
+            ok = false;
+            continue;
+        }
+        gemm_tuning_insert(key, entry);
+    }
+    return ok;
+}
+
+// Write all entries of the cache to a file. Returns false on errors.
+inline bool gemm_tuning_save(const std::string& path) {
+    std::ofstream file(path);
+    file << "# dtype M N K threads mc nc kc pack_A kernel prefetch loop_order tm tn tk seconds\n";
+    {
+        std::lock_guard<std::mutex> lock(gemm_tuned_shapes.mutex);
+        for (const auto& e : gemm_tuned_shapes.entries) file << gemm_tuning_format(e.first, e.second) << "\n";
+    }
+    if (!file) {
+        std::cout << "Cannot write tuning cache " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Look up a shape in the cache. Returns false if it was not tuned.
+inline bool gemm_tuning_find(const gemm_tuning_key& key, gemm_tuning_entry& entry) {
+    static const bool loaded = [] {
+        const char* path = std::getenv("GEMM_TUNING_CACHE");
+        return path && *path && gemm_tuning_load(path);
+    }();
+    (void)loaded;
+    if (gemm_tuned_shapes.empty) return false;
+    std::lock_guard<std::mutex> lock(gemm_tuned_shapes.mutex);
+    auto it = gemm_tuned_shapes.entries.find(key);
+    if (it == gemm_tuned_shapes.entries.end()) return false;
+    entry = it->second;
+    return true;
+}
+
+// The blocking for a GEMM: the tuned one of the shape if blocking.tuned is set and the shape is in the cache,
+// otherwise blocking. entry receives the split over threads (0 if not tuned).
+template <typename T, typename TB>
+gemm_blocking gemm_lookup_blocking(const gemm_blocking& blocking, int M, int N, int K, int threads,
+                                   gemm_tuning_entry* entry = nullptr) {
+    gemm_tuning_entry e;
+    e.blocking = blocking;
+    if (blocking.tuned) gemm_tuning_find({gemm_dtype_name<T, TB>(), M, N, K, threads}, e);
+    if (entry) *entry = e;
+    return e.blocking;
+}
+
+// Copy blocks [mc0, mc1) x [kc0, kc1) of A to out in the order the block kernel reads them:
+// [mc1 - mc0, kc1 - kc0, block_m, block_k]. Rows beyond M and columns beyond K are zero.
+template <typename T>
+void pack_A_panel(const T* A, int lda, int M, int K, int mc0, int mc1, int kc0, int kc1, T* out) {
+    constexpr int block_k = gemm_block_k<T>();
+    T* dst = out;
+    for (int mc = mc0; mc < mc1; ++mc) {
+        for (int kc = kc0; kc < kc1; ++kc) {
+            int k0 = kc * block_k;
+            int cols = std::max(0, std::min(block_k, K - k0));
+            for (int mb = 0; mb < GEMM_BLOCK_M; ++mb, dst += block_k) {
+                int m = mc * GEMM_BLOCK_M + mb;
+                if (m < M && cols == block_k) {
+                    std::memcpy(dst, A + (size_t)m * lda + k0, block_k * sizeof(T));
+                } else {
+                    if (m < M) std::memcpy(dst, A + (size_t)m * lda + k0, cols * sizeof(T));
+                    std::fill(dst + (m < M ? cols : 0), dst + block_k, T());
+                }
+            }
+        }
+    }
+}
+
+// pack_A_panel for fp32 A [M, K] to bf16 with AVX512-BF16: a row of a block is 32 floats,
+// converted by one _mm512_cvtne2ps_pbh (K tails loaded with masks).
+__attribute__((target("avx512f,avx512bw,avx512bf16")))
+inline void pack_A_panel_fp32_avx512bf16(const float* A, int lda, int M, int K, int mc0, int mc1, int kc0, int kc1,
+                                         bfloat16* out) {
+    constexpr int block_k = gemm_block_k<bfloat16>();
+    bfloat16* dst = out;
+    for (int mc = mc0; mc < mc1; ++mc) {
+        for (int kc = kc0; kc < kc1; ++kc) {
+            int k0 = kc * block_k;
+            int cols = std::max(0, std::min(block_k, K - k0));
+            __mmask16 lo = (__mmask16)((1u << std::min(cols, 16)) - 1);
+            __mmask16 hi = (__mmask16)(cols > 16 ? (1u << (cols - 16)) - 1 : 0);
+            for (int mb = 0; mb < GEMM_BLOCK_M; ++mb, dst += block_k) {
+                int m = mc * GEMM_BLOCK_M + mb;
+                if (m >= M) {
+                    _mm512_storeu_si512(dst, _mm512_setzero_si512());
+                    continue;
+                }
+                const float* src = A + (size_t)m * lda + k0;
+                __m512 x0 = cols == block_k ? _mm512_loadu_ps(src) : _mm512_maskz_loadu_ps(lo, src);
+                __m512 x1 = cols == block_k ? _mm512_loadu_ps(src + 16) : _mm512_maskz_loadu_ps(hi, src + 16);
+                _mm512_storeu_si512(dst, (__m512i)_mm512_cvtne2ps_pbh(x1, x0));
+            }
+        }
+    }
+}
+
+// pack_A_panel for fp32 A [M, K] to bf16, converting on the way to the panel with the kernel of bf16_convert.h
+inline void pack_A_panel_fp32(const float* A, int lda, int M, int K, int mc0, int mc1, int kc0, int kc1,
+                              bfloat16* out) {
+    constexpr int block_k = gemm_block_k<bfloat16>();
+    const bf16_convert_kernels& kernels = bf16_convert_active();
+    if (kernels.from_fp32 == bf16_from_fp32_avx512bf16) {
+        pack_A_panel_fp32_avx512bf16(A, lda, M, K, mc0, mc1, kc0, kc1, out);
+        return;
+    }
+    bfloat16* dst = out;
+    for (int mc = mc0; mc < mc1; ++mc) {
+        for (int kc = kc0; kc < kc1; ++kc) {
+            int k0 = kc * block_k;
+            int cols = std::max(0, std::min(block_k, K - k0));
+            for (int mb = 0; mb < GEMM_BLOCK_M; ++mb, dst += block_k) {
+                int m = mc * GEMM_BLOCK_M + mb;
+                if (m < M) kernels.from_fp32(A + (size_t)m * lda + k0, dst, cols);
+                std::fill(dst + (m < M ? cols : 0), dst + block_k, bfloat16());
+            }
+        }
+    }
+}
+
+// pack_A_panel for A given as A^T [K, M] with leading dimension lda >= M, in scalar code
+template <typename T>
+void pack_A_panel_trans_scalar(const T* A, int lda, int M, int K, int mc0, int mc1, int kc0, int kc1, T* out) {
+    constexpr int block_k = gemm_block_k<T>();
+    T* dst = out;
+    for (int mc = mc0; mc < mc1; ++mc) {
+        for (int kc = kc0; kc < kc1; ++kc) {
+            for (int mb = 0; mb < GEMM_BLOCK_M; ++mb) {
+                int m = mc * GEMM_BLOCK_M + mb;
+                for (int kb = 0; kb < block_k; ++kb) {
+                    int k = kc * block_k + kb;
+                    *dst++ = m < M && k < K ? A[(size_t)k * lda + m] : T();
+                }
+            }
+        }
+    }
+}
+
+// pack_A_panel for A given as A^T [K, M] with AVX-512: the 16 packed rows of the block of A^T
+// (as pack_B would pack A^T, with M as N) are transposed as two 16 x 16 blocks of dwords
+// to the 32 rows of the block of A.
+template <typename T>
+__attribute__((target("avx512f,avx512bw,avx512vl,avx512vbmi")))
+void pack_A_panel_trans_avx512(const T* A, int lda, int M, int K, int mc0, int mc1, int kc0, int kc1, T* out) {
+    constexpr int block_k = gemm_block_k<T>();
+    constexpr int vnni = gemm_vnni_size<T>();
+    __m512i idx0, idx1;
+    if constexpr (sizeof(T) == 1) {
+        idx0 = pack_vnni_index_int8(0);
+        idx1 = pack_vnni_index_int8(1);
+    } else {
+        idx0 = pack_vnni_index_bf16(0);
+        idx1 = pack_vnni_index_bf16(1);
+    }
+    char* dst = (char*)out;
+    for (int mc = mc0; mc < mc1; ++mc) {
+        int m0 = mc * GEMM_BLOCK_M;
+        int rows = std::min(GEMM_BLOCK_M, M - m0);
+        __mmask32 mask = rows == 32 ? (__mmask32)~0u : (__mmask32)((1u << rows) - 1);
+        for (int kc = kc0; kc < kc1; ++kc) {
+            __m512i r[2][16];
+            for (int g = 0; g < 16; ++g) {
+                pack_vnni_row_avx512(A, lda, K, kc * block_k + g * vnni, m0, mask, idx0, idx1, r[0][g], r[1][g]);
+            }
+            gemm_transpose_16x16_epi32(r[0]);
+            gemm_transpose_16x16_epi32(r[1]);
+            for (int mb = 0; mb < GEMM_BLOCK_M; ++mb, dst += 64) _mm512_storeu_si512(dst, r[mb / 16][mb % 16]);
+        }
+    }
+}
+
+// Pack block rows [mc0, mc1) x K blocks [kc0, kc1) of A given as A^T [K, M] (column-major A)
+// with leading dimension lda >= M, to the layout of pack_A_panel.
+template <typename T>
+void pack_A_panel_trans(const T* A, int lda, int M, int K, int mc0, int mc1, int kc0, int kc1, T* out) {
+    static const bool has_avx512 = pack_B_has_avx512<typename std::conditional<sizeof(T) == 1, int8_t, T>::type>();
+    if constexpr (sizeof(T) == 1) {
+        if (has_avx512) pack_A_panel_trans_avx512((const int8_t*)A, lda, M, K, mc0, mc1, kc0, kc1, (int8_t*)out);
+        else pack_A_panel_trans_scalar(A, lda, M, K, mc0, mc1, kc0, kc1, out);
+    } else {
+        if (has_avx512) pack_A_panel_trans_avx512(A, lda, M, K, mc0, mc1, kc0, kc1, out);
+        else pack_A_panel_trans_scalar(A, lda, M, K, mc0, mc1, kc0, kc1, out);
+    }
+}
+
+// Compute blocks [mc0, mc1) x [nc0, nc1) of C = A x B over K blocks [kc0, kc1), with B packed by pack_B.
+// Blocks are indexed in units of block_m, block_n and block_k. If the K range is only part of K,
+// C holds the partial sum of the range. Used by gemm_amx and the parallel driver.
+// With an epilogue, C is not used: each block of C is stored to a buffer and the epilogue writes the output.
+// Then the K range must be all of K and K is not split into panels, so that each block is stored once;
+// the B panel is narrowed instead to keep its size in L2.
+// With trans_a, A is given as A^T [K, M] with leading dimension lda >= M; it is always packed (pack_A_panel_trans).
+// With A_fp32 (T = bfloat16), A is not used: fp32 A_fp32 [M, K] is converted while packing (pack_A_panel_fp32).
+template <typename T, typename TB, typename Acc>
+void gemm_amx_range(int M, int N, int K, const T* A, int lda, const TB* B_packed, Acc* C, int ldc,
+                    int mc0, int mc1, int nc0, int nc1, int kc0, int kc1,
+                    const gemm_blocking& blocking = gemm_default_blocking<T>(),
+                    const gemm_epilogue* epilogue = nullptr, bool trans_a = false, const float* A_fp32 = nullptr) {
+    static_assert(sizeof(T) == sizeof(TB), "A and B must be both 8-bit integers or both bf16");
+    constexpr int block_k = gemm_block_k<T>();
+    int Np = gemm_round_up(N, GEMM_BLOCK_N);
+    int KC = (K + block_k - 1) / block_k;
+    size_t b_step = (size_t)block_k * Np;
+    // panel sizes in blocks
+    int panel_mc = std::max(1, blocking.mc / GEMM_BLOCK_M);
+    int panel_nc = std::max(1, blocking.nc / GEMM_BLOCK_N);
+    int panel_kc = std::max(1, blocking.kc / block_k);
+    if (epilogue && panel_kc < kc1 - kc0) {
+        panel_nc = std::max(1, (int)((long)panel_nc * panel_kc / (kc1 - kc0)));
+        panel_kc = kc1 - kc0;
+    }
+    // Block of C for the epilogue, wide enough for both kernels
+    constexpr int c_block_ld = 2 * GEMM_BLOCK_N;
+    alignas(64) Acc c_block[GEMM_BLOCK_M * c_block_ld];
+    gemm_epilogue ep;
+    if (epilogue) {
+        ep = *epilogue;
+        ep.K = K;
+    }
+    // Buffers of the panel of A, from the scratch arena of this thread (reused across calls)
+    arena_scope scratch(arena_thread_scratch());
+    size_t panel_rows = (size_t)std::min(panel_mc, mc1 - mc0) * GEMM_BLOCK_M;
+    // Row sums of the A panel, for the zero point of B
+    int32_t* a_row_sums = epilogue && ep.b_zero_point ? scratch.allocate<int32_t>(panel_rows) : nullptr;
+    T* a_panel = blocking.pack_A || trans_a || A_fp32
+        ? scratch.allocate<T>(panel_rows * std::min(panel_kc, kc1 - kc0) * block_k)
+        : nullptr;
+    // K tails of A for a panel when A is read in place
+    T* a_tails = !a_panel && K % block_k ? scratch.allocate<T>(panel_rows * block_k) : nullptr;
+    gemm_kernel_type kernel = blocking.kernel == GEMM_KERNEL_AUTO ? gemm_select_kernel(M) : blocking.kernel;
+
+    if (kc0 == kc1) {
+        // Empty K range (K = 0): the sums are zero, so C is zeroed or the epilogue is applied to zeros
+        int m0 = mc0 * GEMM_BLOCK_M, m1 = std::min(M, mc1 * GEMM_BLOCK_M);
+        int n0 = nc0 * GEMM_BLOCK_N, n1 = std::min(N, nc1 * GEMM_BLOCK_N);
+        if (!epilogue) {
+            for (int m = m0; m < m1; ++m) std::fill(C + (size_t)m * ldc + n0, C + (size_t)m * ldc + n1, Acc(0));
+            return;
+        }
+        std::fill(c_block, c_block + GEMM_BLOCK_M * c_block_ld, Acc(0));
+        if (a_row_sums) std::fill(a_row_sums, a_row_sums + GEMM_BLOCK_M, 0);
+        GEMM_PROFILE_SCOPE(GEMM_PHASE_EPILOGUE);
+        for (int m = m0; m < m1; m += GEMM_BLOCK_M) {
+            for (int n = n0; n < n1; n += GEMM_BLOCK_N) {
+                gemm_epilogue_apply(ep, c_block, c_block_ld, m, n, std::min(GEMM_BLOCK_M, m1 - m),
+                                    std::min(GEMM_BLOCK_N, n1 - n), a_row_sums);
+            }
+        }
+        return;
+    }
+
+    for (int jc = nc0; jc < nc1; jc += panel_nc) {
+        int jc_end = std::min(jc + panel_nc, nc1);
+        for (int pc = kc0; pc < kc1; pc += panel_kc) {
+            int pc_end = std::min(pc + panel_kc, kc1);
+            bool accumulate = pc != kc0;
+            // Only the last block of K has a tail
+            int k_tail = pc_end == KC ? K % block_k : 0;
+            for (int ic = mc0; ic < mc1; ic += panel_mc) {
+                int ic_end = std::min(ic + panel_mc, mc1);
+                {
+                    GEMM_PROFILE_SCOPE(GEMM_PHASE_PACK_A);
+                    if (epilogue && ep.b_zero_point) {
+                        int m1 = std::min(M, ic_end * GEMM_BLOCK_M);
+                        if (trans_a) gemm_A_row_sums_trans(A, lda, ic * GEMM_BLOCK_M, m1, K, a_row_sums);
+                        else gemm_A_row_sums(A, lda, ic * GEMM_BLOCK_M, m1, K, a_row_sums);
+                    }
+                    if (A_fp32) {
+                        if constexpr (std::is_same<T, bfloat16>::value) {
+                            pack_A_panel_fp32(A_fp32, lda, M, K, ic, ic_end, pc, pc_end, a_panel);
+                        }
+                    } else if (trans_a) {
+                        pack_A_panel_trans(A, lda, M, K, ic, ic_end, pc, pc_end, a_panel);
+                    } else if (a_panel) {
+                        pack_A_panel(A, lda, M, K, ic, ic_end, pc, pc_end, a_panel);
+                    } else if (k_tail) {
+                        // Copy the K tail of each block row of A to a zero-padded buffer,
+                        // so that tile loads neither read beyond K nor pick up garbage.
+                        pack_A_panel(A, lda, M, K, ic, ic_end, KC - 1, KC, a_tails);
+                    }
+                }
+                if (kernel == GEMM_KERNEL_1X4) {
+                    // blocks of 16 rows x 64 columns, i.e., half a block row x 2 block columns
+                    int n_end = std::min(N, jc_end * GEMM_BLOCK_N);
+                    auto block_1x4 = [&](int jr, int ir) {
+                        int nb = std::min(2 * GEMM_BLOCK_N, n_end - jr * GEMM_BLOCK_N);
+                        const TB* b0 = packed_B_block(B_packed, pc, jr, Np);
+                        const TB* b1 = nb > GEMM_BLOCK_N ? packed_B_block(B_packed, pc, jr + 1, Np) : b0;
+                        int mb = std::min(16, M - ir * 16);
+                        // offset of the 16 rows in a [32, block_k] block
+                        size_t half = (size_t)(ir % 2) * 16 * block_k;
+                        Acc* c = epilogue ? c_block : C + (size_t)ir * 16 * ldc + jr * GEMM_BLOCK_N;
+                        int c_ld = epilogue ? c_block_ld : ldc;
+                        gemm_configure_block_1x4<T>(mb);
+                        if (a_panel) {
+                            const T* a = a_panel + (size_t)(ir / 2 - ic) * (pc_end - pc) * GEMM_BLOCK_M * block_k + half;
+                            gemm_block_1x4(a, block_k * sizeof(T), (size_t)GEMM_BLOCK_M * block_k, (const T*)nullptr,
+                                           b0, b1, b_step, c, c_ld, mb, nb, pc_end - pc, accumulate, blocking.prefetch);
+                        } else {
+                            const T* a = A + (size_t)ir * 16 * lda + (size_t)pc * block_k;
+                            const T* a_tail = k_tail ? a_tails + (size_t)(ir / 2 - ic) * GEMM_BLOCK_M * block_k + half
+                                                     : nullptr;
+                            gemm_block_1x4(a, (long)lda * sizeof(T), block_k, a_tail, b0, b1, b_step, c, c_ld, mb, nb,
+                                           pc_end - pc, accumulate, blocking.prefetch);
+                        }
+                        if (epilogue) {
+                            GEMM_PROFILE_SCOPE(GEMM_PHASE_EPILOGUE);
+                            gemm_epilogue_apply(ep, c, c_ld, ir * 16, jr * GEMM_BLOCK_N, mb, nb,
+                                                a_row_sums ? a_row_sums + (ir * 16 - ic * GEMM_BLOCK_M) : nullptr);
+                        }
+                    };
+                    int ir_end = std::min(ic_end * 2, (M + 15) / 16);
+                    if (blocking.loop_order == GEMM_LOOP_ROWS) {
+                        for (int ir = ic * 2; ir < ir_end; ++ir) {
+                            for (int jr = jc; jr < jc_end; jr += 2) block_1x4(jr, ir);
+                        }
+                    } else {
+                        for (int jr = jc; jr < jc_end; jr += 2) {
+                            for (int ir = ic * 2; ir < ir_end; ++ir) block_1x4(jr, ir);
+                        }
+                    }
+                    continue;
+                }
+                auto block_2x2 = [&](int jr, int ir) {
+                    int nb = std::min(GEMM_BLOCK_N, N - jr * GEMM_BLOCK_N);
+                    const TB* b = packed_B_block(B_packed, pc, jr, Np);
+                    int mb = std::min(GEMM_BLOCK_M, M - ir * GEMM_BLOCK_M);
+                    Acc* c = epilogue ? c_block : C + (size_t)ir * GEMM_BLOCK_M * ldc + jr * GEMM_BLOCK_N;
+                    int c_ld = epilogue ? c_block_ld : ldc;
+                    gemm_configure_block<T>(mb, nb);
+                    const T* a;
+                    long a_stride;
+                    size_t a_step;
+                    const T* a_tail = nullptr;
+                    if (a_panel) {
+                        a = a_panel + (size_t)(ir - ic) * (pc_end - pc) * GEMM_BLOCK_M * block_k;
+                        a_stride = block_k * sizeof(T);
+                        a_step = (size_t)GEMM_BLOCK_M * block_k;
+                    } else {
+                        a = A + (size_t)ir * GEMM_BLOCK_M * lda + (size_t)pc * block_k;
+                        a_stride = (long)lda * sizeof(T);
+                        a_step = block_k;
+                        if (k_tail) a_tail = a_tails + (size_t)(ir - ic) * GEMM_BLOCK_M * block_k;
+                    }
+                    if (kernel == GEMM_KERNEL_2X2_PIPELINED) {
+                        gemm_block_pipelined(a, a_stride, a_step, a_tail, b, b_step, c, c_ld, mb, nb,
+                                             pc_end - pc, accumulate, blocking.prefetch);
+                    } else if (kernel == GEMM_KERNEL_JIT) {
+                        gemm_block_jit(a, a_stride, a_step, a_tail, b, b_step, c, c_ld, mb, nb, pc_end - pc, accumulate);
+                    } else {
+                        gemm_block(a, a_stride, a_step, a_tail, b, b_step, c, c_ld, mb, nb, pc_end - pc, accumulate);
+                    }
+                    if (epilogue) {
+                        GEMM_PROFILE_SCOPE(GEMM_PHASE_EPILOGUE);
+                        gemm_epilogue_apply(ep, c, c_ld, ir * GEMM_BLOCK_M, jr * GEMM_BLOCK_N, mb, nb,
+                                            a_row_sums ? a_row_sums + (ir - ic) * GEMM_BLOCK_M : nullptr);
+                    }
+                };
+                if (blocking.loop_order == GEMM_LOOP_ROWS) {
+                    for (int ir = ic; ir < ic_end; ++ir) {
+                        for (int jr = jc; jr < jc_end; ++jr) block_2x2(jr, ir);
+                    }
+                } else {
+                    for (int jr = jc; jr < jc_end; ++jr) {
+                        for (int ir = ic; ir < ic_end; ++ir) block_2x2(jr, ir);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// C = A x B with B packed by pack_B.
+// T & TB = int8_t or uint8_t with Acc = int32_t, or T = TB = bfloat16 with Acc = float.
+// AMX must be enabled with init_amx(). Tile config is loaded on demand.
+// With trans_a, A is given as A^T [K, M] with leading dimension lda >= M.
+template <typename T, typename TB, typename Acc>
+void gemm_amx(int M, int N, int K, const T* A, int lda, const TB* B_packed, Acc* C, int ldc,
+              const gemm_blocking& blocking = gemm_tuned_blocking<T>(), bool trans_a = false) {
+    GEMM_PROFILE_CALL("gemm_amx", M, N, K);
+    constexpr int block_k = gemm_block_k<T>();
+    int MC = (M + GEMM_BLOCK_M - 1) / GEMM_BLOCK_M;
+    int NC = (N + GEMM_BLOCK_N - 1) / GEMM_BLOCK_N;
+    int KC = (K + block_k - 1) / block_k;
+    gemm_amx_range(M, N, K, A, lda, B_packed, C, ldc, 0, MC, 0, NC, 0, KC,
+                   gemm_lookup_blocking<T, TB>(blocking, M, N, K, 1), nullptr, trans_a);
+}
+
+// Post-ops(A x B) with B packed by pack_B: the epilogue writes the output, see gemm_epilogue.h
+template <typename T, typename TB>
+void gemm_amx(int M, int N, int K, const T* A, int lda, const TB* B_packed, const gemm_epilogue& epilogue,
+              const gemm_blocking& blocking = gemm_tuned_blocking<T>()) {
+    GEMM_PROFILE_CALL("gemm_amx", M, N, K);
+    constexpr int block_k = gemm_block_k<T>();
+    int MC = (M + GEMM_BLOCK_M - 1) / GEMM_BLOCK_M;
+    int NC = (N + GEMM_BLOCK_N - 1) / GEMM_BLOCK_N;
+    int KC = (K + block_k - 1) / block_k;
+    gemm_amx_range(M, N, K, A, lda, B_packed, (gemm_acc_type<T>*)nullptr, 0, 0, MC, 0, NC, 0, KC,
+                   gemm_lookup_blocking<T, TB>(blocking, M, N, K, 1), &epilogue);
+}
+
+// C = A x B with B in plain [K, N] layout. B is packed to the scratch arena of the thread on every call,
+// so prefer pack_B + the packed version above if B is reused.
+template <typename T, typename TB, typename Acc>
+void gemm_amx(int M, int N, int K, const T* A, int lda, const TB* B, int ldb, Acc* C, int ldc) {
+    GEMM_PROFILE_CALL("gemm_amx", M, N, K);
+    arena_scope scratch(arena_thread_scratch());
+    TB* B_packed = scratch.allocate<TB>(packed_B_size<TB>(K, N));
+    pack_B(B, K, N, ldb, B_packed);
+    gemm_amx(M, N, K, A, lda, B_packed, C, ldc);
+}
+
+// C = A x B with fp32 A [M, K] and bf16 B packed by pack_B (mixed precision, e.g., fp32 activations with
+// bf16 weights). A is rounded to bf16 panel by panel while it is packed, so the result is the same as
+// converting all of A with bf16_from_fp32 and calling the bf16 GEMM, without the bf16 copy of A.
+inline void gemm_amx(int M, int N, int K, const float* A, int lda, const bfloat16* B_packed, float* C, int ldc,
+                     const gemm_blocking& blocking = gemm_tuned_blocking<bfloat16>()) {
+    GEMM_PROFILE_CALL("gemm_amx", M, N, K);
+    constexpr int block_k = gemm_block_k<bfloat16>();
+    int MC = (M + GEMM_BLOCK_M - 1) / GEMM_BLOCK_M;
+    int NC = (N + GEMM_BLOCK_N - 1) / GEMM_BLOCK_N;
+    int KC = (K + block_k - 1) / block_k;
+    gemm_amx_range(M, N, K, (const bfloat16*)nullptr, lda, B_packed, C, ldc, 0, MC, 0, NC, 0, KC,
+                   gemm_lookup_blocking<bfloat16, bfloat16>(blocking, M, N, K, 1), nullptr, false, A);
+}
+
+// C = op(A) x op(B), with op(X) = X^T if the flag is set, as in BLAS:
+// - trans_a: A is given as A^T [K, M] with lda >= M, otherwise as [M, K] with lda >= K
+// - trans_b: B is given as B^T [N, K] with ldb >= K, otherwise as [K, N] with ldb >= N
+// The transposed operands are packed block by block (pack_A_panel_trans, pack_B_trans) to the layouts
+// of the NN path: no transpose of the whole matrix is made. B is packed to the scratch arena on every call;
+// if it is reused, pack it once with pack_B or pack_B_trans and call the packed version.
+template <typename T, typename TB, typename Acc>
+void gemm_amx(bool trans_a, bool trans_b, int M, int N, int K, const T* A, int lda, const TB* B, int ldb,
+              Acc* C, int ldc) {
+    GEMM_PROFILE_CALL("gemm_amx", M, N, K);
+    arena_scope scratch(arena_thread_scratch());
+    TB* B_packed = scratch.allocate<TB>(packed_B_size<TB>(K, N));
+    if (trans_b) pack_B_trans(B, K, N, ldb, B_packed);
+    else pack_B(B, K, N, ldb, B_packed);
+    gemm_amx(M, N, K, A, lda, B_packed, C, ldc, gemm_tuned_blocking<T>(), trans_a);
+}
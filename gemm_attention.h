@@ -0,0 +1,213 @@
+/*
+    Fused attention of one head on AMX tiles, in the manner of flash attention:
+        O = softmax(scale * Q x K^T + mask) x V
+    with Q [seq_q, d], K & V [seq_k, d] in bf16 and O [seq_q, d] in float.
+
+    The unfused way is two GEMMs and a softmax pass in between, which write and read the whole
+    [seq_q, seq_k] score matrix. Here each block of 32 queries goes over the keys in blocks of
+    GEMM_ATTENTION_BLOCK_KEYS, and for each key block:
+    1. S [32, 64] = Q x K^T with gemm_block, K packed by pack_B_trans (K is already B^T).
+    2. Online softmax of S with AVX-512 (scalar code otherwise): the running max m and sum l of each row
+       are updated, the rows of the output so far are scaled by e^(m_old - m_new), and the probabilities
+       e^(s - m_new) are converted to bf16, written in the packed A layout of the block kernel.
+    3. O += P x V with gemm_block accumulating on the float output block, V packed by pack_B.
+    At the end O is divided by l. Only [32, 64] scores and [32, d] outputs per thread are ever live.
+    With causal masking, query i sees keys j <= i + seq_k - seq_q (the last query sees all keys),
+    and key blocks past the last query of a block are skipped. A query that sees no key gets zeros.
+    Query blocks are interleaved over the threads of a pool, so that causal work is balanced.
+*/
+
+#pragma once
+
+#include "gemm_parallel.h"
+#include <cmath>
+#include <limits>
+
+// Keys per step of the online softmax: 2 block columns of S
+#define GEMM_ATTENTION_BLOCK_KEYS 64
+
+// Online softmax of the rows [0, mb) of S [block_m, GEMM_ATTENTION_BLOCK_KEYS] (scores before scaling),
+// where row i has valid[i] valid keys first (0 to kb). Updates the running max m & sum l of the rows,
+// scales the rows of O [block_m, ldo] by e^(m_old - m_new) and writes the probabilities to P
+// [2, block_m, 32] (the packed A layout of 2 K blocks), with zeros for invalid keys.
+inline void gemm_attention_softmax_scalar(const float* S, int mb, const int* valid, float scale, float* m, float* l,
+                                          float* O, int ldo, bfloat16* P) {
+    constexpr int keys = GEMM_ATTENTION_BLOCK_KEYS;
+    const float neg_inf = -std::numeric_limits<float>::infinity();
+    for (int i = 0; i < mb; ++i) {
+        const float* s = S + i * keys;
+        auto p_at = [&](int j) -> bfloat16& { return P[(j / 32) * GEMM_BLOCK_M * 32 + i * 32 + j % 32]; };
+        int n = valid[i];
+        if (n <= 0) {
+            for (int j = 0; j < keys; ++j) p_at(j) = bfloat16();
+            continue;
+        }
+        float row_max = neg_inf;
+        for (int j = 0; j < n; ++j) row_max = std::max(row_max, s[j] * scale);
+        float m_new = std::max(m[i], row_max);
+        float alpha = m[i] == neg_inf ? 0.0f : std::exp(m[i] - m_new);
+        float sum = 0;
+        for (int j = 0; j < keys; ++j) {
+            float p = j < n ? std::exp(s[j] * scale - m_new) : 0.0f;
+            sum += p;
+            p_at(j) = bfloat16(p);
+        }
+        l[i] = l[i] * alpha + sum;
+        m[i] = m_new;
+        if (alpha != 1.0f) {
+            for (int c = 0; c < ldo; ++c) O[(size_t)i * ldo + c] *= alpha;
+        }
+    }
+}
+
+// Same as gemm_attention_softmax_scalar with AVX-512, 16 keys at a time; ldo is a multiple of 16
+__attribute__((target("avx512f,avx512bw")))
+inline void gemm_attention_softmax_avx512(const float* S, int mb, const int* valid, float scale, float* m, float* l,
+                                          float* O, int ldo, bfloat16* P) {
+    constexpr int keys = GEMM_ATTENTION_BLOCK_KEYS;
+    constexpr int vecs = keys / 16;
+    const float neg_inf = -std::numeric_limits<float>::infinity();
+    const __m512 vscale = _mm512_set1_ps(scale);
+    for (int i = 0; i < mb; ++i) {
+        const float* s_row = S + i * keys;
+        auto p_at = [&](int j) { return P + (j / 32) * GEMM_BLOCK_M * 32 + i * 32 + j % 32; };
+        int n = valid[i];
+        if (n <= 0) {
+            for (int v = 0; v < vecs; ++v) _mm256_storeu_si256((__m256i*)p_at(v * 16), _mm256_setzero_si256());
+            continue;
+        }
+        __m512 s[vecs];
+        __mmask16 k[vecs];
+        __m512 vmax = _mm512_set1_ps(neg_inf);
+        for (int v = 0; v < vecs; ++v) {
+            int cols = std::max(0, std::min(16, n - v * 16));
+            k[v] = (__mmask16)((1u << cols) - 1);
+            s[v] = _mm512_mul_ps(_mm512_maskz_loadu_ps(k[v], s_row + v * 16), vscale);
+            vmax = _mm512_mask_max_ps(vmax, k[v], vmax, s[v]);
+        }
+        float m_new = std::max(m[i], _mm512_reduce_max_ps(vmax));
+        float alpha = m[i] == neg_inf ? 0.0f : std::exp(m[i] - m_new);
+        __m512 vm = _mm512_set1_ps(m_new);
+        __m512 vsum = _mm512_setzero_ps();
+        for (int v = 0; v < vecs; ++v) {
+            __m512 p = _mm512_maskz_mov_ps(k[v], gemm_exp_avx512(_mm512_sub_ps(s[v], vm)));
+            vsum = _mm512_add_ps(vsum, p);
+            _mm256_storeu_si256((__m256i*)p_at(v * 16), bf16_round_avx512(p));
+        }
+        l[i] = l[i] * alpha + _mm512_reduce_add_ps(vsum);
+        m[i] = m_new;
+        if (alpha != 1.0f) {
+            __m512 va = _mm512_set1_ps(alpha);
+            float* o = O + (size_t)i * ldo;
+            for (int c = 0; c < ldo; c += 16) _mm512_storeu_ps(o + c, _mm512_mul_ps(_mm512_loadu_ps(o + c), va));
+        }
+    }
+}
+
+inline void gemm_attention_softmax(const float* S, int mb, const int* valid, float scale, float* m, float* l,
+                                   float* O, int ldo, bfloat16* P) {
+    static const bool has_avx512 = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    }();
+    if (has_avx512) gemm_attention_softmax_avx512(S, mb, valid, scale, m, l, O, ldo, P);
+    else gemm_attention_softmax_scalar(S, mb, valid, scale, m, l, O, ldo, P);
+}
+
+// Fused attention of the query blocks qb0, qb0 + step, ... on this thread, with K packed by
+// pack_B_trans(K, d, seq_k, ldk, K_packed) and V packed by pack_B(V, seq_k, d, ldv, V_packed).
+inline void gemm_attention_range(int seq_q, int seq_k, int d, const bfloat16* Q, int ldq, const bfloat16* K_packed,
+                                 const bfloat16* V_packed, float* O, int ldo, float scale, bool causal, int qb0,
+                                 int step) {
+    constexpr int block_k = gemm_block_k<bfloat16>();
+    constexpr int keys = GEMM_ATTENTION_BLOCK_KEYS;
+    const float neg_inf = -std::numeric_limits<float>::infinity();
+    int QC = gemm_ceil_div(seq_q, GEMM_BLOCK_M);
+    int DC = gemm_ceil_div(d, block_k);  // K blocks of Q x K^T
+    int dp = gemm_round_up(d, GEMM_BLOCK_N);
+    int Np_k = gemm_round_up(seq_k, GEMM_BLOCK_N);
+    int Np_d = dp;
+    int offset = seq_k - seq_q;
+
+    arena_scope scratch(arena_thread_scratch());
+    bfloat16* q_packed = scratch.allocate<bfloat16>((size_t)DC * GEMM_BLOCK_M * block_k);
+    float* s = scratch.allocate<float>(GEMM_BLOCK_M * keys);
+    bfloat16* p = scratch.allocate<bfloat16>(GEMM_BLOCK_M * keys);
+    float* o = scratch.allocate<float>((size_t)GEMM_BLOCK_M * dp);
+    float m[GEMM_BLOCK_M], l[GEMM_BLOCK_M];
+    int valid[GEMM_BLOCK_M];
+    // Blocks are always computed whole: rows beyond seq_q and columns beyond seq_k & d are zeros
+    // in packed Q, K & V, so that one tile config serves all of them.
+    gemm_configure_block<bfloat16>(GEMM_BLOCK_M, GEMM_BLOCK_N);
+
+    for (int qb = qb0; qb < QC; qb += step) {
+        int q0 = qb * GEMM_BLOCK_M;
+        int mb = std::min(GEMM_BLOCK_M, seq_q - q0);
+        // keys seen by the last query of the block
+        int k_end = causal ? std::min(seq_k, q0 + mb + offset) : seq_k;
+        {
+            GEMM_PROFILE_SCOPE(GEMM_PHASE_PACK_A);
+            pack_A_panel(Q, ldq, seq_q, d, qb, qb + 1, 0, DC, q_packed);
+        }
+        std::fill(m, m + GEMM_BLOCK_M, neg_inf);
+        std::fill(l, l + GEMM_BLOCK_M, 0.0f);
+        std::fill(o, o + (size_t)GEMM_BLOCK_M * dp, 0.0f);
+        for (int k0 = 0; k0 < k_end; k0 += keys) {
+            int kb = std::min(keys, k_end - k0);
+            int kcs = gemm_ceil_div(kb, GEMM_BLOCK_N);
+            // 1. S = Q x K^T
+            for (int j = 0; j < kcs; ++j) {
+                gemm_block(q_packed, block_k * sizeof(bfloat16), (size_t)GEMM_BLOCK_M * block_k, (const bfloat16*)nullptr,
+                           packed_B_block(K_packed, 0, k0 / GEMM_BLOCK_N + j, Np_k), (size_t)block_k * Np_k,
+                           s + j * GEMM_BLOCK_N, keys, GEMM_BLOCK_M, GEMM_BLOCK_N, DC);
+            }
+            // 2. online softmax to P
+            {
+                GEMM_PROFILE_SCOPE(GEMM_PHASE_EPILOGUE);
+                for (int i = 0; i < mb; ++i) {
+                    int last = causal ? std::min(kb, q0 + i + offset + 1 - k0) : kb;
+                    valid[i] = std::max(last, 0);
+                }
+                gemm_attention_softmax(s, mb, valid, scale, m, l, o, dp, p);
+            }
+            // 3. O += P x V, the key blocks of P being K blocks of V
+            for (int nc = 0; nc < dp / GEMM_BLOCK_N; ++nc) {
+                gemm_block(p, block_k * sizeof(bfloat16), (size_t)GEMM_BLOCK_M * block_k, (const bfloat16*)nullptr,
+                           packed_B_block(V_packed, k0 / block_k, nc, Np_d), (size_t)block_k * Np_d,
+                           o + nc * GEMM_BLOCK_N, dp, GEMM_BLOCK_M, GEMM_BLOCK_N, kcs, true);
+            }
+        }
+        for (int i = 0; i < mb; ++i) {
+            float inv = l[i] > 0 ? 1.0f / l[i] : 0.0f;
+            for (int c = 0; c < d; ++c) O[(size_t)(q0 + i) * ldo + c] = o[(size_t)i * dp + c] * inv;
+        }
+    }
+}
+
+// Fused attention with K & V packed (see gemm_attention_range), on all threads of pool.
+// scale is usually 1 / sqrt(d).
+inline void gemm_attention_packed(amx_thread_pool& pool, int seq_q, int seq_k, int d, const bfloat16* Q, int ldq,
+                                  const bfloat16* K_packed, const bfloat16* V_packed, float* O, int ldo, float scale,
+                                  bool causal) {
+    GEMM_PROFILE_CALL("gemm_attention", seq_q, seq_k, d);
+    int num_threads = pool.size();
+    pool.run([&](int tid) {
+        gemm_attention_range(seq_q, seq_k, d, Q, ldq, K_packed, V_packed, O, ldo, scale, causal, tid, num_threads);
+    });
+}
+
+// O = softmax(scale * Q x K^T + causal mask) x V on all threads of pool, packing K & V first.
+// Q [seq_q, d], K & V [seq_k, d] and O [seq_q, d] are row-major with leading dimensions ldq, ldk, ldv & ldo.
+inline void gemm_attention(amx_thread_pool& pool, int seq_q, int seq_k, int d, const bfloat16* Q, int ldq,
+                           const bfloat16* K, int ldk, const bfloat16* V, int ldv, float* O, int ldo, float scale,
+                           bool causal = false) {
+    if (seq_q <= 0 || d <= 0) return;
+    arena_scope scratch(arena_thread_scratch());
+    bfloat16* k_packed = scratch.allocate<bfloat16>(packed_B_size<bfloat16>(d, std::max(seq_k, 1)));
+    bfloat16* v_packed = scratch.allocate<bfloat16>(packed_B_size<bfloat16>(std::max(seq_k, 1), d));
+    if (seq_k > 0) {
+        pack_B_trans(K, d, seq_k, ldk, k_packed);
+        pack_B(V, seq_k, d, ldv, v_packed);
+    }
+    gemm_attention_packed(pool, seq_q, seq_k, d, Q, ldq, k_packed, v_packed, O, ldo, scale, causal);
+}
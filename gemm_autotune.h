@@ -0,0 +1,157 @@
+/*
+    Autotuner of the GEMM blocking for a shape, whose results go to the tuning cache (see gemm_tuning_find in gemm.h).
+
+    The fixed choices of gemm_default_blocking (2x2 kernel, panels sized by the caches, blocks column by column)
+    are far from the best for some shapes, e.g., tall-skinny or wide ones. For a given dtype, shape and
+    number of threads, gemm_autotune times candidates and keeps the fastest, one parameter at a time
+    from the default (coordinate descent), so that it takes tens of runs instead of thousands:
+    1. block kernel, i.e., arrangement of C tiles: 2x2, pipelined 2x2, 1x4 (16 x 64 blocks) and JIT
+    2. packing A panels or reading A in place
+    3. panel sizes kc, mc & nc, from 1/4 to 4 times the default (or all of the shape)
+    4. loop order of the blocks in a panel: columns or rows
+    5. prefetch distance, for the kernels that prefetch
+    6. split of the blocks over threads (with a pool of more than one thread): the splits that
+       gemm_partition_grid rates within 2x of the best
+    Candidates that compute the same as one already timed (e.g., panels larger than the shape) are skipped.
+    The micro-block stays 32 x 32 or 16 x 64: it is what the 8 tiles can hold.
+
+    The tuned blocking is exact for int8 and the same as the default for bf16 unless K is split over threads,
+    which changes the order of the sums.
+*/
+
+#pragma once
+
+#include "gemm_parallel.h"
+#include "bench.h"
+#include <set>
+
+struct gemm_autotune_options {
+    double min_seconds = 0.05;  // time each candidate for at least this long
+    int min_iters = 3;
+    int max_iters = 50;
+    bool verbose = false;       // print each candidate
+};
+
+// A candidate: a blocking with its effective panel sizes and a split over threads
+struct gemm_autotune_candidate {
+    gemm_blocking blocking;
+    gemm_partition partition;
+};
+
+inline std::string gemm_autotune_describe(const gemm_autotune_candidate& c) {
+    const gemm_blocking& b = c.blocking;
+    std::ostringstream s;
+    s << gemm_kernel_name(b.kernel) << ", pack_A " << b.pack_A << ", mc " << b.mc << ", nc " << b.nc << ", kc " << b.kc
+      << ", " << (b.loop_order == GEMM_LOOP_ROWS ? "rows" : "columns") << ", prefetch " << b.prefetch;
+    if (c.partition.tm > 0) s << ", split " << c.partition.tm << "x" << c.partition.tn << "x" << c.partition.tk;
+    return s.str();
+}
+
+// Tune C = A x B with B packed by pack_B for the shape, on pool if not null (otherwise on this thread),
+// and add the result to the tuning cache. C is overwritten by the runs.
+// Returns the tuned entry; entry.seconds is its median time.
+template <typename T, typename TB, typename Acc>
+gemm_tuning_entry gemm_autotune(amx_thread_pool* pool, int M, int N, int K, const T* A, int lda, const TB* B_packed,
+                                Acc* C, int ldc, const gemm_autotune_options& options = gemm_autotune_options()) {
+    constexpr int block_k = gemm_block_k<T>();
+    int MC = gemm_ceil_div(M, GEMM_BLOCK_M);
+    int NC = gemm_ceil_div(N, GEMM_BLOCK_N);
+    int KC = gemm_ceil_div(K, block_k);
+    int threads = pool ? pool->size() : 1;
+
+    // Panel sizes beyond the shape compute the same as the whole shape
+    auto effective = [&](const gemm_autotune_candidate& c) {
+        const gemm_blocking& b = c.blocking;
+        int mc = std::min(std::max(1, b.mc / GEMM_BLOCK_M), MC);
+        int nc = std::min(std::max(1, b.nc / GEMM_BLOCK_N), NC);
+        int kc = std::min(std::max(1, b.kc / block_k), KC);
+        bool prefetches = b.kernel == GEMM_KERNEL_2X2_PIPELINED || b.kernel == GEMM_KERNEL_1X4;
+        return std::make_tuple((int)b.kernel, b.pack_A, mc, nc, kc, (int)b.loop_order, prefetches ? b.prefetch : 0,
+                               c.partition.tm, c.partition.tn, c.partition.tk);
+    };
+    std::set<decltype(effective(gemm_autotune_candidate()))> timed;
+
+    auto time = [&](const gemm_autotune_candidate& c) {
+        auto run = [&] {
+            if (pool) gemm_amx_parallel_split(*pool, M, N, K, A, lda, B_packed, C, ldc, c.partition, c.blocking);
+            else gemm_amx(M, N, K, A, lda, B_packed, C, ldc, c.blocking);
+        };
+        double start = bench_now_seconds();
+        run();
+        double first = bench_now_seconds() - start;
+        int iters = (int)std::min<double>(options.max_iters, std::max<double>(options.min_iters,
+                                                                              options.min_seconds / std::max(first, 1e-9)));
+        return bench_run(run, 0, iters).median;
+    };
+
+    gemm_autotune_candidate best;
+    best.blocking = gemm_default_blocking<T>();
+    best.blocking.kernel = gemm_select_kernel(M);
+    best.partition = pool ? gemm_partition_grid(MC, NC, KC, threads) : gemm_partition{0, 0, 0};
+    double best_seconds = time(best);
+    timed.insert(effective(best));
+    if (options.verbose) std::cout << "  " << gemm_autotune_describe(best) << ": " << best_seconds * 1e3 << " ms\n";
+
+    // Time the candidates made by set from the best so far and keep the fastest
+    auto try_values = [&](auto values, auto set) {
+        gemm_autotune_candidate base = best;
+        for (auto value : values) {
+            gemm_autotune_candidate c = base;
+            set(c, value);
+            if (!timed.insert(effective(c)).second) continue;
+            double t = time(c);
+            if (options.verbose) std::cout << "  " << gemm_autotune_describe(c) << ": " << t * 1e3 << " ms\n";
+            if (t < best_seconds) {
+                best_seconds = t;
+                best = c;
+            }
+        }
+    };
+
+    std::vector<gemm_kernel_type> kernels = {GEMM_KERNEL_2X2, GEMM_KERNEL_2X2_PIPELINED, GEMM_KERNEL_1X4};
+    if (gemm_jit_enabled()) kernels.push_back(GEMM_KERNEL_JIT);
+    try_values(kernels, [](gemm_autotune_candidate& c, gemm_kernel_type k) { c.blocking.kernel = k; });
+    try_values(std::vector<bool>{true, false}, [](gemm_autotune_candidate& c, bool p) { c.blocking.pack_A = p; });
+    const gemm_blocking d = gemm_default_blocking<T>();
+    const std::vector<double> scales = {0.25, 0.5, 1, 2, 4, 1e6};
+    try_values(scales, [&](gemm_autotune_candidate& c, double f) {
+        c.blocking.kc = std::max(block_k, (int)std::min<double>(d.kc * f, KC * block_k) / block_k * block_k);
+    });
+    try_values(scales, [&](gemm_autotune_candidate& c, double f) {
+        c.blocking.mc = std::max(GEMM_BLOCK_M, (int)std::min<double>(d.mc * f, MC * GEMM_BLOCK_M) / GEMM_BLOCK_M * GEMM_BLOCK_M);
+    });
+    try_values(scales, [&](gemm_autotune_candidate& c, double f) {
+        c.blocking.nc = std::max(GEMM_BLOCK_N, (int)std::min<double>(d.nc * f, NC * GEMM_BLOCK_N) / GEMM_BLOCK_N * GEMM_BLOCK_N);
+    });
+    try_values(std::vector<gemm_loop_order>{GEMM_LOOP_COLUMNS, GEMM_LOOP_ROWS},
+               [](gemm_autotune_candidate& c, gemm_loop_order o) { c.blocking.loop_order = o; });
+    try_values(std::vector<int>{0, 1, 2, 4}, [](gemm_autotune_candidate& c, int p) { c.blocking.prefetch = p; });
+
+    if (threads > 1) {
+        // splits rated within 2x of the best by the cost model of gemm_partition_grid
+        std::vector<gemm_partition> splits;
+        gemm_partition model = gemm_partition_grid(MC, NC, KC, threads);
+        double model_cost = (double)gemm_ceil_div(MC, model.tm) * gemm_ceil_div(NC, model.tn) * gemm_ceil_div(KC, model.tk);
+        for (int tm = 1; tm <= std::min(MC, threads); ++tm) {
+            for (int tn = 1; tn <= std::min(NC, threads / tm); ++tn) {
+                for (int tk = 1; tk <= std::min(KC, threads / (tm * tn)); ++tk) {
+                    double cost = (double)gemm_ceil_div(MC, tm) * gemm_ceil_div(NC, tn) * gemm_ceil_div(KC, tk);
+                    if (cost <= 2 * model_cost) splits.push_back({tm, tn, tk});
+                }
+            }
+        }
+        try_values(splits, [](gemm_autotune_candidate& c, gemm_partition p) { c.partition = p; });
+    }
+
+    gemm_tuning_entry entry;
+    entry.blocking = best.blocking;
+    entry.blocking.tuned = false;
+    if (pool) {
+        entry.tm = best.partition.tm;
+        entry.tn = best.partition.tn;
+        entry.tk = best.partition.tk;
+    }
+    entry.seconds = best_seconds;
+    gemm_tuning_insert({gemm_dtype_name<T, TB>(), M, N, K, threads}, entry);
+    return entry;
+}
@@ -0,0 +1,208 @@
+/*
+    Batched and grouped GEMM with Intel AMX, for many small problems (e.g., attention heads, MoE experts).
+
+    - gemm_amx_batched: a batch of problems with the same shape, whose A, B & C are stride_a/b/c elements apart.
+    - gemm_amx_grouped: an array of problems with different shapes.
+
+    A loop of gemm_amx calls reloads the tile config whenever the shape of the next block differs
+    (e.g., from the full block to an M or N tail and back again, for every problem).
+    Here all blocks of the problems are first listed as tasks and grouped by their tile config,
+    so a config is loaded once per group instead of once or more per problem.
+    Grouping all problems at once would stream A & B of every problem through the caches once per group,
+    so problems are grouped in chunks whose A & B fit in half of L2.
+    The tasks are then split over the threads of the pool into contiguous ranges of about equal cost.
+    Each block is computed over the whole K with A read in place. The only per-problem setup is copying
+    the K tail of A (if any) to a zero-padded buffer, which is done for all problems before the blocks.
+*/
+
+#pragma once
+
+#include "gemm_parallel.h"
+
+// One problem of a grouped GEMM: C [M, N] = A [M, K] x B [K, N] with B packed by pack_B
+template <typename T, typename TB, typename Acc>
+struct gemm_problem {
+    int M;
+    int N;
+    int K;
+    const T* A;
+    int lda;
+    const TB* B_packed;
+    Acc* C;
+    int ldc;
+};
+
+// A block of C of a problem, with the shape of its tile config
+struct gemm_block_task {
+    int problem;
+    int mc;
+    int nc;
+    int mb;
+    int nb;
+    int cost;  // K blocks
+};
+
+// Compute block (mc, nc) of problem p over the whole K. The config for (mb, nb) must be loaded.
+// a_tail is the K tail of the block row of A from gemm_prepare_A_tails, or null if K has no tail.
+template <typename T, typename TB, typename Acc>
+void gemm_problem_block(const gemm_problem<T, TB, Acc>& p, int mc, int nc, int mb, int nb, const T* a_tail) {
+    constexpr int block_k = gemm_block_k<T>();
+    int Np = gemm_round_up(p.N, GEMM_BLOCK_N);
+    int KC = (p.K + block_k - 1) / block_k;
+    gemm_block(p.A + (size_t)mc * GEMM_BLOCK_M * p.lda, (long)p.lda * sizeof(T), block_k, a_tail,
+               packed_B_block(p.B_packed, 0, nc, Np), (size_t)block_k * Np,
+               p.C + (size_t)mc * GEMM_BLOCK_M * p.ldc + nc * GEMM_BLOCK_N, p.ldc, mb, nb, KC);
+}
+
+// Append the blocks of problem i to tasks. If mb_class & nb_class are given (full = 0, tail = 1),
+// only the blocks of that class are appended.
+template <typename T, typename TB, typename Acc>
+void gemm_problem_tasks(const gemm_problem<T, TB, Acc>& p, int i, std::vector<gemm_block_task>& tasks,
+                        int mb_class = -1, int nb_class = -1) {
+    constexpr int block_k = gemm_block_k<T>();
+    int MC = gemm_ceil_div(p.M, GEMM_BLOCK_M);
+    int NC = gemm_ceil_div(p.N, GEMM_BLOCK_N);
+    int KC = gemm_ceil_div(p.K, block_k);
+    for (int mc = 0; mc < MC; ++mc) {
+        int mb = std::min(GEMM_BLOCK_M, p.M - mc * GEMM_BLOCK_M);
+        if (mb_class >= 0 && (mb < GEMM_BLOCK_M) != (mb_class == 1)) continue;
+        for (int nc = 0; nc < NC; ++nc) {
+            int nb = std::min(GEMM_BLOCK_N, p.N - nc * GEMM_BLOCK_N);
+            if (nb_class >= 0 && (nb < GEMM_BLOCK_N) != (nb_class == 1)) continue;
+            tasks.push_back({i, mc, nc, mb, nb, std::max(KC, 1)});
+        }
+    }
+}
+
+// Bytes of A & packed B of a problem
+template <typename T, typename TB, typename Acc>
+size_t gemm_problem_bytes(const gemm_problem<T, TB, Acc>& p) {
+    return ((size_t)p.M * p.K + packed_B_size<TB>(p.K, p.N)) * sizeof(T);
+}
+
+// Run fn(begin, end) on all threads of pool (or on this thread if pool is null), splitting [0, n)
+// into contiguous ranges of about equal cost by the prefix sums of cost, cost[n] being the total
+template <typename F>
+void gemm_run_split(amx_thread_pool* pool, size_t n, const std::vector<long>& cost, F&& fn) {
+    int num_threads = pool ? pool->size() : 1;
+    if (num_threads == 1 || n < 2) {
+        fn((size_t)0, n);
+        return;
+    }
+    pool->run([&](int tid) {
+        auto begin_of = [&](int i) {
+            long target = cost[n] * i / num_threads;
+            return (size_t)(std::lower_bound(cost.begin(), cost.begin() + n + 1, target) - cost.begin());
+        };
+        size_t begin = tid == 0 ? 0 : begin_of(tid);
+        size_t end = tid + 1 == num_threads ? n : begin_of(tid + 1);
+        fn(begin, end);
+    });
+}
+
+// Copy the K tails of the block rows of A of all problems to a zero-padded buffer from scratch and return it
+// (null if no problem has a K tail). Problem i has its tails at offsets[i], one [block_m, block_k] block per block row.
+template <typename T, typename TB, typename Acc>
+T* gemm_prepare_A_tails(const gemm_problem<T, TB, Acc>* problems, int count, arena_scope& scratch,
+                        std::vector<size_t>& offsets, amx_thread_pool* pool) {
+    constexpr int block_k = gemm_block_k<T>();
+    offsets.assign(count + 1, 0);
+    static thread_local std::vector<long> cost;
+    cost.assign(count + 1, 0);
+    for (int i = 0; i < count; ++i) {
+        const auto& p = problems[i];
+        size_t size = p.K % block_k ? (size_t)gemm_ceil_div(p.M, GEMM_BLOCK_M) * GEMM_BLOCK_M * block_k : 0;
+        offsets[i + 1] = offsets[i] + size;
+        cost[i + 1] = cost[i] + (long)size;
+    }
+    if (!offsets[count]) return nullptr;
+    T* tails = scratch.allocate<T>(offsets[count]);
+    gemm_run_split(pool, count, cost, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const auto& p = problems[i];
+            if (offsets[i + 1] == offsets[i]) continue;
+            GEMM_PROFILE_SCOPE(GEMM_PHASE_PACK_A);
+            int KC = gemm_ceil_div(p.K, block_k);
+            pack_A_panel(p.A, p.lda, p.M, p.K, 0, gemm_ceil_div(p.M, GEMM_BLOCK_M), KC - 1, KC, tails + offsets[i]);
+        }
+    });
+    return tails;
+}
+
+// Run tasks in order, split over the threads of pool (or on this thread if pool is null)
+// into contiguous ranges of about equal cost
+template <typename T, typename TB, typename Acc>
+void gemm_run_tasks(const gemm_problem<T, TB, Acc>* problems, int count, const std::vector<gemm_block_task>& tasks,
+                    amx_thread_pool* pool) {
+    constexpr int block_k = gemm_block_k<T>();
+    arena_scope scratch(arena_thread_scratch());
+    // bookkeeping vectors of this thread keep their capacity across calls, to allocate nothing in steady state
+    // (a reference, so that the lambda below on the other threads reads the vector of this thread)
+    static thread_local std::vector<size_t> a_tail_offsets_buffer;
+    std::vector<size_t>& a_tail_offsets = a_tail_offsets_buffer;
+    T* a_tails = gemm_prepare_A_tails(problems, count, scratch, a_tail_offsets, pool);
+    static thread_local std::vector<long> cost;
+    cost.assign(tasks.size() + 1, 0);
+    for (size_t t = 0; t < tasks.size(); ++t) cost[t + 1] = cost[t] + tasks[t].cost;
+    gemm_run_split(pool, tasks.size(), cost, [&](size_t begin, size_t end) {
+        for (size_t t = begin; t < end; ++t) {
+            const gemm_block_task& task = tasks[t];
+            const auto& p = problems[task.problem];
+            const T* a_tail = p.K % block_k
+                ? a_tails + a_tail_offsets[task.problem] + (size_t)task.mc * GEMM_BLOCK_M * block_k
+                : nullptr;
+            gemm_configure_block<T>(task.mb, task.nb);
+            gemm_problem_block(p, task.mc, task.nc, task.mb, task.nb, a_tail);
+        }
+    });
+}
+
+// batch problems C_i = A_i x B_i, each [M, K] x [K, N], with A_i = A + i * stride_a, B_i = B_packed + i * stride_b
+// (stride_b = 0 to share B) and C_i = C + i * stride_c. Computed by all threads of pool if given.
+template <typename T, typename TB, typename Acc>
+void gemm_amx_batched(int batch, int M, int N, int K, const T* A, int lda, size_t stride_a, const TB* B_packed,
+                      size_t stride_b, Acc* C, int ldc, size_t stride_c, amx_thread_pool* pool = nullptr) {
+    GEMM_PROFILE_CALL("gemm_amx_batched", M, N, K);
+    static thread_local std::vector<gemm_problem<T, TB, Acc>> problems;
+    problems.resize(batch);
+    for (int i = 0; i < batch; ++i) {
+        problems[i] = {M, N, K, A + i * stride_a, lda, B_packed + i * stride_b, C + i * stride_c, ldc};
+    }
+    // All problems have the same blocks, so grouping is by the class of block: full or tail in M & N
+    size_t bytes = std::max<size_t>(1, batch ? gemm_problem_bytes(problems[0]) : 1);
+    int chunk = (int)std::max<size_t>(1, gemm_detect_cache_sizes().l2 / 2 / bytes);
+    static thread_local std::vector<gemm_block_task> tasks;
+    tasks.clear();
+    for (int i0 = 0; i0 < batch; i0 += chunk) {
+        int i1 = std::min(batch, i0 + chunk);
+        for (int mb_class = 0; mb_class < 2; ++mb_class) {
+            for (int nb_class = 0; nb_class < 2; ++nb_class) {
+                for (int i = i0; i < i1; ++i) gemm_problem_tasks(problems[i], i, tasks, mb_class, nb_class);
+            }
+        }
+    }
+    gemm_run_tasks(problems.data(), batch, tasks, pool);
+}
+
+// count problems of any shapes. Computed by all threads of pool if given.
+template <typename T, typename TB, typename Acc>
+void gemm_amx_grouped(const gemm_problem<T, TB, Acc>* problems, int count, amx_thread_pool* pool = nullptr) {
+    GEMM_PROFILE_CALL("gemm_amx_grouped", 0, 0, 0);
+    size_t chunk_bytes = gemm_detect_cache_sizes().l2 / 2;
+    static thread_local std::vector<gemm_block_task> tasks;
+    tasks.clear();
+    for (int i0 = 0; i0 < count;) {
+        // chunk [i0, i1) of at least one problem
+        size_t bytes = gemm_problem_bytes(problems[i0]);
+        int i1 = i0 + 1;
+        while (i1 < count && bytes + gemm_problem_bytes(problems[i1]) <= chunk_bytes) bytes += gemm_problem_bytes(problems[i1++]);
+        size_t first = tasks.size();
+        for (int i = i0; i < i1; ++i) gemm_problem_tasks(problems[i], i, tasks);
+        // group by tile config, keeping the order of problems & blocks in a group
+        std::stable_sort(tasks.begin() + first, tasks.end(), [](const gemm_block_task& a, const gemm_block_task& b) {
+            return a.mb != b.mb ? a.mb > b.mb : a.nb > b.nb;
+        });
+        i0 = i1;
+    }
+    gemm_run_tasks(problems, count, tasks, pool);
+}
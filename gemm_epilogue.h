@@ -0,0 +1,222 @@
+/*
+    Post-ops fused into the tile stores of the GEMM in gemm.h.
+
+    Without an epilogue, C is written as int32/float, and bias, activation and requantization
+    take another pass over C in memory. With an epilogue, each block of C is stored from tiles
+    to a small buffer and the post-ops are applied while it is still in L1,
+    so only the final output is written to memory.
+
+    For each element of the output, with acc the int32/float sum of the GEMM:
+        acc -= a_zero_point * b_col_sums[n] + b_zero_point * row_sum(A)[m] - K * a_zero_point * b_zero_point
+        x = acc * scale * scales[n] + bias[n] + residual[m, n]
+        x = activation(x)
+        out[m, n] = x                                                   (fp32)
+                    bfloat16(x)                                         (bf16, round to nearest even)
+                    clamp(round(x / out_scale) + out_zero_point, -128, 127)   (int8)
+    Null pointers (scales, bias, residual) are skipped.
+    The first line is the zero-point compensation of u8/s8 GEMM (int32 only), so that acc becomes
+    sum_k (A[m, k] - a_zero_point) * (B[k, n] - b_zero_point). Column sums of B are computed once
+    with pack_B_col_sums, row sums of A by the GEMM on the fly.
+
+    Fusing saves the write and the second read of C, but it does not make the post-ops cheaper:
+    they run on the same core between the tile computations, with the same AVX-512 code as a separate pass.
+    So it pays off when the post-ops are light next to the traffic of C (scales, bias, ReLU, requantization
+    to int8 or bf16 output). With a residual and GELU/SiLU on a bf16 GEMM, the epilogue is bound by
+    the exp and the division, and each block reads its residual rows far apart instead of streaming them:
+    fused may be no faster than the GEMM followed by gemm_epilogue_apply over C, or even slower.
+    For such post-ops, prefer the separate pass if it measures faster on the shape (gemm-epilogue.cpp compares both).
+*/
+
+#pragma once
+
+#include "bf16_convert.h"
+#include "common.h"
+#include <immintrin.h>
+#include <cmath>
+
+enum gemm_activation {
+    GEMM_ACTIVATION_NONE,
+    GEMM_ACTIVATION_RELU,
+    GEMM_ACTIVATION_GELU,  // tanh approximation
+    GEMM_ACTIVATION_SILU,
+};
+
+enum gemm_output_type {
+    GEMM_OUTPUT_FP32,
+    GEMM_OUTPUT_BF16,
+    GEMM_OUTPUT_INT8,
+};
+
+struct gemm_epilogue {
+    // zero points of A & B; b_col_sums must be set if a_zero_point is not 0
+    int a_zero_point = 0;
+    int b_zero_point = 0;
+    const int32_t* b_col_sums = nullptr;
+    // K of the GEMM, set by the GEMM
+    int K = 0;
+    // dequantization: per-tensor scale (e.g., of A) and optional per-column scales (e.g., of B)
+    float scale = 1.0f;
+    const float* scales = nullptr;
+    // optional per-column bias
+    const float* bias = nullptr;
+    // optional residual [M, N] with leading dimension ld_residual, added before the activation
+    const float* residual = nullptr;
+    int ld_residual = 0;
+    gemm_activation activation = GEMM_ACTIVATION_NONE;
+    // output [M, N] with leading dimension ld_out, of type out_type
+    gemm_output_type out_type = GEMM_OUTPUT_FP32;
+    void* out = nullptr;
+    int ld_out = 0;
+    // requantization to int8
+    float out_scale = 1.0f;
+    int out_zero_point = 0;
+};
+
+// GELU(x) = x * sigmoid(2 * sqrt(2 / pi) * (x + 0.044715 x^3)), the same as the tanh form
+#define GEMM_GELU_C0 1.5957691216057308f
+#define GEMM_GELU_C1 0.044715f
+
+inline float gemm_activation_scalar(gemm_activation activation, float x) {
+    switch (activation) {
+    case GEMM_ACTIVATION_RELU: return x > 0 ? x : 0;
+    case GEMM_ACTIVATION_GELU: return x / (1.0f + std::exp(-GEMM_GELU_C0 * (x + GEMM_GELU_C1 * x * x * x)));
+    case GEMM_ACTIVATION_SILU: return x / (1.0f + std::exp(-x));
+    default: return x;
+    }
+}
+
+// Apply the epilogue to a block of C with mb rows and nb columns at row m0 and column n0 of the output.
+// C points to the block with leading dimension ldc. a_row_sums are the row sums of A for the rows of the block,
+// needed if b_zero_point is not 0.
+template <typename Acc>
+void gemm_epilogue_apply_scalar(const gemm_epilogue& ep, const Acc* C, int ldc, int m0, int n0, int mb, int nb,
+                                const int32_t* a_row_sums = nullptr) {
+    for (int m = 0; m < mb; ++m) {
+        for (int n = 0; n < nb; ++n) {
+            Acc acc = C[(size_t)m * ldc + n];
+            if constexpr (std::is_same<Acc, int32_t>::value) {
+                if (ep.a_zero_point) acc -= ep.a_zero_point * ep.b_col_sums[n0 + n];
+                if (ep.b_zero_point) acc -= ep.b_zero_point * (a_row_sums[m] - ep.K * ep.a_zero_point);
+            }
+            float x = (float)acc * ep.scale;
+            if (ep.scales) x *= ep.scales[n0 + n];
+            if (ep.bias) x += ep.bias[n0 + n];
+            if (ep.residual) x += ep.residual[(size_t)(m0 + m) * ep.ld_residual + n0 + n];
+            x = gemm_activation_scalar(ep.activation, x);
+            size_t o = (size_t)(m0 + m) * ep.ld_out + n0 + n;
+            if (ep.out_type == GEMM_OUTPUT_FP32) {
+                ((float*)ep.out)[o] = x;
+            } else if (ep.out_type == GEMM_OUTPUT_BF16) {
+                ((bfloat16*)ep.out)[o] = bfloat16(x);
+            } else {
+                float q = std::nearbyint(x / ep.out_scale) + ep.out_zero_point;
+                ((int8_t*)ep.out)[o] = (int8_t)std::min(127.0f, std::max(-128.0f, q));
+            }
+        }
+    }
+}
+
+// e^x for AVX-512: e^x = 2^n * 2^f with n = round(x * log2(e)), |f| <= 0.5,
+// and 2^f by its Taylor series to degree 7 (relative error < 1e-7)
+__attribute__((target("avx512f")))
+inline __m512 gemm_exp_avx512(__m512 x) {
+    x = _mm512_max_ps(_mm512_min_ps(x, _mm512_set1_ps(88.0f)), _mm512_set1_ps(-88.0f));
+    __m512 t = _mm512_mul_ps(x, _mm512_set1_ps(1.4426950408889634f));
+    __m512 n = _mm512_roundscale_ps(t, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512 f = _mm512_mul_ps(_mm512_sub_ps(t, n), _mm512_set1_ps(0.6931471805599453f));
+    __m512 p = _mm512_set1_ps(1.0f / 5040);
+    p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(1.0f / 720));
+    p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(1.0f / 120));
+    p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(1.0f / 24));
+    p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(1.0f / 6));
+    p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(0.5f));
+    p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(1.0f));
+    p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(1.0f));
+    return _mm512_scalef_ps(p, n);
+}
+
+// x * sigmoid(a * x)
+__attribute__((target("avx512f")))
+inline __m512 gemm_x_sigmoid_avx512(__m512 x, __m512 ax) {
+    __m512 e = gemm_exp_avx512(_mm512_sub_ps(_mm512_setzero_ps(), ax));
+    return _mm512_div_ps(x, _mm512_add_ps(_mm512_set1_ps(1.0f), e));
+}
+
+// Same as gemm_epilogue_apply_scalar with AVX-512, 16 columns at a time
+template <typename Acc>
+__attribute__((target("avx512f,avx512bw")))
+void gemm_epilogue_apply_avx512(const gemm_epilogue& ep, const Acc* C, int ldc, int m0, int n0, int mb, int nb,
+                                const int32_t* a_row_sums = nullptr) {
+    const __m512i a_zero_point = _mm512_set1_epi32(ep.a_zero_point);
+    const __m512 scale = _mm512_set1_ps(ep.scale);
+    const __m512 out_scale = _mm512_set1_ps(ep.out_scale);
+    const __m512 zero_point = _mm512_set1_ps((float)ep.out_zero_point);
+    for (int m = 0; m < mb; ++m) {
+        const Acc* c = C + (size_t)m * ldc;
+        size_t row = (size_t)(m0 + m);
+        for (int n = 0; n < nb; n += 16) {
+            __mmask16 k = nb - n >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (nb - n)) - 1);
+            __m512 x;
+            if constexpr (std::is_same<Acc, int32_t>::value) {
+                __m512i acc = _mm512_maskz_loadu_epi32(k, c + n);
+                if (ep.a_zero_point) {
+                    __m512i sums = _mm512_maskz_loadu_epi32(k, ep.b_col_sums + n0 + n);
+                    acc = _mm512_sub_epi32(acc, _mm512_mullo_epi32(a_zero_point, sums));
+                }
+                if (ep.b_zero_point) {
+                    acc = _mm512_sub_epi32(acc, _mm512_set1_epi32(ep.b_zero_point * (a_row_sums[m] - ep.K * ep.a_zero_point)));
+                }
+                x = _mm512_cvtepi32_ps(acc);
+            } else {
+                x = _mm512_maskz_loadu_ps(k, c + n);
+            }
+            x = _mm512_mul_ps(x, scale);
+            if (ep.scales) x = _mm512_mul_ps(x, _mm512_maskz_loadu_ps(k, ep.scales + n0 + n));
+            if (ep.bias) x = _mm512_add_ps(x, _mm512_maskz_loadu_ps(k, ep.bias + n0 + n));
+            if (ep.residual) {
+                x = _mm512_add_ps(x, _mm512_maskz_loadu_ps(k, ep.residual + row * ep.ld_residual + n0 + n));
+            }
+            switch (ep.activation) {
+            case GEMM_ACTIVATION_RELU:
+                x = _mm512_max_ps(x, _mm512_setzero_ps());
+                break;
+            case GEMM_ACTIVATION_GELU: {
+                __m512 x3 = _mm512_mul_ps(_mm512_mul_ps(x, x), x);
+                __m512 u = _mm512_fmadd_ps(x3, _mm512_set1_ps(GEMM_GELU_C1), x);
+                x = gemm_x_sigmoid_avx512(x, _mm512_mul_ps(u, _mm512_set1_ps(GEMM_GELU_C0)));
+                break;
+            }
+            case GEMM_ACTIVATION_SILU:
+                x = gemm_x_sigmoid_avx512(x, x);
+                break;
+            default:
+                break;
+            }
+            size_t o = row * ep.ld_out + n0 + n;
+            if (ep.out_type == GEMM_OUTPUT_FP32) {
+                _mm512_mask_storeu_ps((float*)ep.out + o, k, x);
+            } else if (ep.out_type == GEMM_OUTPUT_BF16) {
+                // round to nearest even as bfloat16(float)
+                _mm256_mask_storeu_epi16((bfloat16*)ep.out + o, k, bf16_round_avx512(x));
+            } else {
+                __m512 q = _mm512_add_ps(_mm512_roundscale_ps(_mm512_div_ps(x, out_scale),
+                                                              _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC),
+                                         zero_point);
+                q = _mm512_min_ps(_mm512_max_ps(q, _mm512_set1_ps(-128.0f)), _mm512_set1_ps(127.0f));
+                _mm_mask_storeu_epi8((int8_t*)ep.out + o, k, _mm512_cvtepi32_epi8(_mm512_cvtps_epi32(q)));
+            }
+        }
+    }
+}
+
+// Apply the epilogue with AVX-512 if available, otherwise scalar code
+template <typename Acc>
+void gemm_epilogue_apply(const gemm_epilogue& ep, const Acc* C, int ldc, int m0, int n0, int mb, int nb,
+                         const int32_t* a_row_sums = nullptr) {
+    static const bool has_avx512 = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    }();
+    if (has_avx512) gemm_epilogue_apply_avx512(ep, C, ldc, m0, n0, mb, nb, a_row_sums);
+    else gemm_epilogue_apply_scalar(ep, C, ldc, m0, n0, mb, nb, a_row_sums);
+}
@@ -0,0 +1,463 @@
+/*
+    Weight-only int4 quantization for the bf16 GEMM: bf16 A x int4 B -> float C.
+
+    When M is small (e.g., decoding in LLM serving), the GEMM streams all of B for little compute,
+    so its time is the time to read the weights. Quantized to 4 bits, B is a quarter of bf16 B.
+    B [K, N] is quantized per group of group_size rows (a multiple of block_k = 32) and per column:
+        B[k][n] ~ scale[g][n] * (q[k][n] - zero_point[g][n]),   g = k / group_size,  q & zero_point in [0, 15]
+    pack_B_int4 quantizes and packs B in blocks as pack_B for bf16, with 2 elements per byte:
+    a block [block_k/2, block_n, 2] of 16 rows of 64 words is 16 rows of 32 bytes. Each half row of 32 words
+    (16 columns) is 16 bytes, where byte j holds word j in the low nibble and word 16 + j in the high nibble,
+    so that the low nibbles convert to the first 16 words and the high nibbles to the last 16 words
+    with one _mm512_cvtne2ps_pbh, already in VNNI order.
+
+    gemm_amx_int4 computes in one of two ways:
+    - Small M (M <= GEMM_INT4_SCALE_AFTER_MAX_M), where dequantization would cost more than the dot products:
+      the tiles of B hold q - zero_point, integers in [-15, 15] that are exact in bf16, unpacked from the nibbles
+      by a table lookup (_mm512_permutexvar_epi16) with no float math. The 1x4 kernel of gemm.h sums each group
+      of K in float, and the scales of the group are applied to these sums, so each element of C takes one fma
+      per group instead of each weight taking one per call. The products are exact, so the result is closer
+      to A x the float dequantized weights than the bf16 GEMM on gemm_int4_dequantize(B) is.
+    - Larger M: the blocks of a block column of B are dequantized a few K blocks at a time to bf16 VNNI layout
+      in a scratch buffer that stays in L1 (GEMM_INT4_SCRATCH_BLOCKS blocks of 2 KB), right before the 2x2
+      kernel loads them to tiles. All block rows of C use each dequantized panel, so it is dequantized once
+      per call. Dequantization rounds as bfloat16(float), so the result is exactly that of the bf16 GEMM
+      on gemm_int4_dequantize(B).
+    Both unpack B right before its use, so with a thread pool, block columns of N are split across threads
+    as in gemm_small_m, and each thread reads and unpacks only its own columns of B.
+*/
+
+#pragma once
+
+#include "gemm_parallel.h"
+
+// K blocks of B dequantized at a time: 8 x 2 KB = 16 KB, in L1 with the tiles of A
+#define GEMM_INT4_SCRATCH_BLOCKS 8
+#define GEMM_INT4_BLOCK_BYTES (GEMM_BLOCK_N * 16)
+// Rows of A up to which the scales are applied after the dot products, see above
+#define GEMM_INT4_SCALE_AFTER_MAX_M 64
+
+// Quantized B, see above. scales & zero_points are [groups, Np] with Np = N rounded up to block_n,
+// and zeros in the padding columns.
+struct gemm_int4_weights {
+    int K = 0;
+    int N = 0;
+    int group_size = 0;
+    uint8_t* data = nullptr;          // packed nibbles, bytes() of them
+    float* scales = nullptr;
+    uint8_t* zero_points = nullptr;
+    arena memory;
+
+    int groups() const { return (K + group_size - 1) / group_size; }
+    int padded_n() const { return gemm_round_up(N, GEMM_BLOCK_N); }
+    size_t bytes() const { return packed_B_size<bfloat16>(K, N) / 2; }
+    // bytes read by the GEMM: nibbles, scales and zero points
+    size_t total_bytes() const { return bytes() + (size_t)groups() * padded_n() * (sizeof(float) + 1); }
+};
+
+// Quantize B [K, N] (float or bf16) with leading dimension ldb to int4 with asymmetric groups of group_size
+// rows of K. The range of a group always includes 0, so that zeros stay exact.
+// Returns false if group_size is not a positive multiple of block_k or memory cannot be mapped.
+template <typename T>
+bool pack_B_int4(const T* B, int K, int N, int ldb, int group_size, gemm_int4_weights& out) {
+    constexpr int block_k = gemm_block_k<bfloat16>();
+    if (group_size <= 0 || group_size % block_k) {
+        std::cout << "int4 group size must be a positive multiple of " << block_k << "\n";
+        return false;
+    }
+    out = gemm_int4_weights();
+    out.K = K;
+    out.N = N;
+    out.group_size = group_size;
+    int Np = out.padded_n();
+    size_t params = (size_t)out.groups() * Np;
+    out.data = out.memory.allocate<uint8_t>(out.bytes());
+    out.scales = out.memory.allocate<float>(params);
+    out.zero_points = out.memory.allocate<uint8_t>(params);
+    if (!out.data || !out.scales || !out.zero_points) return false;
+    std::fill(out.scales, out.scales + params, 0.0f);
+    std::fill(out.zero_points, out.zero_points + params, 0);
+
+    // scale & zero point of each group and column
+    for (int g = 0; g < out.groups(); ++g) {
+        int k1 = std::min(K, (g + 1) * group_size);
+        for (int n = 0; n < N; ++n) {
+            float lo = 0.0f, hi = 0.0f;
+            for (int k = g * group_size; k < k1; ++k) {
+                float x = (float)B[(size_t)k * ldb + n];
+                lo = std::min(lo, x);
+                hi = std::max(hi, x);
+            }
+            float scale = hi > lo ? (hi - lo) / 15.0f : 1.0f;
+            out.scales[(size_t)g * Np + n] = scale;
+            out.zero_points[(size_t)g * Np + n] = (uint8_t)std::min(15.0f, std::max(0.0f, std::nearbyint(-lo / scale)));
+        }
+    }
+    // nibbles in the order above, padding with q = 0 (scale 0 or rows beyond K, which A's zeros cancel)
+    auto quantize = [&](int k, int n) -> uint8_t {
+        if (n >= N || k >= K) return 0;
+        size_t p = (size_t)(k / group_size) * Np + n;
+        float x = std::nearbyint((float)B[(size_t)k * ldb + n] / out.scales[p]) + out.zero_points[p];
+        return (uint8_t)std::min(15.0f, std::max(0.0f, x));
+    };
+    int KC = (K + block_k - 1) / block_k;
+    int NC = Np / GEMM_BLOCK_N;
+    uint8_t* dst = out.data;
+    for (int kc = 0; kc < KC; ++kc) {
+        for (int nc = 0; nc < NC; ++nc) {
+            for (int k = kc * block_k; k < (kc + 1) * block_k; k += 2) {
+                for (int half = 0; half < 2; ++half) {
+                    int n0 = nc * GEMM_BLOCK_N + half * 16;
+                    // word j of the half row is column n0 + j / 2 of row k + j % 2
+                    for (int j = 0; j < 16; ++j) {
+                        *dst++ = (uint8_t)(quantize(k + j % 2, n0 + j / 2) | quantize(k + j % 2, n0 + 8 + j / 2) << 4);
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// scale * (q - zero_point) as computed by the dequantization kernels: q * scale + (-zero_point * scale) in one fma
+inline float gemm_int4_dequantize_value(int q, float scale, int zero_point) {
+    return std::fma((float)q, scale, (float)-zero_point * scale);
+}
+
+// Dequantize block (kc, nc) of B to bf16 in the layout of a block of pack_B, in scalar code
+inline void gemm_int4_dequantize_block_scalar(const gemm_int4_weights& B, int kc, int nc, bfloat16* out) {
+    constexpr int block_k = gemm_block_k<bfloat16>();
+    int Np = B.padded_n();
+    const uint8_t* src = B.data + ((size_t)kc * (Np / GEMM_BLOCK_N) + nc) * GEMM_INT4_BLOCK_BYTES;
+    size_t p = (size_t)(kc * block_k / B.group_size) * Np + nc * GEMM_BLOCK_N;
+    for (int r = 0; r < block_k / 2; ++r) {
+        for (int half = 0; half < 2; ++half, src += 16, out += 32) {
+            for (int j = 0; j < 16; ++j) {
+                // low nibble: column j / 2 of the half, high nibble: column 8 + j / 2
+                for (int i = 0; i < 2; ++i) {
+                    size_t n = p + half * 16 + i * 8 + j / 2;
+                    int q = i ? src[j] >> 4 : src[j] & 0xF;
+                    out[i * 16 + j] = bfloat16(gemm_int4_dequantize_value(q, B.scales[n], B.zero_points[n]));
+                }
+            }
+        }
+    }
+}
+
+// Dequantize block (kc, nc) with AVX-512: the 16 bytes of a half row are widened to dwords, and their
+// low & high nibbles are the first & last 16 words of the half row. Word j is column j / 2, so scales and
+// zero points are loaded once per block and spread to pairs of lanes, and each word takes one fma.
+// With AVX512-BF16, one _mm512_cvtne2ps_pbh rounds both to bf16 (flushing denormals, which needs denormal scales);
+// otherwise the rounding of bfloat16(float) is done in integer code and the upper words are gathered by a permute.
+template <bool avx512bf16>
+__attribute__((target("avx512f,avx512bw,avx512bf16")))
+void gemm_int4_dequantize_block_avx512(const gemm_int4_weights& B, int kc, int nc, bfloat16* out) {
+    constexpr int block_k = gemm_block_k<bfloat16>();
+    int Np = B.padded_n();
+    const uint8_t* src = B.data + ((size_t)kc * (Np / GEMM_BLOCK_N) + nc) * GEMM_INT4_BLOCK_BYTES;
+    size_t p = (size_t)(kc * block_k / B.group_size) * Np + nc * GEMM_BLOCK_N;
+    // lanes j of [half][nibble]: column half * 16 + nibble * 8 + j / 2 of the 32 columns of the block
+    __m512 scales[2] = {_mm512_loadu_ps(B.scales + p), _mm512_loadu_ps(B.scales + p + 16)};
+    __m512i zero_points[2];
+    for (int h = 0; h < 2; ++h) {
+        zero_points[h] = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(B.zero_points + p + h * 16)));
+    }
+    alignas(64) int32_t pairs[16];
+    for (int j = 0; j < 16; ++j) pairs[j] = j / 2;
+    __m512 scale[2][2];
+    __m512 bias[2][2];  // -zero_point * scale
+    for (int half = 0; half < 2; ++half) {
+        for (int i = 0; i < 2; ++i) {
+            __m512i idx = _mm512_add_epi32(_mm512_load_si512(pairs), _mm512_set1_epi32(half * 16 + i * 8));
+            scale[half][i] = _mm512_permutex2var_ps(scales[0], idx, scales[1]);
+            __m512i zero_point = _mm512_permutex2var_epi32(zero_points[0], idx, zero_points[1]);
+            bias[half][i] = _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_sub_epi32(_mm512_setzero_si512(), zero_point)),
+                                          scale[half][i]);
+        }
+    }
+    // odd words of two vectors: the bf16 values of the rounded floats
+    alignas(64) uint16_t odd_words[32];
+    for (int j = 0; j < 32; ++j) odd_words[j] = (uint16_t)(2 * j + 1);
+    const __m512i odd_idx = _mm512_load_si512(odd_words);
+    const __m512i nibble = _mm512_set1_epi32(0xF);
+    for (int r = 0; r < block_k / 2; ++r) {
+        for (int half = 0; half < 2; ++half, src += 16, out += 32) {
+            __m512i q = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)src));
+            __m512 x0 = _mm512_fmadd_ps(_mm512_cvtepi32_ps(_mm512_and_si512(q, nibble)), scale[half][0], bias[half][0]);
+            __m512 x1 = _mm512_fmadd_ps(_mm512_cvtepi32_ps(_mm512_srli_epi32(q, 4)), scale[half][1], bias[half][1]);
+            __m512i v;
+            if constexpr (avx512bf16) {
+                v = (__m512i)_mm512_cvtne2ps_pbh(x1, x0);
+            } else {
+                v = _mm512_permutex2var_epi16(bf16_round_bits_avx512(x0), odd_idx, bf16_round_bits_avx512(x1));
+            }
+            _mm512_storeu_si512(out, v);
+        }
+    }
+}
+
+inline void gemm_int4_dequantize_block(const gemm_int4_weights& B, int kc, int nc, bfloat16* out) {
+    static const int isa = [] {
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx512f") || !__builtin_cpu_supports("avx512bw")) return 0;
+        return __builtin_cpu_supports("avx512bf16") ? 2 : 1;
+    }();
+    if (isa == 2) gemm_int4_dequantize_block_avx512<true>(B, kc, nc, out);
+    else if (isa == 1) gemm_int4_dequantize_block_avx512<false>(B, kc, nc, out);
+    else gemm_int4_dequantize_block_scalar(B, kc, nc, out);
+}
+
+// Unpack block (kc, nc) of B to bf16 q - zero_point in the layout of a block of pack_B, in scalar code
+inline void gemm_int4_unpack_block_scalar(const gemm_int4_weights& B, int kc, int nc, bfloat16* out) {
+    constexpr int block_k = gemm_block_k<bfloat16>();
+    int Np = B.padded_n();
+    const uint8_t* src = B.data + ((size_t)kc * (Np / GEMM_BLOCK_N) + nc) * GEMM_INT4_BLOCK_BYTES;
+    const uint8_t* zero_points = B.zero_points + (size_t)(kc * block_k / B.group_size) * Np + nc * GEMM_BLOCK_N;
+    for (int r = 0; r < block_k / 2; ++r) {
+        for (int half = 0; half < 2; ++half, src += 16, out += 32) {
+            for (int j = 0; j < 16; ++j) {
+                out[j] = bfloat16((float)((src[j] & 0xF) - zero_points[half * 16 + j / 2]));
+                out[16 + j] = bfloat16((float)((src[j] >> 4) - zero_points[half * 16 + 8 + j / 2]));
+            }
+        }
+    }
+}
+
+// Unpack block (kc, nc) with AVX-512: a row of 32 bytes (both halves) is widened to 32 words, and each nibble
+// minus the zero point of its column, plus 15, indexes a table of the bf16 values of -15..16.
+// The low & high nibbles of the first 16 bytes are the first half row, those of the last 16 bytes the second.
+__attribute__((target("avx512f,avx512bw")))
+inline void gemm_int4_unpack_block_avx512(const gemm_int4_weights& B, int kc, int nc, bfloat16* out) {
+    constexpr int block_k = gemm_block_k<bfloat16>();
+    struct tables {
+        alignas(64) uint16_t columns[32];  // column of the low nibble of byte l of a row
+        alignas(64) uint16_t values[32];   // bf16 of i - 15
+    };
+    static const tables t = [] {
+        tables t;
+        for (int l = 0; l < 32; ++l) {
+            t.columns[l] = (uint16_t)(l / 16 * 16 + l % 16 / 2);
+            t.values[l] = bfloat16((float)(l - 15)).value;
+        }
+        return t;
+    }();
+    int Np = B.padded_n();
+    const uint8_t* src = B.data + ((size_t)kc * (Np / GEMM_BLOCK_N) + nc) * GEMM_INT4_BLOCK_BYTES;
+    const uint8_t* zero_points = B.zero_points + (size_t)(kc * block_k / B.group_size) * Np + nc * GEMM_BLOCK_N;
+    // zero_point - 15 of the column of each low & high nibble
+    __m512i z = _mm512_sub_epi16(_mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)zero_points)),
+                                 _mm512_set1_epi16(15));
+    __m512i columns = _mm512_load_si512(t.columns);
+    __m512i z_lo = _mm512_permutexvar_epi16(columns, z);
+    __m512i z_hi = _mm512_permutexvar_epi16(_mm512_add_epi16(columns, _mm512_set1_epi16(8)), z);
+    __m512i values = _mm512_load_si512(t.values);
+    const __m512i nibble = _mm512_set1_epi16(0xF);
+    for (int r = 0; r < block_k / 2; ++r, src += 32, out += 64) {
+        __m512i q = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)src));
+        __m512i lo = _mm512_permutexvar_epi16(_mm512_sub_epi16(_mm512_and_si512(q, nibble), z_lo), values);
+        __m512i hi = _mm512_permutexvar_epi16(_mm512_sub_epi16(_mm512_srli_epi16(q, 4), z_hi), values);
+        _mm512_storeu_si512(out, _mm512_shuffle_i64x2(lo, hi, 0x44));
+        _mm512_storeu_si512(out + 32, _mm512_shuffle_i64x2(lo, hi, 0xEE));
+    }
+}
+
+inline void gemm_int4_unpack_block(const gemm_int4_weights& B, int kc, int nc, bfloat16* out) {
+    static const bool avx512 = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    }();
+    if (avx512) gemm_int4_unpack_block_avx512(B, kc, nc, out);
+    else gemm_int4_unpack_block_scalar(B, kc, nc, out);
+}
+
+// Dequantize all of B to bf16 [K, N] with leading dimension ldb, e.g., for a reference
+inline void gemm_int4_dequantize(const gemm_int4_weights& B, bfloat16* out, int ldb) {
+    constexpr int block_k = gemm_block_k<bfloat16>();
+    alignas(64) bfloat16 block[block_k * GEMM_BLOCK_N];
+    for (int kc = 0; kc * block_k < B.K; ++kc) {
+        for (int nc = 0; nc * GEMM_BLOCK_N < B.N; ++nc) {
+            gemm_int4_dequantize_block(B, kc, nc, block);
+            for (int k = kc * block_k; k < std::min(B.K, (kc + 1) * block_k); ++k) {
+                for (int n = nc * GEMM_BLOCK_N; n < std::min(B.N, (nc + 1) * GEMM_BLOCK_N); ++n) {
+                    int kb = k - kc * block_k, nb = n - nc * GEMM_BLOCK_N;
+                    out[(size_t)k * ldb + n] = block[(kb / 2) * GEMM_BLOCK_N * 2 + nb * 2 + kb % 2];
+                }
+            }
+        }
+    }
+}
+
+// Rows [0, M) of C, nb columns: C = scales * sums, or C += scales * sums if accumulate, in scalar code
+inline void gemm_int4_scale_sums_scalar(const float* sums, int sums_ld, const float* scales, float* C, int ldc, int M,
+                                        int nb, bool accumulate) {
+    for (int m = 0; m < M; ++m, sums += sums_ld, C += ldc) {
+        for (int n = 0; n < nb; ++n) C[n] = accumulate ? std::fma(scales[n], sums[n], C[n]) : scales[n] * sums[n];
+    }
+}
+
+// Same with AVX-512, 16 columns per vector and a mask on the tail
+__attribute__((target("avx512f")))
+inline void gemm_int4_scale_sums_avx512(const float* sums, int sums_ld, const float* scales, float* C, int ldc, int M,
+                                        int nb, bool accumulate) {
+    for (int n = 0; n < nb; n += 16) {
+        __mmask16 mask = nb - n >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (nb - n)) - 1);
+        __m512 scale = _mm512_maskz_loadu_ps(mask, scales + n);
+        for (int m = 0; m < M; ++m) {
+            __m512 x = _mm512_maskz_loadu_ps(mask, sums + (size_t)m * sums_ld + n);
+            float* c = C + (size_t)m * ldc + n;
+            x = accumulate ? _mm512_fmadd_ps(scale, x, _mm512_maskz_loadu_ps(mask, c)) : _mm512_mul_ps(scale, x);
+            _mm512_mask_storeu_ps(c, mask, x);
+        }
+    }
+}
+
+inline void gemm_int4_scale_sums(const float* sums, int sums_ld, const float* scales, float* C, int ldc, int M,
+                                 int nb, bool accumulate) {
+    static const bool avx512 = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx512f");
+    }();
+    if (avx512) gemm_int4_scale_sums_avx512(sums, sums_ld, scales, C, ldc, M, nb, accumulate);
+    else gemm_int4_scale_sums_scalar(sums, sums_ld, scales, C, ldc, M, nb, accumulate);
+}
+
+// Block columns [nc0, nc1) of C = A x B for M <= GEMM_INT4_SCALE_AFTER_MAX_M, with the scales applied
+// after the dot products (see above). a_packed is all of A packed by pack_A_panel.
+// Pairs of block columns are unpacked to b_panel as [K block][2 block columns], for the 1x4 kernel on each 16 rows,
+// which sums a group of K to c_group; the scales of the group then add it to c_pair.
+inline void gemm_amx_int4_scale_after(int M, const bfloat16* a_packed, const gemm_int4_weights& B, float* C, int ldc,
+                                      int nc0, int nc1) {
+    constexpr int block_k = gemm_block_k<bfloat16>();
+    constexpr size_t block_size = (size_t)block_k * GEMM_BLOCK_N;
+    // K blocks of a pair of block columns unpacked at a time, as many bytes as GEMM_INT4_SCRATCH_BLOCKS
+    constexpr int chunk = GEMM_INT4_SCRATCH_BLOCKS / 2;
+    int N = B.N, Np = B.padded_n();
+    int KC = (B.K + block_k - 1) / block_k;
+    int group_blocks = B.group_size / block_k;
+    arena_scope scratch(arena_thread_scratch());
+    bfloat16* b_panel = scratch.allocate<bfloat16>(2 * chunk * block_size);
+    // sums of a group, and C of a pair of block columns, which is written once (the rows of C are far apart in L1)
+    constexpr int c_ld = 2 * GEMM_BLOCK_N;
+    alignas(64) float c_group[GEMM_INT4_SCALE_AFTER_MAX_M * c_ld];
+    alignas(64) float c_pair[GEMM_INT4_SCALE_AFTER_MAX_M * c_ld];
+    for (int nc = nc0; nc < nc1; nc += 2) {
+        int pair = std::min(2, nc1 - nc);
+        int n0 = nc * GEMM_BLOCK_N;
+        int nb = std::min(pair * GEMM_BLOCK_N, N - n0);
+        for (int g0 = 0; g0 < KC; g0 += group_blocks) {
+            int g1 = std::min(g0 + group_blocks, KC);
+            for (int pc = g0; pc < g1; pc += chunk) {
+                int pc_end = std::min(pc + chunk, g1);
+                {
+                    GEMM_PROFILE_SCOPE(GEMM_PHASE_PACK_B);
+                    // B of the next chunk comes from memory, in a new page for each K block
+                    int next_kc = pc_end, next_nc = nc;
+                    if (next_kc == KC) {
+                        next_kc = 0;
+                        next_nc = nc + 2;
+                    }
+                    int next_pair = std::min(2, nc1 - next_nc);
+                    for (int kc = next_kc; next_pair > 0 && kc < std::min(next_kc + chunk, KC); ++kc) {
+                        gemm_prefetch_rows(B.data + ((size_t)kc * (Np / GEMM_BLOCK_N) + next_nc) * GEMM_INT4_BLOCK_BYTES,
+                                           64, next_pair * GEMM_INT4_BLOCK_BYTES / 64);
+                    }
+                    for (int kc = pc; kc < pc_end; ++kc) {
+                        for (int j = 0; j < pair; ++j) {
+                            gemm_int4_unpack_block(B, kc, nc + j, b_panel + ((kc - pc) * 2 + j) * block_size);
+                        }
+                    }
+                }
+                for (int m0 = 0; m0 < M; m0 += 16) {
+                    int mb = std::min(16, M - m0);
+                    const bfloat16* a = a_packed + ((size_t)(m0 / GEMM_BLOCK_M) * KC + pc) * GEMM_BLOCK_M * block_k +
+                                        (m0 % GEMM_BLOCK_M) * block_k;
+                    gemm_configure_block_1x4<bfloat16>(mb);
+                    gemm_block_1x4(a, block_k * sizeof(bfloat16), (size_t)GEMM_BLOCK_M * block_k, (const bfloat16*)nullptr,
+                                   b_panel, b_panel + block_size, 2 * block_size, c_group + (size_t)m0 * c_ld, c_ld, mb, nb,
+                                   pc_end - pc, pc != g0, 0);
+                }
+            }
+            GEMM_PROFILE_SCOPE(GEMM_PHASE_EPILOGUE);
+            gemm_int4_scale_sums(c_group, c_ld, B.scales + (size_t)(g0 / group_blocks) * Np + n0, c_pair, c_ld, M, nb,
+                                 g0 != 0);
+        }
+        for (int m = 0; m < M; ++m) std::copy(c_pair + m * c_ld, c_pair + m * c_ld + nb, C + (size_t)m * ldc + n0);
+    }
+}
+
+// Block columns [nc0, nc1) of C = A x B for M > GEMM_INT4_SCALE_AFTER_MAX_M, dequantizing B (see above).
+// a_packed is all of A packed by pack_A_panel.
+inline void gemm_amx_int4_dequantized(int M, const bfloat16* a_packed, const gemm_int4_weights& B, float* C, int ldc,
+                                      int nc0, int nc1) {
+    constexpr int block_k = gemm_block_k<bfloat16>();
+    constexpr size_t block_size = (size_t)block_k * GEMM_BLOCK_N;
+    int N = B.N;
+    int MC = (M + GEMM_BLOCK_M - 1) / GEMM_BLOCK_M;
+    int KC = (B.K + block_k - 1) / block_k;
+    arena_scope scratch(arena_thread_scratch());
+    bfloat16* b_panel = scratch.allocate<bfloat16>(GEMM_INT4_SCRATCH_BLOCKS * block_size);
+    for (int nc = nc0; nc < nc1; ++nc) {
+        int nb = std::min(GEMM_BLOCK_N, N - nc * GEMM_BLOCK_N);
+        for (int pc = 0; pc < KC; pc += GEMM_INT4_SCRATCH_BLOCKS) {
+            int pc_end = std::min(pc + GEMM_INT4_SCRATCH_BLOCKS, KC);
+            {
+                GEMM_PROFILE_SCOPE(GEMM_PHASE_PACK_B);
+                for (int kc = pc; kc < pc_end; ++kc) gemm_int4_dequantize_block(B, kc, nc, b_panel + (kc - pc) * block_size);
+            }
+            for (int mc = 0; mc < MC; ++mc) {
+                int mb = std::min(GEMM_BLOCK_M, M - mc * GEMM_BLOCK_M);
+                float* c = C + (size_t)mc * GEMM_BLOCK_M * ldc + nc * GEMM_BLOCK_N;
+                const bfloat16* a = a_packed + ((size_t)mc * KC + pc) * GEMM_BLOCK_M * block_k;
+                gemm_configure_block<bfloat16>(mb, nb);
+                gemm_block(a, block_k * sizeof(bfloat16), (size_t)GEMM_BLOCK_M * block_k, (const bfloat16*)nullptr,
+                           b_panel, block_size, c, ldc, mb, nb, pc_end - pc, pc != 0);
+            }
+        }
+    }
+}
+
+// Block columns [nc0, nc1) of C = A x B, on the calling thread
+inline void gemm_amx_int4_range(int M, const bfloat16* a_packed, const gemm_int4_weights& B, float* C, int ldc,
+                                int nc0, int nc1) {
+    if (M <= GEMM_INT4_SCALE_AFTER_MAX_M) gemm_amx_int4_scale_after(M, a_packed, B, C, ldc, nc0, nc1);
+    else gemm_amx_int4_dequantized(M, a_packed, B, C, ldc, nc0, nc1);
+}
+
+// Pack all of A once (pack_A_panel), since each block row is read for every block column
+inline bfloat16* gemm_amx_int4_pack_A(arena_scope& scratch, int M, const bfloat16* A, int lda, int K) {
+    constexpr int block_k = gemm_block_k<bfloat16>();
+    int MC = (M + GEMM_BLOCK_M - 1) / GEMM_BLOCK_M;
+    int KC = (K + block_k - 1) / block_k;
+    bfloat16* a_packed = scratch.allocate<bfloat16>((size_t)MC * KC * GEMM_BLOCK_M * block_k);
+    GEMM_PROFILE_SCOPE(GEMM_PHASE_PACK_A);
+    pack_A_panel(A, lda, M, K, 0, MC, 0, KC, a_packed);
+    return a_packed;
+}
+
+// C = A x B with bf16 A [M, K] and int4 B from pack_B_int4 (B.K = K). AMX must be enabled with init_amx().
+inline void gemm_amx_int4(int M, const bfloat16* A, int lda, const gemm_int4_weights& B, float* C, int ldc) {
+    if (M <= 0 || B.N <= 0) return;
+    GEMM_PROFILE_CALL("gemm_amx_int4", M, B.N, B.K);
+    arena_scope scratch(arena_thread_scratch());
+    const bfloat16* a_packed = gemm_amx_int4_pack_A(scratch, M, A, lda, B.K);
+    gemm_amx_int4_range(M, a_packed, B, C, ldc, 0, (B.N + GEMM_BLOCK_N - 1) / GEMM_BLOCK_N);
+}
+
+// Same on the threads of pool: A is packed once by the calling thread, and the block columns of N are split
+// across the threads as in gemm_small_m, in pairs for the 1x4 kernel, so each thread streams its own part of B.
+inline void gemm_amx_int4(amx_thread_pool& pool, int M, const bfloat16* A, int lda, const gemm_int4_weights& B,
+                          float* C, int ldc) {
+    if (M <= 0 || B.N <= 0) return;
+    GEMM_PROFILE_CALL("gemm_amx_int4", M, B.N, B.K);
+    arena_scope scratch(arena_thread_scratch());
+    const bfloat16* a_packed = gemm_amx_int4_pack_A(scratch, M, A, lda, B.K);
+    int NC = gemm_ceil_div(B.N, GEMM_BLOCK_N);
+    int unit = M <= GEMM_INT4_SCALE_AFTER_MAX_M ? 2 : 1;
+    int units = gemm_ceil_div(NC, unit);
+    int num_threads = pool.size();
+    pool.run([&](int tid) {
+        int nc0 = std::min(NC, gemm_split_begin(units, num_threads, tid) * unit);
+        int nc1 = std::min(NC, gemm_split_begin(units, num_threads, tid + 1) * unit);
+        if (nc0 < nc1) gemm_amx_int4_range(M, a_packed, B, C, ldc, nc0, nc1);
+    });
+}
@@ -0,0 +1,319 @@
+/*
+    A small x86-64 JIT for the block kernel of the GEMM in gemm.h (in the spirit of oneDNN's brgemm).
+
+    gemm_block takes the block shape, K blocks and strides at runtime, so every call branches on the
+    tiles in use and computes addresses from the strides. Here a kernel is generated for each
+    gemm_jit_key: the tiles in use and all strides are baked into the code as immediates & displacements,
+    so the kernel is a straight sequence of tile instructions around a counted loop over K.
+    The trip count of the loop is passed in a register, so one kernel serves every K.
+
+    Generated kernels compute the same as gemm_block, in the same order, and have the signature
+        void kernel(const void* A, const void* B, void* C, const void* A_tail, long k_blocks)
+    where k_blocks is the number of K blocks read from A, without the tail.
+    The tile config for the block must be loaded before calling them (gemm_configure_block).
+    Kernels are cached by key: a per-thread one-entry cache for repeated blocks of the same shape
+    and a global map, guarded by a mutex, for the rest. The code of all kernels goes to one buffer
+    of GEMM_JIT_CODE_CAPACITY bytes, reserved once and grown a page at a time; it is never freed, and
+    once it is full new keys fall back to gemm_block. The buffer is a memfd mapped twice,
+    writable and executable, so kernels are appended while other threads run the ones before them.
+
+    The JIT emits real AMX instructions, so it is off under emulation. It can be turned off with GEMM_JIT=0,
+    in which case gemm.h uses the intrinsic kernel. Epilogues are applied after the kernel by gemm.h,
+    so they are not part of the key.
+*/
+
+#pragma once
+
+#include "common.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+// Dot-product instructions, see GEMM_TILE_DP in gemm.h
+enum gemm_jit_dp {
+    GEMM_JIT_DPBSSD,
+    GEMM_JIT_DPBSUD,
+    GEMM_JIT_DPBUSD,
+    GEMM_JIT_DPBUUD,
+    GEMM_JIT_DPBF16PS,
+};
+
+// Everything a kernel is specialized for. Strides & steps are in bytes.
+struct gemm_jit_key {
+    int dp;          // gemm_jit_dp
+    int mb;          // rows of the block, 16 or 32: the tile config gives the exact rows
+    int nb;          // columns of the block, 16 or 32
+    bool k_tail;     // the last K block comes from A_tail
+    bool accumulate; // load C instead of zeroing it
+    long a_stride;
+    long a_step;
+    long b_step;
+    long c_stride;
+
+    auto tie() const { return std::tie(dp, mb, nb, k_tail, accumulate, a_stride, a_step, b_step, c_stride); }
+    bool operator<(const gemm_jit_key& o) const { return tie() < o.tie(); }
+    bool operator==(const gemm_jit_key& o) const { return tie() == o.tie(); }
+};
+
+// Dot-product instruction for A of type T and B of type TB
+template <typename T, typename TB>
+constexpr gemm_jit_dp gemm_jit_dp_of() {
+    return std::is_same<T, bfloat16>::value                                       ? GEMM_JIT_DPBF16PS
+           : std::is_same<T, int8_t>::value && std::is_same<TB, int8_t>::value   ? GEMM_JIT_DPBSSD
+           : std::is_same<T, int8_t>::value                                      ? GEMM_JIT_DPBSUD
+           : std::is_same<TB, int8_t>::value                                     ? GEMM_JIT_DPBUSD
+                                                                                 : GEMM_JIT_DPBUUD;
+}
+
+typedef void (*gemm_jit_kernel)(const void* A, const void* B, void* C, const void* A_tail, long k_blocks);
+
+// Emits x86-64 machine code to a byte buffer
+class gemm_jit_emitter {
+public:
+    enum reg { RAX = 0, RCX = 1, RDX = 2, RSI = 6, RDI = 7, R8 = 8, R9 = 9, R10 = 10 };
+
+    const std::vector<uint8_t>& code() const { return code_; }
+    size_t size() const { return code_.size(); }
+
+    void mov_imm(reg r, int64_t imm) {
+        // mov r64, imm64
+        rex(true, 0, 0, r);
+        byte(0xB8 + (r & 7));
+        bytes(&imm, 8);
+    }
+    void add_imm(reg r, int32_t imm) {
+        // add r64, imm32
+        rex(true, 0, 0, r);
+        byte(0x81);
+        byte(0xC0 | (r & 7));
+        bytes(&imm, 4);
+    }
+    void mov(reg dst, reg src) {
+        // mov r/m64, r64
+        rex(true, src, 0, dst);
+        byte(0x89);
+        byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+    }
+    void test(reg r) {
+        // test r/m64, r64 with itself
+        rex(true, r, 0, r);
+        byte(0x85);
+        byte(0xC0 | ((r & 7) << 3) | (r & 7));
+    }
+    void dec(reg r) {
+        rex(true, 0, 0, r);
+        byte(0xFF);
+        byte(0xC8 | (r & 7));
+    }
+    // jz forward, returns the position to pass to bind once the target is emitted
+    size_t jz() {
+        byte(0x0F);
+        byte(0x84);
+        size_t at = code_.size();
+        bytes("\0\0\0\0", 4);
+        return at;
+    }
+    // Point the jump at position at to the end of the code
+    void bind(size_t at) {
+        int32_t rel = (int32_t)(code_.size() - (at + 4));
+        std::memcpy(&code_[at], &rel, 4);
+    }
+    // jnz to an offset in the code
+    void jnz(size_t target) {
+        byte(0x0F);
+        byte(0x85);
+        int32_t rel = (int32_t)(target - (code_.size() + 4));
+        bytes(&rel, 4);
+    }
+    void ret() { byte(0xC3); }
+
+    // AMX instructions: VEX.128.<pp>.0F38.W0 <opcode>, pp: 0 = NP, 1 = 66, 2 = F3, 3 = F2
+    void tilezero(int t) { vex(0, 0, 0, 0, 3, 0x49); byte(0xC0 | (t << 3)); }
+    void tileloadd(int t, reg base, reg index, int32_t disp) { vex(0, index, base, 0, 3, 0x4B); sib_disp32(t, base, index, disp); }
+    void tilestored(int t, reg base, reg index, int32_t disp) { vex(0, index, base, 0, 2, 0x4B); sib_disp32(t, base, index, disp); }
+    void tdp(gemm_jit_dp dp, int dst, int src1, int src2) {
+        static const int pp[] = {3, 2, 1, 0, 2};
+        vex(0, 0, 0, src2, pp[dp], dp == GEMM_JIT_DPBF16PS ? 0x5C : 0x5E);
+        byte(0xC0 | (dst << 3) | src1);
+    }
+
+private:
+    void byte(uint8_t b) { code_.push_back(b); }
+    void bytes(const void* p, size_t n) { code_.insert(code_.end(), (const uint8_t*)p, (const uint8_t*)p + n); }
+    void rex(bool w, int r, int x, int b) {
+        byte(0x40 | (w << 3) | ((r >> 3) << 2) | ((x >> 3) << 1) | (b >> 3));
+    }
+    // 3-byte VEX with the map 0F38, L = 0 and W = 0. R, X & B (extension bits of reg, index & base)
+    // and vvvv are stored inverted, so vvvv = 0 when there is no second source.
+    void vex(int r, int x, int b, int vvvv, int pp, uint8_t opcode) {
+        byte(0xC4);
+        byte((((~r >> 3) & 1) << 7) | (((~x >> 3) & 1) << 6) | (((~b >> 3) & 1) << 5) | 0x02);
+        byte((((~vvvv) & 0xF) << 3) | pp);
+        byte(opcode);
+    }
+    // [base + index + disp32] with a SIB byte
+    void sib_disp32(int t, reg base, reg index, int32_t disp) {
+        byte(0x80 | ((t & 7) << 3) | 0x04);
+        byte(((index & 7) << 3) | (base & 7));
+        bytes(&disp, 4);
+    }
+
+    std::vector<uint8_t> code_;
+};
+
+// Generate the code of a kernel, following gemm_block:
+//   rdi = A, rsi = B, rdx = C, rcx = A_tail, r8 = k_blocks; rax = A stride, r8 = B stride, r9 = C stride,
+//   r10 = K counter
+inline void gemm_jit_emit(const gemm_jit_key& key, gemm_jit_emitter& e) {
+    typedef gemm_jit_emitter E;
+    bool m1 = key.mb > 16;
+    bool n1 = key.nb > 16;
+    // B tiles have 16 rows of 64 bytes in a block row of 128 bytes
+    const int b_stride = 128;
+    const int block_k_bytes = 64;
+    gemm_jit_dp dp = (gemm_jit_dp)key.dp;
+    e.mov(E::R10, E::R8);
+    e.mov_imm(E::RAX, key.a_stride);
+    e.mov_imm(E::R8, b_stride);
+    e.mov_imm(E::R9, key.c_stride);
+    int32_t c_disp[4] = {0, 64, (int32_t)(16 * key.c_stride), (int32_t)(16 * key.c_stride + 64)};
+    bool used[4] = {true, n1, m1, m1 && n1};
+    // 1. clear C tiles, or load them
+    for (int t = 0; t < 4; ++t) {
+        if (!used[t]) continue;
+        if (key.accumulate) e.tileloadd(t, E::RDX, E::R9, c_disp[t]);
+        else e.tilezero(t);
+    }
+    // 2. loop over K: A from A with a_stride, then the tail from A_tail
+    auto body = [&](E::reg a, int32_t a_stride_16) {
+        e.tileloadd(4, a, E::RAX, 0);
+        e.tileloadd(6, E::RSI, E::R8, 0);
+        if (n1) e.tileloadd(7, E::RSI, E::R8, 64);
+        if (m1) e.tileloadd(5, a, E::RAX, a_stride_16);
+        e.tdp(dp, 0, 4, 6);
+        if (n1) e.tdp(dp, 1, 4, 7);
+        if (m1) e.tdp(dp, 2, 5, 6);
+        if (m1 && n1) e.tdp(dp, 3, 5, 7);
+    };
+    e.test(E::R10);
+    size_t skip = e.jz();
+    size_t loop = e.size();
+    body(E::RDI, (int32_t)(16 * key.a_stride));
+    e.add_imm(E::RDI, (int32_t)key.a_step);
+    e.add_imm(E::RSI, (int32_t)key.b_step);
+    e.dec(E::R10);
+    e.jnz(loop);
+    e.bind(skip);
+    if (key.k_tail) {
+        e.mov_imm(E::RAX, block_k_bytes);
+        body(E::RCX, 16 * block_k_bytes);
+    }
+    // 3. store C tiles
+    for (int t = 0; t < 4; ++t) {
+        if (used[t]) e.tilestored(t, E::RDX, E::R9, c_disp[t]);
+    }
+    e.ret();
+}
+
+// Bytes reserved for the code of all kernels, room for over 10k kernels
+constexpr size_t GEMM_JIT_CODE_CAPACITY = (size_t)4 << 20;
+
+// Executable buffer the kernels are appended to. The memory is a memfd mapped twice: written through rw,
+// run through rx. Pages are added to the memfd as the code grows.
+struct gemm_jit_code_buffer {
+    int fd = -1;
+    uint8_t* rw = nullptr;
+    uint8_t* rx = nullptr;
+    size_t used = 0;
+    size_t mapped = 0; // size of the memfd, a multiple of the page size
+
+    // Reserve the mappings. Returns false on failure.
+    bool init() {
+        fd = memfd_create("gemm_jit", MFD_CLOEXEC);
+        if (fd < 0) return false;
+        void* w = mmap(nullptr, GEMM_JIT_CODE_CAPACITY, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        void* x = mmap(nullptr, GEMM_JIT_CODE_CAPACITY, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+        if (w == MAP_FAILED || x == MAP_FAILED) {
+            if (w != MAP_FAILED) munmap(w, GEMM_JIT_CODE_CAPACITY);
+            if (x != MAP_FAILED) munmap(x, GEMM_JIT_CODE_CAPACITY);
+            close(fd);
+            fd = -1;
+            return false;
+        }
+        rw = (uint8_t*)w;
+        rx = (uint8_t*)x;
+        return true;
+    }
+
+    // Copy code to the end of the buffer, 64-byte aligned. Returns null if the buffer is full.
+    gemm_jit_kernel append(const std::vector<uint8_t>& code) {
+        size_t offset = (used + 63) / 64 * 64;
+        size_t end = offset + code.size();
+        if (end > GEMM_JIT_CODE_CAPACITY) return nullptr;
+        if (end > mapped) {
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            size_t size = (end + page - 1) / page * page;
+            if (ftruncate(fd, (off_t)size)) return nullptr;
+            mapped = size;
+        }
+        std::memcpy(rw + offset, code.data(), code.size());
+        used = end;
+        return (gemm_jit_kernel)(rx + offset);
+    }
+};
+
+// Whether generated kernels can be used: real AMX and GEMM_JIT is not 0
+inline bool gemm_jit_enabled() {
+    static const bool env_enabled = [] {
+        const char* env = std::getenv("GEMM_JIT");
+        return !env || std::strcmp(env, "0");
+    }();
+    return env_enabled && !amx_emulated;
+}
+
+// Global cache of generated kernels
+struct gemm_jit_cache {
+    std::mutex mutex;
+    std::map<gemm_jit_key, gemm_jit_kernel> kernels;
+    size_t code_bytes = 0;
+    gemm_jit_code_buffer code;
+    bool ready = false; // the code buffer is mapped
+    bool full = false;  // no more kernels can be added, misses return null
+};
+inline gemm_jit_cache gemm_jit_kernels;
+
+// Kernel for key from the caches, generated on a miss. Returns null if it cannot be generated.
+inline gemm_jit_kernel gemm_jit_get(const gemm_jit_key& key) {
+    // the last key looked up by this thread, valid once last_kernel is set
+    static thread_local gemm_jit_key last_key = {};
+    static thread_local gemm_jit_kernel last_kernel = nullptr;
+    if (last_kernel != nullptr && key == last_key) return last_kernel;
+    gemm_jit_cache& cache = gemm_jit_kernels;
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    auto it = cache.kernels.find(key);
+    gemm_jit_kernel kernel;
+    if (it != cache.kernels.end()) {
+        kernel = it->second;
+    } else {
+        if (cache.full) return nullptr;
+        if (!cache.ready && !(cache.ready = cache.code.init())) {
+            cache.full = true;
+            return nullptr;
+        }
+        gemm_jit_emitter e;
+        gemm_jit_emit(key, e);
+        kernel = cache.code.append(e.code());
+        if (!kernel) {
+            cache.full = true;
+            return nullptr;
+        }
+        cache.kernels.emplace(key, kernel);
+        cache.code_bytes += e.size();
+    }
+    last_key = key;
+    last_kernel = kernel;
+    return kernel;
+}
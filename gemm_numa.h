@@ -0,0 +1,414 @@
+/*
+    NUMA placement for the multithreaded GEMM in gemm_parallel.h: thread pinning, first-touch placement
+    of packed B and C, and copies of packed B (weights) on each node.
+
+    On a machine with several sockets, a thread reading packed B or writing C on the memory of another node
+    goes through the inter-socket link, which has a fraction of the bandwidth of local memory.
+    Linux places a page on the node of the thread that first touches it, so that memory written by
+    the threads that later use it stays local, as long as the threads do not move: gemm_numa_pool pins them.
+    Policies (gemm_numa_policy, or GEMM_NUMA_POLICY=none|pin|first-touch|replicate|interleave):
+    - none: threads are not pinned and memory is placed by whoever touches it first (as amx_thread_pool)
+    - pin: threads are pinned to cores, filling one node before the next
+    - first-touch: pin, and the blocks of packed B and of C are first touched by
+      the threads that read or write them (gemm_numa_weights, gemm_numa_first_touch)
+    - replicate: pin, and each node gets its own copy of packed B, first touched by its threads
+    - interleave: pin, and the pages of packed B are interleaved over the nodes (as numactl --interleave)
+    The topology is read from sysfs (/sys/devices/system/node), without libnuma. Without sysfs there is one node.
+    GEMM_NUMA_FAKE_NODES=n splits the CPUs into n fake nodes, like numa=fake of the kernel, to run the
+    multi-node code paths on a single-node machine; memory of a fake node is that of its real node.
+*/
+
+#pragma once
+
+#include "gemm_parallel.h"
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#include <dirent.h>
+
+enum gemm_numa_policy {
+    GEMM_NUMA_NONE,
+    GEMM_NUMA_PIN,
+    GEMM_NUMA_FIRST_TOUCH,
+    GEMM_NUMA_REPLICATE,
+    GEMM_NUMA_INTERLEAVE,
+};
+
+inline const char* gemm_numa_policy_name(gemm_numa_policy policy) {
+    switch (policy) {
+        case GEMM_NUMA_PIN: return "pin";
+        case GEMM_NUMA_FIRST_TOUCH: return "first-touch";
+        case GEMM_NUMA_REPLICATE: return "replicate";
+        case GEMM_NUMA_INTERLEAVE: return "interleave";
+        default: return "none";
+    }
+}
+
+// Policy of a name. Returns false if the name is unknown.
+inline bool gemm_numa_policy_from_name(const std::string& name, gemm_numa_policy& policy) {
+    for (gemm_numa_policy p : {GEMM_NUMA_NONE, GEMM_NUMA_PIN, GEMM_NUMA_FIRST_TOUCH, GEMM_NUMA_REPLICATE,
+                               GEMM_NUMA_INTERLEAVE}) {
+        if (name == gemm_numa_policy_name(p)) {
+            policy = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Policy of GEMM_NUMA_POLICY, none if not set
+inline gemm_numa_policy gemm_numa_policy_from_env() {
+    const char* env = std::getenv("GEMM_NUMA_POLICY");
+    gemm_numa_policy policy = GEMM_NUMA_NONE;
+    if (env && *env && !gemm_numa_policy_from_name(env, policy)) {
+        std::cout << "Unknown GEMM_NUMA_POLICY " << env << ", using none\n";
+    }
+    return policy;
+}
+
+struct gemm_numa_node {
+    int memory;             // node of the memory (sysfs node id)
+    std::vector<int> cpus;  // CPUs of the node this process may run on
+};
+
+struct gemm_numa_topology {
+    std::vector<gemm_numa_node> nodes;
+    bool fake = false;
+};
+
+// CPUs of a sysfs list such as "0-3,8,10-11"
+inline std::vector<int> gemm_numa_parse_cpulist(const std::string& list) {
+    std::vector<int> cpus;
+    std::istringstream s(list);
+    std::string range;
+    while (std::getline(s, range, ',')) {
+        int first, last;
+        int n = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (n < 1) continue;
+        if (n == 1) last = first;
+        for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// Nodes with CPUs this process may run on, from sysfs. GEMM_NUMA_FAKE_NODES=n splits them into n fake nodes.
+inline gemm_numa_topology gemm_numa_detect() {
+    gemm_numa_topology topology;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+        for (int cpu = 0; cpu < (int)std::thread::hardware_concurrency() && cpu < CPU_SETSIZE; ++cpu) {
+            CPU_SET(cpu, &allowed);
+        }
+    }
+
+    std::vector<int> ids;
+    if (DIR* dir = opendir("/sys/devices/system/node")) {
+        while (dirent* entry = readdir(dir)) {
+            int id;
+            char tail;
+            if (std::sscanf(entry->d_name, "node%d%c", &id, &tail) == 1) ids.push_back(id);
+        }
+        closedir(dir);
+    }
+    std::sort(ids.begin(), ids.end());
+    for (int id : ids) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+        std::string list;
+        std::getline(file, list);
+        gemm_numa_node node = {id, {}};
+        for (int cpu : gemm_numa_parse_cpulist(list)) {
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) node.cpus.push_back(cpu);
+        }
+        // nodes of memory only, or of CPUs we may not use
+        if (!node.cpus.empty()) topology.nodes.push_back(node);
+    }
+    if (topology.nodes.empty()) {
+        gemm_numa_node node = {0, {}};
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) node.cpus.push_back(cpu);
+        }
+        topology.nodes.push_back(node);
+    }
+
+    const char* fake = std::getenv("GEMM_NUMA_FAKE_NODES");
+    int num_fake = fake ? std::atoi(fake) : 0;
+    if (num_fake > 0) {
+        // CPUs in the order of the real nodes, split into num_fake parts; with fewer CPUs than fake nodes,
+        // nodes share CPUs
+        std::vector<std::pair<int, int>> cpus;  // (cpu, real node)
+        for (const gemm_numa_node& node : topology.nodes) {
+            for (int cpu : node.cpus) cpus.push_back({cpu, node.memory});
+        }
+        int num_cpus = (int)cpus.size();
+        topology.nodes.clear();
+        for (int i = 0; i < num_fake; ++i) {
+            int first = gemm_split_begin(num_cpus, num_fake, i);
+            int last = std::max(gemm_split_begin(num_cpus, num_fake, i + 1), first + 1);
+            gemm_numa_node node = {cpus[first % num_cpus].second, {}};
+            for (int c = first; c < last; ++c) node.cpus.push_back(cpus[c % num_cpus].first);
+            topology.nodes.push_back(node);
+        }
+        topology.fake = true;
+    }
+    return topology;
+}
+
+// Bind memory [addr, addr + bytes) to nodes with mode MPOL_BIND, MPOL_PREFERRED or MPOL_INTERLEAVE.
+// The pages must not have been touched yet. Returns false on errors.
+inline bool gemm_numa_mbind(void* addr, size_t bytes, int mode, const std::vector<int>& nodes) {
+    int max_node = 0;
+    for (int node : nodes) max_node = std::max(max_node, node);
+    std::vector<unsigned long> mask(max_node / 64 + 1, 0);
+    for (int node : nodes) mask[node / 64] |= 1ul << (node % 64);
+    return syscall(SYS_mbind, addr, bytes, mode, mask.data(), mask.size() * 64 + 1, 0) == 0;
+}
+
+// Node of the page at addr, or -1 if the page is not present
+inline int gemm_numa_page_node(const void* addr) {
+    void* page = (void*)((uintptr_t)addr & ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1));
+    int status = -1;
+    if (syscall(SYS_move_pages, 0, 1ul, &page, nullptr, &status, 0) != 0) return -1;
+    return status < 0 ? -1 : status;
+}
+
+// Pin the calling thread to cpu. Returns false on errors.
+inline bool gemm_numa_pin(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+// Memory of count elements from mmap: pages are placed when first touched, and can be bound before that.
+template <typename T>
+class gemm_numa_buffer {
+public:
+    gemm_numa_buffer() = default;
+    explicit gemm_numa_buffer(size_t count) : count_(count), bytes_(std::max<size_t>(count * sizeof(T), 1)) {
+        void* p = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        data_ = p == MAP_FAILED ? nullptr : (T*)p;
+        if (!data_) {
+            std::cout << "Failed to map " << bytes_ << " bytes\n";
+            count_ = bytes_ = 0;
+        }
+    }
+    ~gemm_numa_buffer() {
+        if (data_) munmap(data_, bytes_);
+    }
+    gemm_numa_buffer(gemm_numa_buffer&& other) noexcept { *this = std::move(other); }
+    gemm_numa_buffer& operator=(gemm_numa_buffer&& other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(count_, other.count_);
+        std::swap(bytes_, other.bytes_);
+        return *this;
+    }
+    gemm_numa_buffer(const gemm_numa_buffer&) = delete;
+    gemm_numa_buffer& operator=(const gemm_numa_buffer&) = delete;
+
+    T* data() const { return data_; }
+    size_t size() const { return count_; }
+    size_t bytes() const { return bytes_; }
+
+private:
+    T* data_ = nullptr;
+    size_t count_ = 0;
+    size_t bytes_ = 0;
+};
+
+// Where each thread of a pool runs: its CPU and node (index in topology.nodes).
+// Threads fill as few nodes as hold them, split evenly over those nodes, with consecutive threads on the same node,
+// so that the threads of a node compute neighbouring blocks (see gemm_amx_parallel_split).
+struct gemm_numa_placement {
+    gemm_numa_policy policy;
+    gemm_numa_topology topology;
+    std::vector<int> cpus;   // CPU of each thread, -1 if not pinned
+    std::vector<int> nodes;  // node of each thread
+    int nodes_used = 1;
+    cpu_set_t caller_affinity;
+
+    gemm_numa_placement(int num_threads, gemm_numa_policy policy, const gemm_numa_topology& topology)
+        : policy(policy), topology(topology) {
+        num_threads = std::max(num_threads, 1);
+        int num_nodes = (int)topology.nodes.size();
+        int cpus_used = 0;
+        nodes_used = 0;
+        while (nodes_used < num_nodes && cpus_used < num_threads) cpus_used += topology.nodes[nodes_used++].cpus.size();
+        nodes_used = std::max(nodes_used, 1);
+        for (int node = 0; node < nodes_used; ++node) {
+            const std::vector<int>& node_cpus = topology.nodes[node].cpus;
+            int first = gemm_split_begin(num_threads, nodes_used, node);
+            int last = gemm_split_begin(num_threads, nodes_used, node + 1);
+            for (int tid = first; tid < last; ++tid) {
+                nodes.push_back(node);
+                cpus.push_back(policy == GEMM_NUMA_NONE ? -1 : node_cpus[(tid - first) % node_cpus.size()]);
+            }
+        }
+        CPU_ZERO(&caller_affinity);
+        sched_getaffinity(0, sizeof(caller_affinity), &caller_affinity);
+    }
+
+    // The first thread of node and the number of threads on it
+    int node_first_thread(int node) const { return gemm_split_begin((int)nodes.size(), nodes_used, node); }
+    int node_threads(int node) const { return node_first_thread(node + 1) - node_first_thread(node); }
+};
+
+// Thread pool for AMX whose threads are pinned by a NUMA policy.
+// The calling thread is thread 0: it is pinned as well while the pool lives.
+class gemm_numa_pool : private gemm_numa_placement, public amx_thread_pool {
+public:
+    explicit gemm_numa_pool(int num_threads, gemm_numa_policy policy = gemm_numa_policy_from_env(),
+                            const gemm_numa_topology& topology = gemm_numa_detect())
+        : gemm_numa_placement(num_threads, policy, topology),
+          amx_thread_pool(num_threads, [cpus = cpus](int tid) {
+              if (cpus[tid] >= 0 && !gemm_numa_pin(cpus[tid])) {
+                  std::cout << "Failed to pin thread " << tid << " to CPU " << cpus[tid] << "\n";
+              }
+          }) {}
+
+    ~gemm_numa_pool() {
+        if (cpus[0] >= 0) sched_setaffinity(0, sizeof(caller_affinity), &caller_affinity);
+    }
+
+    gemm_numa_policy policy() const { return gemm_numa_placement::policy; }
+    const gemm_numa_topology& topology() const { return gemm_numa_placement::topology; }
+    int nodes_used() const { return gemm_numa_placement::nodes_used; }
+    int node_of(int tid) const { return nodes[tid]; }
+    int cpu_of(int tid) const { return cpus[tid]; }
+    using gemm_numa_placement::node_first_thread;
+    using gemm_numa_placement::node_threads;
+};
+
+// Packed B (weights) placed by the policy of a pool:
+// - first-touch: each block is packed by the threads of the node which reads it in gemm_amx_parallel
+// - replicate: each node used by the pool gets a copy, packed by its threads
+// - interleave: pages are interleaved over the nodes used by the pool
+// - none & pin: one copy, packed by the calling thread
+// Blocks are packed straight to the memory of their node (pack_B_block), with no dense copy first.
+template <typename TB>
+class gemm_numa_weights {
+public:
+    // Pack B [K, N] with leading dimension ldb for the threads of pool, to compute gemm_amx_parallel
+    // with M rows of A. First-touch places the blocks by the split of that GEMM (gemm_parallel_partition),
+    // so that other M may read blocks from other nodes. A is taken to be of the type of B for the split.
+    gemm_numa_weights(gemm_numa_pool& pool, const TB* B, int K, int N, int ldb, int M, bool allow_k_split = true)
+        : K_(K), N_(N) {
+        size_t size = packed_B_size<TB>(K, N);
+        gemm_numa_policy policy = pool.policy();
+        int replicas = policy == GEMM_NUMA_REPLICATE ? pool.nodes_used() : 1;
+        for (int i = 0; i < replicas; ++i) copies_.emplace_back(size);
+        std::vector<int> memory;
+        for (int node = 0; node < pool.nodes_used(); ++node) memory.push_back(pool.topology().nodes[node].memory);
+        if (policy == GEMM_NUMA_INTERLEAVE && !gemm_numa_mbind(copies_[0].data(), copies_[0].bytes(), MPOL_INTERLEAVE,
+                                                               memory)) {
+            std::cout << "Failed to interleave packed B over " << memory.size() << " nodes\n";
+        }
+
+        if (policy == GEMM_NUMA_FIRST_TOUCH || policy == GEMM_NUMA_REPLICATE) {
+            constexpr int block_k = gemm_block_k<TB>();
+            constexpr size_t block_size = (size_t)block_k * GEMM_BLOCK_N;
+            int KC = gemm_ceil_div(K, block_k);
+            int NC = gemm_ceil_div(N, GEMM_BLOCK_N);
+            int blocks = KC * NC;
+            // Node of each block (kc, nc) in the order of packed B: the node of most of the threads which read it.
+            // In gemm_amx_parallel_split, thread im + tm * (in + tn * ik) reads the blocks of column part in
+            // and K part ik, so the tm threads of a pair (in, ik) are consecutive and span one or two nodes.
+            std::vector<int> block_node(blocks, 0);
+            if (policy == GEMM_NUMA_FIRST_TOUCH) {
+                gemm_partition p = gemm_parallel_partition<TB, TB>(pool.size(), M, N, K, allow_k_split,
+                                                                   gemm_tuned_blocking<TB>());
+                std::vector<int> part_node((size_t)p.tn * p.tk);
+                for (int part = 0; part < p.tn * p.tk; ++part) {
+                    std::vector<int> threads(pool.nodes_used(), 0);
+                    for (int tid = part * p.tm; tid < (part + 1) * p.tm; ++tid) ++threads[pool.node_of(tid)];
+                    part_node[part] = (int)(std::max_element(threads.begin(), threads.end()) - threads.begin());
+                }
+                for (int ik = 0; ik < p.tk; ++ik) {
+                    for (int kc = gemm_split_begin(KC, p.tk, ik); kc < gemm_split_begin(KC, p.tk, ik + 1); ++kc) {
+                        for (int in = 0; in < p.tn; ++in) {
+                            for (int nc = gemm_split_begin(NC, p.tn, in); nc < gemm_split_begin(NC, p.tn, in + 1);
+                                 ++nc) {
+                                block_node[(size_t)kc * NC + nc] = part_node[in + p.tn * ik];
+                            }
+                        }
+                    }
+                }
+            }
+            pool.run([&](int tid) {
+                int node = pool.node_of(tid);
+                int rank = tid - pool.node_first_thread(node);
+                int threads = pool.node_threads(node);
+                // replicate: all blocks to the copy of the node; first-touch: the blocks of the node
+                TB* out = copies_[policy == GEMM_NUMA_REPLICATE ? node : 0].data();
+                int node_blocks = 0;
+                for (int i = 0; i < blocks; ++i) node_blocks += policy == GEMM_NUMA_REPLICATE || block_node[i] == node;
+                // the threads of the node pack consecutive parts of its blocks
+                int first = gemm_split_begin(node_blocks, threads, rank);
+                int last = gemm_split_begin(node_blocks, threads, rank + 1);
+                for (int i = 0, j = 0; i < blocks && j < last; ++i) {
+                    if (policy != GEMM_NUMA_REPLICATE && block_node[i] != node) continue;
+                    if (j++ >= first) pack_B_block(B, K, N, ldb, i / NC, i % NC, out + i * block_size);
+                }
+            });
+        } else {
+            pack_B(B, K, N, ldb, copies_[0].data());
+        }
+
+        for (int tid = 0; tid < pool.size(); ++tid) {
+            by_thread_.push_back(copies_[policy == GEMM_NUMA_REPLICATE ? pool.node_of(tid) : 0].data());
+        }
+    }
+
+    int K() const { return K_; }
+    int N() const { return N_; }
+    int copies() const { return (int)copies_.size(); }
+    // Packed B of copy i, in the layout of pack_B
+    const TB* data(int i = 0) const { return copies_[i].data(); }
+    size_t size() const { return copies_[0].size(); }
+    // Packed B read by each thread of the pool
+    const TB* const* by_thread() const { return by_thread_.data(); }
+
+private:
+    int K_;
+    int N_;
+    std::vector<gemm_numa_buffer<TB>> copies_;
+    std::vector<const TB*> by_thread_;
+};
+
+// Zero C [M, N] with the threads of pool, each thread its blocks of C in gemm_amx_parallel,
+// so that with pinned threads and C fresh from mmap (gemm_numa_buffer), each page of C is on the node
+// of the thread that writes it. The split must be the one of gemm_amx_parallel with the same arguments.
+template <typename T, typename TB, typename Acc>
+void gemm_numa_first_touch(gemm_numa_pool& pool, int M, int N, int K, Acc* C, int ldc, bool allow_k_split = true) {
+    gemm_partition p = gemm_parallel_partition<T, TB>(pool.size(), M, N, K, allow_k_split, gemm_tuned_blocking<T>());
+    int MC = gemm_ceil_div(M, GEMM_BLOCK_M);
+    int NC = gemm_ceil_div(N, GEMM_BLOCK_N);
+    pool.run([&](int tid) {
+        // threads of K parts other than the first write partial sums, not C
+        if (tid >= p.tm * p.tn) return;
+        int im = tid % p.tm;
+        int in = tid / p.tm;
+        int m0 = gemm_split_begin(MC, p.tm, im) * GEMM_BLOCK_M;
+        int m1 = std::min(gemm_split_begin(MC, p.tm, im + 1) * GEMM_BLOCK_M, M);
+        int n0 = gemm_split_begin(NC, p.tn, in) * GEMM_BLOCK_N;
+        int n1 = std::min(gemm_split_begin(NC, p.tn, in + 1) * GEMM_BLOCK_N, N);
+        for (int m = m0; m < m1; ++m) std::fill(C + (size_t)m * ldc + n0, C + (size_t)m * ldc + n1, Acc());
+    });
+}
+
+// C = A x B with B placed by gemm_numa_weights, computed by all threads of pool, each thread reading
+// the copy of B of its node. Returns false if K differs from that of B.
+template <typename T, typename TB, typename Acc>
+bool gemm_amx_parallel(gemm_numa_pool& pool, int M, int K, const T* A, int lda, const gemm_numa_weights<TB>& B,
+                       Acc* C, int ldc, bool allow_k_split = true) {
+    if (B.K() != K) return false;
+    GEMM_PROFILE_CALL("gemm_amx_parallel", M, B.N(), K);
+    gemm_blocking b;
+    gemm_partition p = gemm_parallel_partition<T, TB>(pool.size(), M, B.N(), K, allow_k_split,
+                                                      gemm_tuned_blocking<T>(), &b);
+    gemm_amx_parallel_split(pool, M, B.N(), K, A, lda, B.data(), C, ldc, p, b, B.by_thread());
+    return true;
+}
@@ -0,0 +1,182 @@
+/*
+    Multithreaded GEMM with Intel AMX on top of gemm.h.
+
+    The grid of MC x NC blocks of C is split into tm x tn rectangles, one per thread,
+    so that each thread reuses its panels of A and B across its blocks.
+    When there are fewer blocks than threads (e.g., small M & N with large K),
+    K is split into tk parts as well and the partial sums are reduced afterwards.
+    Threads are persistent: each of them requests AMX permission and loads the tile config once,
+    and keeps the config resident across calls as long as the block shape does not change.
+*/
+
+#pragma once
+
+#include "gemm.h"
+#include "thread_pool.h"
+
+// Thread pool whose threads are ready to use AMX.
+// init(tid), if given, runs on each thread first, e.g., to pin it to a core (see gemm_numa.h),
+// so that the thread-local buffers of the GEMM are allocated where the thread runs.
+class amx_thread_pool : public thread_pool {
+public:
+    explicit amx_thread_pool(int num_threads, std::function<void(int)> init = nullptr)
+        : thread_pool(num_threads, [init](int tid) {
+              if (init) init(tid);
+              request_amx_permission();
+              // config of a full block, same for int8 & bf16
+              gemm_configure_block<int8_t>(GEMM_BLOCK_M, GEMM_BLOCK_N);
+          }) {}
+};
+
+// Number of threads along M, N and K
+struct gemm_partition {
+    int tm = 1;
+    int tn = 1;
+    int tk = 1;
+};
+
+inline int gemm_ceil_div(int x, int y) { return (x + y - 1) / y; }
+
+// Split [0, n) into parts and return the begin of part i; part i is [begin(i), begin(i + 1)).
+inline int gemm_split_begin(int n, int parts, int i) { return (int)((long)n * i / parts); }
+
+// Choose the partition of MC x NC x KC blocks over num_threads threads which minimizes
+// the blocks computed by the busiest thread. Splitting K costs a reduction of C,
+// so it is only considered when allow_k_split is set.
+// Ties are broken by the size of the panels of A and B each thread reads.
+inline gemm_partition gemm_partition_grid(int MC, int NC, int KC, int num_threads, bool allow_k_split = true) {
+    gemm_partition best;
+    double best_cost = -1;
+    int best_panels = 0;
+    for (int tm = 1; tm <= std::min(MC, num_threads); ++tm) {
+        for (int tn = 1; tn <= std::min(NC, num_threads / tm); ++tn) {
+            int max_tk = allow_k_split ? std::min(KC, num_threads / (tm * tn)) : 1;
+            for (int tk = 1; tk <= std::max(max_tk, 1); ++tk) {
+                int bm = gemm_ceil_div(MC, tm);
+                int bn = gemm_ceil_div(NC, tn);
+                int bk = gemm_ceil_div(std::max(KC, 1), tk);
+                double cost = (double)bm * bn * bk;
+                // reduction: each thread adds tk partial blocks for its share of C
+                if (tk > 1) cost += 0.5 * tk * gemm_ceil_div(MC * NC, num_threads);
+                int panels = (bm + bn) * bk;
+                if (best_cost < 0 || cost < best_cost || (cost == best_cost && panels < best_panels)) {
+                    best_cost = cost;
+                    best_panels = panels;
+                    best.tm = tm;
+                    best.tn = tn;
+                    best.tk = tk;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+// Whether a split fits the blocks and threads
+inline bool gemm_partition_valid(const gemm_partition& p, int MC, int NC, int KC, int num_threads) {
+    return p.tm >= 1 && p.tn >= 1 && p.tk >= 1 && p.tm <= std::max(MC, 1) && p.tn <= std::max(NC, 1) &&
+           p.tk <= std::max(KC, 1) && p.tm * p.tn * p.tk <= num_threads;
+}
+
+// The split over num_threads threads and the blocking of gemm_amx_parallel for the shape:
+// those of the tuning cache if the shape was tuned (see gemm_tuning_find), otherwise gemm_partition_grid.
+template <typename T, typename TB>
+gemm_partition gemm_parallel_partition(int num_threads, int M, int N, int K, bool allow_k_split,
+                                       const gemm_blocking& blocking, gemm_blocking* tuned_blocking = nullptr) {
+    constexpr int block_k = gemm_block_k<T>();
+    int MC = gemm_ceil_div(M, GEMM_BLOCK_M);
+    int NC = gemm_ceil_div(N, GEMM_BLOCK_N);
+    int KC = gemm_ceil_div(K, block_k);
+    gemm_tuning_entry tuned;
+    gemm_blocking b = gemm_lookup_blocking<T, TB>(blocking, M, N, K, num_threads, &tuned);
+    if (tuned_blocking) *tuned_blocking = b;
+    gemm_partition p = {tuned.tm, tuned.tn, tuned.tk};
+    if (!gemm_partition_valid(p, MC, NC, KC, num_threads) || (p.tk > 1 && !allow_k_split)) {
+        p = gemm_partition_grid(MC, NC, KC, num_threads, allow_k_split);
+    }
+    return p;
+}
+
+// C = A x B with B packed by pack_B, computed by all threads of pool with the given split of the blocks.
+// Each thread computes its part with gemm_amx_range and the given blocking.
+// If B_by_thread is given, thread tid reads packed B from B_by_thread[tid] instead of B_packed,
+// e.g., the copy of B on its NUMA node (see gemm_numa.h).
+template <typename T, typename TB, typename Acc>
+void gemm_amx_parallel_split(amx_thread_pool& pool, int M, int N, int K, const T* A, int lda, const TB* B_packed,
+                             Acc* C, int ldc, const gemm_partition& p, const gemm_blocking& blocking,
+                             const TB* const* B_by_thread = nullptr) {
+    GEMM_PROFILE_CALL("gemm_amx_parallel", M, N, K);
+    constexpr int block_k = gemm_block_k<T>();
+    int MC = gemm_ceil_div(M, GEMM_BLOCK_M);
+    int NC = gemm_ceil_div(N, GEMM_BLOCK_N);
+    int KC = gemm_ceil_div(K, block_k);
+    int num_threads = pool.size();
+
+    // Partial sums of K parts 1..tk-1, each [M, N]; K part 0 goes to C directly.
+    // Each part overwrites its sums first, so the buffer from the scratch arena needs no zeroing.
+    arena_scope scratch(arena_thread_scratch());
+    Acc* partial = p.tk > 1 ? scratch.allocate<Acc>((size_t)(p.tk - 1) * M * N) : nullptr;
+
+    pool.run([&](int tid) {
+        if (tid >= p.tm * p.tn * p.tk) return;
+        int im = tid % p.tm;
+        int in = tid / p.tm % p.tn;
+        int ik = tid / (p.tm * p.tn);
+        Acc* c = ik == 0 ? C : partial + (size_t)(ik - 1) * M * N;
+        int c_ld = ik == 0 ? ldc : N;
+        gemm_amx_range(M, N, K, A, lda, B_by_thread ? B_by_thread[tid] : B_packed, c, c_ld,
+                       gemm_split_begin(MC, p.tm, im), gemm_split_begin(MC, p.tm, im + 1),
+                       gemm_split_begin(NC, p.tn, in), gemm_split_begin(NC, p.tn, in + 1),
+                       gemm_split_begin(KC, p.tk, ik), gemm_split_begin(KC, p.tk, ik + 1), blocking);
+    });
+
+    if (p.tk > 1) {
+        // reduce partial sums into C, split by rows
+        pool.run([&](int tid) {
+            int m0 = gemm_split_begin(M, num_threads, tid);
+            int m1 = gemm_split_begin(M, num_threads, tid + 1);
+            for (int m = m0; m < m1; ++m) {
+                Acc* c = C + (size_t)m * ldc;
+                for (int ik = 1; ik < p.tk; ++ik) {
+                    const Acc* part = partial + ((size_t)(ik - 1) * M + m) * N;
+                    for (int n = 0; n < N; ++n) c[n] += part[n];
+                }
+            }
+        });
+    }
+}
+
+// C = A x B with B packed by pack_B, computed by all threads of pool.
+// The split over threads is gemm_partition_grid, unless the shape was tuned (see gemm_tuning_find).
+template <typename T, typename TB, typename Acc>
+void gemm_amx_parallel(amx_thread_pool& pool, int M, int N, int K, const T* A, int lda, const TB* B_packed,
+                       Acc* C, int ldc, bool allow_k_split = true,
+                       const gemm_blocking& blocking = gemm_tuned_blocking<T>()) {
+    GEMM_PROFILE_CALL("gemm_amx_parallel", M, N, K);
+    gemm_blocking b;
+    gemm_partition p = gemm_parallel_partition<T, TB>(pool.size(), M, N, K, allow_k_split, blocking, &b);
+    gemm_amx_parallel_split(pool, M, N, K, A, lda, B_packed, C, ldc, p, b);
+}
+
+// Post-ops(A x B) with B packed by pack_B, computed by all threads of pool.
+// K is not split, so that each block of C is final when the epilogue is applied.
+template <typename T, typename TB>
+void gemm_amx_parallel(amx_thread_pool& pool, int M, int N, int K, const T* A, int lda, const TB* B_packed,
+                       const gemm_epilogue& epilogue) {
+    GEMM_PROFILE_CALL("gemm_amx_parallel", M, N, K);
+    constexpr int block_k = gemm_block_k<T>();
+    int MC = gemm_ceil_div(M, GEMM_BLOCK_M);
+    int NC = gemm_ceil_div(N, GEMM_BLOCK_N);
+    int KC = gemm_ceil_div(K, block_k);
+    gemm_blocking b;
+    gemm_partition p = gemm_parallel_partition<T, TB>(pool.size(), M, N, K, false, gemm_tuned_blocking<T>(), &b);
+    pool.run([&](int tid) {
+        if (tid >= p.tm * p.tn) return;
+        int im = tid % p.tm;
+        int in = tid / p.tm;
+        gemm_amx_range(M, N, K, A, lda, B_packed, (gemm_acc_type<T>*)nullptr, 0,
+                       gemm_split_begin(MC, p.tm, im), gemm_split_begin(MC, p.tm, im + 1),
+                       gemm_split_begin(NC, p.tn, in), gemm_split_begin(NC, p.tn, in + 1), 0, KC,
+                       b, &epilogue);
+    });
+}
@@ -0,0 +1,366 @@
+/*
+    Opt-in instrumentation of the GEMM hot paths, to see where the time of a slow GEMM goes.
+
+    Define GEMM_PROFILE before including any header of the library (or build with -DGEMM_PROFILE).
+    Without it, the macros below expand to nothing and the library compiles to the same code as before.
+    With it:
+    - each phase of a GEMM is timed with the TSC (rdtsc, i.e., reference cycles):
+      pack B (pack_B), pack A (A panels, K tails & row sums), kernel (tile loads & dot products),
+      store (tile stores of C) and epilogue (gemm_epilogue.h)
+    - tile configs, loads, stores, zeros & dot products are counted (see amx_tile_counters in amx_emu.h),
+      also when the tiles are emulated; kernels generated by gemm_jit.h add their counts per call
+    - with GEMM_PROFILE_PERF=1 in the environment (or gemm_profile_perf = true), hardware counters are read
+      with perf_event_open around each phase: cycles, L1D read misses and L2 misses
+      (raw event L2_RQSTS.MISS, 0x3f24, of the Intel CPUs with AMX). Counters that cannot be opened,
+      e.g., in a VM or with perf_event_paranoid > 2, are reported as n/a.
+    - a call (gemm_amx, gemm_amx_parallel, pack_B, ...) sums the counts of all threads and prints
+      a summary when it returns (gemm_profile_dump = false to only keep it in gemm_profile_last).
+      Nested calls (e.g., pack_B in gemm_amx with plain B) are part of the outer call.
+      Counts are reset when a call starts, so profile one call at a time.
+
+    Reading perf counters costs two system calls per phase, so timings are inflated with GEMM_PROFILE_PERF;
+    the TSC alone adds a few percent to small blocks.
+*/
+
+#pragma once
+
+#include "amx_emu.h"
+#include <cstdint>
+
+enum gemm_profile_phase {
+    GEMM_PHASE_PACK_B,
+    GEMM_PHASE_PACK_A,
+    GEMM_PHASE_KERNEL,
+    GEMM_PHASE_STORE,
+    GEMM_PHASE_EPILOGUE,
+    GEMM_PHASES,
+};
+
+#ifndef GEMM_PROFILE
+
+#define GEMM_PROFILE_SCOPE(phase) do {} while (0)
+#define GEMM_PROFILE_NEXT(phase) do {} while (0)
+#define GEMM_PROFILE_CALL(name, M, N, K) do {} while (0)
+
+#else
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <x86intrin.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Time the rest of the enclosing block as phase (one scope per block)
+#define GEMM_PROFILE_SCOPE(phase) gemm_profile_scope gemm_profile_phase_scope(phase)
+// End the phase of the scope of this block and time the rest as the next phase
+#define GEMM_PROFILE_NEXT(phase) gemm_profile_phase_scope.next(phase)
+// Make the rest of the enclosing block a call, summarized when the block ends
+#define GEMM_PROFILE_CALL(name, M, N, K) gemm_profile_call gemm_profile_call_scope(name, M, N, K)
+
+#define GEMM_PROFILE_PERF_EVENTS 3
+
+inline const char* gemm_profile_phase_name(int phase) {
+    static const char* names[GEMM_PHASES] = {"pack B", "pack A", "kernel", "store", "epilogue"};
+    return names[phase];
+}
+
+inline const char* gemm_profile_perf_event_name(int event) {
+    static const char* names[GEMM_PROFILE_PERF_EVENTS] = {"cycles", "L1D misses", "L2 misses"};
+    return names[event];
+}
+
+// Whether to read hardware counters, from GEMM_PROFILE_PERF
+inline bool gemm_profile_perf = [] {
+    const char* env = std::getenv("GEMM_PROFILE_PERF");
+    return env && *env && std::string(env) != "0";
+}();
+// Whether to print the summary of each call
+inline bool gemm_profile_dump = true;
+
+struct gemm_profile_stats {
+    uint64_t calls[GEMM_PHASES] = {};
+    uint64_t cycles[GEMM_PHASES] = {};
+    uint64_t perf[GEMM_PHASES][GEMM_PROFILE_PERF_EVENTS] = {};
+};
+
+// perf_event_open counters of a thread, in one group read at once
+struct gemm_profile_perf_group {
+    bool opened = false;
+    int leader = -1;
+    int fds[GEMM_PROFILE_PERF_EVENTS] = {-1, -1, -1};
+    int index[GEMM_PROFILE_PERF_EVENTS] = {-1, -1, -1};  // position in the group read, -1 = n/a
+    int count = 0;
+
+    void open() {
+        opened = true;
+        const uint64_t configs[GEMM_PROFILE_PERF_EVENTS][2] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+            {PERF_TYPE_RAW, 0x3f24},
+        };
+        for (int e = 0; e < GEMM_PROFILE_PERF_EVENTS; ++e) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = (uint32_t)configs[e][0];
+            attr.config = configs[e][1];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+            if (fd < 0) continue;
+            if (leader < 0) leader = fd;
+            fds[e] = fd;
+            index[e] = count++;
+        }
+        if (leader < 0) {
+            static std::once_flag warned;
+            std::call_once(warned, [] {
+                std::cout << "GEMM profile: perf_event_open failed, hardware counters are n/a\n";
+            });
+        }
+    }
+
+    void close_all() {
+        for (int& fd : fds) {
+            if (fd >= 0) close(fd);
+            fd = -1;
+        }
+        leader = -1;
+    }
+
+    // Read the counters into values (by event). Returns false if none is available.
+    bool read_values(uint64_t* values) {
+        if (!opened) open();
+        if (leader < 0) return false;
+        uint64_t buf[1 + GEMM_PROFILE_PERF_EVENTS];
+        if (read(leader, buf, sizeof(buf)) < (ssize_t)sizeof(uint64_t)) return false;
+        for (int e = 0; e < GEMM_PROFILE_PERF_EVENTS; ++e) values[e] = index[e] >= 0 ? buf[1 + index[e]] : 0;
+        return true;
+    }
+};
+
+struct gemm_profile_thread_state;
+
+// Profile states of all threads, so that a call can sum and reset them
+struct gemm_profile_registry {
+    std::mutex mutex;
+    std::vector<gemm_profile_thread_state*> threads;
+    gemm_profile_stats exited;        // of threads that exited during a call
+    amx_tile_counters exited_tiles;
+};
+inline gemm_profile_registry gemm_profile_threads;
+
+struct gemm_profile_thread_state {
+    gemm_profile_stats stats;
+    gemm_profile_perf_group perf;
+    amx_tile_counters* tiles = &amx_tile_counts;
+    int call_depth = 0;
+
+    gemm_profile_thread_state();
+    ~gemm_profile_thread_state();
+};
+
+inline void gemm_profile_add(gemm_profile_stats& to, const gemm_profile_stats& from) {
+    for (int p = 0; p < GEMM_PHASES; ++p) {
+        to.calls[p] += from.calls[p];
+        to.cycles[p] += from.cycles[p];
+        for (int e = 0; e < GEMM_PROFILE_PERF_EVENTS; ++e) to.perf[p][e] += from.perf[p][e];
+    }
+}
+
+inline void gemm_profile_add(amx_tile_counters& to, const amx_tile_counters& from) {
+    to.configs += from.configs;
+    to.loads += from.loads;
+    to.stores += from.stores;
+    to.zeros += from.zeros;
+    to.dps += from.dps;
+}
+
+inline gemm_profile_thread_state::gemm_profile_thread_state() {
+    std::lock_guard<std::mutex> lock(gemm_profile_threads.mutex);
+    gemm_profile_threads.threads.push_back(this);
+}
+
+inline gemm_profile_thread_state::~gemm_profile_thread_state() {
+    perf.close_all();
+    std::lock_guard<std::mutex> lock(gemm_profile_threads.mutex);
+    auto& threads = gemm_profile_threads.threads;
+    threads.erase(std::remove(threads.begin(), threads.end(), this), threads.end());
+    gemm_profile_add(gemm_profile_threads.exited, stats);
+    gemm_profile_add(gemm_profile_threads.exited_tiles, *tiles);
+}
+
+inline gemm_profile_thread_state& gemm_profile_thread() {
+    static thread_local gemm_profile_thread_state state;
+    return state;
+}
+
+// Times the phase from construction to destruction (or to next) on the current thread
+class gemm_profile_scope {
+public:
+    explicit gemm_profile_scope(gemm_profile_phase phase) : state_(gemm_profile_thread()) { start(phase); }
+    ~gemm_profile_scope() { stop(); }
+
+    void next(gemm_profile_phase phase) {
+        stop();
+        start(phase);
+    }
+
+    gemm_profile_scope(const gemm_profile_scope&) = delete;
+    gemm_profile_scope& operator=(const gemm_profile_scope&) = delete;
+
+private:
+    void start(gemm_profile_phase phase) {
+        phase_ = phase;
+        has_perf_ = gemm_profile_perf && state_.perf.read_values(perf_);
+        start_ = __rdtsc();
+    }
+
+    void stop() {
+        uint64_t end = __rdtsc();
+        gemm_profile_stats& s = state_.stats;
+        ++s.calls[phase_];
+        s.cycles[phase_] += end - start_;
+        uint64_t perf_end[GEMM_PROFILE_PERF_EVENTS];
+        if (has_perf_ && state_.perf.read_values(perf_end)) {
+            for (int e = 0; e < GEMM_PROFILE_PERF_EVENTS; ++e) s.perf[phase_][e] += perf_end[e] - perf_[e];
+        }
+    }
+
+    gemm_profile_thread_state& state_;
+    gemm_profile_phase phase_;
+    bool has_perf_;
+    uint64_t perf_[GEMM_PROFILE_PERF_EVENTS];
+    uint64_t start_;
+};
+
+// Summary of a call, summed over threads
+struct gemm_profile_summary {
+    std::string name;
+    int M = 0;
+    int N = 0;
+    int K = 0;
+    double seconds = 0;
+    uint64_t cycles = 0;   // TSC cycles of the call on the calling thread
+    int threads = 0;       // threads that ran any phase
+    bool has_perf = false;
+    bool perf_available[GEMM_PROFILE_PERF_EVENTS] = {};
+    gemm_profile_stats stats;
+    amx_tile_counters tiles;
+};
+
+// Summary of the last call
+inline gemm_profile_summary gemm_profile_last;
+
+inline void gemm_profile_reset() {
+    std::lock_guard<std::mutex> lock(gemm_profile_threads.mutex);
+    for (gemm_profile_thread_state* t : gemm_profile_threads.threads) {
+        t->stats = gemm_profile_stats();
+        *t->tiles = amx_tile_counters();
+    }
+    gemm_profile_threads.exited = gemm_profile_stats();
+    gemm_profile_threads.exited_tiles = amx_tile_counters();
+}
+
+inline void gemm_profile_collect(gemm_profile_summary& s) {
+    std::lock_guard<std::mutex> lock(gemm_profile_threads.mutex);
+    s.stats = gemm_profile_threads.exited;
+    s.tiles = gemm_profile_threads.exited_tiles;
+    s.threads = 0;
+    for (gemm_profile_thread_state* t : gemm_profile_threads.threads) {
+        gemm_profile_add(s.stats, t->stats);
+        gemm_profile_add(s.tiles, *t->tiles);
+        bool active = false;
+        for (int p = 0; p < GEMM_PHASES; ++p) active |= t->stats.calls[p] > 0;
+        s.threads += active;
+        if (t->perf.leader >= 0) {
+            s.has_perf = true;
+            for (int e = 0; e < GEMM_PROFILE_PERF_EVENTS; ++e) s.perf_available[e] |= t->perf.index[e] >= 0;
+        }
+    }
+}
+
+inline void gemm_profile_print(const gemm_profile_summary& s) {
+    char line[256];
+    std::cout << "GEMM profile: " << s.name;
+    // M = 0 for B only (pack_B), K = 0 for no single shape (grouped GEMM)
+    if (s.K && s.M) std::cout << " [" << s.M << ", " << s.K << "] x [" << s.K << ", " << s.N << "]";
+    else if (s.K) std::cout << " [" << s.K << ", " << s.N << "]";
+    std::cout << ", " << s.seconds * 1e3 << " ms, " << s.cycles << " TSC cycles, " << s.threads
+              << (s.threads == 1 ? " thread\n" : " threads\n");
+    std::snprintf(line, sizeof(line), "  %-9s %10s %14s %7s", "phase", "calls", "TSC cycles", "%");
+    std::cout << line;
+    if (s.has_perf) {
+        for (int e = 0; e < GEMM_PROFILE_PERF_EVENTS; ++e) {
+            std::snprintf(line, sizeof(line), " %14s", gemm_profile_perf_event_name(e));
+            std::cout << line;
+        }
+    }
+    std::cout << "\n";
+    // phases of all threads, relative to the call on the calling thread (may exceed 100% with threads)
+    for (int p = 0; p < GEMM_PHASES; ++p) {
+        if (!s.stats.calls[p]) continue;
+        double percent = s.cycles ? 100.0 * s.stats.cycles[p] / s.cycles : 0;
+        std::snprintf(line, sizeof(line), "  %-9s %10llu %14llu %7.1f", gemm_profile_phase_name(p),
+                      (unsigned long long)s.stats.calls[p], (unsigned long long)s.stats.cycles[p], percent);
+        std::cout << line;
+        if (s.has_perf) {
+            for (int e = 0; e < GEMM_PROFILE_PERF_EVENTS; ++e) {
+                if (s.perf_available[e]) {
+                    std::snprintf(line, sizeof(line), " %14llu", (unsigned long long)s.stats.perf[p][e]);
+                } else {
+                    std::snprintf(line, sizeof(line), " %14s", "n/a");
+                }
+                std::cout << line;
+            }
+        }
+        std::cout << "\n";
+    }
+    std::cout << "  tiles: " << s.tiles.configs << " configs, " << s.tiles.loads << " loads, " << s.tiles.stores
+              << " stores, " << s.tiles.zeros << " zeros, " << s.tiles.dps << " dot products\n";
+}
+
+// A profiled call: resets the counts when the outermost call on this thread starts
+// and summarizes them when it ends
+class gemm_profile_call {
+public:
+    gemm_profile_call(const char* name, int M, int N, int K) : state_(gemm_profile_thread()) {
+        if (state_.call_depth++) return;
+        gemm_profile_reset();
+        summary_.name = name;
+        summary_.M = M;
+        summary_.N = N;
+        summary_.K = K;
+        start_time_ = std::chrono::steady_clock::now();
+        start_ = __rdtsc();
+    }
+
+    ~gemm_profile_call() {
+        if (--state_.call_depth) return;
+        summary_.cycles = __rdtsc() - start_;
+        summary_.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time_).count();
+        gemm_profile_collect(summary_);
+        gemm_profile_last = summary_;
+        if (gemm_profile_dump) gemm_profile_print(summary_);
+    }
+
+    gemm_profile_call(const gemm_profile_call&) = delete;
+    gemm_profile_call& operator=(const gemm_profile_call&) = delete;
+
+private:
+    gemm_profile_thread_state& state_;
+    gemm_profile_summary summary_;
+    std::chrono::steady_clock::time_point start_time_;
+    uint64_t start_ = 0;
+};
+
+#endif
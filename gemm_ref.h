@@ -0,0 +1,312 @@
+/*
+    Fast reference GEMM and result checker, for checking the AMX GEMM on large shapes.
+
+    gemm_ref in common.h is a triple loop reading B by columns, which takes minutes for 4096^3.
+    gemm_ref_fast computes the same with AVX-512 or AVX2 (scalar code otherwise) on all threads:
+    - B is converted once: 8-bit B to int16 pairs of rows [K/2, N, 2], so that a multiply-add
+      of int16 pairs (vpmaddwd) computes 2 steps of K for a vector of columns; bf16 B to float [K, N].
+    - C is computed in blocks of 4 rows x 4 vectors of columns, over K panels that keep B in L2.
+    - Rows of C are split over the threads.
+    Each element is summed over k in order, and products of bf16 are exact in float (also with FMA),
+    so the results are identical to gemm_ref.
+
+    gemm_check compares C with the reference and reports the number of mismatches, max abs/rel error,
+    max & mean ULP distance (float) and the first mismatches with their coordinates.
+*/
+
+#pragma once
+
+#include "common.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#define GEMM_REF_MR 4     // rows of a block of C
+#define GEMM_REF_KC 256   // K steps of a panel
+
+// B converted for gemm_ref_fast: int16 pairs for 8-bit B, float for bf16
+template <typename TB>
+using gemm_ref_b_type = typename std::conditional<sizeof(TB) == 1, int16_t, float>::type;
+
+// Convert B [K, N] to int16 pairs [ceil(K / 2), N, 2], zero-padded, or to float [K, N]
+template <typename TB>
+void gemm_ref_convert_B(const TB* B, int ldb, int K, int N, std::vector<gemm_ref_b_type<TB>>& out) {
+    if constexpr (sizeof(TB) == 1) {
+        int K2 = (K + 1) / 2;
+        out.assign((size_t)K2 * N * 2, 0);
+        for (int k = 0; k < K; ++k) {
+            for (int n = 0; n < N; ++n) out[((size_t)(k / 2) * N + n) * 2 + k % 2] = B[(size_t)k * ldb + n];
+        }
+    } else {
+        out.resize((size_t)K * N);
+        for (int k = 0; k < K; ++k) {
+            for (int n = 0; n < N; ++n) out[(size_t)k * N + n] = B[(size_t)k * ldb + n];
+        }
+    }
+}
+
+// A[m, k] and A[m, k + 1] as int16 in one int32 (A[m, k + 1] = 0 beyond K)
+template <typename TA>
+inline int32_t gemm_ref_A_pair(const TA* a, int k, int K) {
+    uint16_t lo = (uint16_t)(int16_t)a[k];
+    uint16_t hi = k + 1 < K ? (uint16_t)(int16_t)a[k + 1] : 0;
+    return (int32_t)((uint32_t)hi << 16 | lo);
+}
+
+// Rows [m0, m1) of C, scalar
+template <typename TA, typename TB, typename Acc>
+void gemm_ref_rows_scalar(const TA* A, int lda, const gemm_ref_b_type<TB>* Bc, Acc* C, int ldc,
+                          int m0, int m1, int N, int K) {
+    for (int m = m0; m < m1; ++m) {
+        Acc* c = C + (size_t)m * ldc;
+        std::fill(c, c + N, Acc());
+        const TA* a = A + (size_t)m * lda;
+        for (int k = 0; k < K; ++k) {
+            Acc x = (Acc)a[k];
+            for (int n = 0; n < N; ++n) {
+                if constexpr (sizeof(TB) == 1) c[n] += x * (Acc)Bc[((size_t)(k / 2) * N + n) * 2 + k % 2];
+                else c[n] += x * Bc[(size_t)k * N + n];
+            }
+        }
+    }
+}
+
+// Rows [m0, m1) of C with AVX-512: 16 columns per vector, 4 vectors per block
+template <typename TA, typename TB, typename Acc>
+__attribute__((target("avx512f,avx512bw")))
+void gemm_ref_rows_avx512(const TA* A, int lda, const gemm_ref_b_type<TB>* Bc, Acc* C, int ldc,
+                          int m0, int m1, int N, int K) {
+    constexpr bool is_int = sizeof(TB) == 1;
+    // K steps per vector multiply-add: pairs for 8-bit
+    constexpr int kstep = is_int ? 2 : 1;
+    for (int k0 = 0; k0 < K; k0 += GEMM_REF_KC) {
+        int k1 = std::min(K, k0 + GEMM_REF_KC);
+        for (int n0 = 0; n0 < N; n0 += 64) {
+            // masks of the columns below N, as dwords and as pairs of int16
+            __mmask16 mask[4];
+            __mmask32 pair_mask[4];
+            int vecs = 0;
+            for (int j = 0; j < 4; ++j) {
+                int cols = std::max(0, std::min(16, N - n0 - 16 * j));
+                mask[j] = (__mmask16)((1u << cols) - 1);
+                pair_mask[j] = (__mmask32)(((uint64_t)1 << (2 * cols)) - 1);
+                if (cols > 0) vecs = j + 1;
+            }
+            for (int m = m0; m < m1; m += GEMM_REF_MR) {
+                int rows = std::min(GEMM_REF_MR, m1 - m);
+                __m512i acc_i[GEMM_REF_MR][4];
+                __m512 acc_f[GEMM_REF_MR][4];
+                for (int r = 0; r < rows; ++r) {
+                    const Acc* c = C + (size_t)(m + r) * ldc + n0;
+                    for (int j = 0; j < vecs; ++j) {
+                        if constexpr (is_int) {
+                            acc_i[r][j] = k0 ? _mm512_maskz_loadu_epi32(mask[j], c + 16 * j) : _mm512_setzero_si512();
+                        } else {
+                            acc_f[r][j] = k0 ? _mm512_maskz_loadu_ps(mask[j], c + 16 * j) : _mm512_setzero_ps();
+                        }
+                    }
+                }
+                for (int k = k0; k < k1; k += kstep) {
+                    for (int j = 0; j < vecs; ++j) {
+                        if constexpr (is_int) {
+                            // 16 columns x 2 rows of K as 32 int16
+                            __m512i b = _mm512_maskz_loadu_epi16(pair_mask[j], Bc + ((size_t)(k / 2) * N + n0 + 16 * j) * 2);
+                            for (int r = 0; r < rows; ++r) {
+                                __m512i a = _mm512_set1_epi32(gemm_ref_A_pair(A + (size_t)(m + r) * lda, k, K));
+                                acc_i[r][j] = _mm512_add_epi32(acc_i[r][j], _mm512_madd_epi16(a, b));
+                            }
+                        } else {
+                            __m512 b = _mm512_maskz_loadu_ps(mask[j], Bc + (size_t)k * N + n0 + 16 * j);
+                            for (int r = 0; r < rows; ++r) {
+                                __m512 a = _mm512_set1_ps((float)A[(size_t)(m + r) * lda + k]);
+                                acc_f[r][j] = _mm512_fmadd_ps(a, b, acc_f[r][j]);
+                            }
+                        }
+                    }
+                }
+                for (int r = 0; r < rows; ++r) {
+                    Acc* c = C + (size_t)(m + r) * ldc + n0;
+                    for (int j = 0; j < vecs; ++j) {
+                        if constexpr (is_int) _mm512_mask_storeu_epi32(c + 16 * j, mask[j], acc_i[r][j]);
+                        else _mm512_mask_storeu_ps(c + 16 * j, mask[j], acc_f[r][j]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Same with AVX2: 8 columns per vector
+template <typename TA, typename TB, typename Acc>
+__attribute__((target("avx2,fma")))
+void gemm_ref_rows_avx2(const TA* A, int lda, const gemm_ref_b_type<TB>* Bc, Acc* C, int ldc,
+                        int m0, int m1, int N, int K) {
+    constexpr bool is_int = sizeof(TB) == 1;
+    constexpr int kstep = is_int ? 2 : 1;
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for (int k0 = 0; k0 < K; k0 += GEMM_REF_KC) {
+        int k1 = std::min(K, k0 + GEMM_REF_KC);
+        for (int n0 = 0; n0 < N; n0 += 32) {
+            // lanes of columns below N, as masks of dwords
+            __m256i mask[4];
+            int vecs = 0;
+            for (int j = 0; j < 4; ++j) {
+                int cols = N - n0 - 8 * j;
+                mask[j] = _mm256_cmpgt_epi32(_mm256_set1_epi32(cols), lanes);
+                if (cols > 0) vecs = j + 1;
+            }
+            for (int m = m0; m < m1; m += GEMM_REF_MR) {
+                int rows = std::min(GEMM_REF_MR, m1 - m);
+                __m256i acc_i[GEMM_REF_MR][4];
+                __m256 acc_f[GEMM_REF_MR][4];
+                for (int r = 0; r < rows; ++r) {
+                    const Acc* c = C + (size_t)(m + r) * ldc + n0;
+                    for (int j = 0; j < vecs; ++j) {
+                        if constexpr (is_int) {
+                            acc_i[r][j] = k0 ? _mm256_maskload_epi32((const int*)c + 8 * j, mask[j]) : _mm256_setzero_si256();
+                        } else {
+                            acc_f[r][j] = k0 ? _mm256_maskload_ps(c + 8 * j, mask[j]) : _mm256_setzero_ps();
+                        }
+                    }
+                }
+                for (int k = k0; k < k1; k += kstep) {
+                    for (int j = 0; j < vecs; ++j) {
+                        if constexpr (is_int) {
+                            // a pair of int16 is one dword
+                            __m256i b = _mm256_maskload_epi32((const int*)(Bc + ((size_t)(k / 2) * N + n0 + 8 * j) * 2), mask[j]);
+                            for (int r = 0; r < rows; ++r) {
+                                __m256i a = _mm256_set1_epi32(gemm_ref_A_pair(A + (size_t)(m + r) * lda, k, K));
+                                acc_i[r][j] = _mm256_add_epi32(acc_i[r][j], _mm256_madd_epi16(a, b));
+                            }
+                        } else {
+                            __m256 b = _mm256_maskload_ps(Bc + (size_t)k * N + n0 + 8 * j, mask[j]);
+                            for (int r = 0; r < rows; ++r) {
+                                __m256 a = _mm256_set1_ps((float)A[(size_t)(m + r) * lda + k]);
+                                acc_f[r][j] = _mm256_fmadd_ps(a, b, acc_f[r][j]);
+                            }
+                        }
+                    }
+                }
+                for (int r = 0; r < rows; ++r) {
+                    Acc* c = C + (size_t)(m + r) * ldc + n0;
+                    for (int j = 0; j < vecs; ++j) {
+                        if constexpr (is_int) _mm256_maskstore_epi32((int*)c + 8 * j, mask[j], acc_i[r][j]);
+                        else _mm256_maskstore_ps(c + 8 * j, mask[j], acc_f[r][j]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// C = A x B, the same as gemm_ref, on num_threads threads (0 = all CPUs).
+// A is int8/uint8 with B int8/uint8 and Acc int32, or A & B bf16 with Acc float.
+template <typename TA, typename TB, typename Acc>
+void gemm_ref_fast(const TA* A, int lda, const TB* B, int ldb, Acc* C, int ldc, int M, int N, int K,
+                   int num_threads = 0) {
+    static_assert(sizeof(TA) == sizeof(TB), "A and B must be both 8-bit integers or both bf16");
+    std::vector<gemm_ref_b_type<TB>> Bc;
+    gemm_ref_convert_B(B, ldb, K, N, Bc);
+    static const int isa = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) return 2;
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return 1;
+        return 0;
+    }();
+    auto rows = [&](int m0, int m1) {
+        if (m0 >= m1) return;
+        if (isa == 2) gemm_ref_rows_avx512<TA, TB, Acc>(A, lda, Bc.data(), C, ldc, m0, m1, N, K);
+        else if (isa == 1) gemm_ref_rows_avx2<TA, TB, Acc>(A, lda, Bc.data(), C, ldc, m0, m1, N, K);
+        else gemm_ref_rows_scalar<TA, TB, Acc>(A, lda, Bc.data(), C, ldc, m0, m1, N, K);
+    };
+    if (K == 0) {
+        for (int m = 0; m < M; ++m) std::fill(C + (size_t)m * ldc, C + (size_t)m * ldc + N, Acc());
+        return;
+    }
+    if (num_threads <= 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+    // blocks of GEMM_REF_MR rows per thread
+    int blocks = (M + GEMM_REF_MR - 1) / GEMM_REF_MR;
+    num_threads = std::max(1, std::min(num_threads, blocks));
+    if (num_threads == 1) {
+        rows(0, M);
+        return;
+    }
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+        int m0 = (int)((long)blocks * t / num_threads) * GEMM_REF_MR;
+        int m1 = std::min(M, (int)((long)blocks * (t + 1) / num_threads) * GEMM_REF_MR);
+        threads.emplace_back(rows, m0, m1);
+    }
+    for (auto& thread : threads) thread.join();
+}
+
+// Result of gemm_check
+struct gemm_check_result {
+    size_t count = 0;       // elements compared
+    size_t mismatches = 0;  // elements beyond the tolerance
+    double max_abs = 0;     // max |C - C_ref|
+    size_t stat_count = 0;  // elements of the relative & ULP statistics, see gemm_check
+    double max_rel = 0;     // max |C - C_ref| / |C_ref|
+    double max_ulp = 0;     // max ULP distance (float only)
+    double mean_ulp = 0;    // mean ULP distance (float only)
+    bool ok() const { return mismatches == 0; }
+};
+
+// Distance of two floats in units in the last place, i.e., the number of floats between them
+inline int64_t gemm_ulp_distance(float a, float b) {
+    int32_t ia, ib;
+    std::memcpy(&ia, &a, sizeof(ia));
+    std::memcpy(&ib, &b, sizeof(ib));
+    // map the sign-magnitude bits to a monotonic integer line
+    int64_t la = ia < 0 ? (int64_t)INT32_MIN - ia : ia;
+    int64_t lb = ib < 0 ? (int64_t)INT32_MIN - ib : ib;
+    return la > lb ? la - lb : lb - la;
+}
+
+// Compare C [M, N] with C_ref, both with leading dimensions. An element mismatches if
+// |C - C_ref| > abs_tolerance + rel_tolerance * |C_ref|. Prints the first max_print mismatches
+// with their coordinates, and if verbose, a summary line.
+// Relative and ULP errors are only taken where C & C_ref have the same sign and |C_ref| > abs_tolerance
+// (C_ref != 0 without one): near zero, a small absolute error is a large relative one and says nothing.
+template <typename Acc>
+gemm_check_result gemm_check(const Acc* C, int ldc, const Acc* C_ref, int ldr, int M, int N,
+                             double abs_tolerance = 0, double rel_tolerance = 0, int max_print = 10,
+                             bool verbose = true) {
+    gemm_check_result r;
+    double ulp_sum = 0;
+    for (int m = 0; m < M; ++m) {
+        for (int n = 0; n < N; ++n) {
+            Acc x = C[(size_t)m * ldc + n];
+            Acc ref = C_ref[(size_t)m * ldr + n];
+            double diff = std::fabs((double)x - (double)ref);
+            r.max_abs = std::max(r.max_abs, diff);
+            if (std::fabs((double)ref) > abs_tolerance && ref != 0 && (x < 0) == (ref < 0)) {
+                ++r.stat_count;
+                r.max_rel = std::max(r.max_rel, diff / std::fabs((double)ref));
+                if constexpr (std::is_same<Acc, float>::value) {
+                    double ulp = (double)gemm_ulp_distance(x, ref);
+                    r.max_ulp = std::max(r.max_ulp, ulp);
+                    ulp_sum += ulp;
+                }
+            }
+            if (!(diff <= abs_tolerance + rel_tolerance * std::fabs((double)ref))) {
+                if (r.mismatches < (size_t)max_print) {
+                    std::cout << "mismatch at [" << m << ", " << n << "]: ref = " << ref << ", actual = " << x
+                              << ", diff = " << diff << "\n";
+                }
+                ++r.mismatches;
+            }
+        }
+    }
+    r.count = (size_t)M * N;
+    r.mean_ulp = r.stat_count ? ulp_sum / r.stat_count : 0;
+    if (verbose) {
+        if (r.ok()) std::cout << "OK";
+        else std::cout << "Failed: " << r.mismatches << "/" << r.count << " elements mismatch";
+        std::cout << " (max abs err " << r.max_abs << ", max rel err " << r.max_rel;
+        if (std::is_same<Acc, float>::value) std::cout << ", max ulp " << r.max_ulp << ", mean ulp " << r.mean_ulp;
+        std::cout << ")\n";
+    }
+    return r;
+}
@@ -0,0 +1,386 @@
+/*
+    GEMM for small M (1 to 16 rows of A, e.g., decoding token by token) on top of gemm_parallel.h.
+
+    With so few rows, C = A x B does little compute for all of packed B it reads: the time is the time
+    to stream B from memory, which one thread cannot do at the bandwidth of the socket.
+    So N is split over all threads of a pool, each streaming its disjoint range of block columns of B once,
+    and each thread computes its columns with one of two kernels:
+    - AMX: all tiles configured to mb rows, with 5 tiles for C (80 columns), 1 for A and 2 for B,
+      instead of the 4 C tiles and 2 A tiles of gemm_block_1x4. B alternates between its two tiles,
+      so that the load of the next B tile overlaps with the dot product on the current one.
+    - AVX-512: VNNI (vpdpbusd) for int8 and AVX512-BF16 (vdpbf16ps) for bf16, on packed B as it is:
+      a row of a packed block holds a VNNI group of each of its 32 columns, i.e., 2 zmm, which are
+      multiplied by a VNNI group of a row of A broadcast to all lanes.
+      vpdpbusd multiplies u8 by s8: s8 x s8 and u8 x u8 offset one side by 128, and the offset times
+      the column sums of B (computed with one more vpdpbusd per zmm of B) is subtracted at the end.
+    A is copied once to a zero-padded buffer shared by all threads, so that the K tail needs no special case.
+    The kernel is chosen per dtype, shape and number of threads by timing both on the first call of the shape,
+    after a warm-up (see gemm_small_m_choose); GEMM_SMALL_M_KERNEL=amx|avx512 forces one.
+    This makes the first call of a shape cost 12 to 102 calls of the kernels: one of each to warm up, then
+    at least 5 rounds of both and more until 50 ms in total, at most 50 rounds (GEMM_SMALL_M_CHOOSE_*).
+    Set GEMM_SMALL_M_KERNEL, or pass the kernel, where that first call must be fast.
+    The gain comes from streaming B on many cores: on a single thread, the AMX kernel measured slower
+    than gemm_amx, so gemm_small_m pays off only with a pool of several threads.
+    Larger M goes to gemm_amx_parallel.
+*/
+
+#pragma once
+
+#include "gemm_parallel.h"
+#include <chrono>
+
+#define GEMM_SMALL_M_MAX 16
+// C tiles of the AMX kernel: 80 columns, i.e., 2.5 block columns
+#define GEMM_SMALL_M_TILES 5
+// Rows of A computed together by the AVX-512 kernel, with 2 block columns: 16 zmm accumulators
+#define GEMM_SMALL_M_AVX512_ROWS 4
+// Timing of the kernels by gemm_small_m_choose: rounds of one call of each, at least MIN_ROUNDS and
+// until both took MIN_SECONDS in total, at most MAX_ROUNDS
+#define GEMM_SMALL_M_CHOOSE_MIN_ROUNDS 5
+#define GEMM_SMALL_M_CHOOSE_MAX_ROUNDS 50
+#define GEMM_SMALL_M_CHOOSE_MIN_SECONDS 0.05
+
+enum gemm_small_m_kernel {
+    GEMM_SMALL_M_AUTO,    // timed on the first call of each shape, see gemm_small_m_choose
+    GEMM_SMALL_M_AMX,     // gemm_small_m_block_amx
+    GEMM_SMALL_M_AVX512,  // gemm_small_m_rows_avx512
+};
+
+inline const char* gemm_small_m_kernel_name(gemm_small_m_kernel kernel) {
+    static const char* names[] = {"auto", "amx", "avx512"};
+    return names[kernel];
+}
+
+// Copy M rows of A to out [M, Kp] with the K tail padded with zeros, Kp = K rounded up to block_k
+template <typename T>
+void gemm_small_m_pack_A(const T* A, int lda, int M, int K, int Kp, T* out) {
+    for (int m = 0; m < M; ++m) {
+        std::memcpy(out + (size_t)m * Kp, A + (size_t)m * lda, K * sizeof(T));
+        std::fill(out + (size_t)m * Kp + K, out + (size_t)(m + 1) * Kp, T());
+    }
+}
+
+// Tile config of the AMX kernel for mb <= 16 rows
+//            N
+//   +----+----+----+----+----+
+// M |  0 |  1 |  2 |  3 |  4 |
+//   +----+----+----+----+----+
+// Tiles 0-4 hold C, tile 5 holds A and tiles 6 & 7 take turns to hold B, all 64 bytes wide.
+template <typename T>
+void gemm_small_m_tile_config(amx_tilecfg& cfg_data, int mb) {
+    cfg_data.palette_id = 1;
+    cfg_data.start_row = 0;
+    for (int i = 0; i < 8; ++i) {
+        cfg_data.rows[i] = i >= 6 ? 64 / sizeof(T) / gemm_vnni_size<T>() : mb;
+        cfg_data.colsb[i] = 64;
+    }
+}
+
+template <typename T>
+void gemm_configure_small_m(int mb) {
+    auto& cur = gemm_tile_config_current;
+    amx_tilecfg cfg_data;
+    gemm_small_m_tile_config<T>(cfg_data, mb);
+    if (cur.valid && !std::memcmp(&cur.cfg_data, &cfg_data, sizeof(cfg_data))) return;
+    amx_tile_loadconfig(&cfg_data);
+    cur.cfg_data = cfg_data;
+    cur.valid = true;
+}
+
+// Load 16 columns j of the block to B tile b_tile and multiply it with A in tile 5 into C tile j
+#define GEMM_SMALL_M_DP(T, TB, j, b_tile)                                                  \
+    do {                                                                                   \
+        if (nt > j) {                                                                      \
+            int h = h0 + j;                                                                \
+            amx_tile_loadd(b_tile, b + (h / 2) * block_k * GEMM_BLOCK_N + (h % 2) * 16 * vnni, b_stride); \
+            GEMM_TILE_DP(T, TB, j, 5, b_tile);                                             \
+        }                                                                                  \
+    } while (0)
+
+// Compute C [mb, nb] = A x B for nb <= 80 columns of packed B (Np = N rounded up to block_n), starting at
+// column h0 * 16: the block of C may start in the middle of a block column of B.
+// A is [mb, KC * block_k] with rows lda elements apart and padded with zeros.
+// B of K block kc + prefetch is prefetched to L1 while computing K block kc (0 = no prefetch).
+// The config must be loaded by gemm_configure_small_m.
+template <typename T, typename TB, typename Acc>
+void gemm_small_m_block_amx(const T* A, int lda, const TB* B, int Np, int h0, int nb, int KC, Acc* C, int ldc,
+                            int mb, int prefetch = 4) {
+    constexpr int block_k = gemm_block_k<T>();
+    constexpr int vnni = gemm_vnni_size<T>();
+    constexpr long b_stride = GEMM_BLOCK_N * vnni * sizeof(T);
+    constexpr int c_cols = GEMM_SMALL_M_TILES * 16;
+    int nt = gemm_ceil_div(nb, 16);
+    // the block columns of B the block reads from, which are contiguous in each K block
+    int nc0 = h0 / 2;
+    int lines = ((h0 + nt - 1) / 2 - nc0 + 1) * block_k * GEMM_BLOCK_N * (int)sizeof(TB) / 64;
+    // C tiles are stored through this buffer, which also cuts the N tail
+    alignas(64) Acc c_buf[16 * c_cols];
+    GEMM_PROFILE_SCOPE(GEMM_PHASE_KERNEL);
+    amx_tile_zero(0);
+    if (nt > 1) amx_tile_zero(1);
+    if (nt > 2) amx_tile_zero(2);
+    if (nt > 3) amx_tile_zero(3);
+    if (nt > 4) amx_tile_zero(4);
+    for (int kc = 0; kc < KC; ++kc) {
+        const TB* b = packed_B_block(B, kc, 0, Np);
+        if (prefetch && kc + prefetch < KC) gemm_prefetch_rows(packed_B_block(B, kc + prefetch, nc0, Np), 64, lines);
+        amx_tile_loadd(5, A + (size_t)kc * block_k, (long)lda * sizeof(T));
+        GEMM_SMALL_M_DP(T, TB, 0, 6);
+        GEMM_SMALL_M_DP(T, TB, 1, 7);
+        GEMM_SMALL_M_DP(T, TB, 2, 6);
+        GEMM_SMALL_M_DP(T, TB, 3, 7);
+        GEMM_SMALL_M_DP(T, TB, 4, 6);
+    }
+    GEMM_PROFILE_NEXT(GEMM_PHASE_STORE);
+    constexpr long c_stride = c_cols * sizeof(Acc);
+    amx_tile_stored(0, c_buf, c_stride);
+    if (nt > 1) amx_tile_stored(1, c_buf + 16, c_stride);
+    if (nt > 2) amx_tile_stored(2, c_buf + 32, c_stride);
+    if (nt > 3) amx_tile_stored(3, c_buf + 48, c_stride);
+    if (nt > 4) amx_tile_stored(4, c_buf + 64, c_stride);
+    for (int m = 0; m < mb; ++m) std::memcpy(C + (size_t)m * ldc, c_buf + m * c_cols, nb * sizeof(Acc));
+}
+
+// Whether the CPU has the instructions of the AVX-512 kernel for A & B of types T & TB
+template <typename T>
+bool gemm_small_m_has_avx512() {
+    __builtin_cpu_init();
+    bool avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    if constexpr (std::is_same<T, bfloat16>::value) return avx512 && __builtin_cpu_supports("avx512bf16");
+    else return avx512 && __builtin_cpu_supports("avx512vnni");
+}
+
+// Compute C [R, nb] = A x B for nb <= 32 * NB columns from block column nc of packed B, with AVX-512.
+// A is [R, KC * block_k] with rows lda elements apart and padded with zeros.
+// Each packed row of B (a VNNI group of 32 columns) is loaded once for the R rows of A.
+template <typename T, typename TB, typename Acc, int R, int NB>
+__attribute__((target("avx512f,avx512bw,avx512vnni,avx512bf16")))
+void gemm_small_m_rows_avx512(const T* A, int lda, const TB* B, int Np, int nc, int nb, int KC, Acc* C, int ldc,
+                              int prefetch = 4) {
+    constexpr int block_k = gemm_block_k<T>();
+    constexpr int vnni = gemm_vnni_size<T>();
+    constexpr bool bf16 = std::is_same<T, bfloat16>::value;
+    constexpr bool a_signed = std::is_same<T, int8_t>::value;
+    constexpr bool b_signed = std::is_same<TB, int8_t>::value;
+    // vpdpbusd(acc, u, s): B is the signed operand unless A is signed and B is not
+    constexpr bool swap = !bf16 && a_signed && !b_signed;
+    // s8 x s8: A + 128 is unsigned; u8 x u8: A - 128 is signed (with swap)
+    constexpr bool offset = !bf16 && a_signed == b_signed;
+    constexpr bool swap_offset = offset && !b_signed;
+    const __m512i off = _mm512_set1_epi32((int)0x80808080);
+    const int lines = NB * block_k * GEMM_BLOCK_N * (int)sizeof(TB) / 64;
+    __m512i acc[R][2 * NB];
+    __m512i corr[2 * NB];
+#pragma GCC unroll 16
+    for (int j = 0; j < 2 * NB; ++j) {
+        corr[j] = _mm512_setzero_si512();
+#pragma GCC unroll 16
+        for (int i = 0; i < R; ++i) acc[i][j] = _mm512_setzero_si512();
+    }
+    GEMM_PROFILE_SCOPE(GEMM_PHASE_KERNEL);
+    for (int kc = 0; kc < KC; ++kc) {
+        const TB* b = packed_B_block(B, kc, nc, Np);
+        const T* a = A + (size_t)kc * block_k;
+        if (prefetch && kc + prefetch < KC) gemm_prefetch_rows(packed_B_block(B, kc + prefetch, nc, Np), 64, lines);
+        for (int r = 0; r < block_k / vnni; ++r) {
+            __m512i bv[2 * NB];
+#pragma GCC unroll 16
+            for (int j = 0; j < 2 * NB; ++j) {
+                bv[j] = _mm512_loadu_si512(b + (j / 2) * block_k * GEMM_BLOCK_N + r * GEMM_BLOCK_N * vnni + (j % 2) * 16 * vnni);
+                if constexpr (offset) {
+                    corr[j] = swap_offset ? _mm512_dpbusd_epi32(corr[j], bv[j], off)
+                                          : _mm512_dpbusd_epi32(corr[j], off, bv[j]);
+                }
+            }
+#pragma GCC unroll 16
+            for (int i = 0; i < R; ++i) {
+                int32_t group;
+                std::memcpy(&group, a + (size_t)i * lda + r * vnni, 4);
+                __m512i av = _mm512_set1_epi32(group);
+                if constexpr (offset) av = _mm512_xor_si512(av, off);
+#pragma GCC unroll 16
+                for (int j = 0; j < 2 * NB; ++j) {
+                    if constexpr (bf16) {
+                        acc[i][j] = _mm512_castps_si512(_mm512_dpbf16_ps(_mm512_castsi512_ps(acc[i][j]),
+                                                                         (__m512bh)av, (__m512bh)bv[j]));
+                    } else if constexpr (swap || swap_offset) {
+                        acc[i][j] = _mm512_dpbusd_epi32(acc[i][j], bv[j], av);
+                    } else {
+                        acc[i][j] = _mm512_dpbusd_epi32(acc[i][j], av, bv[j]);
+                    }
+                }
+            }
+        }
+    }
+    GEMM_PROFILE_NEXT(GEMM_PHASE_STORE);
+#pragma GCC unroll 16
+    for (int j = 0; j < 2 * NB; ++j) {
+        int cols = std::min(nb - j * 16, 16);
+        if (cols <= 0) break;
+        __mmask16 mask = (__mmask16)((1u << cols) - 1);
+#pragma GCC unroll 16
+        for (int i = 0; i < R; ++i) {
+            __m512i c = offset ? _mm512_sub_epi32(acc[i][j], corr[j]) : acc[i][j];
+            _mm512_mask_storeu_epi32(C + (size_t)i * ldc + j * 16, mask, c);
+        }
+    }
+}
+
+// The AVX-512 kernel on mb <= 16 rows, GEMM_SMALL_M_AVX512_ROWS rows at a time
+template <typename T, typename TB, typename Acc, int NB>
+void gemm_small_m_cols_avx512(const T* A, int lda, const TB* B, int Np, int nc, int nb, int KC, Acc* C, int ldc,
+                              int mb) {
+    for (int m = 0; m < mb; m += GEMM_SMALL_M_AVX512_ROWS) {
+        const T* a = A + (size_t)m * lda;
+        Acc* c = C + (size_t)m * ldc;
+        switch (std::min(mb - m, GEMM_SMALL_M_AVX512_ROWS)) {
+        case 1: gemm_small_m_rows_avx512<T, TB, Acc, 1, NB>(a, lda, B, Np, nc, nb, KC, c, ldc); break;
+        case 2: gemm_small_m_rows_avx512<T, TB, Acc, 2, NB>(a, lda, B, Np, nc, nb, KC, c, ldc); break;
+        case 3: gemm_small_m_rows_avx512<T, TB, Acc, 3, NB>(a, lda, B, Np, nc, nb, KC, c, ldc); break;
+        default: gemm_small_m_rows_avx512<T, TB, Acc, 4, NB>(a, lda, B, Np, nc, nb, KC, c, ldc); break;
+        }
+    }
+}
+
+// C columns of block columns [nc0, nc1) with the given kernel, on one thread.
+// A is [M, Kp] padded with zeros (gemm_small_m_pack_A).
+template <typename T, typename TB, typename Acc>
+void gemm_small_m_range(gemm_small_m_kernel kernel, int M, int N, int K, const T* A, int Kp, const TB* B_packed,
+                        Acc* C, int ldc, int nc0, int nc1) {
+    constexpr int block_k = gemm_block_k<T>();
+    int KC = gemm_ceil_div(K, block_k);
+    int Np = gemm_round_up(N, GEMM_BLOCK_N);
+    if (kernel == GEMM_SMALL_M_AMX) {
+        // in units of 16 columns, GEMM_SMALL_M_TILES per call of the kernel
+        gemm_configure_small_m<T>(M);
+        int n1 = std::min(N, nc1 * GEMM_BLOCK_N);
+        for (int h = nc0 * 2; h * 16 < n1; h += GEMM_SMALL_M_TILES) {
+            int nb = std::min(n1 - h * 16, GEMM_SMALL_M_TILES * 16);
+            gemm_small_m_block_amx(A, Kp, B_packed, Np, h, nb, KC, C + h * 16, ldc, M);
+        }
+        return;
+    }
+    // block columns per call of the AVX-512 kernel
+    constexpr int step = 2;
+    for (int nc = nc0; nc < nc1; nc += step) {
+        int ncs = std::min(step, nc1 - nc);
+        int nb = std::min(N - nc * GEMM_BLOCK_N, ncs * GEMM_BLOCK_N);
+        Acc* c = C + nc * GEMM_BLOCK_N;
+        if (ncs == 2) {
+            gemm_small_m_cols_avx512<T, TB, Acc, 2>(A, Kp, B_packed, Np, nc, nb, KC, c, ldc, M);
+        } else {
+            gemm_small_m_cols_avx512<T, TB, Acc, 1>(A, Kp, B_packed, Np, nc, nb, KC, c, ldc, M);
+        }
+    }
+}
+
+// C = A x B for M <= 16 with the given kernel (not auto), block columns split evenly over the threads of pool.
+// A is [M, Kp] padded with zeros (gemm_small_m_pack_A).
+template <typename T, typename TB, typename Acc>
+void gemm_small_m_split(amx_thread_pool& pool, gemm_small_m_kernel kernel, int M, int N, int K, const T* A, int Kp,
+                        const TB* B_packed, Acc* C, int ldc) {
+    int NC = gemm_ceil_div(N, GEMM_BLOCK_N);
+    int num_threads = pool.size();
+    pool.run([&](int tid) {
+        int nc0 = gemm_split_begin(NC, num_threads, tid);
+        int nc1 = gemm_split_begin(NC, num_threads, tid + 1);
+        if (nc0 < nc1) gemm_small_m_range(kernel, M, N, K, A, Kp, B_packed, C, ldc, nc0, nc1);
+    });
+}
+
+// The kernel forced by GEMM_SMALL_M_KERNEL=amx|avx512, or auto
+inline gemm_small_m_kernel gemm_small_m_forced() {
+    static const gemm_small_m_kernel forced = [] {
+        const char* env = std::getenv("GEMM_SMALL_M_KERNEL");
+        if (env && *env) {
+            for (int k = GEMM_SMALL_M_AUTO; k <= GEMM_SMALL_M_AVX512; ++k) {
+                if (!std::strcmp(env, gemm_small_m_kernel_name((gemm_small_m_kernel)k))) return (gemm_small_m_kernel)k;
+            }
+            std::cout << "Unknown GEMM_SMALL_M_KERNEL=" << env << ", choosing by timing\n";
+        }
+        return GEMM_SMALL_M_AUTO;
+    }();
+    return forced;
+}
+
+// Kernels chosen by gemm_small_m_choose, by dtype, M, N, K & number of threads
+struct gemm_small_m_choices {
+    std::mutex mutex;
+    std::map<std::tuple<std::string, int, int, int, int>, gemm_small_m_kernel> kernels;
+};
+inline gemm_small_m_choices gemm_small_m_chosen;
+
+// The kernel chosen for a shape by gemm_small_m_choose. Returns false if the shape has not been timed.
+template <typename T, typename TB>
+bool gemm_small_m_lookup(int M, int N, int K, int num_threads, gemm_small_m_kernel& kernel) {
+    auto key = std::make_tuple(std::string(gemm_dtype_name<T, TB>()), M, N, K, num_threads);
+    std::lock_guard<std::mutex> lock(gemm_small_m_chosen.mutex);
+    auto it = gemm_small_m_chosen.kernels.find(key);
+    if (it == gemm_small_m_chosen.kernels.end()) return false;
+    kernel = it->second;
+    return true;
+}
+
+// Kernel for the shape: the one asked for, the one forced by GEMM_SMALL_M_KERNEL, AMX if the CPU lacks
+// the AVX-512 instructions, or else the faster of both on this shape.
+// The first call of a shape runs each kernel once to warm up (first touch of C, A and B in the caches
+// as far as they fit), then times rounds of both on the real operands (see GEMM_SMALL_M_CHOOSE_*)
+// and compares the medians, so that a slow first run or an outlier does not decide.
+// Later calls look up the choice.
+template <typename T, typename TB, typename Acc>
+gemm_small_m_kernel gemm_small_m_choose(amx_thread_pool& pool, gemm_small_m_kernel kernel, int M, int N, int K,
+                                        const T* A, int Kp, const TB* B_packed, Acc* C, int ldc) {
+    if (kernel == GEMM_SMALL_M_AUTO) kernel = gemm_small_m_forced();
+    if (!gemm_small_m_has_avx512<T>()) return GEMM_SMALL_M_AMX;
+    if (kernel != GEMM_SMALL_M_AUTO) return kernel;
+    if (gemm_small_m_lookup<T, TB>(M, N, K, pool.size(), kernel)) return kernel;
+    const gemm_small_m_kernel kernels[2] = {GEMM_SMALL_M_AMX, GEMM_SMALL_M_AVX512};
+    for (gemm_small_m_kernel k : kernels) gemm_small_m_split(pool, k, M, N, K, A, Kp, B_packed, C, ldc);
+    std::vector<double> times[2];
+    double total = 0;
+    for (int round = 0; round < GEMM_SMALL_M_CHOOSE_MAX_ROUNDS; ++round) {
+        if (round >= GEMM_SMALL_M_CHOOSE_MIN_ROUNDS && total >= GEMM_SMALL_M_CHOOSE_MIN_SECONDS) break;
+        // alternate the order, so that neither kernel always runs after the other
+        for (int j = 0; j < 2; ++j) {
+            int i = (round + j) % 2;
+            auto start = std::chrono::steady_clock::now();
+            gemm_small_m_split(pool, kernels[i], M, N, K, A, Kp, B_packed, C, ldc);
+            double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            times[i].push_back(t);
+            total += t;
+        }
+    }
+    double median[2];
+    for (int i = 0; i < 2; ++i) {
+        std::sort(times[i].begin(), times[i].end());
+        median[i] = times[i][times[i].size() / 2];
+    }
+    kernel = median[1] < median[0] ? GEMM_SMALL_M_AVX512 : GEMM_SMALL_M_AMX;
+    std::lock_guard<std::mutex> lock(gemm_small_m_chosen.mutex);
+    gemm_small_m_chosen.kernels[std::make_tuple(std::string(gemm_dtype_name<T, TB>()), M, N, K, pool.size())] = kernel;
+    return kernel;
+}
+
+// C = A x B with B packed by pack_B and M <= 16, computed by all threads of pool.
+// kernel selects the AMX or AVX-512 kernel, auto chooses by timing (see gemm_small_m_choose).
+// M > 16 is computed by gemm_amx_parallel.
+template <typename T, typename TB, typename Acc>
+void gemm_small_m(amx_thread_pool& pool, int M, int N, int K, const T* A, int lda, const TB* B_packed, Acc* C,
+                  int ldc, gemm_small_m_kernel kernel = GEMM_SMALL_M_AUTO) {
+    static_assert(std::is_same<Acc, gemm_acc_type<T>>::value, "C must be int32 for int8 and float for bf16");
+    if (M > GEMM_SMALL_M_MAX) {
+        gemm_amx_parallel(pool, M, N, K, A, lda, B_packed, C, ldc);
+        return;
+    }
+    if (M <= 0 || N <= 0) return;
+    GEMM_PROFILE_CALL("gemm_small_m", M, N, K);
+    int Kp = gemm_round_up(std::max(K, 1), gemm_block_k<T>());
+    arena_scope scratch(arena_thread_scratch());
+    T* a = scratch.allocate<T>((size_t)M * Kp);
+    {
+        GEMM_PROFILE_SCOPE(GEMM_PHASE_PACK_A);
+        gemm_small_m_pack_A(A, lda, M, K, Kp, a);
+    }
+    kernel = gemm_small_m_choose(pool, kernel, M, N, K, a, Kp, B_packed, C, ldc);
+    gemm_small_m_split(pool, kernel, M, N, K, a, Kp, B_packed, C, ldc);
+}
@@ -0,0 +1,138 @@
+/*
+    Block-sparse B for the AMX GEMM: pruned weights where whole blocks of B are zero.
+
+    pack_B_sparse keeps only the non-zero blocks of packed B (block_k x block_n: 32 x 32 for bf16 and
+    64 x 32 for int8, each in the VNNI layout of pack_B), column panel by column panel:
+    for block column nc, the blocks are blocks[col_start[nc], col_start[nc + 1]) and k_index holds
+    the K block of each of them, in increasing order. A block is zero if all of its elements in B are
+    (padding of the K & N tails counts as zero). Blocks are tested in B itself and only the non-zero ones
+    are packed, so zero blocks are neither packed, stored nor loaded.
+
+    gemm_amx_sparse computes C = A x B block by block as gemm_amx, but the K loop of each block of C
+    (gemm_block with the k_index of the panel) only goes over the non-zero blocks of its column panel:
+    a zero block costs neither its tile loads nor its dot product. A is packed once, so that any K block of it can be loaded.
+    Zero blocks add nothing to C, so the result is exactly that of the dense GEMM on the same B.
+*/
+
+#pragma once
+
+#include "gemm.h"
+
+// Packed non-zero blocks of B [K, N] with A & B of type T, see above
+template <typename T>
+struct gemm_sparse_B {
+    int K = 0;
+    int N = 0;
+    int* col_start = nullptr;  // [NC + 1] first block of each column panel
+    int* k_index = nullptr;    // [stored_blocks()] K block of each stored block
+    T* blocks = nullptr;       // [stored_blocks(), block_k * block_n]
+    arena memory;
+
+    int KC() const { return (K + gemm_block_k<T>() - 1) / gemm_block_k<T>(); }
+    int NC() const { return (N + GEMM_BLOCK_N - 1) / GEMM_BLOCK_N; }
+    int stored_blocks() const { return col_start ? col_start[NC()] : 0; }
+    // fraction of the blocks of B which are stored
+    double density() const { return KC() && NC() ? (double)stored_blocks() / ((double)KC() * NC()) : 0; }
+    size_t bytes() const { return (size_t)stored_blocks() * gemm_block_k<T>() * GEMM_BLOCK_N * sizeof(T); }
+};
+
+// Mark in nonzero[nc] the column panels nc of a row of B [N] which have a non-zero element.
+// Elements are compared bit by bit (-0.0 counts as non-zero).
+template <typename T>
+void gemm_sparse_row_nonzero(const T* row, int N, uint8_t* nonzero) {
+    constexpr size_t panel_bytes = GEMM_BLOCK_N * sizeof(T);
+    const uint8_t* p = (const uint8_t*)row;
+    size_t bytes = (size_t)N * sizeof(T);
+    size_t full = bytes / panel_bytes * panel_bytes;
+    for (size_t i = 0; i < full; i += panel_bytes) {
+        uint64_t any = 0;
+        for (size_t j = 0; j < panel_bytes; j += 8) {
+            uint64_t w;
+            std::memcpy(&w, p + i + j, 8);
+            any |= w;
+        }
+        nonzero[i / panel_bytes] |= any != 0;
+    }
+    uint8_t any = 0;
+    for (size_t i = full; i < bytes; ++i) any |= p[i];
+    if (full < bytes) nonzero[full / panel_bytes] |= any != 0;
+}
+
+// Pack the non-zero blocks of B [K, N] with leading dimension ldb to out.
+// B is scanned row by row for its non-zero blocks (the K & N tails of a block count as zeros),
+// then only those are packed (pack_B_block), straight to their place in out.
+// Returns false if memory cannot be mapped.
+template <typename T>
+bool pack_B_sparse(const T* B, int K, int N, int ldb, gemm_sparse_B<T>& out) {
+    constexpr int block_k = gemm_block_k<T>();
+    constexpr size_t block_size = (size_t)block_k * GEMM_BLOCK_N;
+    out = gemm_sparse_B<T>();
+    out.K = K;
+    out.N = N;
+    int KC = out.KC(), NC = out.NC();
+    arena& memory = out.memory;
+    arena_scope scratch(arena_thread_scratch());
+    // whether each block is non-zero, [KC, NC], and the next block of each column panel in out
+    uint8_t* nonzero = scratch.allocate<uint8_t>(std::max((size_t)KC * NC, (size_t)1));
+    int* next = scratch.allocate<int>(std::max(NC, 1));
+    out.col_start = memory.allocate<int>(NC + 1);
+    if (!nonzero || !next || !out.col_start) return false;
+    GEMM_PROFILE_SCOPE(GEMM_PHASE_PACK_B);
+    // 1. find the non-zero blocks and count them by column panel
+    std::fill(nonzero, nonzero + (size_t)KC * NC, 0);
+    for (int k = 0; k < K; ++k) gemm_sparse_row_nonzero(B + (size_t)k * ldb, N, nonzero + (size_t)(k / block_k) * NC);
+    out.col_start[0] = 0;
+    for (int nc = 0; nc < NC; ++nc) {
+        int count = 0;
+        for (int kc = 0; kc < KC; ++kc) count += nonzero[(size_t)kc * NC + nc];
+        out.col_start[nc + 1] = out.col_start[nc] + count;
+        next[nc] = out.col_start[nc];
+    }
+    // 2. pack them in the order of B, so that k_index of each column panel is increasing
+    int total = out.col_start[NC];
+    out.k_index = memory.allocate<int>(std::max(total, 1));
+    out.blocks = memory.allocate<T>(std::max<size_t>(total, 1) * block_size);
+    if (!out.k_index || !out.blocks) return false;
+    for (int kc = 0; kc < KC; ++kc) {
+        for (int nc = 0; nc < NC; ++nc) {
+            if (!nonzero[(size_t)kc * NC + nc]) continue;
+            int i = next[nc]++;
+            pack_B_block(B, K, N, ldb, kc, nc, out.blocks + i * block_size);
+            out.k_index[i] = kc;
+        }
+    }
+    return true;
+}
+
+// C = A x B with B packed by pack_B_sparse.
+// Column panels of B are taken one by one, so that each panel stays in L2 for all block rows of A.
+template <typename T, typename TB, typename Acc>
+void gemm_amx_sparse(int M, const T* A, int lda, const gemm_sparse_B<TB>& B, Acc* C, int ldc) {
+    constexpr int block_k = gemm_block_k<T>();
+    constexpr size_t block_size = (size_t)block_k * GEMM_BLOCK_N;
+    int N = B.N, K = B.K;
+    GEMM_PROFILE_CALL("gemm_amx_sparse", M, N, K);
+    int MC = (M + GEMM_BLOCK_M - 1) / GEMM_BLOCK_M;
+    int NC = B.NC(), KC = B.KC();
+    arena_scope scratch(arena_thread_scratch());
+    // A as [MC, KC, block_m, block_k], so that every K block of A is a whole tile
+    T* a_packed = scratch.allocate<T>((size_t)MC * std::max(KC, 1) * GEMM_BLOCK_M * block_k);
+    {
+        GEMM_PROFILE_SCOPE(GEMM_PHASE_PACK_A);
+        pack_A_panel(A, lda, M, K, 0, MC, 0, KC, a_packed);
+    }
+    for (int nc = 0; nc < NC; ++nc) {
+        int nb = std::min(GEMM_BLOCK_N, N - nc * GEMM_BLOCK_N);
+        int first = B.col_start[nc];
+        int count = B.col_start[nc + 1] - first;
+        for (int mc = 0; mc < MC; ++mc) {
+            int mb = std::min(GEMM_BLOCK_M, M - mc * GEMM_BLOCK_M);
+            gemm_configure_block<T>(mb, nb);
+            // block i of the panel goes with K block k_index[i] of A; C is zeros if the panel is empty
+            gemm_block(a_packed + (size_t)mc * KC * GEMM_BLOCK_M * block_k, block_k * sizeof(T),
+                       (size_t)GEMM_BLOCK_M * block_k, (const T*)nullptr, B.blocks + first * block_size, block_size,
+                       C + (size_t)mc * GEMM_BLOCK_M * ldc + nc * GEMM_BLOCK_N, ldc, mb, nb, count, false,
+                       B.k_index + first);
+        }
+    }
+}
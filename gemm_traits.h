@@ -0,0 +1,176 @@
+/*
+    A compile-time family of AMX GEMM kernels for the fixed-shape large examples.
+
+    int8-gemm-large.cpp (uint8 A, 32 x 32 x 64) and bf16-gemm-large.cpp (32 x 32 x 32) are one member each:
+    the data type decides the VNNI factor, block_k, tile colsb and the dot-product instruction,
+    and the block shape decides how many tiles hold C, A and B. Here these come from
+    - amx_traits<In>: B type, accumulator type, VNNI factor and dot-product instruction of a data type
+    - amx_gemm_kernel<In, Acc, BM, BN, BK>: C in blocks of BM x BN (multiples of 16),
+      accumulated over K in steps of BK elements (at most 64 bytes, a row of an A tile)
+    The tile config, tile numbers and loop bounds within a block are constexpr, and the tiles
+    are unrolled with fold expressions, so a member compiles to the same code as a hand-written one.
+
+    Tiles: C uses (BM / 16) x (BN / 16) tiles, A one tile per 16 rows and B the remaining tiles,
+    one per 16 columns; if there are fewer tiles left than columns (e.g., 16 x 64 blocks with 4 C tiles),
+    B tiles are reused in turn.
+    M, N and K must be multiples of BM, BN and BK. gemm.h handles arbitrary shapes.
+*/
+
+#pragma once
+
+#include "common.h"
+#include <algorithm>
+#include <utility>
+
+template <typename In>
+struct amx_traits;
+
+template <>
+struct amx_traits<int8_t> {
+    typedef int8_t b_type;
+    typedef int32_t acc_type;
+    static constexpr int vnni = 4;
+    static constexpr const char* name = "int8";
+    template <int dst, int src1, int src2>
+    static void dp() { amx_tile_dpbssd_t<dst, src1, src2>(); }
+};
+
+// uint8 A with int8 B, as in quantized int8-gemm-large.cpp
+template <>
+struct amx_traits<uint8_t> {
+    typedef int8_t b_type;
+    typedef int32_t acc_type;
+    static constexpr int vnni = 4;
+    static constexpr const char* name = "uint8";
+    template <int dst, int src1, int src2>
+    static void dp() { amx_tile_dpbusd_t<dst, src1, src2>(); }
+};
+
+template <>
+struct amx_traits<bfloat16> {
+    typedef bfloat16 b_type;
+    typedef float acc_type;
+    static constexpr int vnni = 2;
+    static constexpr const char* name = "bf16";
+    template <int dst, int src1, int src2>
+    static void dp() { amx_tile_dpbf16ps_t<dst, src1, src2>(); }
+};
+
+// Needs AMX-FP16 (amx_fp16_supported)
+template <>
+struct amx_traits<float16> {
+    typedef float16 b_type;
+    typedef float acc_type;
+    static constexpr int vnni = 2;
+    static constexpr const char* name = "fp16";
+    template <int dst, int src1, int src2>
+    static void dp() { amx_tile_dpfp16ps_t<dst, src1, src2>(); }
+};
+
+template <typename In, typename Acc, int BM, int BN, int BK>
+struct amx_gemm_kernel {
+    typedef amx_traits<In> traits;
+    typedef typename traits::b_type TB;
+    static constexpr int vnni = traits::vnni;
+    static constexpr int tiles_m = BM / 16;
+    static constexpr int tiles_n = BN / 16;
+    static constexpr int c_tiles = tiles_m * tiles_n;
+    static constexpr int b_tiles = std::min(tiles_n, 8 - c_tiles - tiles_m);
+    // B in VNNI layout: a tile is [BK / vnni, 16 columns x vnni]
+    static constexpr int b_stride = BN * vnni * sizeof(TB);
+
+    static_assert(std::is_same<Acc, typename traits::acc_type>::value, "Acc must be the accumulator type of In");
+    static_assert(BM % 16 == 0 && BN % 16 == 0 && BM > 0 && BN > 0, "BM and BN must be multiples of 16");
+    static_assert(BK % vnni == 0 && BK > 0 && BK * sizeof(In) <= 64, "BK must be a multiple of vnni up to 64 bytes");
+    static_assert(b_tiles >= 1, "C and A tiles leave no tile for B");
+
+    static constexpr int c_tile(int i, int j) { return i * tiles_n + j; }
+    static constexpr int a_tile(int i) { return c_tiles + i; }
+    static constexpr int b_tile(int j) { return c_tiles + tiles_m + j % b_tiles; }
+
+    static constexpr amx_tilecfg make_tilecfg() {
+        amx_tilecfg cfg;
+        cfg.palette_id = 1;
+        for (int t = 0; t < c_tiles; ++t) {
+            cfg.rows[t] = 16;
+            cfg.colsb[t] = 16 * sizeof(Acc);
+        }
+        for (int i = 0; i < tiles_m; ++i) {
+            cfg.rows[a_tile(i)] = 16;
+            cfg.colsb[a_tile(i)] = BK * sizeof(In);
+        }
+        for (int j = 0; j < b_tiles; ++j) {
+            cfg.rows[b_tile(j)] = BK / vnni;
+            cfg.colsb[b_tile(j)] = 16 * vnni * sizeof(TB);
+        }
+        return cfg;
+    }
+    static constexpr amx_tilecfg tilecfg = make_tilecfg();
+
+    // Pack B [K, N] to [K / BK, N / BN, BK / vnni, BN, vnni]
+    static void pack_B(const TB* in, int K, int N, int ldb, TB* out) {
+        for (int kc = 0; kc < K / BK; ++kc) {
+            for (int nc = 0; nc < N / BN; ++nc) {
+                for (int kb = 0; kb < BK / vnni; ++kb) {
+                    for (int n = 0; n < BN; ++n) {
+                        for (int v = 0; v < vnni; ++v) {
+                            *out++ = in[(size_t)(kc * BK + kb * vnni + v) * ldb + nc * BN + n];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // C = A x B with B packed by pack_B. Returns false if the shape is not a multiple of the blocks.
+    static bool compute(int M, int N, int K, const In* A, int lda, const TB* B_packed, Acc* C, int ldc) {
+        if (M % BM || N % BN || K % BK) {
+            std::cout << "Shape [" << M << ", " << K << "] x [" << K << ", " << N << "] is not a multiple of blocks ["
+                      << BM << ", " << BK << "] x [" << BK << ", " << BN << "]\n";
+            return false;
+        }
+        amx_tile_loadconfig(&tilecfg);
+        auto m_tiles = std::make_integer_sequence<int, tiles_m>();
+        auto n_tiles = std::make_integer_sequence<int, tiles_n>();
+        auto all_c_tiles = std::make_integer_sequence<int, c_tiles>();
+        for (int mc = 0; mc < M / BM; ++mc) {
+            for (int nc = 0; nc < N / BN; ++nc) {
+                // 1. clear C tiles
+                zero_c(all_c_tiles);
+                // 2. loop over K: load A tiles, then each B tile followed by its dot products
+                for (int kc = 0; kc < K / BK; ++kc) {
+                    load_a(A + (size_t)mc * BM * lda + kc * BK, (long)lda * sizeof(In), m_tiles);
+                    dp_columns(B_packed + ((size_t)kc * (N / BN) + nc) * BK * BN, m_tiles, n_tiles);
+                }
+                // 3. store C tiles
+                store_c(C + (size_t)mc * BM * ldc + nc * BN, (long)ldc * sizeof(Acc), all_c_tiles);
+            }
+        }
+        return true;
+    }
+
+private:
+    template <int... T>
+    static void zero_c(std::integer_sequence<int, T...>) { (amx_tile_zero_t<T>(), ...); }
+
+    template <int... I>
+    static void load_a(const In* a, long stride, std::integer_sequence<int, I...>) {
+        (amx_tile_loadd_t<a_tile(I)>((const char*)a + 16 * I * stride, stride), ...);
+    }
+
+    template <int J, int... I>
+    static void dp_column(const TB* b, std::integer_sequence<int, I...>) {
+        amx_tile_loadd_t<b_tile(J)>(b + J * 16 * vnni, b_stride);
+        (traits::template dp<c_tile(I, J), a_tile(I), b_tile(J)>(), ...);
+    }
+
+    template <int... I, int... J>
+    static void dp_columns(const TB* b, std::integer_sequence<int, I...> m, std::integer_sequence<int, J...>) {
+        (dp_column<J>(b, m), ...);
+    }
+
+    template <int... T>
+    static void store_c(Acc* c, long stride, std::integer_sequence<int, T...>) {
+        (amx_tile_stored_t<T>(c + (size_t)(T / tiles_n) * 16 * (stride / sizeof(Acc)) + (T % tiles_n) * 16, stride), ...);
+    }
+};
@@ -35,20 +35,20 @@ void init_tile_config() {
     cfg_data.colsb[2] = N * 4 * sizeof(int8_t);
     cfg_data.rows[2] = K / 4;
 
-    _tile_loadconfig(&cfg_data);
+    amx_tile_loadconfig(&cfg_data);
 }
 
 void gemm_amx(int8_t* A, int8_t* B, int32_t* C) {
     // load A to tile 1
-    _tile_loadd(1, A, /* stride */ K);
+    amx_tile_loadd(1, A, /* stride */ K);
     // load B to tile 2
-    _tile_loadd(2, B, /* stride */ N * 4);
+    amx_tile_loadd(2, B, /* stride */ N * 4);
     // clear tile 0 to hold results
-    _tile_zero(0);
+    amx_tile_zero(0);
     // compute GEMM (dot product)
-    _tile_dpbssd(0, 1, 2);
+    amx_tile_dpbssd(0, 1, 2);
     // store results to C buffer
-    _tile_stored(0, C, /* stride */ N * sizeof(int32_t));
+    amx_tile_stored(0, C, /* stride */ N * sizeof(int32_t));
 }
 
 int main() {
@@ -84,7 +84,7 @@ int main() {
     std::cout << "Check results...\n";
     check_results(C, C_ref, M, N);
     std::cout << "Release tiles...\n";
-    _tile_release();
+    amx_tile_release();
     std::cout << "Done\n";
     return 0;
 }
\ No newline at end of file
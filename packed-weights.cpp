@@ -0,0 +1,73 @@
+/*
+    This example shows how to pack B (weights) once, save it to a file and memory-map it back,
+    so that later runs skip packing. It checks GEMM with the mapped B against gemm_ref,
+    and compares the time of packing B with the time of mapping the file.
+
+    Usage: packed-weights [M N K [dir]]
+*/
+
+#include "packed_matrix.h"
+#include "bench.h"
+
+template <typename T, typename Acc>
+bool run_dtype(const char* name, int M, int N, int K, const std::string& path, Acc tolerance) {
+    std::cout << "Data type: " << name << "\n";
+    std::vector<T> A((size_t)M * K);
+    std::vector<T> B((size_t)K * N);
+    std::vector<Acc> C((size_t)M * N);
+    std::vector<Acc> C_ref((size_t)M * N);
+    if constexpr (std::is_same<T, int8_t>::value) {
+        init_int8_buffer(A.data(), A.size());
+        init_int8_buffer(B.data(), B.size());
+    } else {
+        init_bf16_buffer(A.data(), A.size());
+        init_bf16_buffer(B.data(), B.size());
+    }
+
+    double start = bench_now_seconds();
+    packed_matrix packed = packed_matrix::pack(B.data(), K, N, N);
+    std::cout << "pack B: " << (bench_now_seconds() - start) * 1e3 << " ms\n";
+    std::cout << "save packed B to " << path << "...\n";
+    if (!packed.save(path.c_str())) return false;
+
+    start = bench_now_seconds();
+    packed_matrix mapped;
+    if (!mapped.map(path.c_str(), /* populate */ true)) return false;
+    std::cout << "map packed B: " << (bench_now_seconds() - start) * 1e3 << " ms\n";
+
+    std::cout << "compute GEMM with ref impl...\n";
+    gemm_ref(A.data(), B.data(), C_ref.data(), M, N, K);
+    std::cout << "compute GEMM with AMX impl and mapped B...\n";
+    if (!gemm_amx(M, K, A.data(), K, mapped, C.data(), N)) {
+        std::cout << "Mapped B does not match A\n";
+        return false;
+    }
+    std::remove(path.c_str());
+    return check_results(C.data(), C_ref.data(), M, N, tolerance);
+}
+
+int main(int argc, char** argv) {
+    int M = 64, N = 4096, K = 4096;
+    std::string dir = "/tmp";
+    if (argc >= 4) {
+        M = std::atoi(argv[1]);
+        N = std::atoi(argv[2]);
+        K = std::atoi(argv[3]);
+    }
+    if (argc >= 5) dir = argv[4];
+
+    std::cout << "=========================================\n";
+    std::cout << "  Prepacked weights with Intel AMX\n";
+    std::cout << "=========================================\n";
+    std::cout << "Shape: [" << M << ", " << K << "] x [" << K << ", " << N << "]\n";
+
+    if (!init_amx()) return 1;
+
+    bool ok = run_dtype<int8_t, int32_t>("int8 * int8 -> int32", M, N, K, dir + "/packed-weights-int8.bin", 0);
+    ok = run_dtype<bfloat16, float>("bf16 * bf16 -> float", M, N, K, dir + "/packed-weights-bf16.bin", 1e-3f) && ok;
+
+    std::cout << "Release tiles...\n";
+    amx_tile_release();
+    std::cout << "Done\n";
+    return ok ? 0 : 1;
+}
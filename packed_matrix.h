@@ -0,0 +1,233 @@
+/*
+    Prepacked B (weights) for the GEMM in gemm.h, which can be saved to a file and memory-mapped back.
+
+    A packed_matrix records the data type, shape, block sizes and VNNI factor of packed B.
+    File format (little endian):
+    - header of 64 bytes, see packed_matrix_header
+    - zero padding up to data_offset, which is page aligned
+    - packed B, data_size bytes, in the layout of pack_B
+    Mapping a file is zero-copy: data points into the page cache with a read-only shared mapping,
+    so the packed pages are shared among all processes mapping the same file.
+    Packing allocates with arena_map (arena.h): 2 MB aligned and backed by huge pages by default,
+    which saves TLB misses when the GEMM streams a large packed B.
+*/
+
+#pragma once
+
+#include "gemm.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstdio>
+
+#define PACKED_MATRIX_MAGIC "AMXPACKB"
+#define PACKED_MATRIX_VERSION 1
+#define PACKED_MATRIX_ALIGNMENT 4096
+
+enum packed_dtype : uint32_t {
+    PACKED_DTYPE_INT8 = 1,
+    PACKED_DTYPE_BF16 = 2,
+    PACKED_DTYPE_UINT8 = 3,
+};
+
+template <typename T>
+constexpr packed_dtype packed_dtype_of() {
+    return std::is_same<T, int8_t>::value    ? PACKED_DTYPE_INT8
+           : std::is_same<T, uint8_t>::value ? PACKED_DTYPE_UINT8
+                                             : PACKED_DTYPE_BF16;
+}
+
+struct packed_matrix_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    int32_t K;
+    int32_t N;
+    int32_t block_k;
+    int32_t block_n;
+    int32_t vnni;
+    int32_t elem_size;
+    uint64_t data_offset;
+    uint64_t data_size;
+    uint8_t reserved[8];
+};
+static_assert(sizeof(packed_matrix_header) == 64, "packed_matrix_header must be 64 bytes");
+
+class packed_matrix {
+public:
+    packed_matrix() = default;
+    ~packed_matrix() { reset(); }
+
+    packed_matrix(packed_matrix&& other) noexcept { *this = std::move(other); }
+    packed_matrix& operator=(packed_matrix&& other) noexcept {
+        if (this != &other) {
+            reset();
+            header_ = other.header_;
+            data_ = other.data_;
+            mapping_ = other.mapping_;
+            mapping_size_ = other.mapping_size_;
+            packed_size_ = other.packed_size_;
+            other.data_ = nullptr;
+            other.mapping_ = nullptr;
+            other.mapping_size_ = 0;
+            other.packed_size_ = 0;
+        }
+        return *this;
+    }
+    packed_matrix(const packed_matrix&) = delete;
+    packed_matrix& operator=(const packed_matrix&) = delete;
+
+    // Pack B [K, N] with leading dimension ldb, into memory with the given pages
+    template <typename T>
+    static packed_matrix pack(const T* B, int K, int N, int ldb, arena_pages pages = arena_default_pages()) {
+        packed_matrix pm;
+        pm.init_header(packed_dtype_of<T>(), K, N, gemm_block_k<T>(), gemm_vnni_size<T>(), sizeof(T),
+                       packed_B_size<T>(K, N) * sizeof(T));
+        pm.data_ = arena_map(pm.header_.data_size, pages, &pm.packed_size_);
+        if (pm.data_) pack_B(B, K, N, ldb, (T*)pm.data_);
+        return pm;
+    }
+
+    // Write to a file. Returns false on errors.
+    bool save(const char* path) const {
+        if (!data_) return false;
+        FILE* f = std::fopen(path, "wb");
+        if (!f) {
+            std::cout << "Failed to open " << path << " for writing\n";
+            return false;
+        }
+        char zeros[PACKED_MATRIX_ALIGNMENT] = {0};
+        bool ok = std::fwrite(&header_, sizeof(header_), 1, f) == 1 &&
+                  std::fwrite(zeros, header_.data_offset - sizeof(header_), 1, f) == 1 &&
+                  std::fwrite(data_, header_.data_size, 1, f) == 1;
+        ok = std::fclose(f) == 0 && ok;
+        if (!ok) std::cout << "Failed to write " << path << "\n";
+        return ok;
+    }
+
+    // Memory-map a file written by save(). Returns false if the file cannot be mapped or is not valid.
+    // populate pre-faults the pages, to move page faults out of the first GEMM.
+    bool map(const char* path, bool populate = false) {
+        reset();
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            std::cout << "Failed to open " << path << "\n";
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) || (size_t)st.st_size < sizeof(packed_matrix_header)) {
+            std::cout << "Failed to map " << path << ": file is too small\n";
+            close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED | (populate ? MAP_POPULATE : 0), fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            std::cout << "Failed to map " << path << "\n";
+            return false;
+        }
+        mapping_ = p;
+        mapping_size_ = st.st_size;
+        std::memcpy(&header_, p, sizeof(header_));
+        if (!valid_header((size_t)st.st_size)) {
+            std::cout << "Failed to map " << path << ": not a valid packed matrix\n";
+            reset();
+            return false;
+        }
+        data_ = (char*)p + header_.data_offset;
+        return true;
+    }
+
+    bool empty() const { return data_ == nullptr; }
+    packed_dtype dtype() const { return (packed_dtype)header_.dtype; }
+    int K() const { return header_.K; }
+    int N() const { return header_.N; }
+    int block_k() const { return header_.block_k; }
+    int block_n() const { return header_.block_n; }
+    int vnni() const { return header_.vnni; }
+    bool is_mapped() const { return mapping_ != nullptr; }
+
+    // Packed B for pack_B's layout. Returns null if T does not match the data type.
+    template <typename T>
+    const T* data() const {
+        return header_.dtype == packed_dtype_of<T>() ? (const T*)data_ : nullptr;
+    }
+
+private:
+    void init_header(packed_dtype dtype, int K, int N, int block_k, int vnni, int elem_size, size_t data_size) {
+        std::memset(&header_, 0, sizeof(header_));
+        std::memcpy(header_.magic, PACKED_MATRIX_MAGIC, sizeof(header_.magic));
+        header_.version = PACKED_MATRIX_VERSION;
+        header_.dtype = dtype;
+        header_.K = K;
+        header_.N = N;
+        header_.block_k = block_k;
+        header_.block_n = GEMM_BLOCK_N;
+        header_.vnni = vnni;
+        header_.elem_size = elem_size;
+        header_.data_offset = PACKED_MATRIX_ALIGNMENT;
+        header_.data_size = data_size;
+    }
+
+    // The header must describe data in the layout gemm.h expects
+    bool valid_header(size_t file_size) const {
+        if (std::memcmp(header_.magic, PACKED_MATRIX_MAGIC, sizeof(header_.magic)) ||
+            header_.version != PACKED_MATRIX_VERSION || header_.K < 0 || header_.N < 0) {
+            return false;
+        }
+        size_t expected_size;
+        if (header_.dtype == PACKED_DTYPE_INT8 || header_.dtype == PACKED_DTYPE_UINT8) {
+            if (header_.block_k != gemm_block_k<int8_t>() || header_.vnni != gemm_vnni_size<int8_t>() ||
+                header_.elem_size != 1) return false;
+            expected_size = packed_B_size<int8_t>(header_.K, header_.N);
+        } else if (header_.dtype == PACKED_DTYPE_BF16) {
+            if (header_.block_k != gemm_block_k<bfloat16>() || header_.vnni != gemm_vnni_size<bfloat16>() ||
+                header_.elem_size != 2) return false;
+            expected_size = packed_B_size<bfloat16>(header_.K, header_.N) * 2;
+        } else {
+            return false;
+        }
+        return header_.block_n == GEMM_BLOCK_N && header_.data_size == expected_size &&
+               header_.data_offset % PACKED_MATRIX_ALIGNMENT == 0 &&
+               header_.data_offset >= sizeof(packed_matrix_header) && header_.data_offset <= file_size &&
+               header_.data_size <= file_size - header_.data_offset;
+    }
+
+    void reset() {
+        if (mapping_) munmap(mapping_, mapping_size_);
+        else if (data_) arena_unmap(data_, packed_size_);
+        data_ = nullptr;
+        mapping_ = nullptr;
+        mapping_size_ = 0;
+        packed_size_ = 0;
+    }
+
+    packed_matrix_header header_ = {};
+    void* data_ = nullptr;
+    void* mapping_ = nullptr;
+    size_t mapping_size_ = 0;
+    size_t packed_size_ = 0;  // size of the memory of pack()
+};
+
+// C = A x B with prepacked B. Returns false if the data type of B does not go with T or its K differs.
+// 8-bit A goes with int8 or uint8 B.
+template <typename T, typename Acc>
+bool gemm_amx(int M, int K, const T* A, int lda, const packed_matrix& B, Acc* C, int ldc) {
+    if (B.K() != K) return false;
+    if constexpr (sizeof(T) == 1) {
+        if (const int8_t* B_packed = B.data<int8_t>()) {
+            gemm_amx(M, B.N(), K, A, lda, B_packed, C, ldc);
+            return true;
+        }
+        if (const uint8_t* B_packed = B.data<uint8_t>()) {
+            gemm_amx(M, B.N(), K, A, lda, B_packed, C, ldc);
+            return true;
+        }
+        return false;
+    } else {
+        const T* B_packed = B.data<T>();
+        if (!B_packed) return false;
+        gemm_amx(M, B.N(), K, A, lda, B_packed, C, ldc);
+        return true;
+    }
+}
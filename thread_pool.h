@@ -0,0 +1,98 @@
+/*
+    A minimal pool of persistent threads.
+    Threads live as long as the pool, so per-thread state (e.g., AMX tile config) stays resident across runs.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class thread_pool {
+public:
+    // Create a pool of num_threads threads, including the calling thread as thread 0.
+    // init(tid) is called once on each thread before it runs any work.
+    explicit thread_pool(int num_threads, std::function<void(int)> init = nullptr)
+        : num_threads_(num_threads < 1 ? 1 : num_threads) {
+        if (init) init(0);
+        for (int tid = 1; tid < num_threads_; ++tid) {
+            workers_.emplace_back([this, tid, init] {
+                if (init) init(tid);
+                worker_loop(tid);
+            });
+        }
+    }
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        start_cv_.notify_all();
+        for (auto& t : workers_) t.join();
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    int size() const { return num_threads_; }
+
+    // Run fn(tid) on all threads and wait for all of them to finish.
+    // fn is called through a pointer to it, so that no std::function (and no heap allocation) is made per run.
+    template <typename F>
+    void run(F&& fn) {
+        if (num_threads_ == 1) {
+            fn(0);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = (void*)&fn;
+            call_ = [](void* job, int tid) { (*(typename std::remove_reference<F>::type*)job)(tid); };
+            pending_ = num_threads_ - 1;
+            ++generation_;
+        }
+        start_cv_.notify_all();
+        fn(0);
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this] { return pending_ == 0; });
+        job_ = nullptr;
+    }
+
+private:
+    void worker_loop(int tid) {
+        unsigned long seen = 0;
+        while (true) {
+            void* job;
+            void (*call)(void*, int);
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                start_cv_.wait(lock, [this, seen] { return stop_ || generation_ != seen; });
+                if (stop_) return;
+                seen = generation_;
+                job = job_;
+                call = call_;
+            }
+            call(job, tid);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--pending_ == 0) done_cv_.notify_one();
+            }
+        }
+    }
+
+    int num_threads_;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable start_cv_;
+    std::condition_variable done_cv_;
+    void* job_ = nullptr;
+    void (*call_)(void*, int) = nullptr;
+    unsigned long generation_ = 0;
+    int pending_ = 0;
+    bool stop_ = false;
+};